@@ -0,0 +1,928 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef CX_ZLIB
+#include <zlib.h>
+#endif
+
+#include "archive.h"
+#include "hash.h"
+#include "log.h"
+#include "util.h"
+
+/* indexes kept for archives visited recently */
+#define MAX_ARCHIVES 8
+
+#define TAR_BLOCK 512
+#define TAR_MAGIC "ustar"
+
+/* a long name or pax record of more than this is not a real one */
+#define TAR_MAX_EXTENDED (1024 * 1024)
+
+#define ZIP_LOCAL_SIG UINT32_C (0x04034b50)
+#define ZIP_CENTRAL_SIG UINT32_C (0x02014b50)
+#define ZIP_END_SIG UINT32_C (0x06054b50)
+#define ZIP64_END_SIG UINT32_C (0x06064b50)
+#define ZIP64_LOCATOR_SIG UINT32_C (0x07064b50)
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP64_END_SIZE 56
+#define ZIP_MAX_COMMENT 65535
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+typedef enum
+{
+  ARCHIVE_ZIP,
+  ARCHIVE_TAR
+} ArchiveType;
+
+typedef struct
+{
+  const char *name;
+  int         name_len;
+  uint64_t    size;
+  uint64_t    csize;
+  uint64_t    offset; /* of the local header (zip) or the data (tar) */
+  time_t      mtime;
+  int         method;
+  bool        is_dir;
+} Member;
+
+/* The member index of one archive, kept between visits for as long as the
+   file is unchanged. Zip member names point into the mapping, of which
+   only the central directory is ever read to build it; tar names are
+   copied out of the headers as they are read. */
+typedef struct Archive
+{
+  struct Archive *next;
+  CxPath          path;
+  ArchiveType     type;
+  dev_t           dev;
+  ino_t           ino;
+  off_t           size;
+  time_t          mtime;
+  const uint8_t * map;
+  Member *        members;
+  int             n_members;
+  int             alloc;
+} Archive;
+
+typedef struct
+{
+  const char *  name;
+  int           name_len;
+  const Member *member; /* NULL for a directory only implied by its contents */
+  bool          is_dir;
+} Child;
+
+/* listings are also built on the scanner thread */
+static struct
+{
+  pthread_mutex_t lock;
+  Archive *       list;
+} archives = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint16_t
+get16 (const uint8_t *p)
+{
+  return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t
+get32 (const uint8_t *p)
+{
+  return get16 (p) | (uint32_t) get16 (p + 2) << 16;
+}
+
+static uint64_t
+get64 (const uint8_t *p)
+{
+  return get32 (p) | (uint64_t) get32 (p + 4) << 32;
+}
+
+static bool
+read_at (int fd, void *buf, size_t len, off_t off)
+{
+  char *  p = buf;
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = pread (fd, p, len, off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+    off += n;
+  }
+  return true;
+}
+
+static uint64_t
+tar_number (const uint8_t *p, int len)
+{
+  uint64_t v = 0;
+  int      i;
+
+  /* GNU tar's base-256 form for values too large for octal */
+  if (p[0] & 0x80)
+  {
+    v = p[0] & 0x3f;
+    for (i = 1; i < len; ++i)
+      v = v << 8 | p[i];
+    return v;
+  }
+
+  for (i = 0; i < len && (p[i] == ' ' || p[i] == '\0'); ++i)
+    ;
+  for (; i < len && p[i] >= '0' && p[i] <= '7'; ++i)
+    v = v * 8 + (p[i] - '0');
+  return v;
+}
+
+static bool
+tar_header_valid (const uint8_t *h)
+{
+  uint64_t sum = 0;
+  int      i;
+
+  /* the checksum field itself counts as spaces */
+  for (i = 0; i < TAR_BLOCK; ++i)
+    sum += (i >= 148 && i < 156) ? ' ' : h[i];
+  return sum == tar_number (h + 148, 8);
+}
+
+static bool
+detect_type (int fd, ArchiveType *type)
+{
+  uint8_t h[TAR_BLOCK];
+
+  memset (h, 0, sizeof (h));
+  if (pread (fd, h, sizeof (h), 0) < 4)
+    return false;
+
+  if (get32 (h) == ZIP_LOCAL_SIG || get32 (h) == ZIP_END_SIG)
+    *type = ARCHIVE_ZIP;
+  else if (memcmp (h + 257, TAR_MAGIC, strlen (TAR_MAGIC)) == 0 &&
+           tar_header_valid (h))
+    *type = ARCHIVE_TAR;
+  else
+    return false;
+  return true;
+}
+
+static Member *
+add_member (Archive *a)
+{
+  Member *m;
+
+  if (a->n_members == a->alloc)
+  {
+    a->alloc   = a->alloc ? a->alloc * 2 : 64;
+    a->members = realloc (a->members, a->alloc * sizeof (Member));
+    if (!a->members)
+      cx_die (errno, "failed to allocate memory");
+  }
+
+  m = &a->members[a->n_members++];
+  memset (m, 0, sizeof (*m));
+  return m;
+}
+
+/* names are kept relative and without a trailing slash; false for one
+   that is nothing but slashes and dots */
+static bool
+set_name (Member *m, const char *name, int len)
+{
+  while (len > 0 && name[len - 1] == '/')
+  {
+    m->is_dir = true;
+    --len;
+  }
+
+  for (;;)
+  {
+    if (len >= 2 && name[0] == '.' && name[1] == '/')
+    {
+      name += 2;
+      len -= 2;
+    }
+    else if (len >= 1 && name[0] == '/')
+    {
+      ++name;
+      --len;
+    }
+    else
+      break;
+  }
+
+  if (len == 0 || (len == 1 && name[0] == '.'))
+    return false;
+  m->name     = name;
+  m->name_len = len;
+  return true;
+}
+
+static time_t
+dos_time (uint16_t time, uint16_t date)
+{
+  struct tm tm;
+
+  memset (&tm, 0, sizeof (tm));
+  tm.tm_year  = (date >> 9) + 80;
+  tm.tm_mon   = ((date >> 5) & 15) - 1;
+  tm.tm_mday  = date & 31;
+  tm.tm_hour  = time >> 11;
+  tm.tm_min   = (time >> 5) & 63;
+  tm.tm_sec   = (time & 31) * 2;
+  tm.tm_isdst = -1;
+  return mktime (&tm);
+}
+
+/* 64-bit sizes and offsets replace the 32-bit fields saturated at ~0 */
+static void
+read_zip64_extra (Member *m, const uint8_t *p, int len)
+{
+  const uint8_t *end = p + len;
+  const uint8_t *q;
+  const uint8_t *q_end;
+  int            size;
+
+  for (; end - p >= 4; p += 4 + size)
+  {
+    size = get16 (p + 2);
+    if (end - p - 4 < size)
+      return;
+    if (get16 (p) != ZIP64_EXTRA_ID)
+      continue;
+
+    q     = p + 4;
+    q_end = q + size;
+    if (m->size == UINT32_MAX && q_end - q >= 8)
+    {
+      m->size = get64 (q);
+      q += 8;
+    }
+    if (m->csize == UINT32_MAX && q_end - q >= 8)
+    {
+      m->csize = get64 (q);
+      q += 8;
+    }
+    if (m->offset == UINT32_MAX && q_end - q >= 8)
+      m->offset = get64 (q);
+    return;
+  }
+}
+
+/* Only the end record and the central directory are touched, so indexing
+   takes the same time whatever the size of the data before them. */
+static bool
+zip_index (Archive *a, int fd)
+{
+  const uint8_t *map;
+  const uint8_t *p;
+  const uint8_t *cd_end;
+  Member *       m;
+  uint64_t       n_entries;
+  uint64_t       cd_size;
+  uint64_t       cd_offset;
+  uint64_t       end64;
+  uint64_t       i;
+  off_t          off;
+  off_t          min_off;
+  int            name_len;
+  int            extra_len;
+  int            comment_len;
+
+  if (a->size < ZIP_END_SIZE)
+    return false;
+  map = mmap (NULL, a->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return false;
+  a->map = map;
+
+  /* the end record sits behind an optional comment */
+  min_off = a->size - ZIP_END_SIZE - ZIP_MAX_COMMENT;
+  for (off = a->size - ZIP_END_SIZE; off >= 0 && off >= min_off; --off)
+    if (get32 (map + off) == ZIP_END_SIG)
+      break;
+  if (off < 0 || off < min_off)
+    return false;
+
+  n_entries = get16 (map + off + 10);
+  cd_size   = get32 (map + off + 12);
+  cd_offset = get32 (map + off + 16);
+
+  if (off >= ZIP64_LOCATOR_SIZE &&
+      get32 (map + off - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIG)
+  {
+    end64 = get64 (map + off - ZIP64_LOCATOR_SIZE + 8);
+    if (end64 + ZIP64_END_SIZE > (uint64_t) a->size ||
+        get32 (map + end64) != ZIP64_END_SIG)
+      return false;
+    n_entries = get64 (map + end64 + 32);
+    cd_size   = get64 (map + end64 + 40);
+    cd_offset = get64 (map + end64 + 48);
+  }
+
+  if (cd_offset + cd_size > (uint64_t) a->size)
+    return false;
+
+  p      = map + cd_offset;
+  cd_end = p + cd_size;
+  for (i = 0; i < n_entries; ++i)
+  {
+    if (cd_end - p < ZIP_CENTRAL_SIZE || get32 (p) != ZIP_CENTRAL_SIG)
+      return false;
+    name_len    = get16 (p + 28);
+    extra_len   = get16 (p + 30);
+    comment_len = get16 (p + 32);
+    if (cd_end - p < ZIP_CENTRAL_SIZE + name_len + extra_len + comment_len)
+      return false;
+
+    m         = add_member (a);
+    m->method = get16 (p + 10);
+    m->mtime  = dos_time (get16 (p + 12), get16 (p + 14));
+    m->csize  = get32 (p + 20);
+    m->size   = get32 (p + 24);
+    m->offset = get32 (p + 42);
+    read_zip64_extra (m, p + ZIP_CENTRAL_SIZE + name_len, extra_len);
+    if (!set_name (m, (const char *) p + ZIP_CENTRAL_SIZE, name_len))
+      --a->n_members;
+
+    p += ZIP_CENTRAL_SIZE + name_len + extra_len + comment_len;
+  }
+  return true;
+}
+
+/* the `path' and `size' records of a pax extended header */
+static void
+parse_pax (const char *buf, size_t len, char **path, int *path_len,
+           int64_t *size)
+{
+  const char *p   = buf;
+  const char *end = buf + len;
+  const char *key;
+  const char *value;
+  char *      q;
+  size_t      rec_len;
+
+  while (p < end)
+  {
+    rec_len = strtoul (p, &q, 10);
+    if (q == p || *q != ' ' || rec_len == 0 || rec_len > (size_t) (end - p))
+      return;
+
+    key   = q + 1;
+    value = memchr (key, '=', p + rec_len - key);
+    if (value)
+    {
+      ++value;
+      if (value - key == 5 && memcmp (key, "path", 4) == 0)
+      {
+        free (*path);
+        *path_len = p + rec_len - 1 - value;
+        *path     = malloc (*path_len + 1);
+        if (!*path)
+          cx_die (errno, "failed to allocate memory");
+        memcpy (*path, value, *path_len);
+      }
+      else if (value - key == 5 && memcmp (key, "size", 4) == 0)
+        *size = strtoll (value, NULL, 10);
+    }
+    p += rec_len;
+  }
+}
+
+/* One pass over the headers, seeking past the data, leaves an index of
+   where every member starts. */
+static bool
+tar_index (Archive *a, int fd)
+{
+  uint8_t  h[TAR_BLOCK];
+  char     ustar_name[TAR_BLOCK];
+  char *   long_name     = NULL;
+  int      long_name_len = 0;
+  int64_t  pax_size      = -1;
+  char *   buf;
+  char *   name;
+  int      name_len;
+  uint64_t size;
+  off_t    off;
+  Member * m;
+
+  for (off = 0; off + TAR_BLOCK <= a->size; off += TAR_BLOCK + size)
+  {
+    if (!read_at (fd, h, TAR_BLOCK, off) || h[0] == '\0')
+      break;
+    if (!tar_header_valid (h))
+    {
+      cx_log (CX_LOG_STATUS_WARN, "bad tar header in `%s' at offset %lld",
+              a->path.str, (long long) off);
+      break;
+    }
+
+    size = tar_number (h + 124, 12);
+
+    if (h[156] == 'L' || h[156] == 'x')
+    {
+      if (size > TAR_MAX_EXTENDED ||
+          size > (uint64_t) (a->size - off - TAR_BLOCK))
+      {
+        cx_log (CX_LOG_STATUS_WARN, "bad tar header in `%s' at offset %lld",
+                a->path.str, (long long) off);
+        break;
+      }
+      buf = malloc (size + 1);
+      if (!buf)
+        cx_die (errno, "failed to allocate memory");
+      if (!read_at (fd, buf, size, off + TAR_BLOCK))
+      {
+        free (buf);
+        break;
+      }
+      buf[size] = '\0';
+      if (h[156] == 'L')
+      {
+        free (long_name);
+        long_name     = buf;
+        long_name_len = strlen (buf);
+      }
+      else
+      {
+        parse_pax (buf, size, &long_name, &long_name_len, &pax_size);
+        free (buf);
+      }
+    }
+    else if (h[156] != 'g')
+    {
+      if (pax_size >= 0)
+        size = pax_size;
+
+      if (long_name)
+      {
+        name     = long_name;
+        name_len = long_name_len;
+      }
+      else if (memcmp (h + 257, TAR_MAGIC, strlen (TAR_MAGIC)) == 0 && h[345])
+      {
+        name_len = snprintf (ustar_name, sizeof (ustar_name), "%.155s/%.100s",
+                             (const char *) h + 345, (const char *) h);
+        name     = ustar_name;
+      }
+      else
+      {
+        name_len = strnlen ((const char *) h, 100);
+        name     = (char *) h;
+      }
+
+      m = add_member (a);
+      if (set_name (m, name, name_len))
+      {
+        name = malloc (m->name_len);
+        if (!name)
+          cx_die (errno, "failed to allocate memory");
+        memcpy (name, m->name, m->name_len);
+        m->name   = name;
+        m->size   = size;
+        m->offset = off + TAR_BLOCK;
+        m->mtime  = tar_number (h + 136, 12);
+        m->is_dir = m->is_dir || h[156] == '5';
+      }
+      else
+        --a->n_members;
+
+      free (long_name);
+      long_name = NULL;
+      pax_size  = -1;
+    }
+
+    /* nothing follows a member that runs past the end */
+    if (size > (uint64_t) (a->size - off - TAR_BLOCK))
+      break;
+    size = (size + TAR_BLOCK - 1) & ~(uint64_t) (TAR_BLOCK - 1);
+  }
+
+  free (long_name);
+  return true;
+}
+
+static void
+archive_free (Archive *a)
+{
+  int i;
+
+  if (a->map)
+    munmap ((void *) a->map, a->size);
+  if (a->type == ARCHIVE_TAR)
+    for (i = 0; i < a->n_members; ++i)
+      free ((char *) a->members[i].name);
+  free (a->members);
+  free (a);
+}
+
+/* the index of the archive at `path', built again if the file changed */
+static Archive *
+get_archive (const CxPath *path)
+{
+  Archive **  p;
+  Archive *   a;
+  struct stat st;
+  bool        ok;
+  int         fd;
+  int         n;
+
+  fd = open (path->str, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat (fd, &st) != 0)
+  {
+    if (fd != -1)
+      close (fd);
+    return NULL;
+  }
+
+  for (p = &archives.list; (a = *p); p = &a->next)
+    if (cx_strneq (a->path.str, a->path.len, path->str, path->len))
+      break;
+
+  if (a)
+  {
+    *p = a->next;
+    if (a->dev == st.st_dev && a->ino == st.st_ino && a->size == st.st_size &&
+        a->mtime == st.st_mtime)
+    {
+      close (fd);
+      a->next       = archives.list;
+      archives.list = a;
+      return a;
+    }
+    archive_free (a);
+  }
+
+  a = calloc (1, sizeof (Archive));
+  if (!a)
+    cx_die (errno, "failed to allocate memory");
+  cx_path_init_copy (&a->path, path);
+  a->dev   = st.st_dev;
+  a->ino   = st.st_ino;
+  a->size  = st.st_size;
+  a->mtime = st.st_mtime;
+
+  ok = detect_type (fd, &a->type);
+  if (ok)
+    ok = (a->type == ARCHIVE_ZIP) ? zip_index (a, fd) : tar_index (a, fd);
+  close (fd);
+  if (!ok)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "cannot read archive `%s'", a->path.str);
+    archive_free (a);
+    return NULL;
+  }
+
+  a->next       = archives.list;
+  archives.list = a;
+  for (n = 1, p = &a->next; *p; ++n)
+  {
+    if (n < MAX_ARCHIVES)
+    {
+      p = &(*p)->next;
+      continue;
+    }
+    a  = *p;
+    *p = a->next;
+    archive_free (a);
+  }
+  return archives.list;
+}
+
+/* the length of the part of `path' that names an archive on disk */
+static bool
+split_path (const CxPath *path, int *archive_len)
+{
+  struct stat st;
+  CxPath      p;
+
+  cx_path_init_copy (&p, path);
+  for (;;)
+  {
+    if (stat (p.str, &st) == 0)
+    {
+      *archive_len = p.len;
+      return S_ISREG (st.st_mode);
+    }
+    /* only a file where a directory should be means an archive */
+    if (errno != ENOTDIR || cx_path_is_root (&p))
+      return false;
+    cx_path_init_parent_of (&p);
+  }
+}
+
+static const Member *
+find_member (const Archive *a, const char *name, int name_len)
+{
+  int i;
+
+  for (i = 0; i < a->n_members; ++i)
+    if (!a->members[i].is_dir &&
+        cx_strneq (a->members[i].name, a->members[i].name_len, name, name_len))
+      return &a->members[i];
+  return NULL;
+}
+
+/* The entries directly below `prefix', including directories that only
+   show up as part of the names of members further down. */
+static int
+list_children (const Archive *a, const char *prefix, int prefix_len,
+               const CxScanOptions *options, Child **out)
+{
+  const Member *m;
+  const char *  rest;
+  const char *  slash;
+  Child *       children;
+  Child *       c;
+  int *         slots;
+  int           n_slots;
+  int           n = 0;
+  int           rest_len;
+  int           len;
+  int           i;
+  int           j;
+
+  for (n_slots = 16; n_slots < 2 * a->n_members; n_slots *= 2)
+    ;
+  children = malloc ((a->n_members + 1) * sizeof (Child));
+  slots    = malloc (n_slots * sizeof (int));
+  if (!children || !slots)
+    cx_die (errno, "failed to allocate memory");
+  memset (slots, -1, n_slots * sizeof (int));
+
+  for (i = 0; i < a->n_members; ++i)
+  {
+    m = &a->members[i];
+    if (prefix_len > 0)
+    {
+      if (m->name_len <= prefix_len || m->name[prefix_len] != '/' ||
+          memcmp (m->name, prefix, prefix_len) != 0)
+        continue;
+      rest = m->name + prefix_len + 1;
+    }
+    else
+      rest = m->name;
+
+    rest_len = m->name + m->name_len - rest;
+    slash    = memchr (rest, '/', rest_len);
+    len      = slash ? slash - rest : rest_len;
+    if (len == 0 || (!options->include_hidden_files && *rest == '.'))
+      continue;
+
+    j = cx_hash64 (rest, len) & (n_slots - 1);
+    for (; slots[j] != -1; j = (j + 1) & (n_slots - 1))
+      if (cx_strneq (children[slots[j]].name, children[slots[j]].name_len,
+                     rest, len))
+        break;
+
+    if (slots[j] == -1)
+    {
+      slots[j]    = n;
+      c           = &children[n++];
+      c->name     = rest;
+      c->name_len = len;
+      c->member   = NULL;
+      c->is_dir   = false;
+    }
+    else
+      c = &children[slots[j]];
+
+    /* an entry of its own carries the size and time */
+    if (!slash)
+      c->member = m;
+    c->is_dir = c->is_dir || slash || m->is_dir;
+  }
+
+  free (slots);
+  *out = children;
+  return n;
+}
+
+static void
+build_listing (CxDirListing *listing, CxPath *path, const Archive *a,
+               const char *prefix, int prefix_len,
+               const CxScanOptions *options)
+{
+  Child *     children;
+  CxDirItem * item;
+  struct stat st;
+  int         n;
+  int         i;
+
+  n = list_children (a, prefix, prefix_len, options, &children);
+
+  listing->path           = path;
+  listing->roots[0]       = NULL;
+  listing->roots[1]       = NULL;
+  listing->letter_index   = NULL;
+  listing->links          = NULL;
+  listing->window         = NULL;
+  listing->git_repo       = NULL;
+  listing->git_generation = 0;
+  listing->total          = n + 1;
+  listing->options        = *options;
+  listing->list           = malloc (listing->total * sizeof (CxDirItem));
+  if (!listing->list)
+    cx_die (errno, "failed to allocate memory");
+#ifdef CX_STATS
+  memset (&listing->stats, 0, sizeof (listing->stats));
+#endif
+
+  item = listing->list;
+  cx_dir_item_init_parent (item++);
+
+  memset (&st, 0, sizeof (st));
+  for (i = 0; i < n; ++i, ++item)
+  {
+    st.st_mode  = children[i].is_dir ? S_IFDIR | 0755 : S_IFREG | 0644;
+    st.st_size  = children[i].member ? children[i].member->size : 0;
+    st.st_mtime = children[i].member ? children[i].member->mtime : 0;
+    cx_dir_item_init (item, children[i].name, children[i].name_len, 0, &st,
+                      options->size_units);
+  }
+
+  free (children);
+}
+
+bool
+cx_archive_is_archive (const CxPath *path)
+{
+  ArchiveType type;
+  struct stat st;
+  bool        ok;
+  int         fd;
+
+  if (stat (path->str, &st) != 0 || !S_ISREG (st.st_mode))
+    return false;
+
+  fd = open (path->str, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  ok = detect_type (fd, &type);
+  close (fd);
+  return ok;
+}
+
+/* For a directory on disk this costs a single stat. */
+bool
+cx_archive_listing_init (CxDirListing *listing, CxPath *path,
+                         const CxScanOptions *options)
+{
+  const char *prefix;
+  Archive *   a;
+  CxPath      archive;
+  int         archive_len;
+
+  if (!split_path (path, &archive_len))
+    return false;
+  cx_path_init (&archive, path->str, archive_len);
+
+  prefix = path->str + archive_len;
+  if (*prefix == '/')
+    ++prefix;
+
+  pthread_mutex_lock (&archives.lock);
+  a = get_archive (&archive);
+  if (a)
+    build_listing (listing, path, a, prefix, path->str + path->len - prefix,
+                   options);
+  pthread_mutex_unlock (&archives.lock);
+  return a != NULL;
+}
+
+#ifdef CX_ZLIB
+static ssize_t
+inflate_member (const uint8_t *data, uint64_t csize, char *buf, size_t len)
+{
+  z_stream z;
+  ssize_t  n;
+  int      rc;
+
+  memset (&z, 0, sizeof (z));
+  if (inflateInit2 (&z, -MAX_WBITS) != Z_OK)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* decompression stops as soon as `buf' is full */
+  z.next_in   = (Bytef *) data;
+  z.avail_in  = csize > UINT32_MAX ? UINT32_MAX : (uInt) csize;
+  z.next_out  = (Bytef *) buf;
+  z.avail_out = len;
+  rc          = inflate (&z, Z_SYNC_FLUSH);
+  n           = len - z.avail_out;
+  inflateEnd (&z);
+
+  if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+  {
+    errno = EIO;
+    return -1;
+  }
+  return n;
+}
+#endif
+
+static ssize_t
+read_member (const Archive *a, const Member *m, char *buf, size_t len)
+{
+  const uint8_t *local;
+  uint64_t       data;
+  ssize_t        n;
+  int            fd;
+
+  if (len > m->size)
+    len = m->size;
+
+  if (a->type == ARCHIVE_TAR)
+  {
+    fd = open (a->path.str, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return -1;
+    n = read_at (fd, buf, len, m->offset) ? (ssize_t) len : -1;
+    close (fd);
+    return n;
+  }
+
+  if (m->offset + ZIP_LOCAL_SIZE > (uint64_t) a->size)
+  {
+    errno = EIO;
+    return -1;
+  }
+  local = a->map + m->offset;
+  data  = m->offset + ZIP_LOCAL_SIZE + get16 (local + 26) + get16 (local + 28);
+  if (get32 (local) != ZIP_LOCAL_SIG || data + m->csize > (uint64_t) a->size)
+  {
+    errno = EIO;
+    return -1;
+  }
+
+  switch (m->method)
+  {
+    case ZIP_STORED:
+      /* only `csize' bytes are known to be mapped */
+      if (len > m->csize)
+        len = m->csize;
+      memcpy (buf, a->map + data, len);
+      return len;
+#ifdef CX_ZLIB
+    case ZIP_DEFLATED:
+      return inflate_member (a->map + data, m->csize, buf, len);
+#endif
+    default:
+      errno = ENOTSUP;
+      return -1;
+  }
+}
+
+/* Reads the start of a member straight out of the archive, decompressing
+   no more than fits in `buf'. */
+ssize_t
+cx_archive_read (const CxPath *path, char *buf, size_t len)
+{
+  const Member *m;
+  const char *  name;
+  Archive *     a;
+  CxPath        archive;
+  ssize_t       n = -1;
+  int           archive_len;
+
+  if (!split_path (path, &archive_len) || archive_len == path->len)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  cx_path_init (&archive, path->str, archive_len);
+  name = path->str + archive_len + 1;
+
+  pthread_mutex_lock (&archives.lock);
+  a = get_archive (&archive);
+  m = a ? find_member (a, name, path->str + path->len - name) : NULL;
+  if (m)
+    n = read_member (a, m, buf, len);
+  else
+    errno = ENOENT;
+  pthread_mutex_unlock (&archives.lock);
+  return n;
+}
@@ -0,0 +1,18 @@
+#ifndef __CX_ARCHIVE_H__
+#define __CX_ARCHIVE_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "files.h"
+#include "path.h"
+
+/* Zip and tar archives can be browsed like directories: a path that goes
+   on past an archive names a directory or member inside it. */
+bool cx_archive_is_archive (const CxPath *path);
+
+bool    cx_archive_listing_init (CxDirListing *listing, CxPath *path,
+                                 const CxScanOptions *options);
+ssize_t cx_archive_read (const CxPath *path, char *buf, size_t len);
+
+#endif /* __CX_ARCHIVE_H__ */
@@ -0,0 +1,518 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cx.h"
+#include "files.h"
+#include "log.h"
+#include "mount.h"
+#include "path.h"
+#include "ui.h"
+#include "util.h"
+
+#define BENCH_PROGRAM_NAME CX_PROGRAM_NAME "-bench"
+
+#define DEFAULT_FLAT_COUNT 100000
+#define DEFAULT_RUNS 10
+#define DEFAULT_SCREEN_LINES "50"
+#define DEFAULT_SCREEN_COLUMNS "160"
+
+#define DEEP_LEVELS 256
+#define DEEP_FILES_PER_LEVEL 8
+#define LONG_NAME_LEN 255
+#define DIR_TEMPLATE "cx-bench-XXXXXX"
+
+const char *g_program_name  = BENCH_PROGRAM_NAME;
+bool        g_state_changed = false;
+
+CxScanOptions g_options = {
+  .size_units       = CX_SIZE_UNITS_BINARY,
+  .window_threshold = CX_DEFAULT_WINDOW_THRESHOLD,
+};
+
+typedef struct
+{
+  const char *name;
+  CxPath      root;
+  CxPath      leaf;
+  bool        is_deep;
+} BenchCase;
+
+static struct
+{
+  FILE *    out;
+  uint64_t *samples;
+  int       runs;
+  int       flat_count;
+  bool      keep;
+  bool      draw;
+} bench;
+
+static void
+usage (bool error)
+{
+  fprintf (error ? stderr : stdout,
+           "Usage: %s [OPTION...]\n"
+           "Options:\n"
+           "  -d DIR    Create synthetic trees under DIR (default: /dev/shm,"
+           " then $TMPDIR)\n"
+           "  -n COUNT  Number of entries in the flat tree (default: %d)\n"
+           "  -r RUNS   Samples taken per phase (default: %d)\n"
+           "  -w COUNT  List directories of more than COUNT entries through"
+           " a window\n            (default: %d)\n"
+           "  -k        Keep the generated trees\n"
+           "  -R        Skip the Ncurses rendering phase\n"
+           "  -h        Print this message and exit\n",
+           BENCH_PROGRAM_NAME, DEFAULT_FLAT_COUNT, DEFAULT_RUNS,
+           CX_DEFAULT_WINDOW_THRESHOLD);
+  exit (error ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static void
+make_file (const char *path, off_t size)
+{
+  int fd;
+
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    cx_die (errno, "failed to create `%s'", path);
+  if (size > 0 && ftruncate (fd, size) != 0)
+    cx_die (errno, "failed to resize `%s'", path);
+  close (fd);
+}
+
+static void
+make_dir (const char *path)
+{
+  if (mkdir (path, 0755) != 0)
+    cx_die (errno, "failed to create directory `%s'", path);
+}
+
+static void
+make_case_dir (BenchCase *c, const CxPath *base, const char *name)
+{
+  c->name = name;
+  cx_path_dir_item (&c->root, base, name, strlen (name));
+  make_dir (c->root.str);
+  cx_path_init_copy (&c->leaf, &c->root);
+  c->is_deep = false;
+}
+
+static void
+gen_flat (BenchCase *c, const CxPath *base)
+{
+  CxPath p;
+  char   name[CX_SMALL_BUFMAX];
+  int    i;
+  int    n;
+
+  make_case_dir (c, base, "flat");
+  for (i = 0; i < bench.flat_count; ++i)
+  {
+    n = snprintf (name, sizeof (name), "file-%08d", i);
+    cx_path_dir_item (&p, &c->root, name, n);
+    make_file (p.str, (off_t) (i % 4096) * 977);
+  }
+}
+
+static void
+gen_deep (BenchCase *c, const CxPath *base)
+{
+  CxPath p;
+  char   name[CX_SMALL_BUFMAX];
+  int    level;
+  int    i;
+  int    n;
+
+  make_case_dir (c, base, "deep");
+  c->is_deep = true;
+  for (level = 0; level < DEEP_LEVELS; ++level)
+  {
+    for (i = 0; i < DEEP_FILES_PER_LEVEL; ++i)
+    {
+      n = snprintf (name, sizeof (name), "f%d", i);
+      cx_path_dir_item (&p, &c->leaf, name, n);
+      make_file (p.str, 0);
+    }
+    cx_path_dir_item (&p, &c->leaf, "d", 1);
+    make_dir (p.str);
+    cx_path_init_copy (&c->leaf, &p);
+  }
+}
+
+static void
+gen_long_names (BenchCase *c, const CxPath *base)
+{
+  CxPath p;
+  char   name[LONG_NAME_LEN + 1];
+  int    count = bench.flat_count / 10;
+  int    i;
+
+  make_case_dir (c, base, "long-names");
+  memset (name, 'n', LONG_NAME_LEN);
+  name[LONG_NAME_LEN] = '\0';
+  for (i = 0; i < count; ++i)
+  {
+    snprintf (name, 16, "%08d", i);
+    name[8] = 'n';
+    cx_path_dir_item (&p, &c->root, name, LONG_NAME_LEN);
+    make_file (p.str, 0);
+  }
+}
+
+static void
+gen_mixed (BenchCase *c, const CxPath *base)
+{
+  CxPath p;
+  char   name[CX_SMALL_BUFMAX];
+  int    count = bench.flat_count / 10;
+  int    i;
+  int    n;
+
+  make_case_dir (c, base, "mixed");
+  for (i = 0; i < count; ++i)
+  {
+    switch (i % 5)
+    {
+      case 0:
+        n = snprintf (name, sizeof (name), "file-%d", i);
+        cx_path_dir_item (&p, &c->root, name, n);
+        make_file (p.str, (off_t) i * 131);
+        break;
+      case 1:
+        n = snprintf (name, sizeof (name), "dir-%d", i);
+        cx_path_dir_item (&p, &c->root, name, n);
+        make_dir (p.str);
+        break;
+      case 2:
+        n = snprintf (name, sizeof (name), "fifo-%d", i);
+        cx_path_dir_item (&p, &c->root, name, n);
+        if (mkfifo (p.str, 0644) != 0)
+          cx_die (errno, "failed to create fifo `%s'", p.str);
+        break;
+      case 3:
+        n = snprintf (name, sizeof (name), "link-%d", i);
+        cx_path_dir_item (&p, &c->root, name, n);
+        if (symlink ("file-0", p.str) != 0)
+          cx_die (errno, "failed to create symlink `%s'", p.str);
+        break;
+      default:
+        n = snprintf (name, sizeof (name), ".hidden-%d", i);
+        cx_path_dir_item (&p, &c->root, name, n);
+        make_file (p.str, 0);
+        break;
+    }
+  }
+}
+
+static void
+gen_symlink_farm (BenchCase *c, const CxPath *base)
+{
+  CxPath targets;
+  CxPath p;
+  char   name[CX_SMALL_BUFMAX];
+  char   target[CX_PATHMAX];
+  int    count = bench.flat_count / 10;
+  int    i;
+  int    n;
+
+  make_case_dir (c, base, "symlink-farm");
+  cx_path_dir_item (&targets, base, "symlink-targets", 15);
+  make_dir (targets.str);
+  for (i = 0; i < count; ++i)
+  {
+    n = snprintf (name, sizeof (name), "t-%d", i);
+    cx_path_dir_item (&p, &targets, name, n);
+    make_file (p.str, (off_t) i);
+
+    snprintf (target, sizeof (target), "../symlink-targets/t-%d", i);
+    n = snprintf (name, sizeof (name), "l-%d", i);
+    cx_path_dir_item (&p, &c->root, name, n);
+    if (symlink (target, p.str) != 0)
+      cx_die (errno, "failed to create symlink `%s'", p.str);
+  }
+}
+
+static int
+sample_cmp (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+report (const BenchCase *c, const char *phase, int entries)
+{
+  int p99;
+
+  qsort (bench.samples, bench.runs, sizeof (uint64_t), sample_cmp);
+  p99 = (bench.runs * 99 + 99) / 100 - 1;
+  fprintf (bench.out,
+           "case=%s phase=%s entries=%d runs=%d median_ns=%" PRIu64
+           " p99_ns=%" PRIu64 " min_ns=%" PRIu64 " max_ns=%" PRIu64 "\n",
+           c->name, phase, entries, bench.runs,
+           bench.samples[bench.runs / 2], bench.samples[p99],
+           bench.samples[0], bench.samples[bench.runs - 1]);
+  fflush (bench.out);
+}
+
+static int
+time_scan (const BenchCase *c, bool include_hidden)
+{
+  CxScanOptions options = g_options;
+  CxDirListing  listing;
+  CxDir *       at;
+  CxPath        p;
+  CxPath        next;
+  uint64_t      start;
+  int           entries;
+  int           run;
+
+  options.include_hidden_files = include_hidden;
+  entries                      = 0;
+  for (run = 0; run < bench.runs; ++run)
+  {
+    entries = 0;
+    start   = cx_monotonic_ns ();
+    if (c->is_deep)
+    {
+      /* One sample is a full descent from the root to the deepest level,
+         each level opened from the one above as a pane moving down does */
+      cx_path_init_copy (&p, &c->root);
+      at = NULL;
+      for (;;)
+      {
+        if (!cx_dir_listing_init_at (&listing, &p, at, at ? "d" : p.str,
+                                     &options))
+          cx_die (errno, "failed to read directory `%s'", p.str);
+        entries += listing.total;
+        cx_dir_unref (at);
+        at = cx_dir_ref (listing.dir);
+        cx_dir_listing_free (&listing);
+        if (p.len == c->leaf.len)
+          break;
+        cx_path_dir_item (&next, &p, "d", 1);
+        cx_path_init_copy (&p, &next);
+      }
+      cx_dir_unref (at);
+    }
+    else
+    {
+      if (!cx_dir_listing_init (&listing, (CxPath *) &c->root, &options))
+        cx_die (errno, "failed to read directory `%s'", c->root.str);
+      entries = listing.total;
+      cx_dir_listing_free (&listing);
+    }
+    bench.samples[run] = cx_monotonic_ns () - start;
+  }
+  return entries;
+}
+
+static void
+time_draw (const BenchCase *c)
+{
+  CxCacheEntry *entry;
+  uint64_t      start;
+  int           total;
+  int           run;
+
+  /* the UI opens the same cache entry, so the directory is scanned once */
+  entry = cx_cache_acquire (&c->root);
+  total = entry->listing.total;
+  cx_ui_open (&c->root);
+
+  cx_ui_set_first_listing_item_index (0);
+  cx_ui_set_hilighted_index (0);
+  for (run = 0; run < bench.runs; ++run)
+  {
+    start = cx_monotonic_ns ();
+    cx_ui_draw ();
+    bench.samples[run] = cx_monotonic_ns () - start;
+  }
+  report (c, "draw_top", total);
+
+  cx_ui_set_first_listing_item_index (total / 2);
+  cx_ui_set_hilighted_index (total / 2);
+  for (run = 0; run < bench.runs; ++run)
+  {
+    start = cx_monotonic_ns ();
+    cx_ui_draw ();
+    bench.samples[run] = cx_monotonic_ns () - start;
+  }
+  report (c, "draw_middle", total);
+
+  cx_cache_release (entry);
+}
+
+static int
+remove_entry (const char *path, const struct stat *st, int flag,
+              struct FTW *ftw)
+{
+  if (remove (path) != 0)
+    cx_log (CX_LOG_STATUS_WARN, "failed to remove `%s'", path);
+  return 0;
+}
+
+static void
+pick_base_dir (CxPath *base, const char *requested)
+{
+  struct stat st;
+  const char *dir;
+  char        buf[CX_PATHMAX];
+  int         n;
+
+  if (requested)
+    dir = requested;
+  else if (stat ("/dev/shm", &st) == 0 && S_ISDIR (st.st_mode) &&
+           access ("/dev/shm", W_OK) == 0)
+    dir = "/dev/shm";
+  else if ((dir = getenv ("TMPDIR")) == NULL || !*dir)
+    dir = "/tmp";
+
+  n = snprintf (buf, sizeof (buf), "%s/" DIR_TEMPLATE, dir);
+  if (n >= (int) sizeof (buf))
+    cx_die (0, "benchmark directory name too long");
+  if (!mkdtemp (buf))
+    cx_die (errno, "failed to create benchmark directory under `%s'", dir);
+  cx_path_init (base, buf, strlen (buf));
+}
+
+static void
+start_offscreen_ui (void)
+{
+  int out_fd;
+
+  /* curses output goes to /dev/null; results keep the original stdout */
+  out_fd = dup (STDOUT_FILENO);
+  if (out_fd == -1 || !(bench.out = fdopen (out_fd, "w")))
+    cx_die (errno, "failed to duplicate standard output");
+  if (!freopen ("/dev/null", "w", stdout))
+    cx_die (errno, "failed to redirect standard output");
+
+  setenv ("LINES", DEFAULT_SCREEN_LINES, 1);
+  setenv ("COLUMNS", DEFAULT_SCREEN_COLUMNS, 1);
+  if (!getenv ("TERM") || !*getenv ("TERM"))
+    setenv ("TERM", "xterm", 1);
+
+  cx_ui_start ();
+}
+
+int
+main (int argc, char **argv)
+{
+  static void (*const generators[]) (BenchCase *, const CxPath *) = {
+    gen_flat, gen_deep, gen_long_names, gen_mixed, gen_symlink_farm,
+  };
+  static const int n_cases = sizeof (generators) / sizeof (generators[0]);
+
+  BenchCase     cases[sizeof (generators) / sizeof (generators[0])];
+  CxPath        base;
+  struct rusage ru;
+  const char *  dir = NULL;
+  uint64_t      start;
+  long          peak_rss_kb;
+  int           entries;
+  int           opt;
+  int           i;
+
+  bench.out        = stdout;
+  bench.runs       = DEFAULT_RUNS;
+  bench.flat_count = DEFAULT_FLAT_COUNT;
+  bench.draw       = true;
+
+  while ((opt = getopt (argc, argv, "d:n:r:w:kRh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'd':
+        dir = optarg;
+        break;
+      case 'n':
+        bench.flat_count = atoi (optarg);
+        if (bench.flat_count < 10)
+          usage (true);
+        break;
+      case 'r':
+        bench.runs = atoi (optarg);
+        if (bench.runs < 1)
+          usage (true);
+        break;
+      case 'w':
+        g_options.window_threshold = atoi (optarg);
+        if (g_options.window_threshold < 1)
+          usage (true);
+        break;
+      case 'k':
+        bench.keep = true;
+        break;
+      case 'R':
+        bench.draw = false;
+        break;
+      case 'h':
+        usage (false);
+      default:
+        usage (true);
+    }
+  }
+
+  bench.samples = malloc (sizeof (uint64_t) * bench.runs);
+  if (!bench.samples)
+    cx_die (errno, "failed to allocate memory");
+  g_options.mounts = cx_mount_table_new (cx_log_debug);
+
+  pick_base_dir (&base, dir);
+  fprintf (stderr, "%s: generating trees in `%s'\n", g_program_name,
+           base.str);
+  for (i = 0; i < n_cases; ++i)
+  {
+    start = cx_monotonic_ns ();
+    generators[i](&cases[i], &base);
+    fprintf (stderr, "%s: generated `%s' in %.2fs\n", g_program_name,
+             cases[i].name, (double) (cx_monotonic_ns () - start) / 1e9);
+  }
+
+  if (bench.draw)
+    start_offscreen_ui ();
+
+  for (i = 0; i < n_cases; ++i)
+  {
+    entries = time_scan (&cases[i], false);
+    report (&cases[i], "scan", entries);
+    entries = time_scan (&cases[i], true);
+    report (&cases[i], "scan_hidden", entries);
+    if (bench.draw)
+      time_draw (&cases[i]);
+  }
+
+  if (bench.draw)
+    cx_ui_stop ();
+
+  getrusage (RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+  peak_rss_kb = ru.ru_maxrss / 1024;
+#else
+  peak_rss_kb = ru.ru_maxrss;
+#endif
+  fprintf (bench.out, "peak_rss_kb=%ld\n", peak_rss_kb);
+
+  if (!bench.keep)
+    nftw (base.str, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+  else
+    fprintf (stderr, "%s: kept trees in `%s'\n", g_program_name, base.str);
+
+  free (bench.samples);
+  cx_mount_table_free (g_options.mounts);
+  fclose (bench.out);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,386 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "event.h"
+#include "log.h"
+#include "scan.h"
+#include "util.h"
+
+extern CxScanOptions g_options;
+extern bool          g_state_changed;
+
+static struct
+{
+  CxCacheEntry *entries;
+  uint64_t      generation;
+  int           n_stale;
+} cache;
+
+static void
+mark_stale (CxCacheEntry *entry)
+{
+  if (entry->stale)
+    return;
+  entry->stale = true;
+  ++cache.n_stale;
+}
+
+static void
+on_dir_changed (int watch, void *data)
+{
+  mark_stale (data);
+}
+
+/* a directory too deep to be named from `/' is named through the
+   descriptor the entry holds open on it */
+static int
+watch (CxCacheEntry *entry)
+{
+  char fd_path[CX_SMALL_BUFMAX];
+
+  if (!cx_path_is_elided (&entry->path))
+    return cx_event_watch (entry->path.str, on_dir_changed, entry);
+  if (!entry->dir)
+    return -1;
+  snprintf (fd_path, sizeof (fd_path), "/proc/self/fd/%d",
+            cx_dir_fd (entry->dir));
+  return cx_event_watch (fd_path, on_dir_changed, entry);
+}
+
+static CxCacheEntry *
+find_path (const CxPath *path)
+{
+  CxCacheEntry *entry;
+
+  if (cx_path_is_elided (path))
+    return NULL;
+  for (entry = cache.entries; entry; entry = entry->next)
+    if (cx_strneq (entry->path.str, entry->path.len, path->str, path->len))
+      return entry;
+  return NULL;
+}
+
+static CxCacheEntry *
+find_dir (const CxDir *dir)
+{
+  CxCacheEntry *entry;
+
+  for (entry = cache.entries; entry; entry = entry->next)
+    if (entry->dir == dir)
+      return entry;
+  return NULL;
+}
+
+static CxCacheEntry *
+find_named (const CxDir *at, const char *name)
+{
+  CxCacheEntry *entry;
+
+  for (entry = cache.entries; entry; entry = entry->next)
+    if (entry->dir && cx_dir_parent (entry->dir) == at &&
+        cx_streq (cx_dir_name (entry->dir), name))
+      return entry;
+  return NULL;
+}
+/* the name of `path' in `dir' when it is directly below it, else NULL */
+static const char *
+name_in (const CxPath *path, const CxPath *dir)
+{
+  int n = cx_path_is_root (dir) ? 0 : dir->len;
+
+  if (path->len <= n + 1 || memcmp (path->str, dir->str, n) != 0 ||
+      path->str[n] != '/' ||
+      memchr (path->str + n + 1, '/', path->len - n - 1))
+    return NULL;
+  return path->str + n + 1;
+}
+
+/* A directory next to one already open, which is what moving a pane up
+   or down leads to, is opened from it: by its name, or as the directory
+   that one was opened from. Anything else is looked up from `/', and
+   failing that, a parent that was renamed is still found through `..'. */
+static CxDir *
+open_dir (const CxPath *path)
+{
+  CxCacheEntry *entry;
+  CxDir *       child;
+  CxDir *       dir;
+  const char *  name;
+
+  child = NULL;
+  for (entry = cache.entries; entry; entry = entry->next)
+  {
+    if (!entry->dir)
+      continue;
+    if ((name = name_in (path, &entry->path)))
+      return cx_dir_open (entry->dir, name);
+    if (name_in (&entry->path, path))
+    {
+      if (cx_dir_parent (entry->dir))
+        return cx_dir_ref (cx_dir_parent (entry->dir));
+      child = entry->dir;
+    }
+  }
+
+  dir = cx_dir_open (NULL, path->str);
+  if (!dir && child)
+    dir = cx_dir_open (child, "..");
+  return dir;
+}
+
+static void
+on_scanned (const CxPath *path, CxDirListing *listing, void *data)
+{
+  CxCacheEntry *entry = data;
+
+  cx_scan_cancel (&entry->listing);
+  cx_dir_listing_free (&entry->listing);
+  entry->listing      = *listing;
+  entry->listing.path = &entry->path;
+  entry->scanning     = false;
+  entry->reading      = false;
+  entry->restored     = false;
+  entry->generation   = ++cache.generation;
+  g_state_changed     = true;
+}
+
+/* Reads the directory again in the background; the entry keeps its
+   listing until the new one is in. Directories are read through the one
+   the entry holds open, so one that is renamed, or sits below one that
+   is, is still read; only one that was removed is looked up by its path
+   again. */
+static void
+scan (CxCacheEntry *entry)
+{
+  struct stat st;
+
+  if (entry->dir && fstat (cx_dir_fd (entry->dir), &st) == 0 &&
+      st.st_nlink == 0 && !cx_path_is_elided (&entry->path))
+  {
+    cx_dir_unref (entry->dir);
+    entry->dir = cx_dir_open (NULL, entry->path.str);
+  }
+  entry->scanning = true;
+  cx_scan_request (&entry->path, entry->dir, ".", on_scanned, entry);
+}
+
+/* what a directory shows until it has been read: a way back up */
+static void
+init_placeholder (CxCacheEntry *entry)
+{
+  CxDirItem *list;
+  int        total = cx_path_is_root (&entry->path) ? 0 : 1;
+
+  list = malloc (sizeof (CxDirItem));
+  if (!list)
+    cx_die (errno, "failed to allocate memory");
+  if (total)
+    cx_dir_item_init_parent (list);
+  if (!cx_dir_listing_init_items (&entry->listing, &entry->path, list, total,
+                                  &g_options))
+    cx_die (ENOMEM, "failed to allocate memory");
+  entry->reading = true;
+}
+
+/* The directory as it was read again, kept only if it differs from what
+   was restored; a directory that can no longer be read is left to the
+   next rescan. */
+static void
+on_revalidated (const CxPath *path, CxDirListing *listing, void *data)
+{
+  CxCacheEntry *entry = data;
+
+  entry->restored = false;
+  if (!listing->error && !cx_dir_listing_same (listing, &entry->listing))
+  {
+    cx_scan_cancel (&entry->listing);
+    cx_dir_listing_free (&entry->listing);
+    entry->listing      = *listing;
+    entry->listing.path = &entry->path;
+  }
+  else
+  {
+    if (listing->error)
+      mark_stale (entry);
+    cx_dir_listing_free (listing);
+  }
+
+  entry->generation = ++cache.generation;
+  g_state_changed   = true;
+}
+
+/* Scans and watches a directory no pane has open yet; its listing is a
+   placeholder until the scan is in. Only a directory that could be opened
+   is watched, which leaves out the insides of archives. */
+static CxCacheEntry *
+entry_new (const CxPath *path, CxDir *dir)
+{
+  CxCacheEntry *entry;
+
+  entry = calloc (1, sizeof (CxCacheEntry));
+  if (!entry)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&entry->path, path);
+  entry->dir    = dir;
+  entry->refs   = 1;
+  entry->watch  = dir ? watch (entry) : -1;
+  entry->next   = cache.entries;
+  cache.entries = entry;
+
+  init_placeholder (entry);
+  scan (entry);
+  return entry;
+}
+
+CxCacheEntry *
+cx_cache_ref (CxCacheEntry *entry)
+{
+  ++entry->refs;
+  return entry;
+}
+
+CxCacheEntry *
+cx_cache_acquire (const CxPath *path)
+{
+  CxCacheEntry *entry = find_path (path);
+
+  return entry ? cx_cache_ref (entry) : entry_new (path, open_dir (path));
+}
+
+/* The directory `name' in `at', which is how a pane steps into one; its
+   path is made from theirs, and can be too deep to look anything up by. */
+CxCacheEntry *
+cx_cache_acquire_at (CxDir *at, const char *name, int name_len)
+{
+  CxCacheEntry *entry;
+  CxPath        path;
+
+  if ((entry = find_named (at, name)))
+    return cx_cache_ref (entry);
+
+  cx_dir_path (at, &path);
+  cx_path_dir_item (&path, &path, name, name_len);
+  if ((entry = find_path (&path)))
+    return cx_cache_ref (entry);
+  return entry_new (&path, cx_dir_open (at, name));
+}
+
+/* The directory `entry' was opened from, if it is still held; otherwise
+   the one above its path, or if that is too long to look up, its `..'. */
+CxCacheEntry *
+cx_cache_acquire_parent (CxCacheEntry *entry)
+{
+  CxCacheEntry *found;
+  CxDir *       dir;
+  CxPath        path;
+
+  dir = entry->dir ? cx_dir_parent (entry->dir) : NULL;
+  if (dir)
+  {
+    if ((found = find_dir (dir)))
+      return cx_cache_ref (found);
+    cx_dir_path (dir, &path);
+    if ((found = find_path (&path)))
+      return cx_cache_ref (found);
+    return entry_new (&path, cx_dir_ref (dir));
+  }
+
+  cx_path_init_copy (&path, &entry->path);
+  cx_path_init_parent_of (&path);
+  if (!cx_path_is_elided (&path) || !entry->dir)
+    return cx_cache_acquire (&path);
+
+  dir = cx_dir_open (entry->dir, "..");
+  if (dir)
+    cx_dir_path (dir, &path);
+  return entry_new (&path, dir);
+}
+
+/* Makes an entry for `path' out of a listing of it kept from an earlier
+   run, which it takes over. The directory is watched from now on and read
+   again in the background, and the listing replaced if it changed. */
+CxCacheEntry *
+cx_cache_restore (const CxPath *path, CxDirListing *listing)
+{
+  CxCacheEntry *entry;
+
+  entry = calloc (1, sizeof (CxCacheEntry));
+  if (!entry)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&entry->path, path);
+  entry->listing      = *listing;
+  entry->listing.path = &entry->path;
+  entry->generation   = ++cache.generation;
+  entry->refs         = 1;
+  entry->restored     = true;
+  entry->dir          = open_dir (path);
+  entry->watch        = watch (entry);
+  entry->next         = cache.entries;
+  cache.entries       = entry;
+
+  cx_scan_request (&entry->path, entry->dir, ".", on_revalidated, entry);
+  return entry;
+}
+
+void
+cx_cache_release (CxCacheEntry *entry)
+{
+  CxCacheEntry **p;
+
+  if (!entry || --entry->refs > 0)
+    return;
+
+  for (p = &cache.entries; *p != entry; p = &(*p)->next)
+    ;
+  *p = entry->next;
+
+  if (entry->stale)
+    --cache.n_stale;
+  cx_scan_cancel (entry);
+  cx_scan_cancel (&entry->listing);
+  cx_event_unwatch (entry->watch);
+  cx_dir_listing_free (&entry->listing);
+  cx_dir_unref (entry->dir);
+  free (entry);
+}
+
+void
+cx_cache_invalidate_all (void)
+{
+  CxCacheEntry *entry;
+
+  for (entry = cache.entries; entry; entry = entry->next)
+    mark_stale (entry);
+}
+
+bool
+cx_cache_has_stale (void)
+{
+  return cache.n_stale > 0;
+}
+
+/* An entry that changes again while it is being read is read once more
+   after that scan is in, rather than alongside it. */
+void
+cx_cache_rescan_stale (void)
+{
+  CxCacheEntry *entry;
+
+  for (entry = cache.entries; entry && cache.n_stale > 0; entry = entry->next)
+  {
+    if (!entry->stale || entry->scanning)
+      continue;
+    /* a revalidation still under way would be older than this scan */
+    if (entry->restored)
+      cx_scan_cancel (entry);
+    scan (entry);
+    entry->stale = false;
+    --cache.n_stale;
+  }
+}
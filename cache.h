@@ -0,0 +1,42 @@
+#ifndef __CX_CACHE_H__
+#define __CX_CACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "files.h"
+#include "path.h"
+
+/* One scanned and watched directory, shared by every pane showing it.
+   `generation' changes whenever `listing' is replaced by a scan, and
+   when a `restored' listing has been read again and found current. While
+   it is `reading', the listing is only a placeholder. An entry is found
+   again by the name `dir' was opened by in the directory above, or by
+   `path' when that is not elided. */
+typedef struct CxCacheEntry
+{
+  struct CxCacheEntry *next;
+  CxPath               path;
+  CxDirListing         listing;
+  CxDir *              dir; /* NULL when it could not be opened */
+  uint64_t             generation;
+  int                  refs;
+  int                  watch;
+  bool                 stale;
+  bool                 restored;
+  bool                 scanning;
+  bool                 reading;
+} CxCacheEntry;
+
+CxCacheEntry *cx_cache_acquire (const CxPath *path);
+CxCacheEntry *cx_cache_acquire_at (CxDir *at, const char *name, int name_len);
+CxCacheEntry *cx_cache_acquire_parent (CxCacheEntry *entry);
+CxCacheEntry *cx_cache_restore (const CxPath *path, CxDirListing *listing);
+CxCacheEntry *cx_cache_ref (CxCacheEntry *entry);
+void          cx_cache_release (CxCacheEntry *entry);
+
+void cx_cache_invalidate_all (void);
+bool cx_cache_has_stale (void);
+void cx_cache_rescan_stale (void);
+
+#endif /* __CX_CACHE_H__ */
@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "files.h"
+#include "mount.h"
+#include "path.h"
+
+/* Lists directories of different sizes from as many threads at once,
+   through libcx alone, and checks that every listing holds exactly the
+   entries its directory has. Links against nothing but the library. */
+
+#define CHECK_PROGRAM_NAME "cx-check"
+
+#define N_DIRS 8
+#define FILES_STEP 1500
+#define ROUNDS 10
+#define WINDOW_THRESHOLD 5000
+#define DIR_TEMPLATE "cx-check-XXXXXX"
+#define SUB_DIR_NAME "sub"
+#define HIDDEN_NAME ".hidden"
+
+typedef struct
+{
+  pthread_t     thread;
+  CxScanOptions options;
+  CxPath        path;
+  int           n_files;
+  bool          failed;
+} CheckDir;
+
+static void
+fail (const char *fmt, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "%s: ", CHECK_PROGRAM_NAME);
+  va_start (args, fmt);
+  vfprintf (stderr, fmt, args);
+  va_end (args);
+  fputc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+static int
+remove_entry (const char *path, const struct stat *st, int flag,
+              struct FTW *ftw)
+{
+  return remove (path);
+}
+
+/* file `i' is `i % 7' bytes long, so a listing mixing up entries shows */
+static void
+make_dir (CheckDir *d, const CxPath *base, int index)
+{
+  CxPath p;
+  char   name[CX_SMALL_BUFMAX];
+  int    fd;
+  int    n;
+  int    i;
+
+  n = snprintf (name, sizeof (name), "d%d", index);
+  cx_path_dir_item (&d->path, base, name, n);
+  if (mkdir (d->path.str, 0755) != 0)
+    fail ("failed to create directory `%s' - %s", d->path.str,
+          strerror (errno));
+
+  d->n_files = (index + 1) * FILES_STEP;
+  for (i = 0; i < d->n_files + 2; ++i)
+  {
+    if (i < d->n_files)
+      n = snprintf (name, sizeof (name), "f-%06d", i);
+    else
+      n = snprintf (name, sizeof (name), "%s",
+                    i == d->n_files ? SUB_DIR_NAME : HIDDEN_NAME);
+    cx_path_dir_item (&p, &d->path, name, n);
+
+    if (i == d->n_files)
+      fd = mkdir (p.str, 0755);
+    else
+    {
+      fd = open (p.str, O_WRONLY | O_CREAT | O_EXCL, 0644);
+      if (fd != -1 && (ftruncate (fd, i % 7) != 0 || close (fd) != 0))
+        fd = -1;
+    }
+    if (fd == -1)
+      fail ("failed to create `%s' - %s", p.str, strerror (errno));
+  }
+}
+
+static bool
+check_listing (CheckDir *d, CxDirListing *listing, bool *seen)
+{
+  const CxDirItem *item;
+  bool             hidden = d->options.include_hidden_files;
+  bool             sub    = false;
+  bool             dot    = false;
+  int              expected;
+  int              i;
+  int              n;
+
+  expected = 1 + d->n_files + 1 + hidden;
+  if (listing->total != expected)
+  {
+    fprintf (stderr, "%s: `%s' listed %d entries, not %d\n",
+             CHECK_PROGRAM_NAME, d->path.str, listing->total, expected);
+    return false;
+  }
+
+  memset (seen, 0, d->n_files * sizeof (bool));
+  for (i = 1; i < listing->total; ++i)
+  {
+    item = cx_dir_listing_item (listing, i);
+    if (cx_streq (item->name, SUB_DIR_NAME))
+      sub = item->info.type == CX_FILE_TYPE_DIRECTORY;
+    else if (cx_streq (item->name, HIDDEN_NAME))
+      dot = true;
+    else if (sscanf (item->name, "f-%06d", &n) != 1 || n < 0 ||
+             n >= d->n_files || seen[n] ||
+             item->info.type != CX_FILE_TYPE_FILE ||
+             item->info.st.st_size != n % 7)
+    {
+      fprintf (stderr, "%s: `%s' listed `%s' wrongly or twice\n",
+               CHECK_PROGRAM_NAME, d->path.str, item->name);
+      return false;
+    }
+    else
+      seen[n] = true;
+  }
+
+  if (!sub || dot != hidden)
+  {
+    fprintf (stderr, "%s: `%s' listed `%s' wrongly\n", CHECK_PROGRAM_NAME,
+             d->path.str, sub ? HIDDEN_NAME : SUB_DIR_NAME);
+    return false;
+  }
+  return true;
+}
+
+static void *
+check_main (void *arg)
+{
+  CheckDir *   d = arg;
+  CxDirListing listing;
+  bool *       seen;
+  int          i;
+
+  seen = malloc (d->n_files * sizeof (bool));
+  if (!seen)
+  {
+    d->failed = true;
+    return NULL;
+  }
+
+  for (i = 0; i < ROUNDS && !d->failed; ++i)
+  {
+    if (!cx_dir_listing_init (&listing, &d->path, &d->options))
+    {
+      fprintf (stderr, "%s: cannot list `%s' - %s\n", CHECK_PROGRAM_NAME,
+               d->path.str, strerror (errno));
+      d->failed = true;
+      break;
+    }
+    d->failed = !check_listing (d, &listing, seen);
+    cx_dir_listing_free (&listing);
+  }
+
+  free (seen);
+  return NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+  static CheckDir dirs[N_DIRS];
+  CxMountTable *  mounts;
+  CxPath          base;
+  const char *    tmp;
+  char            template[CX_PATHMAX];
+  bool            failed;
+  int             i;
+
+  tmp = getenv ("TMPDIR");
+  snprintf (template, sizeof (template), "%s/%s", tmp && *tmp ? tmp : "/tmp",
+            DIR_TEMPLATE);
+  if (!mkdtemp (template))
+    fail ("failed to create a directory in `%s' - %s", template,
+          strerror (errno));
+  cx_path_init (&base, template, strlen (template));
+
+  /* every scan profiles its mount in the one table */
+  mounts = cx_mount_table_new (NULL);
+  if (!mounts)
+    fail ("failed to allocate memory");
+
+  /* the larger ones are listed through a window */
+  for (i = 0; i < N_DIRS; ++i)
+  {
+    make_dir (&dirs[i], &base, i);
+    dirs[i].options.size_units           = CX_SIZE_UNITS_BINARY;
+    dirs[i].options.include_hidden_files = i % 2;
+    dirs[i].options.window_threshold     = WINDOW_THRESHOLD;
+    dirs[i].options.mounts               = mounts;
+  }
+
+  for (i = 0; i < N_DIRS; ++i)
+    if (pthread_create (&dirs[i].thread, NULL, check_main, &dirs[i]) != 0)
+      fail ("failed to start a thread");
+
+  failed = false;
+  for (i = 0; i < N_DIRS; ++i)
+  {
+    pthread_join (dirs[i].thread, NULL);
+    failed = failed || dirs[i].failed;
+  }
+
+  cx_mount_table_free (mounts);
+  nftw (base.str, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+
+  printf ("%s: %d directories listed %d times each from %d threads: %s\n",
+          CHECK_PROGRAM_NAME, N_DIRS, ROUNDS, N_DIRS,
+          failed ? "FAILED" : "ok");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
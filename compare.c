@@ -0,0 +1,688 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compare.h"
+#include "event.h"
+#include "hash.h"
+#include "log.h"
+#include "util.h"
+#include "walk.h"
+
+#define MAX_WORKERS 8
+
+/* contents are read sequentially in chunks this large */
+#define READ_BYTES (1024 * 1024)
+
+/* how far the walk gets ahead of the workers comparing contents */
+#define MAX_PENDING 1024
+
+/* past this many differences only the first by path are kept, and the
+   rest are only counted */
+#define MAX_DIFFERENCES 10000
+
+/* how many entries the walk gets through between checks for being
+   cancelled */
+#define CANCEL_INTERVAL 4096
+
+#define LEFT_ONLY_TYPE_STR "left only"
+#define RIGHT_ONLY_TYPE_STR "right only"
+#define DIFFERS_TYPE_STR "differs"
+#define CONTENT_TYPE_STR "content differs"
+#define UNREADABLE_TYPE_STR "unreadable"
+
+extern CxScanOptions g_options;
+
+typedef enum
+{
+  DIFFERENCE_LEFT_ONLY,
+  DIFFERENCE_RIGHT_ONLY,
+  DIFFERENCE_METADATA,
+  DIFFERENCE_CONTENT,
+  DIFFERENCE_UNREADABLE
+} DifferenceKind;
+
+typedef struct
+{
+  char *         path;
+  int            path_len;
+  DifferenceKind kind;
+  uint64_t       size;
+  int64_t        mtime;
+  uint32_t       mode;
+  uint64_t       ino;
+} Difference;
+
+/* a file the walk found the same on both sides, as far as it can tell */
+typedef struct Pending
+{
+  struct Pending *next;
+  Difference      file;
+} Pending;
+
+typedef struct
+{
+  CxCompare *compare;
+  pthread_t  thread;
+  char *     buf;
+} Worker;
+
+/* The walk merges the two trees on its own thread, both already in path
+   order, so it only ever holds one entry of each. Files it cannot tell
+   apart are queued for the workers, which hash both copies; the queue is
+   bounded, so a tree of millions of them never is in memory at once. */
+typedef struct CompareSearch
+{
+  pthread_mutex_t lock;
+  pthread_cond_t  work; /* a file queued, or the walk over */
+  pthread_cond_t  room; /* a file taken off a full queue */
+  pthread_t       thread;
+  Worker          workers[MAX_WORKERS];
+  int             n_workers;
+  CxWalker        left;
+  CxWalker        right;
+  Pending *       pending;
+  Pending *       pending_end;
+  int             n_pending;
+  bool            walked;
+  Difference *    differences; /* a heap, the last by path on top */
+  int             n_differences;
+  int             alloc;
+  int             wake_fd;
+  bool            cancel;
+} CompareSearch;
+
+static bool
+cancelled (CompareSearch *s)
+{
+  bool cancel;
+
+  pthread_mutex_lock (&s->lock);
+  cancel = s->cancel;
+  pthread_mutex_unlock (&s->lock);
+  return cancel;
+}
+
+static void
+difference_init (Difference *diff, DifferenceKind kind, const CxWalkEntry *e)
+{
+  diff->path = malloc (e->path_len + 1);
+  if (!diff->path)
+    cx_die (errno, "failed to allocate memory");
+  memcpy (diff->path, e->path, e->path_len + 1);
+  diff->path_len = e->path_len;
+  diff->kind     = kind;
+  diff->size     = e->size;
+  diff->mtime    = e->mtime;
+  diff->mode     = e->mode;
+  diff->ino      = e->ino;
+}
+
+static int
+compare_differences (const void *a, const void *b)
+{
+  const Difference *da = a;
+  const Difference *db = b;
+
+  return cx_walk_compare (da->path, da->path_len, db->path, db->path_len);
+}
+
+static void
+swap_differences (Difference *a, Difference *b)
+{
+  Difference t = *a;
+
+  *a = *b;
+  *b = t;
+}
+
+static void
+sift_up (CompareSearch *s, int i)
+{
+  int parent;
+
+  for (; i > 0; i = parent)
+  {
+    parent = (i - 1) / 2;
+    if (compare_differences (&s->differences[parent], &s->differences[i]) >= 0)
+      break;
+    swap_differences (&s->differences[parent], &s->differences[i]);
+  }
+}
+
+static void
+sift_down (CompareSearch *s, int i)
+{
+  int last;
+  int child;
+
+  for (;;)
+  {
+    last = i;
+    for (child = 2 * i + 1; child <= 2 * i + 2 && child < s->n_differences;
+         ++child)
+      if (compare_differences (&s->differences[last],
+                               &s->differences[child]) < 0)
+        last = child;
+    if (last == i)
+      break;
+    swap_differences (&s->differences[i], &s->differences[last]);
+    i = last;
+  }
+}
+
+/* Takes over the path of `diff'. Once there are as many as are kept, it
+   replaces the last by path if it comes before it. */
+static void
+add_difference (CxCompare *d, const Difference *diff)
+{
+  CompareSearch *s = d->search;
+
+  pthread_mutex_lock (&s->lock);
+  switch (diff->kind)
+  {
+    case DIFFERENCE_LEFT_ONLY:
+      ++d->n_left_only;
+      break;
+    case DIFFERENCE_RIGHT_ONLY:
+      ++d->n_right_only;
+      break;
+    default:
+      ++d->n_differ;
+      break;
+  }
+
+  if (s->n_differences == MAX_DIFFERENCES)
+  {
+    if (compare_differences (diff, &s->differences[0]) < 0)
+    {
+      free (s->differences[0].path);
+      s->differences[0] = *diff;
+      sift_down (s, 0);
+    }
+    else
+      free (diff->path);
+    pthread_mutex_unlock (&s->lock);
+    return;
+  }
+  if (s->n_differences == s->alloc)
+  {
+    s->alloc       = s->alloc ? s->alloc * 2 : 64;
+    s->differences = realloc (s->differences, s->alloc * sizeof (Difference));
+    if (!s->differences)
+      cx_die (errno, "failed to allocate memory");
+  }
+  s->differences[s->n_differences++] = *diff;
+  sift_up (s, s->n_differences - 1);
+  pthread_mutex_unlock (&s->lock);
+}
+
+static void
+add_entry (CxCompare *d, DifferenceKind kind, const CxWalkEntry *e)
+{
+  Difference diff;
+
+  difference_init (&diff, kind, e);
+  add_difference (d, &diff);
+}
+
+/* waits while the workers are a full queue behind */
+static void
+queue_file (CompareSearch *s, const CxWalkEntry *e)
+{
+  Pending *p;
+
+  p = malloc (sizeof (Pending));
+  if (!p)
+    cx_die (errno, "failed to allocate memory");
+  difference_init (&p->file, DIFFERENCE_CONTENT, e);
+  p->next = NULL;
+
+  pthread_mutex_lock (&s->lock);
+  while (s->n_pending == MAX_PENDING && !s->cancel)
+    pthread_cond_wait (&s->room, &s->lock);
+  if (s->cancel)
+  {
+    pthread_mutex_unlock (&s->lock);
+    free (p->file.path);
+    free (p);
+    return;
+  }
+
+  if (s->pending_end)
+    s->pending_end->next = p;
+  else
+    s->pending = p;
+  s->pending_end = p;
+  ++s->n_pending;
+  pthread_cond_signal (&s->work);
+  pthread_mutex_unlock (&s->lock);
+}
+
+/* NULL once the walk is over and the queue empty */
+static Pending *
+claim_file (CompareSearch *s)
+{
+  Pending *p;
+
+  pthread_mutex_lock (&s->lock);
+  while (!s->pending && !s->walked && !s->cancel)
+    pthread_cond_wait (&s->work, &s->lock);
+
+  p = s->cancel ? NULL : s->pending;
+  if (p)
+  {
+    s->pending = p->next;
+    if (!s->pending)
+      s->pending_end = NULL;
+    --s->n_pending;
+    pthread_cond_signal (&s->room);
+  }
+  pthread_mutex_unlock (&s->lock);
+  return p;
+}
+
+/* false unless the whole file could be read */
+static bool
+hash_file (CompareSearch *s, const CxPath *path, char *buf, uint64_t *hash)
+{
+  CxHash64 h;
+  ssize_t  n;
+  int      fd;
+
+  fd = open (path->str, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  cx_hash64_init (&h);
+  for (;;)
+  {
+    n = read (fd, buf, READ_BYTES);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0 || cancelled (s))
+      break;
+    cx_hash64_update (&h, buf, n);
+  }
+  close (fd);
+
+  *hash = cx_hash64_digest (&h);
+  return n == 0;
+}
+
+/* each copy is read from start to end on its own, so that neither read
+   seeks back and forth between the two */
+static void
+verify_file (CxCompare *d, Worker *w, Pending *p)
+{
+  CompareSearch *s = d->search;
+  CxPath         path;
+  uint64_t       left_hash;
+  uint64_t       right_hash;
+  bool           ok;
+
+  cx_path_dir_item (&path, &d->left, p->file.path, p->file.path_len);
+  ok = hash_file (s, &path, w->buf, &left_hash);
+  if (ok)
+  {
+    cx_path_dir_item (&path, &d->right, p->file.path, p->file.path_len);
+    ok = hash_file (s, &path, w->buf, &right_hash);
+  }
+
+  if (!ok)
+    p->file.kind = DIFFERENCE_UNREADABLE;
+  else
+  {
+    pthread_mutex_lock (&s->lock);
+    ++d->n_verified;
+    pthread_mutex_unlock (&s->lock);
+  }
+
+  if (!ok || left_hash != right_hash)
+    add_difference (d, &p->file);
+  else
+    free (p->file.path);
+  free (p);
+}
+
+static void *
+worker_main (void *arg)
+{
+  Worker * w = arg;
+  Pending *p;
+
+  while ((p = claim_file (w->compare->search)))
+    verify_file (w->compare, w, p);
+  return NULL;
+}
+
+/* Entries on one side only are not walked into, since everything below
+   them is just as missing from the other side, and neither are the two
+   sides of an entry that is a directory on one side only. */
+static void
+walk_both (CxCompare *d)
+{
+  CompareSearch *    s = d->search;
+  const CxWalkEntry *a;
+  const CxWalkEntry *b;
+  long long          n;
+  int                cmp;
+
+  a = cx_walker_next (&s->left);
+  b = cx_walker_next (&s->right);
+  for (n = 1; a || b; ++n)
+  {
+    if (n % CANCEL_INTERVAL == 0 && cancelled (s))
+      break;
+
+    cmp = !a ? 1
+             : (!b ? -1
+                   : cx_walk_compare (a->path, a->path_len, b->path,
+                                      b->path_len));
+    if (cmp < 0)
+    {
+      add_entry (d, DIFFERENCE_LEFT_ONLY, a);
+      cx_walker_skip (&s->left);
+      a = cx_walker_next (&s->left);
+      continue;
+    }
+    if (cmp > 0)
+    {
+      add_entry (d, DIFFERENCE_RIGHT_ONLY, b);
+      cx_walker_skip (&s->right);
+      b = cx_walker_next (&s->right);
+      continue;
+    }
+
+    if ((a->mode & S_IFMT) != (b->mode & S_IFMT))
+    {
+      add_entry (d, DIFFERENCE_METADATA, a);
+      cx_walker_skip (&s->left);
+      cx_walker_skip (&s->right);
+    }
+    else if (!S_ISDIR (a->mode) &&
+             (a->size != b->size || a->mtime != b->mtime))
+      add_entry (d, DIFFERENCE_METADATA, a);
+    else if (d->verify && S_ISREG (a->mode) && a->size > 0)
+      queue_file (s, a);
+    a = cx_walker_next (&s->left);
+    b = cx_walker_next (&s->right);
+  }
+}
+
+static void *
+compare_main (void *arg)
+{
+  CxCompare *    d = arg;
+  CompareSearch *s = d->search;
+  int            i;
+
+  for (i = 0; i < s->n_workers; ++i)
+    if (pthread_create (&s->workers[i].thread, NULL, worker_main,
+                        &s->workers[i]) != 0)
+      cx_die (0, "failed to start directory comparison");
+
+  walk_both (d);
+
+  pthread_mutex_lock (&s->lock);
+  s->walked = true;
+  pthread_cond_broadcast (&s->work);
+  pthread_mutex_unlock (&s->lock);
+  for (i = 0; i < s->n_workers; ++i)
+    pthread_join (s->workers[i].thread, NULL);
+
+  /* the workers add theirs as they finish */
+  qsort (s->differences, s->n_differences, sizeof (Difference),
+         compare_differences);
+  cx_event_wakeup (s->wake_fd);
+  return NULL;
+}
+
+static void
+set_title (CxCompare *d)
+{
+  int len;
+
+  if (d->failed)
+    len = snprintf (d->title.str, CX_PATHMAX, "%s: cannot compare with `%s'",
+                    d->left.str, d->right.str);
+  else if (!d->done)
+    len = snprintf (d->title.str, CX_PATHMAX, "%s: comparing %swith `%s'",
+                    d->left.str, d->verify ? "contents " : "", d->right.str);
+  else
+  {
+    len = snprintf (d->title.str, CX_PATHMAX,
+                    "%s: %lld left only, %lld right only, %lld differ "
+                    "from `%s'",
+                    d->left.str, d->n_left_only, d->n_right_only, d->n_differ,
+                    d->right.str);
+    if (d->verify && len < CX_PATHMAX)
+      len += snprintf (d->title.str + len, CX_PATHMAX - len,
+                       " (%lld files verified)", d->n_verified);
+    if (d->search->n_differences == MAX_DIFFERENCES && len < CX_PATHMAX)
+      len += snprintf (d->title.str + len, CX_PATHMAX - len,
+                       " (first %d shown)", MAX_DIFFERENCES);
+  }
+  d->title.len = len < CX_PATHMAX ? len : CX_PATHMAX - 1;
+}
+
+static void
+build_listing (CxCompare *d)
+{
+  static const char *kind_strs[] = {
+    [DIFFERENCE_LEFT_ONLY]  = LEFT_ONLY_TYPE_STR,
+    [DIFFERENCE_RIGHT_ONLY] = RIGHT_ONLY_TYPE_STR,
+    [DIFFERENCE_METADATA]   = DIFFERS_TYPE_STR,
+    [DIFFERENCE_CONTENT]    = CONTENT_TYPE_STR,
+    [DIFFERENCE_UNREADABLE] = UNREADABLE_TYPE_STR,
+  };
+
+  const CompareSearch *s = d->search;
+  const Difference *   diff;
+  CxDirItem *          item;
+  struct stat          st;
+  char                 type_str[CX_SMALL_BUFMAX];
+  int                  i;
+
+  cx_dir_listing_free (&d->listing);
+  d->listing.path  = &d->title;
+  d->listing.total = 1 + s->n_differences;
+  d->listing.list  = malloc (d->listing.total * sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+
+  item = d->listing.list;
+  cx_dir_item_init_parent (item++);
+
+  /* entries are named by their path below either side, and are on the
+     right only where missing from the left */
+  memset (&st, 0, sizeof (st));
+  for (i = 0; i < s->n_differences; ++i, ++item)
+  {
+    diff        = &s->differences[i];
+    st.st_mode  = diff->mode;
+    st.st_size  = diff->size;
+    st.st_mtime = diff->mtime;
+    st.st_ino   = diff->ino;
+    cx_dir_item_init (item, diff->path, diff->path_len,
+                      diff->kind == DIFFERENCE_RIGHT_ONLY, &st,
+                      g_options.size_units);
+
+    item->info.type_str_len =
+      snprintf (type_str, sizeof (type_str), "%s %s", kind_strs[diff->kind],
+                item->info.type_str);
+    memcpy (item->info.type_str, type_str, item->info.type_str_len + 1);
+  }
+}
+
+static void
+free_search (CompareSearch *s)
+{
+  Pending *p;
+  int      i;
+
+  while ((p = s->pending))
+  {
+    s->pending = p->next;
+    free (p->file.path);
+    free (p);
+  }
+  s->pending_end = NULL;
+
+  for (i = 0; i < s->n_differences; ++i)
+    free (s->differences[i].path);
+  free (s->differences);
+  s->differences   = NULL;
+  s->n_differences = 0;
+  s->alloc         = 0;
+
+  for (i = 0; i < s->n_workers; ++i)
+  {
+    free (s->workers[i].buf);
+    s->workers[i].buf = NULL;
+  }
+  cx_walker_free (&s->left);
+  cx_walker_free (&s->right);
+}
+
+static void
+on_compare_done (int fd, void *data)
+{
+  CxCompare *d = data;
+
+  pthread_join (d->search->thread, NULL);
+  d->done = true;
+
+  build_listing (d);
+  set_title (d);
+  free_search (d->search);
+
+  cx_log (CX_LOG_STATUS_INFO,
+          "%lld left only, %lld right only, %lld differ between `%s' and "
+          "`%s'",
+          d->n_left_only, d->n_right_only, d->n_differ, d->left.str,
+          d->right.str);
+  if (d->callback)
+    d->callback (d, d->data);
+}
+
+CxCompare *
+cx_compare_start (const CxPath *left, const CxPath *right, bool verify,
+                  CxCompareCallback callback, void *data)
+{
+  CxCompare *    d;
+  CompareSearch *s;
+  long           n_cpus;
+  bool           ok;
+  int            i;
+
+  d = calloc (1, sizeof (CxCompare));
+  s = calloc (1, sizeof (CompareSearch));
+  if (!d || !s)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&d->root, left);
+  cx_path_init_copy (&d->left, left);
+  cx_path_init_copy (&d->right, right);
+  d->verify   = verify;
+  d->callback = callback;
+  d->data     = data;
+  d->search   = s;
+  s->wake_fd  = -1;
+
+  /* entries are found below the real paths of both */
+  ok = cx_walker_init (&s->left, left);
+  if (ok)
+  {
+    cx_path_init (&d->left, s->left.path, s->left.root_len);
+    ok = cx_walker_init (&s->right, right);
+  }
+  if (ok)
+    cx_path_init (&d->right, s->right.path, s->right.root_len);
+
+  /* just a way back until the results are in; what is only on the right
+     is named below it */
+  d->listing.path     = &d->title;
+  d->listing.roots[0] = &d->left;
+  d->listing.roots[1] = &d->right;
+  d->listing.total    = 1;
+  d->listing.list  = malloc (sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+  cx_dir_item_init_parent (d->listing.list);
+
+  if (!ok)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "failed to compare `%s' with `%s' - %s",
+            left->str, right->str, strerror (errno));
+    free_search (s);
+    d->done   = true;
+    d->failed = true;
+    set_title (d);
+    return d;
+  }
+
+  if (verify)
+  {
+    n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    s->n_workers =
+      n_cpus < 2 ? 2 : (n_cpus > MAX_WORKERS ? MAX_WORKERS : n_cpus);
+    for (i = 0; i < s->n_workers; ++i)
+    {
+      s->workers[i].compare = d;
+      s->workers[i].buf     = malloc (READ_BYTES);
+      if (!s->workers[i].buf)
+        cx_die (errno, "failed to allocate memory");
+    }
+  }
+
+  set_title (d);
+  pthread_mutex_init (&s->lock, NULL);
+  pthread_cond_init (&s->work, NULL);
+  pthread_cond_init (&s->room, NULL);
+  s->wake_fd = cx_event_wakeup_new (on_compare_done, d);
+  if (pthread_create (&s->thread, NULL, compare_main, d) != 0)
+    cx_die (0, "failed to start directory comparison");
+  return d;
+}
+
+void
+cx_compare_free (CxCompare *d)
+{
+  CompareSearch *s;
+
+  if (!d)
+    return;
+  s = d->search;
+
+  if (!d->done)
+  {
+    pthread_mutex_lock (&s->lock);
+    s->cancel = true;
+    pthread_cond_broadcast (&s->work);
+    pthread_cond_broadcast (&s->room);
+    pthread_mutex_unlock (&s->lock);
+    pthread_join (s->thread, NULL);
+    free_search (s);
+  }
+
+  if (s->wake_fd != -1)
+  {
+    cx_event_wakeup_free (s->wake_fd);
+    pthread_cond_destroy (&s->room);
+    pthread_cond_destroy (&s->work);
+    pthread_mutex_destroy (&s->lock);
+  }
+  cx_dir_listing_free (&d->listing);
+  free (s);
+  free (d);
+}
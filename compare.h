@@ -0,0 +1,43 @@
+#ifndef __CX_COMPARE_H__
+#define __CX_COMPARE_H__
+
+#include <stdbool.h>
+
+#include "files.h"
+#include "path.h"
+
+typedef struct CxCompare CxCompare;
+
+/* Called on the main thread once `listing' holds the results. */
+typedef void (*CxCompareCallback) (CxCompare *compare, void *data);
+
+/* How the tree below `left' differs from the one below `right'. Entries
+   found on one side only are listed without what is below them; entries on
+   both differ by type, size or mtime, or, when `verify' is set, by the
+   contents of files that agree on all three. Its listing starts with a
+   `..' item, then one item per difference, in path order. */
+struct CxCompare
+{
+  CxPath                root; /* where the pane shows the results */
+  CxPath                left;
+  CxPath                right;
+  CxPath                title;
+  CxDirListing          listing;
+  long long             n_left_only;
+  long long             n_right_only;
+  long long             n_differ;
+  long long             n_verified;
+  bool                  verify;
+  bool                  done;
+  bool                  failed;
+  CxCompareCallback     callback;
+  void *                data;
+  struct CompareSearch *search;
+};
+
+CxCompare *cx_compare_start (const CxPath *left, const CxPath *right,
+                             bool verify, CxCompareCallback callback,
+                             void *data);
+void       cx_compare_free (CxCompare *compare);
+
+#endif /* __CX_COMPARE_H__ */
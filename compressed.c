@@ -0,0 +1,692 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef CX_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CX_LZMA
+#include <lzma.h>
+#endif
+
+#include "compressed.h"
+#include "log.h"
+#include "util.h"
+
+/* files whose seek points are kept */
+#define MAX_FILES 4
+
+#define INPUT_BYTES 65536
+#define OUTPUT_BYTES 32768
+
+/* decompressed bytes between two gzip seek points, each of which holds
+   the 32 KiB window a deflate stream can refer back into */
+#define GZIP_SPAN (1024 * 1024)
+#define GZIP_WINDOW OUTPUT_BYTES
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+#define XZ_MAGIC "\xfd" "7zXZ"
+#define XZ_MAGIC_SIZE 6
+
+typedef enum
+{
+  FORMAT_GZIP,
+  FORMAT_XZ
+} Format;
+
+#ifdef CX_ZLIB
+/* where gzip decoding can start over: a deflate block boundary, with the
+   output before it that the blocks after may copy from */
+typedef struct
+{
+  uint64_t out;
+  uint64_t in;
+  int      bits; /* of the byte before `in' not read yet */
+  uint8_t *window;
+} Point;
+#endif
+
+struct Decoder
+{
+  Format   format;
+  int      fd;
+  dev_t    dev;
+  ino_t    ino;
+  off_t    size;
+  time_t   mtime;
+  uint8_t *input;
+  uint8_t *output; /* a ring holding the last window, for gzip */
+  int      output_pos;
+  uint64_t in;  /* where input is read from next */
+  uint64_t out; /* of the next byte decoded */
+  bool     live;
+  bool     at_end;
+#ifdef CX_ZLIB
+  z_stream z;
+  Point *  points;
+  int      alloc;
+#endif
+#ifdef CX_LZMA
+  lzma_stream     xz;
+  lzma_index *    index;
+  lzma_index_iter iter;
+  lzma_block      block;
+  lzma_filter     filters[LZMA_FILTERS_MAX + 1];
+#endif
+};
+
+/* only the preview reads compressed files, on the main thread */
+static struct
+{
+  CxCompressed *list;
+} files;
+
+static bool
+read_at (int fd, void *buf, size_t len, off_t off)
+{
+  char *  p = buf;
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = pread (fd, p, len, off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+    off += n;
+  }
+  return true;
+}
+
+#if defined (CX_ZLIB) || defined (CX_LZMA)
+/* Fills the input buffer from where decoding got to. False at the end of
+   the file, which a truncated file reaches early. */
+static bool
+fill_input (struct Decoder *d, const uint8_t **next_in, size_t *avail_in)
+{
+  ssize_t n;
+
+  do
+    n = pread (d->fd, d->input, INPUT_BYTES, d->in);
+  while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return false;
+  d->in += n;
+  *next_in  = d->input;
+  *avail_in = n;
+  return true;
+}
+#endif
+
+#ifdef CX_ZLIB
+static bool
+skip_string (int fd, uint64_t *off)
+{
+  uint8_t  buf[256];
+  uint8_t *end;
+  ssize_t  n;
+
+  for (;;)
+  {
+    n = pread (fd, buf, sizeof (buf), *off);
+    if (n <= 0)
+      return false;
+    end = memchr (buf, '\0', n);
+    if (end)
+    {
+      *off += end - buf + 1;
+      return true;
+    }
+    *off += n;
+  }
+}
+
+/* where the deflate data of the member at `off' starts */
+static bool
+gzip_header (int fd, uint64_t off, uint64_t *data)
+{
+  uint8_t h[GZIP_HEADER_SIZE];
+  uint8_t len[2];
+
+  if (!read_at (fd, h, sizeof (h), off) || h[0] != 0x1f || h[1] != 0x8b ||
+      h[2] != Z_DEFLATED)
+    return false;
+  off += sizeof (h);
+  if (h[3] & GZIP_FEXTRA)
+  {
+    if (!read_at (fd, len, sizeof (len), off))
+      return false;
+    off += sizeof (len) + (len[0] | len[1] << 8);
+  }
+  if ((h[3] & GZIP_FNAME) && !skip_string (fd, &off))
+    return false;
+  if ((h[3] & GZIP_FCOMMENT) && !skip_string (fd, &off))
+    return false;
+  if (h[3] & GZIP_FHCRC)
+    off += 2;
+  *data = off;
+  return true;
+}
+
+static void
+gzip_add_point (CxCompressed *c, int bits)
+{
+  struct Decoder *d = c->decoder;
+  Point *         p;
+
+  if (c->n_points == d->alloc)
+  {
+    d->alloc  = d->alloc ? d->alloc * 2 : 16;
+    d->points = realloc (d->points, d->alloc * sizeof (Point));
+    if (!d->points)
+      cx_die (errno, "failed to allocate memory");
+  }
+  p         = &d->points[c->n_points++];
+  p->out    = d->out;
+  p->in     = d->in - d->z.avail_in;
+  p->bits   = bits;
+  p->window = malloc (GZIP_WINDOW);
+  if (!p->window)
+    cx_die (errno, "failed to allocate memory");
+  memcpy (p->window, d->output + d->output_pos, GZIP_WINDOW - d->output_pos);
+  memcpy (p->window + GZIP_WINDOW - d->output_pos, d->output, d->output_pos);
+}
+
+/* Members are inflated as raw deflate data, their headers skipped here,
+   so that every seek point resumes the same way. */
+static bool
+gzip_open (CxCompressed *c)
+{
+  struct Decoder *d = c->decoder;
+
+  if (!gzip_header (d->fd, 0, &d->in) ||
+      inflateInit2 (&d->z, -MAX_WBITS) != Z_OK)
+    return false;
+  c->format = "gzip";
+  gzip_add_point (c, 0);
+  return true;
+}
+
+static const Point *
+gzip_point (const CxCompressed *c, uint64_t offset)
+{
+  const Point *points = c->decoder->points;
+  int          lo     = 0;
+  int          hi     = c->n_points - 1;
+  int          mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi + 1) / 2;
+    if (points[mid].out <= offset)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &points[lo];
+}
+
+static bool
+gzip_restart (CxCompressed *c, uint64_t offset)
+{
+  struct Decoder *d = c->decoder;
+  const Point *   p = gzip_point (c, offset);
+  uint8_t         byte;
+
+  if (inflateReset (&d->z) != Z_OK)
+    return false;
+  if (p->bits)
+  {
+    if (!read_at (d->fd, &byte, 1, p->in - 1))
+      return false;
+    inflatePrime (&d->z, p->bits, byte >> (8 - p->bits));
+  }
+  inflateSetDictionary (&d->z, p->window, GZIP_WINDOW);
+  memcpy (d->output, p->window, GZIP_WINDOW);
+  d->output_pos = 0;
+  d->z.avail_in = 0;
+  d->in         = p->in;
+  d->out        = p->out;
+  return true;
+}
+
+/* Inflates no more than `max' bytes, stopping early at the end of a
+   block; each block boundary far enough past the last seek point is
+   recorded as the next one. */
+static bool
+gzip_step (CxCompressed *c, size_t max, const uint8_t **chunk, size_t *len)
+{
+  struct Decoder *d = c->decoder;
+  const uint8_t * in;
+  size_t          avail;
+  uint64_t        next;
+  int             rc;
+
+  if (d->z.avail_in == 0)
+  {
+    if (!fill_input (d, &in, &avail))
+    {
+      d->at_end = true;
+      *len      = 0;
+      return true;
+    }
+    d->z.next_in  = (Bytef *) in;
+    d->z.avail_in = avail;
+  }
+
+  if (d->output_pos == GZIP_WINDOW)
+    d->output_pos = 0;
+  if (max > (size_t) (GZIP_WINDOW - d->output_pos))
+    max = GZIP_WINDOW - d->output_pos;
+  d->z.next_out  = d->output + d->output_pos;
+  d->z.avail_out = max;
+  rc             = inflate (&d->z, Z_BLOCK);
+  if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+  {
+    errno = EIO;
+    return false;
+  }
+
+  *chunk = d->output + d->output_pos;
+  *len   = max - d->z.avail_out;
+  d->output_pos += *len;
+  d->out += *len;
+
+  if (rc == Z_STREAM_END)
+  {
+    /* another member may follow, as in files that were concatenated */
+    next = d->in - d->z.avail_in + GZIP_TRAILER_SIZE;
+    if (!gzip_header (d->fd, next, &next) || inflateReset (&d->z) != Z_OK)
+    {
+      d->at_end = true;
+      return true;
+    }
+    d->z.avail_in = 0;
+    d->in         = next;
+  }
+  else if (!(d->z.data_type & 128) || (d->z.data_type & 64))
+    return true;
+
+  if (d->out >= d->points[c->n_points - 1].out + GZIP_SPAN)
+    gzip_add_point (c, rc == Z_STREAM_END ? 0 : d->z.data_type & 7);
+  return true;
+}
+
+static void
+gzip_free (CxCompressed *c)
+{
+  struct Decoder *d = c->decoder;
+  int             i;
+
+  inflateEnd (&d->z);
+  for (i = 0; i < c->n_points; ++i)
+    free (d->points[i].window);
+  free (d->points);
+}
+#endif
+
+#ifdef CX_LZMA
+/* The index at the end of each stream lists its blocks, and where each
+   starts in and out; only those pieces of the file are read. */
+static bool
+xz_open (CxCompressed *c)
+{
+  struct Decoder *d = c->decoder;
+  lzma_stream     s  = LZMA_STREAM_INIT;
+  lzma_ret        rc = LZMA_DATA_ERROR;
+
+  d->filters[0].id = LZMA_VLI_UNKNOWN;
+  if (lzma_file_info_decoder (&s, &d->index, UINT64_MAX, d->size) != LZMA_OK)
+    return false;
+  d->in = 0;
+  do
+  {
+    if (s.avail_in == 0 && !fill_input (d, &s.next_in, &s.avail_in))
+      break;
+    rc = lzma_code (&s, LZMA_RUN);
+    if (rc == LZMA_SEEK_NEEDED)
+    {
+      d->in      = s.seek_pos;
+      s.avail_in = 0;
+    }
+  } while (rc == LZMA_OK || rc == LZMA_SEEK_NEEDED);
+  lzma_end (&s);
+  if (rc != LZMA_STREAM_END)
+    return false;
+
+  c->format   = "xz";
+  c->n_points = lzma_index_block_count (d->index);
+  return true;
+}
+
+/* the start of the block holding `offset', or the end of the data */
+static uint64_t
+xz_point (const CxCompressed *c, uint64_t offset)
+{
+  lzma_index_iter iter;
+
+  lzma_index_iter_init (&iter, c->decoder->index);
+  if (lzma_index_iter_locate (&iter, offset))
+    return lzma_index_uncompressed_size (c->decoder->index);
+  return iter.block.uncompressed_file_offset;
+}
+
+static bool
+xz_start_block (struct Decoder *d)
+{
+  uint8_t  header[LZMA_BLOCK_HEADER_SIZE_MAX];
+  uint64_t off = d->iter.block.compressed_file_offset;
+
+  lzma_filters_free (d->filters, NULL);
+  memset (&d->block, 0, sizeof (d->block));
+  d->block.check   = d->iter.stream.flags->check;
+  d->block.filters = d->filters;
+  if (!read_at (d->fd, header, 1, off))
+    return false;
+  d->block.header_size = lzma_block_header_size_decode (header[0]);
+  if (!read_at (d->fd, header, d->block.header_size, off) ||
+      lzma_block_header_decode (&d->block, NULL, header) != LZMA_OK ||
+      lzma_block_compressed_size (&d->block, d->iter.block.unpadded_size) !=
+        LZMA_OK ||
+      lzma_block_decoder (&d->xz, &d->block) != LZMA_OK)
+  {
+    errno = EIO;
+    return false;
+  }
+  d->xz.avail_in = 0;
+  d->in          = off + d->block.header_size;
+  d->out         = d->iter.block.uncompressed_file_offset;
+  return true;
+}
+
+static bool
+xz_restart (CxCompressed *c, uint64_t offset)
+{
+  struct Decoder *d = c->decoder;
+
+  lzma_index_iter_init (&d->iter, d->index);
+  if (lzma_index_iter_locate (&d->iter, offset))
+  {
+    d->at_end = true;
+    d->out    = lzma_index_uncompressed_size (d->index);
+    return true;
+  }
+  return xz_start_block (d);
+}
+
+static bool
+xz_step (CxCompressed *c, size_t max, const uint8_t **chunk, size_t *len)
+{
+  struct Decoder *d = c->decoder;
+  lzma_ret        rc;
+
+  if (d->xz.avail_in == 0 && !fill_input (d, &d->xz.next_in, &d->xz.avail_in))
+  {
+    d->at_end = true;
+    *len      = 0;
+    return true;
+  }
+
+  if (max > OUTPUT_BYTES)
+    max = OUTPUT_BYTES;
+  d->xz.next_out  = d->output;
+  d->xz.avail_out = max;
+  rc              = lzma_code (&d->xz, LZMA_RUN);
+  *chunk          = d->output;
+  *len            = max - d->xz.avail_out;
+  d->out += *len;
+
+  if (rc == LZMA_STREAM_END)
+  {
+    if (lzma_index_iter_next (&d->iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK))
+      d->at_end = true;
+    else if (!xz_start_block (d))
+      return false;
+  }
+  else if (rc != LZMA_OK)
+  {
+    errno = EIO;
+    return false;
+  }
+  return true;
+}
+
+static void
+xz_free (struct Decoder *d)
+{
+  lzma_end (&d->xz);
+  lzma_index_end (d->index, NULL);
+  lzma_filters_free (d->filters, NULL);
+}
+#endif
+
+static void
+compressed_free (CxCompressed *c)
+{
+  struct Decoder *d = c->decoder;
+
+#ifdef CX_ZLIB
+  if (d->format == FORMAT_GZIP)
+    gzip_free (c);
+#endif
+#ifdef CX_LZMA
+  if (d->format == FORMAT_XZ)
+    xz_free (d);
+#endif
+  close (d->fd);
+  free (d->input);
+  free (d->output);
+  free (d);
+  free (c);
+}
+
+/* Only the header, or the index, is read here; nothing is decompressed
+   until something is read. */
+static bool
+detect_format (CxCompressed *c)
+{
+  struct Decoder *d = c->decoder;
+  uint8_t         magic[XZ_MAGIC_SIZE];
+
+  if (!read_at (d->fd, magic, sizeof (magic), 0))
+    return false;
+#ifdef CX_ZLIB
+  if (magic[0] == 0x1f && magic[1] == 0x8b)
+  {
+    d->format = FORMAT_GZIP;
+    return gzip_open (c);
+  }
+#endif
+#ifdef CX_LZMA
+  if (memcmp (magic, XZ_MAGIC, sizeof (magic)) == 0)
+  {
+    d->format = FORMAT_XZ;
+    return xz_open (c);
+  }
+#endif
+  return false;
+}
+
+CxCompressed *
+cx_compressed_open (const CxPath *path)
+{
+  CxCompressed ** p;
+  CxCompressed *  c;
+  struct Decoder *d;
+  struct stat     st;
+  int             fd;
+  int             n;
+
+  fd = open (path->str, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat (fd, &st) != 0 || !S_ISREG (st.st_mode))
+  {
+    if (fd != -1)
+      close (fd);
+    return NULL;
+  }
+
+  for (p = &files.list; (c = *p); p = &c->next)
+    if (cx_strneq (c->path.str, c->path.len, path->str, path->len))
+      break;
+
+  if (c)
+  {
+    *p = c->next;
+    d  = c->decoder;
+    if (d->dev == st.st_dev && d->ino == st.st_ino && d->size == st.st_size &&
+        d->mtime == st.st_mtime)
+    {
+      close (fd);
+      c->next    = files.list;
+      files.list = c;
+      return c;
+    }
+    compressed_free (c);
+  }
+
+  c = calloc (1, sizeof (CxCompressed));
+  d = calloc (1, sizeof (struct Decoder));
+  if (c)
+    c->decoder = d;
+  if (d)
+  {
+    d->input  = malloc (INPUT_BYTES);
+    d->output = calloc (1, OUTPUT_BYTES);
+  }
+  if (!c || !d || !d->input || !d->output)
+    cx_die (errno, "failed to allocate memory");
+  cx_path_init_copy (&c->path, path);
+  d->fd    = fd;
+  d->dev   = st.st_dev;
+  d->ino   = st.st_ino;
+  d->size  = st.st_size;
+  d->mtime = st.st_mtime;
+
+  if (!detect_format (c))
+  {
+    compressed_free (c);
+    return NULL;
+  }
+
+  c->next    = files.list;
+  files.list = c;
+  for (n = 1, p = &c->next; *p; ++n)
+  {
+    if (n < MAX_FILES)
+    {
+      p = &(*p)->next;
+      continue;
+    }
+    c  = *p;
+    *p = c->next;
+    compressed_free (c);
+  }
+  return files.list;
+}
+
+static uint64_t
+seek_point (const CxCompressed *c, uint64_t offset)
+{
+  switch (c->decoder->format)
+  {
+#ifdef CX_ZLIB
+    case FORMAT_GZIP:
+      return gzip_point (c, offset)->out;
+#endif
+#ifdef CX_LZMA
+    case FORMAT_XZ:
+      return xz_point (c, offset);
+#endif
+    default:
+      return 0;
+  }
+}
+
+static bool
+restart (CxCompressed *c, uint64_t offset)
+{
+  c->decoder->at_end = false;
+  switch (c->decoder->format)
+  {
+#ifdef CX_ZLIB
+    case FORMAT_GZIP:
+      return gzip_restart (c, offset);
+#endif
+#ifdef CX_LZMA
+    case FORMAT_XZ:
+      return xz_restart (c, offset);
+#endif
+    default:
+      errno = ENOTSUP;
+      return false;
+  }
+}
+
+static bool
+step (CxCompressed *c, size_t max, const uint8_t **chunk, size_t *len)
+{
+  switch (c->decoder->format)
+  {
+#ifdef CX_ZLIB
+    case FORMAT_GZIP:
+      return gzip_step (c, max, chunk, len);
+#endif
+#ifdef CX_LZMA
+    case FORMAT_XZ:
+      return xz_step (c, max, chunk, len);
+#endif
+    default:
+      errno = ENOTSUP;
+      return false;
+  }
+}
+
+/* Decoding goes on from where the last read stopped, which it never
+   overshoots, so reading on from there costs only the new data. Reading
+   before it, or far enough after it to pass a seek point, starts over at
+   the nearest seek point. */
+ssize_t
+cx_compressed_read (CxCompressed *c, uint64_t offset, char *buf, size_t len)
+{
+  struct Decoder *d = c->decoder;
+  const uint8_t * chunk;
+  size_t          done;
+  size_t          n;
+  uint64_t        end;
+
+  if (!d->live || offset < d->out || seek_point (c, offset) > d->out)
+  {
+    d->live = restart (c, offset);
+    if (!d->live)
+      return -1;
+  }
+
+  end = offset + len;
+  for (done = 0; d->out < end && !d->at_end;)
+  {
+    n = d->out < offset ? offset - d->out : end - d->out;
+    if (!step (c, n, &chunk, &n))
+    {
+      d->live = false;
+      return -1;
+    }
+    /* a step before `offset' stops at it */
+    if (d->out > offset)
+    {
+      memcpy (buf + done, chunk, n);
+      done += n;
+    }
+  }
+  return done;
+}
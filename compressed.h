@@ -0,0 +1,30 @@
+#ifndef __CX_COMPRESSED_H__
+#define __CX_COMPRESSED_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "path.h"
+
+/* A gzip or xz file read as the data it decompresses to. Reading at an
+   offset decodes from the nearest seek point before it, never from the
+   start of the file unless nothing closer is known yet. Seek points are
+   recorded as decoding goes past them (gzip), or are the blocks listed
+   in the file's own index (xz). Files opened recently stay cached with
+   their seek points while unchanged. */
+typedef struct CxCompressed
+{
+  struct CxCompressed *next;
+  CxPath               path;
+  const char *         format;
+  int                  n_points;
+  uint64_t             view; /* where the preview was left */
+  struct Decoder *     decoder;
+} CxCompressed;
+
+/* NULL unless `path' is a compressed file this build can decode */
+CxCompressed *cx_compressed_open (const CxPath *path);
+ssize_t       cx_compressed_read (CxCompressed *file, uint64_t offset,
+                                  char *buf, size_t len);
+
+#endif /* __CX_COMPRESSED_H__ */
@@ -0,0 +1,773 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dupes.h"
+#include "event.h"
+#include "hash.h"
+#include "log.h"
+#include "util.h"
+
+#define MAX_WORKERS 8
+
+/* the partial hash covers this much at either end of a file */
+#define EDGE_BYTES 4096
+
+/* the full hash reads files sequentially in chunks this large */
+#define READ_BYTES (1024 * 1024)
+
+#define GROUP_TYPE_STR "reclaimable"
+
+extern CxScanOptions g_options;
+
+typedef struct
+{
+  char *    path;
+  int       path_len;
+  cx_byte_t size;
+  dev_t     dev;
+  ino_t     ino;
+  uint64_t  hash;
+  bool      hashed_all; /* the partial hash already covered every byte */
+  bool      failed;
+} DupeFile;
+
+typedef struct
+{
+  DupeFile *list;
+  int       total;
+  int       alloc;
+} FileList;
+
+typedef struct DirJob
+{
+  struct DirJob *next;
+  char           path[];
+} DirJob;
+
+typedef struct
+{
+  struct DupesSearch *search;
+  pthread_t           thread;
+  FileList            files;
+  char *              buf;
+} Worker;
+
+/* The search runs in stages on its own thread, each one fanned out over
+   the workers: walking the tree, hashing the ends of every file that shares
+   its size with another, then hashing whole files only where the ends
+   matched too. Each stage drops the files left without a twin. */
+typedef struct DupesSearch
+{
+  pthread_mutex_t lock;
+  pthread_cond_t  work;
+  pthread_t       thread;
+  Worker          workers[MAX_WORKERS];
+  int             n_workers;
+  DirJob *        dirs;
+  int             n_walking;
+  int             next_file;
+  FileList        files;
+  int             wake_fd;
+  bool            hidden;
+  bool            cancel;
+} DupesSearch;
+
+typedef struct
+{
+  int       start;
+  int       n;
+  cx_byte_t reclaimable;
+} Group;
+
+static bool
+cancelled (DupesSearch *s)
+{
+  bool cancel;
+
+  pthread_mutex_lock (&s->lock);
+  cancel = s->cancel;
+  pthread_mutex_unlock (&s->lock);
+  return cancel;
+}
+
+static DirJob *
+dir_job_new (const char *path, int path_len, DirJob *next)
+{
+  DirJob *job;
+
+  job = malloc (sizeof (DirJob) + path_len + 1);
+  if (!job)
+    cx_die (errno, "failed to allocate memory");
+  memcpy (job->path, path, path_len + 1);
+  job->next = next;
+  return job;
+}
+
+static void
+file_list_add (FileList *files, const char *path, int path_len,
+               const struct stat *st)
+{
+  DupeFile *f;
+
+  if (files->total == files->alloc)
+  {
+    files->alloc = files->alloc ? files->alloc * 2 : 256;
+    files->list  = realloc (files->list, files->alloc * sizeof (DupeFile));
+    if (!files->list)
+      cx_die (errno, "failed to allocate memory");
+  }
+
+  f = &files->list[files->total++];
+  memset (f, 0, sizeof (*f));
+  f->path = malloc (path_len + 1);
+  if (!f->path)
+    cx_die (errno, "failed to allocate memory");
+  memcpy (f->path, path, path_len + 1);
+  f->path_len = path_len;
+  f->size     = st->st_size;
+  f->dev      = st->st_dev;
+  f->ino      = st->st_ino;
+}
+
+static void
+file_list_free (FileList *files)
+{
+  int i;
+
+  for (i = 0; i < files->total; ++i)
+    free (files->list[i].path);
+  free (files->list);
+  memset (files, 0, sizeof (*files));
+}
+
+/* Symlinks are never followed, so nothing is found twice through one and
+   a link cycle cannot keep the walk going. */
+static void
+walk_dir (Worker *w, const char *dir)
+{
+  DupesSearch *  s     = w->search;
+  DirJob *       found = NULL;
+  DirJob *       last;
+  DIR *          dp;
+  struct dirent *de;
+  struct stat    st;
+  char           path[CX_PATHMAX];
+  int            len;
+
+  dp = opendir (dir);
+  if (!dp)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "cannot search `%s' - %s", dir,
+            strerror (errno));
+    return;
+  }
+
+  while ((de = readdir (dp)))
+  {
+    if (cx_streq (de->d_name, ".") || cx_streq (de->d_name, "..") ||
+        (!s->hidden && *de->d_name == '.'))
+      continue;
+
+    len = snprintf (path, sizeof (path), "%s/%s",
+                    cx_streq (dir, "/") ? "" : dir, de->d_name);
+    if (len >= (int) sizeof (path))
+      continue;
+
+    /* the entry type saves a stat for every directory */
+    if (de->d_type == DT_DIR)
+      found = dir_job_new (path, len, found);
+    else if (de->d_type == DT_REG || de->d_type == DT_UNKNOWN)
+    {
+      if (fstatat (dirfd (dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      if (S_ISDIR (st.st_mode))
+        found = dir_job_new (path, len, found);
+      else if (S_ISREG (st.st_mode) && st.st_size > 0)
+        file_list_add (&w->files, path, len, &st);
+    }
+  }
+  closedir (dp);
+
+  if (!found)
+    return;
+
+  for (last = found; last->next; last = last->next)
+    ;
+  pthread_mutex_lock (&s->lock);
+  last->next = s->dirs;
+  s->dirs    = found;
+  pthread_cond_broadcast (&s->work);
+  pthread_mutex_unlock (&s->lock);
+}
+
+/* the walk is over once no directory is queued and none is being read */
+static void *
+walk_main (void *arg)
+{
+  Worker *     w = arg;
+  DupesSearch *s = w->search;
+  DirJob *     job;
+
+  pthread_mutex_lock (&s->lock);
+  for (;;)
+  {
+    while (!s->dirs && s->n_walking > 0 && !s->cancel)
+      pthread_cond_wait (&s->work, &s->lock);
+    if (!s->dirs || s->cancel)
+      break;
+
+    job     = s->dirs;
+    s->dirs = job->next;
+    ++s->n_walking;
+    pthread_mutex_unlock (&s->lock);
+
+    walk_dir (w, job->path);
+    free (job);
+
+    pthread_mutex_lock (&s->lock);
+    --s->n_walking;
+  }
+  pthread_cond_broadcast (&s->work);
+  pthread_mutex_unlock (&s->lock);
+  return NULL;
+}
+
+static DupeFile *
+claim_file (DupesSearch *s)
+{
+  DupeFile *f = NULL;
+
+  pthread_mutex_lock (&s->lock);
+  if (!s->cancel && s->next_file < s->files.total)
+    f = &s->files.list[s->next_file++];
+  pthread_mutex_unlock (&s->lock);
+  return f;
+}
+
+static bool
+read_at (int fd, char *buf, size_t len, off_t off)
+{
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = pread (fd, buf, len, off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    buf += n;
+    len -= n;
+    off += n;
+  }
+  return true;
+}
+
+/* the first and last EDGE_BYTES, or all of a file no larger than both */
+static void
+hash_edges (DupeFile *f, char *buf)
+{
+  size_t len;
+  bool   ok;
+  int    fd;
+
+  fd = open (f->path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    f->failed = true;
+    return;
+  }
+
+  if (f->size <= 2 * EDGE_BYTES)
+  {
+    len           = f->size;
+    ok            = read_at (fd, buf, len, 0);
+    f->hashed_all = true;
+  }
+  else
+  {
+    len = 2 * EDGE_BYTES;
+    ok  = read_at (fd, buf, EDGE_BYTES, 0) &&
+         read_at (fd, buf + EDGE_BYTES, EDGE_BYTES, f->size - EDGE_BYTES);
+  }
+  close (fd);
+
+  if (ok)
+    f->hash = cx_hash64 (buf, len);
+  else
+    f->failed = true;
+}
+
+static void
+hash_all (DupesSearch *s, DupeFile *f, char *buf)
+{
+  CxHash64  h;
+  cx_byte_t total = 0;
+  ssize_t   n;
+  int       fd;
+
+  fd = open (f->path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    f->failed = true;
+    return;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  cx_hash64_init (&h);
+  for (;;)
+  {
+    n = read (fd, buf, READ_BYTES);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0 || cancelled (s))
+      break;
+    cx_hash64_update (&h, buf, n);
+    total += n;
+  }
+  close (fd);
+
+  /* a file that changed size since the walk is left out */
+  if (n < 0 || total != f->size)
+    f->failed = true;
+  else
+    f->hash = cx_hash64_digest (&h);
+}
+
+static void *
+partial_main (void *arg)
+{
+  Worker *  w = arg;
+  DupeFile *f;
+
+  while ((f = claim_file (w->search)))
+    hash_edges (f, w->buf);
+  return NULL;
+}
+
+static void *
+full_main (void *arg)
+{
+  Worker *  w = arg;
+  DupeFile *f;
+
+  while ((f = claim_file (w->search)))
+    if (!f->hashed_all)
+      hash_all (w->search, f, w->buf);
+  return NULL;
+}
+
+static void
+run_workers (DupesSearch *s, void *(*worker_main) (void *))
+{
+  int i;
+
+  s->next_file = 0;
+  for (i = 0; i < s->n_workers; ++i)
+    if (pthread_create (&s->workers[i].thread, NULL, worker_main,
+                        &s->workers[i]) != 0)
+      cx_die (0, "failed to start duplicate search");
+  for (i = 0; i < s->n_workers; ++i)
+    pthread_join (s->workers[i].thread, NULL);
+}
+
+static void
+collect_files (DupesSearch *s)
+{
+  FileList *files = &s->files;
+  FileList *found;
+  int       total = 0;
+  int       i;
+
+  for (i = 0; i < s->n_workers; ++i)
+    total += s->workers[i].files.total;
+
+  files->list = malloc ((total + 1) * sizeof (DupeFile));
+  if (!files->list)
+    cx_die (errno, "failed to allocate memory");
+  files->alloc = total + 1;
+
+  for (i = 0; i < s->n_workers; ++i)
+  {
+    found = &s->workers[i].files;
+    if (found->total > 0)
+      memcpy (files->list + files->total, found->list,
+              found->total * sizeof (DupeFile));
+    files->total += found->total;
+    free (found->list);
+    memset (found, 0, sizeof (*found));
+  }
+}
+
+static int
+compare_inodes (const void *a, const void *b)
+{
+  const DupeFile *fa = a;
+  const DupeFile *fb = b;
+
+  if (fa->size != fb->size)
+    return fa->size < fb->size ? -1 : 1;
+  if (fa->dev != fb->dev)
+    return fa->dev < fb->dev ? -1 : 1;
+  if (fa->ino != fb->ino)
+    return fa->ino < fb->ino ? -1 : 1;
+  return 0;
+}
+
+static int
+compare_hashes (const void *a, const void *b)
+{
+  const DupeFile *fa = a;
+  const DupeFile *fb = b;
+
+  if (fa->size != fb->size)
+    return fa->size < fb->size ? -1 : 1;
+  if (fa->hash != fb->hash)
+    return fa->hash < fb->hash ? -1 : 1;
+  return 0;
+}
+
+static bool
+same_size (const DupeFile *a, const DupeFile *b)
+{
+  return a->size == b->size;
+}
+
+static bool
+same_hash (const DupeFile *a, const DupeFile *b)
+{
+  return a->size == b->size && a->hash == b->hash;
+}
+
+/* hard links are one file; keeps the first path found to each inode */
+static void
+drop_hard_links (FileList *files)
+{
+  DupeFile *f;
+  int       n = 0;
+  int       i;
+
+  for (i = 0; i < files->total; ++i)
+  {
+    f = &files->list[i];
+    if (n > 0 && f->dev == files->list[n - 1].dev &&
+        f->ino == files->list[n - 1].ino)
+      free (f->path);
+    else
+      files->list[n++] = *f;
+  }
+  files->total = n;
+}
+
+static void
+drop_failed (FileList *files)
+{
+  DupeFile *f;
+  int       n = 0;
+  int       i;
+
+  for (i = 0; i < files->total; ++i)
+  {
+    f = &files->list[i];
+    if (f->failed)
+      free (f->path);
+    else
+      files->list[n++] = *f;
+  }
+  files->total = n;
+}
+
+/* keeps only the runs of two or more files that `same' cannot tell apart,
+   in a list sorted so that those runs are adjacent */
+static void
+keep_groups (FileList *files, bool (*same) (const DupeFile *, const DupeFile *))
+{
+  int n = 0;
+  int i;
+  int j;
+
+  for (i = 0; i < files->total; i = j)
+  {
+    for (j = i + 1; j < files->total && same (&files->list[i], &files->list[j]);
+         ++j)
+      ;
+    if (j - i >= 2)
+    {
+      memmove (&files->list[n], &files->list[i], (j - i) * sizeof (DupeFile));
+      n += j - i;
+    }
+    else
+      free (files->list[i].path);
+  }
+  files->total = n;
+}
+
+static void *
+search_main (void *arg)
+{
+  CxDupes *    d     = arg;
+  DupesSearch *s     = d->search;
+  FileList *   files = &s->files;
+  int          i;
+
+  run_workers (s, walk_main);
+  collect_files (s);
+  qsort (files->list, files->total, sizeof (DupeFile), compare_inodes);
+  drop_hard_links (files);
+  keep_groups (files, same_size);
+
+  for (i = 0; i < s->n_workers; ++i)
+  {
+    s->workers[i].buf = malloc (READ_BYTES);
+    if (!s->workers[i].buf)
+      cx_die (errno, "failed to allocate memory");
+  }
+
+  run_workers (s, partial_main);
+  drop_failed (files);
+  qsort (files->list, files->total, sizeof (DupeFile), compare_hashes);
+  keep_groups (files, same_hash);
+
+  run_workers (s, full_main);
+  drop_failed (files);
+  qsort (files->list, files->total, sizeof (DupeFile), compare_hashes);
+  keep_groups (files, same_hash);
+
+  for (i = 0; i < s->n_workers; ++i)
+  {
+    free (s->workers[i].buf);
+    s->workers[i].buf = NULL;
+  }
+
+  cx_event_wakeup (s->wake_fd);
+  return NULL;
+}
+
+static void
+set_title (CxDupes *d)
+{
+  char size_str[CX_SMALL_BUFMAX];
+  int  size_len;
+
+  if (!d->done)
+    d->title.len = snprintf (d->title.str, CX_PATHMAX,
+                             "%s: searching for duplicates", d->root.str);
+  else
+  {
+    cx_size_str (size_str, &size_len, d->reclaimable, g_options.size_units);
+    d->title.len =
+      snprintf (d->title.str, CX_PATHMAX,
+                "%s: %d groups of duplicates, %s reclaimable", d->root.str,
+                d->n_groups, size_str);
+  }
+  if (d->title.len >= CX_PATHMAX)
+    d->title.len = CX_PATHMAX - 1;
+}
+
+static int
+compare_groups (const void *a, const void *b)
+{
+  const Group *ga = a;
+  const Group *gb = b;
+
+  if (ga->reclaimable != gb->reclaimable)
+    return ga->reclaimable > gb->reclaimable ? -1 : 1;
+  return ga->start - gb->start;
+}
+
+static Group *
+find_groups (CxDupes *d, const FileList *files)
+{
+  Group *groups;
+  int    i;
+  int    j;
+
+  groups = malloc ((files->total / 2 + 1) * sizeof (Group));
+  if (!groups)
+    cx_die (errno, "failed to allocate memory");
+
+  d->n_groups    = 0;
+  d->reclaimable = 0;
+  for (i = 0; i < files->total; i = j)
+  {
+    for (j = i + 1;
+         j < files->total && same_hash (&files->list[i], &files->list[j]); ++j)
+      ;
+    groups[d->n_groups].start       = i;
+    groups[d->n_groups].n           = j - i;
+    groups[d->n_groups].reclaimable = files->list[i].size * (j - i - 1);
+    d->reclaimable += groups[d->n_groups++].reclaimable;
+  }
+
+  qsort (groups, d->n_groups, sizeof (Group), compare_groups);
+  return groups;
+}
+
+static void
+build_listing (CxDupes *d)
+{
+  const FileList *files = &d->search->files;
+  const DupeFile *f;
+  const char *    rel;
+  CxDirItem *     item;
+  Group *         groups;
+  struct stat     st;
+  char            size_str[CX_SMALL_BUFMAX];
+  char            name[CX_SMALL_BUFMAX];
+  int             size_len;
+  int             name_len;
+  int             i;
+  int             j;
+
+  groups = find_groups (d, files);
+
+  cx_dir_listing_free (&d->listing);
+  d->listing.path  = &d->title;
+  d->listing.total = 1 + d->n_groups + files->total;
+  d->listing.list  = malloc (d->listing.total * sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+
+  item = d->listing.list;
+  cx_dir_item_init_parent (item++);
+
+  memset (&st, 0, sizeof (st));
+  for (i = 0; i < d->n_groups; ++i)
+  {
+    f = &files->list[groups[i].start];
+    cx_size_str (size_str, &size_len, f->size, g_options.size_units);
+    name_len = snprintf (name, sizeof (name), "%d copies of %s", groups[i].n,
+                         size_str);
+
+    st.st_mode = 0;
+    st.st_size = groups[i].reclaimable;
+    cx_dir_item_init (item, name, name_len, 0, &st, g_options.size_units);
+    item->info.type_str_len = strlen (GROUP_TYPE_STR);
+    memcpy (item->info.type_str, GROUP_TYPE_STR,
+            item->info.type_str_len + 1);
+    ++item;
+
+    /* copies are named by their path below the search root */
+    for (j = 0; j < groups[i].n; ++j, ++f, ++item)
+    {
+      st.st_mode = S_IFREG;
+      st.st_size = f->size;
+      st.st_dev  = f->dev;
+      st.st_ino  = f->ino;
+      rel        = f->path + d->root.len + (cx_path_is_root (&d->root) ? 0 : 1);
+      cx_dir_item_init (item, rel, f->path_len - (rel - f->path), 0, &st,
+                        g_options.size_units);
+    }
+  }
+
+  free (groups);
+}
+
+static void
+on_search_done (int fd, void *data)
+{
+  CxDupes *d = data;
+
+  pthread_join (d->search->thread, NULL);
+  d->done = true;
+
+  build_listing (d);
+  file_list_free (&d->search->files);
+  set_title (d);
+
+  cx_log (CX_LOG_STATUS_INFO, "found %d groups of duplicates below `%s'",
+          d->n_groups, d->root.str);
+  if (d->callback)
+    d->callback (d, d->data);
+}
+
+CxDupes *
+cx_dupes_start (const CxPath *root, CxDupesCallback callback, void *data)
+{
+  CxDupes *    d;
+  DupesSearch *s;
+  long         n_cpus;
+  int          i;
+
+  d = calloc (1, sizeof (CxDupes));
+  s = calloc (1, sizeof (DupesSearch));
+  if (!d || !s)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&d->root, root);
+  d->callback = callback;
+  d->data     = data;
+  d->search   = s;
+  set_title (d);
+
+  /* just a way back until the results are in */
+  d->listing.path     = &d->title;
+  d->listing.roots[0] = &d->root;
+  d->listing.total    = 1;
+  d->listing.list  = malloc (sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+  cx_dir_item_init_parent (d->listing.list);
+
+  pthread_mutex_init (&s->lock, NULL);
+  pthread_cond_init (&s->work, NULL);
+
+  n_cpus       = sysconf (_SC_NPROCESSORS_ONLN);
+  s->n_workers = n_cpus < 2 ? 2 : (n_cpus > MAX_WORKERS ? MAX_WORKERS : n_cpus);
+  for (i = 0; i < s->n_workers; ++i)
+    s->workers[i].search = s;
+
+  s->hidden  = g_options.include_hidden_files;
+  s->dirs    = dir_job_new (root->str, root->len, NULL);
+  s->wake_fd = cx_event_wakeup_new (on_search_done, d);
+
+  if (pthread_create (&s->thread, NULL, search_main, d) != 0)
+    cx_die (0, "failed to start duplicate search");
+  return d;
+}
+
+void
+cx_dupes_free (CxDupes *d)
+{
+  DupesSearch *s;
+  DirJob *     job;
+  int          i;
+
+  if (!d)
+    return;
+  s = d->search;
+
+  if (!d->done)
+  {
+    pthread_mutex_lock (&s->lock);
+    s->cancel = true;
+    pthread_cond_broadcast (&s->work);
+    pthread_mutex_unlock (&s->lock);
+    pthread_join (s->thread, NULL);
+  }
+
+  while ((job = s->dirs))
+  {
+    s->dirs = job->next;
+    free (job);
+  }
+  for (i = 0; i < s->n_workers; ++i)
+    file_list_free (&s->workers[i].files);
+  file_list_free (&s->files);
+
+  cx_event_wakeup_free (s->wake_fd);
+  pthread_cond_destroy (&s->work);
+  pthread_mutex_destroy (&s->lock);
+  cx_dir_listing_free (&d->listing);
+  free (s);
+  free (d);
+}
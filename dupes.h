@@ -0,0 +1,34 @@
+#ifndef __CX_DUPES_H__
+#define __CX_DUPES_H__
+
+#include <stdbool.h>
+
+#include "files.h"
+#include "path.h"
+
+typedef struct CxDupes CxDupes;
+
+/* Called on the main thread once `listing' holds the results. */
+typedef void (*CxDupesCallback) (CxDupes *dupes, void *data);
+
+/* A search for identical files below `root'. Its listing starts with a
+   `..' item, then one item per group of copies, largest reclaimable space
+   first, each followed by the copies themselves. */
+struct CxDupes
+{
+  CxPath              root;
+  CxPath              title;
+  CxDirListing        listing;
+  int                 n_groups;
+  cx_byte_t           reclaimable;
+  bool                done;
+  CxDupesCallback     callback;
+  void *              data;
+  struct DupesSearch *search;
+};
+
+CxDupes *cx_dupes_start (const CxPath *root, CxDupesCallback callback,
+                         void *data);
+void     cx_dupes_free (CxDupes *dupes);
+
+#endif /* __CX_DUPES_H__ */
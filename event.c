@@ -0,0 +1,493 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#else
+#include <poll.h>
+#endif
+
+#include "event.h"
+#include "log.h"
+#include "ui.h"
+#include "util.h"
+
+#define MAX_HANDLERS 64
+#define MAX_WATCHES 64
+#define MAX_EVENTS 16
+
+#ifdef __linux__
+#define WATCH_MASK                                                            \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |          \
+   IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#define INOTIFY_BUFSIZE 4096
+#endif
+
+typedef struct
+{
+  CxEventCallback callback;
+  void *          data;
+  int             fd;
+  int             wakeup_write_fd;
+  bool            is_wakeup;
+} Handler;
+
+typedef struct
+{
+  CxEventCallback callback;
+  void *          data;
+  int             wd;
+} Watch;
+
+static struct
+{
+  Handler handlers[MAX_HANDLERS];
+  Watch   watches[MAX_WATCHES];
+  int     n_handlers;
+  int     signal_fd;
+  int     inotify_fd;
+#ifdef __linux__
+  int epoll_fd;
+#else
+  int signal_write_fd;
+#endif
+} event = {
+  .inotify_fd = -1,
+};
+
+static Handler *
+find_handler (int fd)
+{
+  int i;
+
+  for (i = 0; i < event.n_handlers; ++i)
+    if (event.handlers[i].fd == fd)
+      return &event.handlers[i];
+  return NULL;
+}
+
+static void wakeup_drain (int fd);
+
+static void
+dispatch (int fd)
+{
+  Handler *h = find_handler (fd);
+
+  if (!h)
+    return;
+  if (h->is_wakeup)
+    wakeup_drain (fd);
+  if (h->callback)
+    h->callback (fd, h->data);
+}
+
+static void
+handle_signal (int signo)
+{
+  switch (signo)
+  {
+    case SIGWINCH:
+      cx_ui_resize ();
+      break;
+    case SIGINT:
+    case SIGTERM:
+      cx_ui_set_keep_running (false);
+      break;
+    default:;
+  }
+}
+
+#ifdef __linux__
+
+static void
+on_signal_fd (int fd, void *data)
+{
+  struct signalfd_siginfo si;
+
+  while (read (fd, &si, sizeof (si)) == sizeof (si))
+    handle_signal (si.ssi_signo);
+}
+
+static void
+on_inotify_fd (int fd, void *data)
+{
+  char                        buf[INOTIFY_BUFSIZE]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  const struct inotify_event *ev;
+  ssize_t                     n;
+  char *                      p;
+  int                         i;
+
+  while ((n = read (fd, buf, sizeof (buf))) > 0)
+  {
+    for (p = buf; p < buf + n; p += sizeof (*ev) + ev->len)
+    {
+      ev = (const struct inotify_event *) p;
+      for (i = 0; i < MAX_WATCHES; ++i)
+        if (event.watches[i].callback && event.watches[i].wd == ev->wd)
+          event.watches[i].callback (ev->wd, event.watches[i].data);
+    }
+  }
+}
+
+static void
+backend_init (void)
+{
+  sigset_t mask;
+
+  event.epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (event.epoll_fd == -1)
+    cx_die (errno, "failed to create epoll instance");
+
+  /* signals are delivered through the loop, never to a handler that could
+     interrupt curses in the middle of an update */
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGWINCH);
+  sigaddset (&mask, SIGINT);
+  sigaddset (&mask, SIGTERM);
+  pthread_sigmask (SIG_BLOCK, &mask, NULL);
+
+  event.signal_fd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (event.signal_fd == -1)
+    cx_die (errno, "failed to create signalfd");
+  cx_event_add_fd (event.signal_fd, on_signal_fd, NULL);
+
+  event.inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (event.inotify_fd != -1)
+    cx_event_add_fd (event.inotify_fd, on_inotify_fd, NULL);
+}
+
+static void
+backend_add (int fd)
+{
+  struct epoll_event ev;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events  = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl (event.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    cx_die (errno, "failed to add fd %d to the event loop", fd);
+}
+
+static void
+backend_remove (int fd)
+{
+  epoll_ctl (event.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void
+backend_wait (int timeout_ms)
+{
+  struct epoll_event evs[MAX_EVENTS];
+  int                n;
+  int                i;
+
+  n = epoll_wait (event.epoll_fd, evs, MAX_EVENTS, timeout_ms);
+  for (i = 0; i < n; ++i)
+    dispatch (evs[i].data.fd);
+}
+
+static int
+wakeup_open (int *write_fd)
+{
+  int fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  *write_fd = fd;
+  return fd;
+}
+
+static void
+wakeup_drain (int fd)
+{
+  uint64_t n;
+
+  read (fd, &n, sizeof (n));
+}
+
+#else /* !__linux__ */
+
+static void
+on_signal_fd (int fd, void *data)
+{
+  unsigned char signo;
+
+  while (read (fd, &signo, 1) == 1)
+    handle_signal (signo);
+}
+
+static void
+signal_to_pipe (int signo)
+{
+  unsigned char c     = signo;
+  int           saved = errno;
+
+  write (event.signal_write_fd, &c, 1);
+  errno = saved;
+}
+
+static void
+set_nonblock_cloexec (int fd)
+{
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void
+backend_init (void)
+{
+  struct sigaction sa;
+  int              fds[2];
+
+  if (pipe (fds) != 0)
+    cx_die (errno, "failed to create signal pipe");
+  set_nonblock_cloexec (fds[0]);
+  set_nonblock_cloexec (fds[1]);
+  event.signal_fd       = fds[0];
+  event.signal_write_fd = fds[1];
+  cx_event_add_fd (event.signal_fd, on_signal_fd, NULL);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = signal_to_pipe;
+  sa.sa_flags   = SA_RESTART;
+  sigaction (SIGWINCH, &sa, NULL);
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  event.inotify_fd = -1;
+}
+
+static void
+backend_add (int fd)
+{
+}
+
+static void
+backend_remove (int fd)
+{
+}
+
+static void
+backend_wait (int timeout_ms)
+{
+  struct pollfd pfds[MAX_HANDLERS];
+  int           n_fds;
+  int           n;
+  int           i;
+
+  for (i = 0; i < event.n_handlers; ++i)
+  {
+    pfds[i].fd      = event.handlers[i].fd;
+    pfds[i].events  = POLLIN;
+    pfds[i].revents = 0;
+  }
+
+  n_fds = event.n_handlers;
+  n     = poll (pfds, n_fds, timeout_ms);
+  for (i = 0; n > 0 && i < n_fds; ++i)
+    if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+      dispatch (pfds[i].fd);
+}
+
+static int
+wakeup_open (int *write_fd)
+{
+  int fds[2];
+
+  if (pipe (fds) != 0)
+    return -1;
+  set_nonblock_cloexec (fds[0]);
+  set_nonblock_cloexec (fds[1]);
+  *write_fd = fds[1];
+  return fds[0];
+}
+
+static void
+wakeup_drain (int fd)
+{
+  char buf[64];
+
+  while (read (fd, buf, sizeof (buf)) > 0)
+    ;
+}
+
+#endif /* __linux__ */
+
+void
+cx_event_init (void)
+{
+  event.n_handlers = 0;
+  backend_init ();
+}
+
+void
+cx_event_finish (void)
+{
+  event.n_handlers = 0;
+  close (event.signal_fd);
+  if (event.inotify_fd != -1)
+    close (event.inotify_fd);
+#ifdef __linux__
+  close (event.epoll_fd);
+#else
+  close (event.signal_write_fd);
+#endif
+}
+
+void
+cx_event_add_fd (int fd, CxEventCallback callback, void *data)
+{
+  Handler *h;
+
+  if (event.n_handlers == MAX_HANDLERS)
+    cx_die (0, "too many event sources");
+
+  h                  = &event.handlers[event.n_handlers++];
+  h->fd              = fd;
+  h->callback        = callback;
+  h->data            = data;
+  h->wakeup_write_fd = -1;
+  h->is_wakeup       = false;
+  backend_add (fd);
+}
+
+void
+cx_event_remove_fd (int fd)
+{
+  Handler *h = find_handler (fd);
+
+  if (!h)
+    return;
+
+  backend_remove (fd);
+  *h = event.handlers[--event.n_handlers];
+}
+
+int
+cx_event_wakeup_new (CxEventCallback callback, void *data)
+{
+  Handler *h;
+  int      write_fd;
+  int      fd;
+
+  fd = wakeup_open (&write_fd);
+  if (fd == -1)
+    cx_die (errno, "failed to create wakeup fd");
+
+  cx_event_add_fd (fd, callback, data);
+  h                  = find_handler (fd);
+  h->wakeup_write_fd = write_fd;
+  h->is_wakeup       = true;
+  return fd;
+}
+
+/* called from worker threads */
+void
+cx_event_wakeup (int fd)
+{
+#ifdef __linux__
+  uint64_t one = 1;
+
+  write (fd, &one, sizeof (one));
+#else
+  Handler *h = find_handler (fd);
+  char     one = 1;
+
+  if (h)
+    write (h->wakeup_write_fd, &one, sizeof (one));
+#endif
+}
+
+void
+cx_event_wakeup_free (int fd)
+{
+  Handler *h = find_handler (fd);
+  int      write_fd;
+
+  if (!h)
+    return;
+
+  write_fd = h->wakeup_write_fd;
+  cx_event_remove_fd (fd);
+  if (write_fd != fd)
+    close (write_fd);
+  close (fd);
+}
+
+#ifdef __linux__
+static bool
+watch_in_use (int wd)
+{
+  int i;
+
+  for (i = 0; i < MAX_WATCHES; ++i)
+    if (event.watches[i].callback && event.watches[i].wd == wd)
+      return true;
+  return false;
+}
+#endif
+
+int
+cx_event_watch (const char *path, CxEventCallback callback, void *data)
+{
+#ifdef __linux__
+  int wd;
+  int i;
+
+  if (event.inotify_fd == -1)
+    return -1;
+
+  wd = inotify_add_watch (event.inotify_fd, path, WATCH_MASK);
+  if (wd == -1)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "failed to watch `%s' - %s", path,
+            strerror (errno));
+    return -1;
+  }
+
+  for (i = 0; i < MAX_WATCHES; ++i)
+  {
+    if (!event.watches[i].callback)
+    {
+      event.watches[i].callback = callback;
+      event.watches[i].data     = data;
+      event.watches[i].wd       = wd;
+      return i;
+    }
+  }
+  if (!watch_in_use (wd))
+    inotify_rm_watch (event.inotify_fd, wd);
+#endif
+  return -1;
+}
+
+/* the same inode watched twice shares one kernel watch, which stays until
+   both are gone */
+void
+cx_event_unwatch (int watch)
+{
+#ifdef __linux__
+  int wd;
+
+  if (watch == -1 || !event.watches[watch].callback)
+    return;
+
+  wd                            = event.watches[watch].wd;
+  event.watches[watch].callback = NULL;
+  if (!watch_in_use (wd))
+    inotify_rm_watch (event.inotify_fd, wd);
+#endif
+}
+
+void
+cx_event_wait (int timeout_ms)
+{
+  backend_wait (timeout_ms);
+}
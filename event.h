@@ -0,0 +1,23 @@
+#ifndef __CX_EVENT_H__
+#define __CX_EVENT_H__
+
+#include <stdbool.h>
+
+typedef void (*CxEventCallback) (int fd, void *data);
+
+void cx_event_init (void);
+void cx_event_finish (void);
+
+void cx_event_add_fd (int fd, CxEventCallback callback, void *data);
+void cx_event_remove_fd (int fd);
+
+int  cx_event_wakeup_new (CxEventCallback callback, void *data);
+void cx_event_wakeup (int fd);
+void cx_event_wakeup_free (int fd);
+
+int  cx_event_watch (const char *path, CxEventCallback callback, void *data);
+void cx_event_unwatch (int watch);
+
+void cx_event_wait (int timeout_ms);
+
+#endif /* __CX_EVENT_H__ */
@@ -1,10 +1,18 @@
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wchar.h>
 
 #include "files.h"
+#include "mount.h"
+#include "stats.h"
 #include "util.h"
 
 #define BINARY_K_FACTOR CX_BYTE_C (1024)
@@ -37,11 +45,278 @@
 #define FILE_TYPE_STR "file"
 #define SOCKET_TYPE_STR "socket"
 #define SYMLINK_TYPE_STR "symlink"
+#define DIR_LINK_TYPE_STR "dir link"
+#define FILE_LINK_TYPE_STR "file link"
+#define BROKEN_LINK_TYPE_STR "broken link"
+#define ERROR_TYPE_STR "error"
 
 #define PARENT_ITEM_NAME "[..]"
+#define PLACEHOLDER_ITEM_NAME "..."
 
-extern CxSizeUnits g_size_units;
-extern bool        g_include_hidden_files;
+#define N_LETTERS 256
+
+/* listings start with room for this many items and double from there */
+#define INITIAL_LISTING_ALLOC 64
+
+/* a windowed listing decodes this many items at a time, and keeps this
+   many such blocks; any WINDOW_BLOCKS - 1 blocks in a row are held at
+   once, which is more than a screen of rows */
+#define WINDOW_BLOCK 256
+#define WINDOW_BLOCKS 4
+
+#define WINDOW_FILE_TEMPLATE "cx-listing-XXXXXX"
+
+/* directories are held open only to look names up in */
+#ifdef O_PATH
+#define DIR_OPEN_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIR_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+#if defined(__linux__) && !defined(_DIRENT_HAVE_D_NAMLEN)
+#define DIRENT_NAMLEN(__de) ((int) strlen ((__de)->d_name))
+#else
+#define DIRENT_NAMLEN(__de) ((__de)->d_namlen)
+#endif
+
+/* `name' is looked up in `parent', or without one, is the whole path */
+struct CxDir
+{
+  struct CxDir *parent;
+  char *        name;
+  int           fd;
+  int           refs;
+};
+
+/* the entries of one directory, stat'ed by several threads at once */
+typedef struct
+{
+  pthread_mutex_t lock;
+  CxDirListing *  listing;
+  int             dir_fd;
+  int             next;
+  int             total;
+  int             batch;
+  uint64_t        stat_ns;
+} StatJob;
+
+/* what a symlink led to when it was followed */
+typedef struct
+{
+  ino_t      ino;
+  CxFileType type;
+  cx_byte_t  size;
+  bool       used;
+} Link;
+
+/* Where the symlinks of a listing lead, keyed by the inode of the link so
+   every name for the same link is followed only once. The table is sized
+   for all of the listing's links when it is read, so it never fills. */
+struct Links
+{
+  Link *slots;
+  int   mask;
+};
+
+/* The entries of a directory too large to hold. Each name is written to
+   an unlinked temporary file as its length followed by its bytes, and the
+   offset of every WINDOW_BLOCK-th one is kept, so an entry is found by
+   index without reading all those before it. Entries are only decoded,
+   and stat'ed, a block at a time as they are asked for; block `b' goes to
+   the slots of `b % WINDOW_BLOCKS'. Blocks only drawn are not decoded on
+   the spot but stand in as `placeholder' until they are, elsewhere. */
+struct ListingWindow
+{
+  FILE *      file;
+  const char *map;
+  size_t      map_size; /* all that was written, mapped or not */
+  uint64_t *  offsets;
+  int         n_offsets;
+  int         alloc_offsets;
+  int         first; /* listing index of the first entry in the file */
+  int         blocks[WINDOW_BLOCKS];   /* held in each slot, or -1 */
+  int         wanted[WINDOW_BLOCKS];   /* drawn as placeholders, or -1 */
+  int         decoding[WINDOW_BLOCKS]; /* handed out to decode, or -1 */
+  CxDirItem   parent;
+  CxDirItem   placeholder;
+};
+
+/* a block of a windowed listing decoded apart from it, on any thread */
+struct CxDirBlock
+{
+  CxDirListing listing;
+  CxPath       path;
+  int          block;
+  CxDirItem    items[WINDOW_BLOCK];
+};
+
+/* the path of a directory opened from `at' by more than one name, or by
+   `..', which only says what it is called; it is not looked up by it */
+static char *
+unchained_name (const CxDir *at, const char *name)
+{
+  CxPath path;
+  char * str;
+  int    n;
+
+  cx_dir_path (at, &path);
+  if (cx_streq (name, ".."))
+  {
+    if (!cx_path_is_root (&path))
+      cx_path_init_parent_of (&path);
+    return strdup (path.str);
+  }
+
+  n   = strlen (name);
+  str = malloc (path.len + 1 + n + 1);
+  if (str)
+    sprintf (str, "%s/%s", path.str, name);
+  return str;
+}
+
+/* takes over `fd'; a directory opened by a single name keeps the one it
+   was opened from, however many there are above it */
+static CxDir *
+dir_new (int fd, CxDir *at, const char *name)
+{
+  CxDir *dir;
+  bool   chained;
+
+  chained = at && !strchr (name, '/') && !cx_streq (name, "..");
+  dir     = malloc (sizeof (CxDir));
+  if (dir)
+    dir->name = chained || !at ? strdup (name) : unchained_name (at, name);
+  if (!dir || !dir->name)
+  {
+    free (dir);
+    close (fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  dir->fd     = fd;
+  dir->refs   = 1;
+  dir->parent = chained ? cx_dir_ref (at) : NULL;
+  return dir;
+}
+
+/* `name' is looked up in `at', or from the working directory without
+   one; NULL with errno set when it is not a directory */
+CxDir *
+cx_dir_open (CxDir *at, const char *name)
+{
+  int fd;
+
+  if (at && cx_streq (name, "."))
+    return cx_dir_ref (at);
+
+  fd = openat (at ? at->fd : AT_FDCWD, name, DIR_OPEN_FLAGS);
+  if (fd == -1)
+    return NULL;
+  return dir_new (fd, at, name);
+}
+
+CxDir *
+cx_dir_ref (CxDir *dir)
+{
+  __atomic_add_fetch (&dir->refs, 1, __ATOMIC_RELAXED);
+  return dir;
+}
+
+void
+cx_dir_unref (CxDir *dir)
+{
+  CxDir *parent;
+
+  for (; dir; dir = parent)
+  {
+    if (__atomic_sub_fetch (&dir->refs, 1, __ATOMIC_ACQ_REL) > 0)
+      return;
+    parent = dir->parent;
+    close (dir->fd);
+    free (dir->name);
+    free (dir);
+  }
+}
+
+/* the directory `dir' was opened from, if it is still held */
+CxDir *
+cx_dir_parent (const CxDir *dir)
+{
+  return dir->parent;
+}
+
+int
+cx_dir_fd (const CxDir *dir)
+{
+  return dir->fd;
+}
+
+const char *
+cx_dir_name (const CxDir *dir)
+{
+  return dir->name;
+}
+
+static bool
+ends_in_slash (const char *str)
+{
+  return *str && str[strlen (str) - 1] == '/';
+}
+
+/* Names the directory by the names it was opened through. A path too long
+   to hold is left elided, and false returned with errno set. */
+bool
+cx_dir_path (const CxDir *dir, CxPath *path)
+{
+  const CxDir *d;
+  char *       dst;
+  size_t       total;
+  size_t       skip;
+  size_t       at;
+  size_t       n;
+
+  total = 0;
+  for (d = dir; d; d = d->parent)
+    total += strlen (d->name) + (d->parent && !ends_in_slash (d->parent->name));
+
+  /* what does not fit is the beginning, of which nothing is copied */
+  dst  = path->str;
+  skip = 0;
+  if (total >= CX_PATHMAX)
+  {
+    memcpy (dst, CX_PATH_ELIDED, CX_PATH_ELIDED_LEN);
+    dst += CX_PATH_ELIDED_LEN;
+    skip = total - (CX_PATHMAX - 1 - CX_PATH_ELIDED_LEN);
+  }
+  path->len            = (dst - path->str) + (total - skip);
+  path->str[path->len] = '\0';
+
+  at = total;
+  for (d = dir; d && at > skip; d = d->parent)
+  {
+    n = strlen (d->name);
+    if (at - skip >= n)
+    {
+      at -= n;
+      memcpy (dst + (at - skip), d->name, n);
+    }
+    else
+    {
+      memcpy (dst, d->name + (n - (at - skip)), at - skip);
+      at = skip;
+    }
+    if (d->parent && !ends_in_slash (d->parent->name) && at-- > skip)
+      dst[at - skip] = '/';
+  }
+
+  if (skip > 0)
+  {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  return true;
+}
 
 static void
 set_type_str (char *buffer, int *len, CxFileType type)
@@ -91,11 +366,11 @@ set_type_str (char *buffer, int *len, CxFileType type)
 #undef __SET_TYPE_STR
 }
 
-static void
-set_size_str (char *buffer, int *len, cx_byte_t bytes)
+void
+cx_size_str (char *buffer, int *len, cx_byte_t bytes, CxSizeUnits units)
 {
-  if ((g_size_units == CX_SIZE_UNITS_BINARY && bytes < BINARY_K_FACTOR) ||
-      (g_size_units == CX_SIZE_UNITS_METRIC && bytes < METRIC_K_FACTOR))
+  if ((units == CX_SIZE_UNITS_BINARY && bytes < BINARY_K_FACTOR) ||
+      (units == CX_SIZE_UNITS_METRIC && bytes < METRIC_K_FACTOR))
   {
     snprintf (buffer, CX_SMALL_BUFMAX, "%" CX_PRIbyte " " B_SYMBOL, bytes);
     *len = strlen (buffer);
@@ -106,7 +381,7 @@ set_size_str (char *buffer, int *len, cx_byte_t bytes)
   snprintf (buffer, CX_SMALL_BUFMAX, "%.1Lf " __symbol,                       \
             ((long double) bytes / (long double) __factor))
 
-  switch (g_size_units)
+  switch (units)
   {
     case CX_SIZE_UNITS_BINARY:
       if (bytes < BINARY_M_FACTOR)
@@ -136,127 +411,774 @@ set_size_str (char *buffer, int *len, cx_byte_t bytes)
   *len = strlen (buffer);
 }
 
-static void
-dir_item_file_info_set (CxDirItem *item, const CxPath *parent)
+/* Eight bytes at a time: a byte is outside the printable range when its
+   high bit is set, it is below 0x20, or it is 0x7f. */
+bool
+cx_str_is_ascii (const char *str, int len)
 {
-  cx_path_dir_item (&item->info.path, parent, item->name, item->name_len);
+  const uint64_t ones  = UINT64_C (0x0101010101010101);
+  const uint64_t highs = ones * 0x80;
+  uint64_t       w;
+  uint64_t       del;
+  int            i;
 
-  memset (&item->info.st, 0, sizeof (struct stat));
-  if (stat (item->info.path.str, &item->info.st) == 0)
-  {
-    if (S_ISBLK (item->info.st.st_mode))
-      item->info.type = CX_FILE_TYPE_BLOCK_DEVICE;
-    else if (S_ISCHR (item->info.st.st_mode))
-      item->info.type = CX_FILE_TYPE_CHARACTER_DEVICE;
-    else if (S_ISDIR (item->info.st.st_mode))
-      item->info.type = CX_FILE_TYPE_DIRECTORY;
-    else if (S_ISFIFO (item->info.st.st_mode))
-      item->info.type = CX_FILE_TYPE_FIFO;
-    else if (S_ISREG (item->info.st.st_mode))
-      item->info.type = CX_FILE_TYPE_FILE;
-    else if (S_ISSOCK (item->info.st.st_mode))
-      item->info.type = CX_FILE_TYPE_SOCKET;
-    else if (S_ISLNK (item->info.st.st_mode))
-      item->info.type = CX_FILE_TYPE_SYMLINK;
-    else
-      item->info.type = CX_FILE_TYPE_UNKNOWN;
-    set_type_str (item->info.type_str, &item->info.type_str_len,
-                  item->info.type);
-    set_size_str (item->info.size_str, &item->info.size_str_len,
-                  (cx_byte_t) item->info.st.st_size);
+  for (i = 0; i + 8 <= len; i += 8)
+  {
+    memcpy (&w, str + i, 8);
+    del = w ^ (ones * 0x7f);
+    if ((w | ((w - ones * 0x20) & ~w) | ((del - ones) & ~del)) & highs)
+      return false;
   }
-  else
-    cx_die (errno, "failed to stat `%s'", item->info.path.str);
+  for (; i < len; ++i)
+    if ((unsigned char) str[i] < 0x20 || (unsigned char) str[i] >= 0x7f)
+      return false;
+  return true;
 }
 
+/* bytes that do not decode and characters that cannot be printed are
+   drawn as a single `?' each */
 static int
-num_children (const char *path)
+decoded_width (const char *str, int len)
 {
-  DIR *          dp;
-  struct dirent *de;
-  int            num;
-
-  dp = opendir (path);
-  if (!dp)
-    cx_die (errno, "failed to open directory `%s'", path);
+  mbstate_t state;
+  wchar_t   wc;
+  size_t    n;
+  int       width;
+  int       w;
 
-  num = 0;
-  for (;;)
+  memset (&state, 0, sizeof (state));
+  for (width = 0; len > 0; str += n, len -= n)
   {
-    de = readdir (dp);
-    if (!de)
+    n = mbrtowc (&wc, str, len, &state);
+    if (n == (size_t) -1 || n == (size_t) -2)
     {
-      if (errno != 0)
-        cx_die (errno, "failed to read directory `%s'", path);
-      break;
-    }
-    if (cx_streq (de->d_name, ".") || cx_streq (de->d_name, "..") ||
-        (!g_include_hidden_files && *de->d_name == '.'))
+      memset (&state, 0, sizeof (state));
+      n = 1;
+      ++width;
       continue;
-    ++num;
+    }
+    if (n == 0)
+      n = 1;
+    w = wcwidth (wc);
+    width += w < 0 ? 1 : w;
   }
-  closedir (dp);
-  return num;
+  return width;
+}
+
+int
+cx_str_width (const char *str, int len)
+{
+  return cx_str_is_ascii (str, len) ? len : decoded_width (str, len);
+}
+
+static void
+set_name_width (CxDirItem *item)
+{
+  item->name_ascii = cx_str_is_ascii (item->name, item->name_len);
+  item->name_width = item->name_ascii
+                       ? item->name_len
+                       : decoded_width (item->name, item->name_len);
+}
+
+static CxFileType
+file_type_of (mode_t mode)
+{
+  if (S_ISBLK (mode))
+    return CX_FILE_TYPE_BLOCK_DEVICE;
+  else if (S_ISCHR (mode))
+    return CX_FILE_TYPE_CHARACTER_DEVICE;
+  else if (S_ISDIR (mode))
+    return CX_FILE_TYPE_DIRECTORY;
+  else if (S_ISFIFO (mode))
+    return CX_FILE_TYPE_FIFO;
+  else if (S_ISREG (mode))
+    return CX_FILE_TYPE_FILE;
+  else if (S_ISSOCK (mode))
+    return CX_FILE_TYPE_SOCKET;
+  else if (S_ISLNK (mode))
+    return CX_FILE_TYPE_SYMLINK;
+  return CX_FILE_TYPE_UNKNOWN;
 }
 
 static void
-set_parent_item (CxDirItem *item)
+file_info_set_from_stat (CxFileInfo *info, CxSizeUnits units)
+{
+  info->type        = file_type_of (info->st.st_mode);
+  info->target_type = info->type;
+  set_type_str (info->type_str, &info->type_str_len, info->type);
+  cx_size_str (info->size_str, &info->size_str_len,
+               (cx_byte_t) info->st.st_size, units);
+}
+
+static void
+file_info_set_error (CxFileInfo *info, int error)
+{
+  static const int error_len = strlen (ERROR_TYPE_STR);
+
+  info->error        = error;
+  info->type         = CX_FILE_TYPE_UNKNOWN;
+  info->target_type  = CX_FILE_TYPE_UNKNOWN;
+  info->type_str_len = error_len;
+  memcpy (info->type_str, ERROR_TYPE_STR, error_len + 1);
+  snprintf (info->size_str, CX_SMALL_BUFMAX, "%s", strerror (error));
+  info->size_str_len = strlen (info->size_str);
+}
+
+/* Symlinks are not followed here; an entry that cannot be stat'ed, most
+   likely because it went away since it was read, keeps its error to show
+   in place of its type and size. Also runs on the stat threads. */
+static void
+dir_item_stat (CxDirItem *item, const CxDirListing *listing, int dir_fd)
+{
+  memset (&item->info.st, 0, sizeof (struct stat));
+  if (fstatat (dir_fd, item->name, &item->info.st, AT_SYMLINK_NOFOLLOW) != 0)
+  {
+    file_info_set_error (&item->info, errno);
+    return;
+  }
+  item->info.error = 0;
+  file_info_set_from_stat (&item->info, listing->options.size_units);
+}
+
+/* an item that does not come from reading a directory, such as a search
+   result named below one of its listing's roots; names too long to keep
+   lose their beginning, and with it the way to the item */
+void
+cx_dir_item_init (CxDirItem *item, const char *name, int name_len, int root,
+                  const struct stat *st, CxSizeUnits units)
+{
+  item->name_cut = name_len >= CX_DIR_ITEM_NAME_MAX;
+  if (item->name_cut)
+  {
+    name += name_len - (CX_DIR_ITEM_NAME_MAX - 1);
+    name_len = CX_DIR_ITEM_NAME_MAX - 1;
+  }
+  item->name_len = name_len;
+  memcpy (item->name, name, name_len);
+  item->name[name_len] = '\0';
+  item->root           = root;
+  item->git_status     = 0;
+  set_name_width (item);
+
+  item->info.st    = *st;
+  item->info.error = 0;
+  file_info_set_from_stat (&item->info, units);
+}
+
+void
+cx_dir_item_init_parent (CxDirItem *item)
 {
   static const int parent_name_len = strlen (PARENT_ITEM_NAME);
 
   item->name_len = parent_name_len;
   memcpy (item->name, PARENT_ITEM_NAME, item->name_len);
   item->name[item->name_len] = '\0';
+  item->name_width = item->name_len;
+  item->name_ascii = true;
+  item->name_cut   = false;
+  item->root       = 0;
+  item->git_status = 0;
 }
 
-void
-cx_dir_listing_init (CxDirListing *listing, CxPath *path)
+static void *
+stat_worker_main (void *arg)
 {
-  DIR *          dp;
-  struct dirent *de;
-  int            pos;
+  StatJob *  job = arg;
+  CxDirItem *list = job->listing->list;
+  uint64_t   stat_ns;
+  uint64_t   start;
+  int        end;
+  int        i;
+
+  stat_ns = 0;
+  for (;;)
+  {
+    pthread_mutex_lock (&job->lock);
+    i   = job->next;
+    end = job->total - i > job->batch ? i + job->batch : job->total;
+    job->next = end;
+    pthread_mutex_unlock (&job->lock);
+    if (i == end)
+      break;
+
+    for (; i < end; ++i)
+    {
+      start = cx_monotonic_ns ();
+      dir_item_stat (&list[i], job->listing, job->dir_fd);
+      stat_ns += cx_monotonic_ns () - start;
+    }
+  }
+
+  pthread_mutex_lock (&job->lock);
+  job->stat_ns += stat_ns;
+  pthread_mutex_unlock (&job->lock);
+  return NULL;
+}
+
+/* stats the items from `first' up to `end', from as many threads as the
+   mount's profile asks for; the calling thread is one of them */
+static uint64_t
+stat_items (CxDirListing *listing, int first, int end, int dir_fd,
+            const CxMountProfile *profile)
+{
+  pthread_t threads[CX_MOUNT_MAX_PARALLELISM];
+  StatJob   job;
+  int       n_threads;
+  int       i;
+
+  memset (&job, 0, sizeof (job));
+  pthread_mutex_init (&job.lock, NULL);
+  job.listing = listing;
+  job.dir_fd  = dir_fd;
+  job.next    = first;
+  job.total   = end;
+  job.batch   = profile->batch;
+
+  n_threads = (end - first + job.batch - 1) / job.batch;
+  if (n_threads > profile->parallelism)
+    n_threads = profile->parallelism;
+
+  CX_STATS_BEGIN (CX_STATS_PHASE_STAT);
+  for (i = 1; i < n_threads; ++i)
+    if (pthread_create (&threads[i], NULL, stat_worker_main, &job) != 0)
+      break;
+  n_threads = i;
+  stat_worker_main (&job);
+  for (i = 1; i < n_threads; ++i)
+    pthread_join (threads[i], NULL);
+  CX_STATS_TALLY_END (&listing->stats, CX_STATS_PHASE_STAT);
+  CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_SYSCALLS,
+                        end - first);
+
+  pthread_mutex_destroy (&job.lock);
+  return job.stat_ns;
+}
+
+static struct Links *
+links_new (int n_links)
+{
+  struct Links *links;
+  int           n_slots;
+
+  for (n_slots = 16; n_slots < n_links * 2; n_slots *= 2)
+    ;
+  links = malloc (sizeof (struct Links));
+  if (!links)
+    return NULL;
+  links->slots = calloc (n_slots, sizeof (Link));
+  if (!links->slots)
+  {
+    free (links);
+    return NULL;
+  }
+  links->mask = n_slots - 1;
+  return links;
+}
+
+/* a table for the listing's symlinks, if it has any */
+static bool
+add_links (CxDirListing *listing)
+{
+  int n_links;
+  int i;
+
+  n_links = 0;
+  i       = cx_dir_listing_has_parent_item (listing) ? 1 : 0;
+  for (; i < listing->total; ++i)
+    if (listing->list[i].info.type == CX_FILE_TYPE_SYMLINK)
+      ++n_links;
+  if (n_links > 0)
+    listing->links = links_new (n_links);
+  return n_links == 0 || listing->links;
+}
+
+static Link *
+links_find (struct Links *links, ino_t ino)
+{
+  Link *link;
+  int   i;
+
+  for (i = (int) (ino * UINT64_C (0x9e3779b97f4a7c15) >> 32) & links->mask;;
+       i = (i + 1) & links->mask)
+  {
+    link = &links->slots[i];
+    if (!link->used || link->ino == ino)
+      return link;
+  }
+}
+
+static bool
+grow_listing (CxDirListing *listing, int *alloc)
+{
+  CxDirItem *list;
+  int        n;
+
+  n = *alloc ? *alloc * 2 : INITIAL_LISTING_ALLOC;
+
+  CX_STATS_BEGIN (CX_STATS_PHASE_ALLOC);
+  list = realloc (listing->list, sizeof (CxDirItem) * n);
+  CX_STATS_TALLY_END (&listing->stats, CX_STATS_PHASE_ALLOC);
+  CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_ALLOC_BYTES,
+                        sizeof (CxDirItem) * (n - listing->total));
+  if (!list)
+    return false;
+  listing->list = list;
+  *alloc        = n;
+  return true;
+}
+
+static FILE *
+open_window_file (void)
+{
+  const char *dir;
+  char        name[CX_PATHMAX];
+  FILE *      fp;
+  int         fd;
+
+  if ((dir = getenv ("TMPDIR")) == NULL || !*dir)
+    dir = "/tmp";
+  snprintf (name, sizeof (name), "%s/" WINDOW_FILE_TEMPLATE, dir);
+  fd = mkostemp (name, O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  unlink (name);
+
+  fp = fdopen (fd, "w+");
+  if (!fp)
+    close (fd);
+  return fp;
+}
+
+/* `n' counts the entries written before this one */
+static bool
+window_add (struct ListingWindow *w, int n, const char *name, int name_len)
+{
+  uint64_t *offsets;
+  uint16_t  len = name_len;
+  int       alloc;
+
+  if (n % WINDOW_BLOCK == 0)
+  {
+    if (w->n_offsets == w->alloc_offsets)
+    {
+      alloc   = w->alloc_offsets ? w->alloc_offsets * 2 : 64;
+      offsets = realloc (w->offsets, alloc * sizeof (uint64_t));
+      if (!offsets)
+        return false;
+      w->offsets       = offsets;
+      w->alloc_offsets = alloc;
+    }
+    w->offsets[w->n_offsets++] = w->map_size;
+  }
+
+  if (fwrite (&len, sizeof (len), 1, w->file) != 1 ||
+      fwrite (name, 1, name_len, w->file) != (size_t) name_len)
+    return false;
+  w->map_size += sizeof (len) + name_len;
+  return true;
+}
+
+/* what is drawn for an entry until its block has been decoded */
+static void
+placeholder_init (CxDirItem *item)
+{
+  static const int len = strlen (PLACEHOLDER_ITEM_NAME);
+
+  memcpy (item->name, PLACEHOLDER_ITEM_NAME, len + 1);
+  memcpy (item->info.type_str, PLACEHOLDER_ITEM_NAME, len + 1);
+  memcpy (item->info.size_str, PLACEHOLDER_ITEM_NAME, len + 1);
+  item->name_len          = len;
+  item->info.type_str_len = len;
+  item->info.size_str_len = len;
+  set_name_width (item);
+}
+
+/* moves the entries read so far out of memory; the rest follow them as
+   they are read */
+static bool
+window_open (CxDirListing *listing, int first)
+{
+  struct ListingWindow *w;
+  int                   i;
+
+  w = calloc (1, sizeof (struct ListingWindow));
+  if (!w)
+    return false;
+  w->file = open_window_file ();
+  if (!w->file)
+  {
+    free (w);
+    return false;
+  }
+  w->first = first;
+  cx_dir_item_init_parent (&w->parent);
+  placeholder_init (&w->placeholder);
+  listing->window = w;
+
+  for (i = first; i < listing->total; ++i)
+    if (!window_add (w, i - first, listing->list[i].name,
+                     listing->list[i].name_len))
+      return false;
+  return true;
+}
+
+/* Leaves the listing room for its window; entries are stat'ed through
+   the listing's directory as they are decoded. There is no git column for
+   such directories, which would mean decoding every entry. */
+static bool
+window_finish (CxDirListing *listing)
+{
+  struct ListingWindow *w = listing->window;
+  CxDirItem *           list;
+  int                   i;
+
+  if (fflush (w->file) != 0)
+    return false;
+  for (i = 0; i < WINDOW_BLOCKS; ++i)
+    w->blocks[i] = w->wanted[i] = w->decoding[i] = -1;
+
+  list =
+    realloc (listing->list, WINDOW_BLOCK * WINDOW_BLOCKS * sizeof (CxDirItem));
+  if (!list)
+    return false;
+  listing->list           = list;
+  listing->git_generation = 0;
+  return true;
+}
+
+/* the file is only mapped once something is read from it */
+static bool
+window_map (struct ListingWindow *w)
+{
+  void *map;
+
+  if (w->map)
+    return true;
+  map = mmap (NULL, w->map_size, PROT_READ, MAP_SHARED, fileno (w->file), 0);
+  if (map == MAP_FAILED)
+    return false;
+  w->map = map;
+  return true;
+}
+
+/* what stands in for the entries of a block that could not be read back */
+static void
+window_set_error (CxDirListing *listing, int base, int n, int error)
+{
+  CxDirItem *item;
+  int        i;
 
-  listing->path = path;
-  if (!cx_path_is_root (listing->path))
+  for (i = 0; i < n; ++i)
   {
-    listing->total = num_children (listing->path->str) + 1;
-    listing->list  = malloc (sizeof (CxDirItem) * listing->total);
-    if (!listing->list)
-      cx_die (errno, "failed to allocate memory");
-    set_parent_item (&listing->list[0]);
-    pos = 1;
+    item           = &listing->list[base + i];
+    item->name_len = 1;
+    memcpy (item->name, "?", 2);
+    item->name_cut   = false;
+    item->root       = 0;
+    item->git_status = 0;
+    set_name_width (item);
+    memset (&item->info.st, 0, sizeof (struct stat));
+    file_info_set_error (&item->info, error);
+  }
+}
+
+static int
+window_block_len (const CxDirListing *listing, int block)
+{
+  int n;
+
+  n = listing->total - listing->window->first - block * WINDOW_BLOCK;
+  return n > WINDOW_BLOCK ? WINDOW_BLOCK : n;
+}
+
+static void
+decode_names (CxDirItem *items, const char *p, int n)
+{
+  CxDirItem *item;
+  uint16_t   len;
+  int        i;
+
+  for (i = 0; i < n; ++i)
+  {
+    item = &items[i];
+    memcpy (&len, p, sizeof (len));
+    memcpy (item->name, p + sizeof (len), len);
+    item->name[len]  = '\0';
+    item->name_len   = len;
+    item->name_cut   = false;
+    item->root       = 0;
+    item->git_status = 0;
+    set_name_width (item);
+    p += sizeof (len) + len;
+  }
+}
+
+/* Entries are stat'ed as they would have been when the directory was
+   read, by the mount's current profile, and feed back into it */
+static void
+stat_block (CxDirListing *listing, int base, int n)
+{
+  CxMountProfile profile;
+  uint64_t       stat_ns;
+  uint64_t       start;
+  int            i;
+
+  cx_mount_profile (listing->options.mounts, listing->dir->fd,
+                    listing->path->str, &profile);
+  if (profile.eager_stat)
+  {
+    start = cx_monotonic_ns ();
+    for (i = 0; i < n; ++i)
+      dir_item_stat (&listing->list[base + i], listing, listing->dir->fd);
+    stat_ns = cx_monotonic_ns () - start;
+    CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_SYSCALLS, n);
   }
   else
+    stat_ns =
+      stat_items (listing, base, base + n, listing->dir->fd, &profile);
+  cx_mount_feedback (listing->options.mounts, profile.dev, n, stat_ns);
+}
+
+/* A block that cannot be read back is shown as errors, and tried again
+   when it is next asked for. One decoded here is no longer waited for
+   from elsewhere. */
+static void
+window_decode (CxDirListing *listing, int block, int slot)
+{
+  struct ListingWindow *w = listing->window;
+  int                   base;
+  int                   n;
+
+  base = slot * WINDOW_BLOCK;
+  n    = window_block_len (listing, block);
+  if (w->wanted[slot] == block)
+    w->wanted[slot] = -1;
+  w->decoding[slot] = -1;
+  if (!window_map (w))
   {
-    listing->total = num_children (listing->path->str);
-    listing->list  = malloc (sizeof (CxDirItem) * listing->total);
-    if (!listing->list)
-      cx_die (errno, "failed to allocate memory");
-    pos = 0;
+    window_set_error (listing, base, n, errno);
+    w->blocks[slot] = -1;
+    return;
   }
 
-  dp = opendir (listing->path->str);
-  if (!dp)
-    cx_die (errno, "failed to open directory `%s'", listing->path->str);
+  decode_names (&listing->list[base], w->map + w->offsets[block], n);
+  stat_block (listing, base, n);
+  w->blocks[slot] = block;
+}
+
+static void
+window_free (struct ListingWindow *w)
+{
+  if (w->map)
+    munmap ((void *) w->map, w->map_size);
+  fclose (w->file);
+  free (w->offsets);
+  free (w);
+}
 
+static void
+listing_reset (CxDirListing *listing, const CxPath *path,
+               const CxScanOptions *options)
+{
+  listing->path           = path;
+  listing->roots[0]       = NULL;
+  listing->roots[1]       = NULL;
+  listing->letter_index   = NULL;
+  listing->links          = NULL;
+  listing->window         = NULL;
+  listing->git_repo       = NULL;
+  listing->dir            = NULL;
+  listing->git_generation = -1;
+  listing->list           = NULL;
+  listing->total          = 0;
+  listing->error          = 0;
+  listing->options        = *options;
+#ifdef CX_STATS
+  memset (&listing->stats, 0, sizeof (listing->stats));
+#endif
+}
+
+/* everything but opening and closing the directory; the listing is left
+   for the caller to free when this fails */
+static bool
+read_dir (CxDirListing *listing, DIR *dp, const CxMountProfile *profile)
+{
+  const CxScanOptions *options = &listing->options;
+  struct dirent *      de;
+  CxDirItem *          item;
+  uint64_t             stat_ns;
+  uint64_t             start;
+  int                  alloc;
+  int                  first;
+
+  alloc = 0;
+  if (!grow_listing (listing, &alloc))
+    return false;
+  first = cx_path_is_root (listing->path) ? 0 : 1;
+  if (first)
+    cx_dir_item_init_parent (&listing->list[listing->total++]);
+
+  stat_ns = 0;
   for (;;)
   {
-    de = readdir (dp);
+    CX_STATS_BEGIN (CX_STATS_PHASE_READDIR);
+    errno = 0;
+    de    = readdir (dp);
+    CX_STATS_TALLY_END (&listing->stats, CX_STATS_PHASE_READDIR);
+    CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_SYSCALLS, 1);
     if (!de)
     {
       if (errno != 0)
-        cx_die (errno, "failed to read directory `%s'", listing->path->str);
+        return false;
       break;
     }
     if (cx_streq (de->d_name, ".") || cx_streq (de->d_name, "..") ||
-        (!g_include_hidden_files && *de->d_name == '.'))
+        (!options->include_hidden_files && *de->d_name == '.'))
+      continue;
+
+    if (!listing->window &&
+        listing->total - first == options->window_threshold &&
+        !window_open (listing, first))
+      return false;
+    if (listing->window)
+    {
+      if (!window_add (listing->window, listing->total - first, de->d_name,
+                       DIRENT_NAMLEN (de)))
+        return false;
+      ++listing->total;
       continue;
-    listing->list[pos].name_len = de->d_namlen;
-    memcpy (listing->list[pos].name, de->d_name, de->d_namlen);
-    listing->list[pos].name[de->d_namlen] = '\0';
-    dir_item_file_info_set (&listing->list[pos++], listing->path);
+    }
+
+    if (listing->total == alloc && !grow_listing (listing, &alloc))
+      return false;
+    item           = &listing->list[listing->total++];
+    item->name_len = DIRENT_NAMLEN (de);
+    memcpy (item->name, de->d_name, item->name_len);
+    item->name[item->name_len] = '\0';
+    item->name_cut             = false;
+    item->root                 = 0;
+    item->git_status           = 0;
+    set_name_width (item);
+
+    if (profile->eager_stat)
+    {
+      start = cx_monotonic_ns ();
+      CX_STATS_BEGIN (CX_STATS_PHASE_STAT);
+      dir_item_stat (item, listing, dirfd (dp));
+      CX_STATS_TALLY_END (&listing->stats, CX_STATS_PHASE_STAT);
+      CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_SYSCALLS, 1);
+      stat_ns += cx_monotonic_ns () - start;
+    }
+  }
+
+  if (listing->window)
+    return window_finish (listing);
+
+  if (!profile->eager_stat)
+    stat_ns = stat_items (listing, first, listing->total, dirfd (dp),
+                          profile);
+  cx_mount_feedback (options->mounts, profile->dev, listing->total - first,
+                     stat_ns);
+  return add_links (listing);
+}
+
+/* Opens `name' in `at' to read it, and keeps it open as the listing's
+   directory. The name is only looked up once: what is kept is the same
+   open directory, under another descriptor. */
+static DIR *
+open_entries (CxDirListing *listing, CxDir *at, const char *name)
+{
+  DIR *dp;
+  int  dir_fd;
+  int  fd;
+
+  if (at && cx_streq (name, "."))
+  {
+    listing->dir = cx_dir_ref (at);
+    fd = openat (at->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  else
+  {
+    fd = openat (at ? at->fd : AT_FDCWD, name,
+                 O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    dir_fd = fd == -1 ? -1 : fcntl (fd, F_DUPFD_CLOEXEC, 0);
+    if (dir_fd != -1)
+      listing->dir = dir_new (dir_fd, at, name);
+  }
+  CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_SYSCALLS, 2);
+
+  dp = fd != -1 && listing->dir ? fdopendir (fd) : NULL;
+  if (!dp && fd != -1)
+    close (fd);
+  return dp;
+}
+
+/* The directory `name' in `at' (see cx_dir_open()) is read once, growing
+   the listing as it goes. How its entries are then stat'ed depends on the
+   mount it is on, and the time the calls take is fed back into that
+   mount's profile. A directory that cannot be read, or held, leaves the
+   listing empty and returns false with errno set. Listings made on
+   different threads share nothing but the mount table of their options
+   and the directories they were opened from. */
+bool
+cx_dir_listing_init_at (CxDirListing *listing, const CxPath *path,
+                        CxDir *at, const char *name,
+                        const CxScanOptions *options)
+{
+  CxMountProfile profile;
+  DIR *          dp;
+  bool           ok;
+  int            error;
+
+  CX_STATS_BEGIN (CX_STATS_PHASE_SCAN);
+
+  listing_reset (listing, path, options);
+  dp = open_entries (listing, at, name);
+  if (dp)
+  {
+    cx_mount_profile (options->mounts, dirfd (dp), listing->path->str,
+                      &profile);
+    ok    = read_dir (listing, dp, &profile);
+    error = errno;
+    closedir (dp);
+    CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_SYSCALLS, 1);
+  }
+  else
+  {
+    ok    = false;
+    error = errno;
+  }
+
+  if (!ok)
+  {
+    cx_dir_listing_free (listing);
+    listing_reset (listing, path, options);
+    errno = error;
   }
-  closedir (dp);
+  CX_STATS_TALLY_END (&listing->stats, CX_STATS_PHASE_SCAN);
+  return ok;
+}
+
+/* the directory at `path', looked up from `/' or the working directory */
+bool
+cx_dir_listing_init (CxDirListing *listing, const CxPath *path,
+                     const CxScanOptions *options)
+{
+  return cx_dir_listing_init_at (listing, path, NULL, path->str, options);
+}
+
+/* A listing of a directory made from items kept elsewhere, which it takes
+   over; they are expected to start with the parent item unless `path' is
+   the root. False when there is no memory to follow its links with. */
+bool
+cx_dir_listing_init_items (CxDirListing *listing, const CxPath *path,
+                           CxDirItem *list, int total,
+                           const CxScanOptions *options)
+{
+  listing_reset (listing, path, options);
+  listing->list  = list;
+  listing->total = total;
+  return add_links (listing);
 }
 
 bool
@@ -265,6 +1187,396 @@ cx_dir_listing_has_parent_item (const CxDirListing *listing)
   return !cx_path_is_root (listing->path);
 }
 
+CxDirItem *
+cx_dir_listing_item (CxDirListing *listing, int index)
+{
+  struct ListingWindow *w = listing->window;
+  int                   block;
+  int                   slot;
+
+  if (!w)
+    return &listing->list[index];
+  if (index < w->first)
+    return &w->parent;
+
+  index -= w->first;
+  block = index / WINDOW_BLOCK;
+  slot  = block % WINDOW_BLOCKS;
+  if (w->blocks[slot] != block)
+    window_decode (listing, block, slot);
+  return &listing->list[slot * WINDOW_BLOCK + index % WINDOW_BLOCK];
+}
+
+/* As cx_dir_listing_item(), but for drawing: an item of a block that is
+   not held is a placeholder, and the block is left for
+   cx_dir_listing_take_block() to hand out. */
+CxDirItem *
+cx_dir_listing_item_nowait (CxDirListing *listing, int index)
+{
+  struct ListingWindow *w = listing->window;
+  int                   block;
+  int                   slot;
+
+  if (!w)
+    return &listing->list[index];
+  if (index < w->first)
+    return &w->parent;
+
+  index -= w->first;
+  block = index / WINDOW_BLOCK;
+  slot  = block % WINDOW_BLOCKS;
+  if (w->blocks[slot] != block)
+  {
+    if (w->decoding[slot] != block)
+      w->wanted[slot] = block;
+    return &w->placeholder;
+  }
+  return &listing->list[slot * WINDOW_BLOCK + index % WINDOW_BLOCK];
+}
+
+/* the names of `block' copied out, to be stat'ed away from the listing */
+static CxDirBlock *
+block_new (CxDirListing *listing, int block)
+{
+  struct ListingWindow *w = listing->window;
+  CxDirBlock *          b;
+
+  if (!window_map (w))
+    return NULL;
+  b = malloc (sizeof (CxDirBlock));
+  if (!b)
+    return NULL;
+  cx_path_init (&b->path, listing->path->str, listing->path->len);
+  listing_reset (&b->listing, &b->path, &listing->options);
+  b->listing.list  = b->items;
+  b->listing.total = window_block_len (listing, block);
+  b->listing.dir   = cx_dir_ref (listing->dir);
+  b->block         = block;
+  decode_names (b->items, w->map + w->offsets[block], b->listing.total);
+  return b;
+}
+
+/* The next block drawn as placeholders, copied out to be stat'ed by
+   cx_dir_block_decode() on any thread and given back through
+   cx_dir_listing_put_block(); NULL once there are none. A block there is
+   no memory to copy out is decoded in place instead. */
+CxDirBlock *
+cx_dir_listing_take_block (CxDirListing *listing)
+{
+  struct ListingWindow *w = listing->window;
+  CxDirBlock *          b;
+  int                   block;
+  int                   slot;
+
+  if (!w)
+    return NULL;
+  for (slot = 0; slot < WINDOW_BLOCKS; ++slot)
+  {
+    block = w->wanted[slot];
+    if (block == -1)
+      continue;
+    w->wanted[slot] = -1;
+    b               = block_new (listing, block);
+    if (!b)
+    {
+      window_decode (listing, block, slot);
+      continue;
+    }
+    w->decoding[slot] = block;
+    return b;
+  }
+  return NULL;
+}
+
+void
+cx_dir_block_decode (CxDirBlock *b)
+{
+  stat_block (&b->listing, 0, b->listing.total);
+}
+
+/* The block goes in its slot unless that has since been decoded in
+   place, or handed out for another block; it is freed either way. */
+void
+cx_dir_listing_put_block (CxDirListing *listing, CxDirBlock *b)
+{
+  struct ListingWindow *w    = listing->window;
+  int                   slot = b->block % WINDOW_BLOCKS;
+
+  if (w && w->decoding[slot] == b->block)
+  {
+    memcpy (&listing->list[slot * WINDOW_BLOCK], b->items,
+            b->listing.total * sizeof (CxDirItem));
+    w->blocks[slot]   = b->block;
+    w->decoding[slot] = -1;
+  }
+  cx_dir_block_free (b);
+}
+
+void
+cx_dir_block_free (CxDirBlock *b)
+{
+  if (!b)
+    return;
+  cx_dir_unref (b->listing.dir);
+  free (b);
+}
+
+/* Items have their paths made only when one is asked for, which is for
+   those shown or acted on. False with errno set when there is none to look
+   the item up by: it is then either elided, being too deep to hold, or
+   empty, for a name that lost its beginning. */
+bool
+cx_dir_listing_item_path (const CxDirListing *listing, const CxDirItem *item,
+                          CxPath *path)
+{
+  const CxPath *root = listing->roots[item->root];
+
+  if (item->name_cut)
+  {
+    path->len    = 0;
+    path->str[0] = '\0';
+    errno        = ENAMETOOLONG;
+    return false;
+  }
+  return cx_path_dir_item (path, root ? root : listing->path, item->name,
+                           item->name_len);
+}
+
+/* Looks up where `item' leads the first time it is needed, which is when
+   it is drawn or acted on. Listings that were not read from a directory
+   have no links to follow; in windowed ones, an item is followed again
+   each time it is decoded. */
+void
+cx_dir_listing_follow_link (CxDirListing *listing, CxDirItem *item)
+{
+  static const int dir_link_len    = strlen (DIR_LINK_TYPE_STR);
+  static const int file_link_len   = strlen (FILE_LINK_TYPE_STR);
+  static const int broken_link_len = strlen (BROKEN_LINK_TYPE_STR);
+  CxFileInfo *     info            = &item->info;
+  struct stat      st;
+  CxPath           path;
+  Link             unshared;
+  Link *           link;
+
+  if (info->target_type != CX_FILE_TYPE_SYMLINK)
+    return;
+  if (listing->links)
+    link = links_find (listing->links, info->st.st_ino);
+  else if (listing->window)
+  {
+    link       = &unshared;
+    link->used = false;
+  }
+  else
+    return;
+
+  if (!link->used)
+  {
+    link->ino  = info->st.st_ino;
+    link->used = true;
+    CX_STATS_TALLY_COUNT (&listing->stats, CX_STATS_COUNTER_SYSCALLS, 1);
+    if (listing->dir ? fstatat (listing->dir->fd, item->name, &st, 0) == 0
+                     : cx_dir_listing_item_path (listing, item, &path) &&
+                         stat (path.str, &st) == 0)
+    {
+      link->type = file_type_of (st.st_mode);
+      link->size = st.st_size;
+    }
+    else
+      link->type = CX_FILE_TYPE_UNKNOWN;
+  }
+
+  /* links to anything but a directory or a file keep saying `symlink' */
+  info->target_type = link->type;
+  switch (link->type)
+  {
+    case CX_FILE_TYPE_DIRECTORY:
+      info->type_str_len = dir_link_len;
+      memcpy (info->type_str, DIR_LINK_TYPE_STR, dir_link_len + 1);
+      break;
+    case CX_FILE_TYPE_FILE:
+      info->type_str_len = file_link_len;
+      memcpy (info->type_str, FILE_LINK_TYPE_STR, file_link_len + 1);
+      cx_size_str (info->size_str, &info->size_str_len, link->size,
+                   listing->options.size_units);
+      break;
+    case CX_FILE_TYPE_UNKNOWN:
+      info->type_str_len = broken_link_len;
+      memcpy (info->type_str, BROKEN_LINK_TYPE_STR, broken_link_len + 1);
+      break;
+    default:;
+  }
+}
+
+/* The index is N_LETTERS + 1 bucket offsets followed by the item positions
+   grouped by lowercased first byte, each group in listing order. */
+static bool
+build_letter_index (CxDirListing *listing)
+{
+  int *start;
+  int *pos;
+  int  first;
+  int  b;
+  int  i;
+
+  listing->letter_index =
+    calloc (N_LETTERS + 1 + listing->total, sizeof (int));
+  if (!listing->letter_index)
+    return false;
+
+  start = listing->letter_index;
+  pos   = start + N_LETTERS + 1;
+  first = cx_dir_listing_has_parent_item (listing) ? 1 : 0;
+
+  for (i = first; i < listing->total; ++i)
+    ++start[tolower ((unsigned char) listing->list[i].name[0]) + 1];
+  for (b = 0; b < N_LETTERS; ++b)
+    start[b + 1] += start[b];
+
+  /* use the bucket ends as cursors, then restore them */
+  for (i = first; i < listing->total; ++i)
+  {
+    b               = tolower ((unsigned char) listing->list[i].name[0]);
+    pos[start[b]++] = i;
+  }
+  for (b = N_LETTERS; b > 0; --b)
+    start[b] = start[b - 1];
+  start[0] = 0;
+  return true;
+}
+
+/* Windowed listings are not indexed: the names are scanned where they
+   are kept, which is a small fraction of what decoding them would be. */
+static int
+window_find_letter (CxDirListing *listing, int c, int after)
+{
+  struct ListingWindow *w = listing->window;
+  const char *          p;
+  uint16_t              len;
+  int                   found;
+  int                   b;
+  int                   i;
+
+  if (!window_map (w))
+    return -1;
+  b     = tolower ((unsigned char) c);
+  found = -1;
+  p     = w->map;
+  for (i = w->first; i < listing->total; ++i)
+  {
+    memcpy (&len, p, sizeof (len));
+    if (tolower ((unsigned char) p[sizeof (len)]) == b)
+    {
+      if (i > after)
+        return i;
+      if (found < 0)
+        found = i;
+    }
+    p += sizeof (len) + len;
+  }
+  return found;
+}
+
+int
+cx_dir_listing_find_letter (CxDirListing *listing, int c, int after)
+{
+  const int *pos;
+  int        lo;
+  int        hi;
+  int        mid;
+  int        b;
+
+  if (listing->window)
+    return window_find_letter (listing, c, after);
+  if (!listing->letter_index && !build_letter_index (listing))
+    return -1;
+
+  b   = tolower ((unsigned char) c);
+  pos = listing->letter_index + N_LETTERS + 1;
+  lo  = listing->letter_index[b];
+  hi  = listing->letter_index[b + 1];
+  if (lo == hi)
+    return -1;
+
+  /* first matching item after `after', wrapping to the first match */
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (pos[mid] <= after)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == listing->letter_index[b + 1])
+    return pos[listing->letter_index[b]];
+  return pos[lo];
+}
+
+/* True when both listings hold the same entries, in the same order and
+   with the same stat data, as far as a listing shows it. Windowed
+   listings are never compared. */
+bool
+cx_dir_listing_same (const CxDirListing *a, const CxDirListing *b)
+{
+  const struct stat *x;
+  const struct stat *y;
+  int                i;
+
+  if (a->total != b->total || a->window || b->window)
+    return false;
+
+  i = cx_dir_listing_has_parent_item (a) ? 1 : 0;
+  for (; i < a->total; ++i)
+  {
+    if (!cx_strneq (a->list[i].name, a->list[i].name_len, b->list[i].name,
+                    b->list[i].name_len) ||
+        a->list[i].info.error != b->list[i].info.error)
+      return false;
+    x = &a->list[i].info.st;
+    y = &b->list[i].info.st;
+    if (x->st_mode != y->st_mode || x->st_size != y->st_size ||
+        x->st_mtime != y->st_mtime || x->st_ctime != y->st_ctime ||
+        x->st_ino != y->st_ino || x->st_dev != y->st_dev ||
+        x->st_uid != y->st_uid || x->st_gid != y->st_gid)
+      return false;
+  }
+  return true;
+}
+
+/* the index of the entry called `name', leaving out the parent item;
+   nothing is decoded to find it */
+int
+cx_dir_listing_find_name (CxDirListing *listing, const char *name,
+                          int name_len)
+{
+  struct ListingWindow *w = listing->window;
+  const char *          p;
+  uint16_t              len;
+  int                   i;
+
+  if (!w)
+  {
+    i = cx_dir_listing_has_parent_item (listing) ? 1 : 0;
+    for (; i < listing->total; ++i)
+      if (cx_strneq (listing->list[i].name, listing->list[i].name_len, name,
+                     name_len))
+        return i;
+    return -1;
+  }
+
+  if (!window_map (w))
+    return -1;
+  p = w->map;
+  for (i = w->first; i < listing->total; ++i)
+  {
+    memcpy (&len, p, sizeof (len));
+    if (cx_strneq (p + sizeof (len), len, name, name_len))
+      return i;
+    p += sizeof (len) + len;
+  }
+  return -1;
+}
+
 void
 cx_dir_listing_free (CxDirListing *listing)
 {
@@ -274,6 +1586,29 @@ cx_dir_listing_free (CxDirListing *listing)
     listing->list = NULL;
   }
 
-  listing->path  = NULL;
-  listing->total = 0;
+  if (listing->letter_index)
+  {
+    free (listing->letter_index);
+    listing->letter_index = NULL;
+  }
+
+  if (listing->links)
+  {
+    free (listing->links->slots);
+    free (listing->links);
+    listing->links = NULL;
+  }
+
+  if (listing->window)
+  {
+    window_free (listing->window);
+    listing->window = NULL;
+  }
+
+  cx_dir_unref (listing->dir);
+  listing->path           = NULL;
+  listing->git_repo       = NULL;
+  listing->dir            = NULL;
+  listing->git_generation = 0;
+  listing->total          = 0;
 }
@@ -7,6 +7,7 @@
 
 #include "cx.h"
 #include "path.h"
+#include "stats.h"
 
 #ifdef _DARWIN_FEATURE_64_BIT_INODE
 #define CX_DIR_ITEM_NAME_MAX 1024
@@ -14,6 +15,9 @@
 #define CX_DIR_ITEM_NAME_MAX 256
 #endif
 
+/* directories of more entries are listed through a window */
+#define CX_DEFAULT_WINDOW_THRESHOLD 10000
+
 #define CX_BYTE_C(n) UINT64_C (n)
 #define CX_PRIbyte PRIu64
 
@@ -37,33 +41,139 @@ typedef enum
   CX_FILE_TYPE_SYMLINK
 } CxFileType;
 
+struct CxMountTable;
+
+/* An open directory, and the one it was opened from when that was by a
+   single name, so that moving up and down a tree looks up one name at a
+   time rather than a whole path from `/', and keeps working when a
+   directory above is renamed. The chain of names is also where the path
+   of a directory comes from, however deep it is, when it is shown. Shared
+   by reference, from any thread. */
+typedef struct CxDir CxDir;
+
+/* How a directory is listed. Each listing keeps its own copy, so options
+   changed later only apply to listings made after. `mounts' is where the
+   mount profiles are kept and shared between scans; without one, each
+   scan starts from the defaults for its file system. */
+typedef struct
+{
+  CxSizeUnits          size_units;
+  bool                 include_hidden_files;
+  int                  window_threshold;
+  struct CxMountTable *mounts;
+} CxScanOptions;
+
+/* `st' describes the entry itself, so a symlink is a symlink. What it
+   points to is only looked up once the item is shown: until then its
+   `target_type' is CX_FILE_TYPE_SYMLINK, and a link that leads nowhere
+   ends up CX_FILE_TYPE_UNKNOWN. For anything else the two types agree.
+   `error' is the errno of an entry that could not be stat'ed at all. */
 typedef struct
 {
   struct stat st;
-  CxPath      path;
   char        type_str[CX_SMALL_BUFMAX];
   char        size_str[CX_SMALL_BUFMAX];
   int         type_str_len;
   int         size_str_len;
   CxFileType  type;
+  CxFileType  target_type;
+  int         error;
 } CxFileInfo;
 
+/* `name_width' is how many screen columns the name takes, worked out once
+   when the item is made; names of printable ASCII alone are flagged so
+   they can be drawn and cut byte for column. An item has no path of its
+   own: it is named in its listing's directory, or for search results,
+   below the listing root `root' picks. */
 typedef struct
 {
-  CxFileInfo info;
-  char       name[CX_DIR_ITEM_NAME_MAX];
-  int        name_len;
+  CxFileInfo    info;
+  char          name[CX_DIR_ITEM_NAME_MAX];
+  int           name_len;
+  int           name_width;
+  bool          name_ascii;
+  bool          name_cut; /* lost its beginning */
+  unsigned char root;
+  unsigned char git_status; /* a CxGitStatus */
 } CxDirItem;
 
+#define CX_DIR_LISTING_ROOTS 2
+
+/* Items are reached by index through cx_dir_listing_item(). A directory
+   of more entries than the window threshold is not held in memory: `list'
+   is then only a window of decoded items, and an item from it stays valid
+   until items more than a few hundred positions away are asked for, or a
+   block decoded elsewhere is put in.
+   `dir' is the directory the listing was read from, if it was; links are
+   followed and windowed entries stat'ed relative to it. Listings of
+   search results, whose `path' is only a title, name their items below
+   `roots' instead. `error' says why a directory could not be read. */
 typedef struct
 {
-  CxDirItem *   list;
-  const CxPath *path;
-  int           total;
+  CxDirItem *           list;
+  const CxPath *        path;
+  const CxPath *        roots[CX_DIR_LISTING_ROOTS];
+  int *                 letter_index;
+  struct Links *        links;
+  struct ListingWindow *window;
+  struct GitRepo *      git_repo;
+  CxDir *               dir;
+  int                   git_generation;
+  int                   total;
+  int                   error;
+  CxScanOptions         options;
+#ifdef CX_STATS
+  CxStatsTally          stats;
+#endif
 } CxDirListing;
 
-void cx_dir_listing_init (CxDirListing *listing, CxPath *path);
-bool cx_dir_listing_has_parent_item (const CxDirListing *listing);
-void cx_dir_listing_free (CxDirListing *listing);
+/* a block of a windowed listing's items drawn before they were decoded,
+   copied out to be decoded on another thread */
+typedef struct CxDirBlock CxDirBlock;
+
+CxDir *cx_dir_open (CxDir *at, const char *name);
+CxDir *cx_dir_ref (CxDir *dir);
+void   cx_dir_unref (CxDir *dir);
+CxDir *cx_dir_parent (const CxDir *dir);
+int    cx_dir_fd (const CxDir *dir);
+
+const char *cx_dir_name (const CxDir *dir);
+bool        cx_dir_path (const CxDir *dir, CxPath *path);
+
+void cx_size_str (char *buffer, int *len, cx_byte_t bytes, CxSizeUnits units);
+
+bool cx_str_is_ascii (const char *str, int len);
+int  cx_str_width (const char *str, int len);
+
+void cx_dir_item_init (CxDirItem *item, const char *name, int name_len,
+                       int root, const struct stat *st, CxSizeUnits units);
+void cx_dir_item_init_parent (CxDirItem *item);
+
+bool       cx_dir_listing_init (CxDirListing *listing, const CxPath *path,
+                                const CxScanOptions *options);
+bool       cx_dir_listing_init_at (CxDirListing *listing, const CxPath *path,
+                                   CxDir *at, const char *name,
+                                   const CxScanOptions *options);
+bool       cx_dir_listing_init_items (CxDirListing *listing,
+                                      const CxPath *path, CxDirItem *list,
+                                      int total, const CxScanOptions *options);
+bool       cx_dir_listing_has_parent_item (const CxDirListing *listing);
+CxDirItem *cx_dir_listing_item (CxDirListing *listing, int index);
+CxDirItem *cx_dir_listing_item_nowait (CxDirListing *listing, int index);
+bool       cx_dir_listing_item_path (const CxDirListing *listing,
+                                     const CxDirItem *item, CxPath *path);
+void       cx_dir_listing_follow_link (CxDirListing *listing,
+                                       CxDirItem *   item);
+int        cx_dir_listing_find_letter (CxDirListing *listing, int c,
+                                       int after);
+int        cx_dir_listing_find_name (CxDirListing *listing, const char *name,
+                                     int name_len);
+bool       cx_dir_listing_same (const CxDirListing *a, const CxDirListing *b);
+void       cx_dir_listing_free (CxDirListing *listing);
+
+CxDirBlock *cx_dir_listing_take_block (CxDirListing *listing);
+void        cx_dir_block_decode (CxDirBlock *b);
+void        cx_dir_listing_put_block (CxDirListing *listing, CxDirBlock *b);
+void        cx_dir_block_free (CxDirBlock *b);
 
 #endif /* __CX_FILES_H__ */
@@ -0,0 +1,162 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "follow.h"
+#include "log.h"
+#include "util.h"
+
+/* more of the end of the file than any screen shows */
+#define TAIL_BYTES 65536
+
+/* Events only mark the file as changed; however fast it grows, it is
+   looked at once per update, which the interface does once a frame. */
+static void
+on_change (int watch, void *data)
+{
+  CxFollow *f = data;
+
+  if (f->changed)
+    return;
+  f->changed = true;
+  if (f->callback)
+    f->callback (f, f->data);
+}
+
+/* Starts over on whatever file is now at the path. */
+static bool
+open_file (CxFollow *f)
+{
+  struct stat st;
+  int         fd;
+
+  fd = open (f->path.str, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode))
+  {
+    close (fd);
+    errno = EINVAL;
+    return false;
+  }
+
+  if (f->fd != -1)
+    close (f->fd);
+  cx_event_unwatch (f->file_watch);
+
+  f->fd         = fd;
+  f->dev        = st.st_dev;
+  f->ino        = st.st_ino;
+  f->offset     = 0;
+  f->tail_len   = 0;
+  f->file_watch = cx_event_watch (f->path.str, on_change, f);
+  return true;
+}
+
+CxFollow *
+cx_follow_start (const CxPath *path, CxFollowCallback callback, void *data)
+{
+  CxFollow *f;
+  CxPath    dir;
+  int       saved;
+
+  f = calloc (1, sizeof (CxFollow));
+  if (f)
+    f->tail = malloc (TAIL_BYTES);
+  if (!f || !f->tail)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&f->path, path);
+  f->fd         = -1;
+  f->file_watch = -1;
+  if (!open_file (f))
+  {
+    saved = errno;
+    free (f->tail);
+    free (f);
+    errno = saved;
+    return NULL;
+  }
+
+  /* a rotated file is replaced by a new one, which only its directory
+     hears about */
+  cx_path_init_copy (&dir, path);
+  cx_path_init_parent_of (&dir);
+  f->dir_watch = cx_event_watch (dir.str, on_change, f);
+
+  f->callback = callback;
+  f->data     = data;
+  f->changed  = true;
+  return f;
+}
+
+/* Reads what was appended since the last update, never more than the
+   tail can hold, so a file that grew by gigabytes costs as little as one
+   that grew by a line. True when the tail changed. */
+bool
+cx_follow_update (CxFollow *f)
+{
+  struct stat st;
+  off_t       start;
+  ssize_t     n;
+  bool        restarted;
+  int         want;
+  int         keep;
+
+  if (!f->changed)
+    return false;
+  f->changed = false;
+
+  restarted = stat (f->path.str, &st) == 0 &&
+              (st.st_dev != f->dev || st.st_ino != f->ino) && open_file (f);
+  if (restarted)
+  {
+    ++f->n_restarts;
+    cx_log (CX_LOG_STATUS_INFO, "`%s' was replaced, following the new file",
+            f->path.str);
+  }
+
+  if (fstat (f->fd, &st) != 0)
+    return false;
+  if (st.st_size < f->offset)
+  {
+    ++f->n_restarts;
+    restarted   = true;
+    f->offset   = 0;
+    f->tail_len = 0;
+    cx_log (CX_LOG_STATUS_INFO, "`%s' was truncated, following from its start",
+            f->path.str);
+  }
+  if (st.st_size == f->offset)
+    return restarted;
+
+  start = f->offset;
+  if (st.st_size - start > TAIL_BYTES)
+    start = st.st_size - TAIL_BYTES;
+  want = st.st_size - start;
+  keep = TAIL_BYTES - want < f->tail_len ? TAIL_BYTES - want : f->tail_len;
+
+  memmove (f->tail, f->tail + f->tail_len - keep, keep);
+  n = pread (f->fd, f->tail + keep, want, start);
+  if (n < 0)
+    n = 0;
+  f->tail_len = keep + n;
+  f->offset   = start + n;
+  return true;
+}
+
+void
+cx_follow_free (CxFollow *f)
+{
+  if (!f)
+    return;
+  cx_event_unwatch (f->file_watch);
+  cx_event_unwatch (f->dir_watch);
+  close (f->fd);
+  free (f->tail);
+  free (f);
+}
@@ -0,0 +1,40 @@
+#ifndef __CX_FOLLOW_H__
+#define __CX_FOLLOW_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "path.h"
+
+typedef struct CxFollow CxFollow;
+
+/* Called on the main thread when the file may have changed; the new data
+   is only read by the next cx_follow_update(). */
+typedef void (*CxFollowCallback) (CxFollow *follow, void *data);
+
+/* The last bytes of a file that keeps being written to. Data appended to
+   it is read as it arrives; when it is truncated or replaced by a new
+   file of the same name, following starts over from the new start. */
+struct CxFollow
+{
+  CxPath           path;
+  char *           tail;
+  int              tail_len;
+  off_t            offset; /* how much of the file has been taken in */
+  dev_t            dev;
+  ino_t            ino;
+  int              fd;
+  int              file_watch;
+  int              dir_watch;
+  int              n_restarts;
+  bool             changed;
+  CxFollowCallback callback;
+  void *           data;
+};
+
+CxFollow *cx_follow_start (const CxPath *path, CxFollowCallback callback,
+                           void *data);
+bool      cx_follow_update (CxFollow *follow);
+void      cx_follow_free (CxFollow *follow);
+
+#endif /* __CX_FOLLOW_H__ */
@@ -0,0 +1,913 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "git.h"
+#include "log.h"
+#include "util.h"
+
+#define GIT_DIR_NAME ".git"
+#define GIT_IGNORE_NAME ".gitignore"
+
+#define INDEX_SIGNATURE "DIRC"
+#define INDEX_HEADER_SIZE 12
+
+/* each entry starts with ten 32-bit stat fields, the object id and a
+   16-bit flags word */
+#define INDEX_STAT_SIZE 40
+#define INDEX_FLAG_EXTENDED 0x4000
+#define INDEX_FLAG_STAGE 0x3000
+#define INDEX_XFLAG_SKIP_WORKTREE 0x4000
+
+#define SHA1_SIZE 20
+#define SHA256_SIZE 32
+
+#define GITLINK_MODE 0160000
+
+/* the index is stat'ed at most this often to see if it has changed */
+#define INDEX_CHECK_NS UINT64_C (1000000000)
+
+/* the stat data git keeps for an entry, cut down to 32 bits like git
+   does; `path' is an offset into the index's path pool */
+typedef struct
+{
+  int      path;
+  int      path_len;
+  uint32_t ctime;
+  uint32_t mtime;
+  uint32_t ino;
+  uint32_t mode;
+  uint32_t size;
+  bool     conflicted;
+  bool     skip_worktree;
+} GitEntry;
+
+typedef struct
+{
+  const char *pattern;
+  bool        negate;
+  bool        dir_only;
+  bool        anchored;
+} GitRule;
+
+/* the rules of one ignore file, which apply below `base' */
+typedef struct
+{
+  char *   base;
+  int      base_len;
+  char *   text;
+  GitRule *rules;
+  int      n_rules;
+} GitIgnore;
+
+typedef struct
+{
+  GitEntry *  entries;
+  int         n_entries;
+  char *      paths;
+  GitIgnore   exclude;
+  GitIgnore * ignores; /* sorted by base */
+  int         n_ignores;
+  CxPath      file;
+  struct stat st;
+} GitIndex;
+
+typedef struct GitRepo
+{
+  struct GitRepo *next;
+  struct GitRepo *next_pending;
+  CxPath          root;
+  GitIndex *      index;  /* only touched by the main thread */
+  GitIndex *      loaded; /* handed over by the reader */
+  int             generation;
+  uint64_t        checked_ns;
+  bool            loading;
+} GitRepo;
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t  work;
+  pthread_t       reader;
+  GitRepo *       repos;
+  GitRepo *       pending;
+  CxGitCallback   callback;
+  void *          data;
+  int             wake_fd;
+  int             generation;
+  bool            running;
+  bool            stopping;
+} git = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+};
+
+static uint32_t
+be32 (const unsigned char *p)
+{
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+         (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+static uint16_t
+be16 (const unsigned char *p)
+{
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+/* git's path order: bytes, then the shorter path first */
+static int
+compare_paths (const char *a, int a_len, const char *b, int b_len)
+{
+  int cmp = memcmp (a, b, a_len < b_len ? a_len : b_len);
+
+  return cmp != 0 ? cmp : a_len - b_len;
+}
+
+static char *
+read_file (const char *file, int *len)
+{
+  struct stat st;
+  char *      text;
+  ssize_t     n;
+  int         fd;
+
+  fd = open (file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) ||
+      !(text = malloc (st.st_size + 1)))
+  {
+    close (fd);
+    return NULL;
+  }
+  n = read (fd, text, st.st_size);
+  close (fd);
+  if (n < 0)
+  {
+    free (text);
+    return NULL;
+  }
+  text[n] = '\0';
+  *len    = n;
+  return text;
+}
+
+/* `.git' is either the git directory or, in worktrees and submodules, a
+   file naming it */
+static bool
+find_git_dir (const CxPath *root, CxPath *git_dir)
+{
+  struct stat st;
+  char *      text;
+  char *      dir;
+  int         len;
+
+  cx_path_dir_item (git_dir, root, GIT_DIR_NAME, strlen (GIT_DIR_NAME));
+  if (stat (git_dir->str, &st) != 0)
+    return false;
+  if (S_ISDIR (st.st_mode))
+    return true;
+
+  text = read_file (git_dir->str, &len);
+  if (!text || strncmp (text, "gitdir: ", 8) != 0)
+  {
+    free (text);
+    return false;
+  }
+  dir = text + 8;
+  len = strcspn (dir, "\r\n");
+  if (*dir == '/')
+    cx_path_init (git_dir, dir, len);
+  else
+    cx_path_dir_item (git_dir, root, dir, len);
+  free (text);
+  return true;
+}
+
+/* Turns the lines of an ignore file into rules, in place. Patterns with
+   a slash other than at the end match the whole path below the file's
+   directory, the rest only the last component. */
+static void
+parse_ignore (GitIgnore *ig, char *text)
+{
+  GitRule *rule;
+  char *   line;
+  char *   next;
+  int      alloc;
+  int      len;
+
+  ig->text    = text;
+  ig->rules   = NULL;
+  ig->n_rules = 0;
+  alloc       = 0;
+
+  for (line = text; line && *line; line = next)
+  {
+    next = strchr (line, '\n');
+    if (next)
+      *next++ = '\0';
+
+    len = strlen (line);
+    while (len > 0 && (line[len - 1] == '\r' ||
+                       (line[len - 1] == ' ' &&
+                        (len < 2 || line[len - 2] != '\\'))))
+      line[--len] = '\0';
+    if (len == 0 || *line == '#')
+      continue;
+
+    if (ig->n_rules == alloc)
+    {
+      alloc     = alloc ? alloc * 2 : 16;
+      ig->rules = realloc (ig->rules, alloc * sizeof (GitRule));
+      if (!ig->rules)
+        cx_die (errno, "failed to allocate memory");
+    }
+    rule = &ig->rules[ig->n_rules];
+    memset (rule, 0, sizeof (GitRule));
+
+    if (*line == '!')
+    {
+      rule->negate = true;
+      ++line;
+      --len;
+    }
+    else if (*line == '\\')
+    {
+      ++line;
+      --len;
+    }
+    if (len > 0 && line[len - 1] == '/')
+    {
+      rule->dir_only = true;
+      line[--len]    = '\0';
+    }
+    if (strncmp (line, "**/", 3) == 0 && !strchr (line + 3, '/'))
+      line += 3;
+    else if (*line == '/')
+    {
+      rule->anchored = true;
+      ++line;
+    }
+    else if (strchr (line, '/'))
+      rule->anchored = true;
+    if (*line == '\0')
+      continue;
+
+    rule->pattern = line;
+    ++ig->n_rules;
+  }
+}
+
+static void
+ignore_free (GitIgnore *ig)
+{
+  free (ig->base);
+  free (ig->text);
+  free (ig->rules);
+}
+
+static int
+compare_ignores (const void *a, const void *b)
+{
+  const GitIgnore *ia = a;
+  const GitIgnore *ib = b;
+
+  return compare_paths (ia->base, ia->base_len, ib->base, ib->base_len);
+}
+
+/* every tracked ignore file, plus the repository's own exclude file */
+static void
+read_ignores (GitIndex *index, const CxPath *root, const CxPath *git_dir)
+{
+  static const int name_len = strlen (GIT_IGNORE_NAME);
+  const GitEntry * e;
+  GitIgnore *      ig;
+  CxPath           file;
+  char *           text;
+  const char *     path;
+  int              alloc;
+  int              len;
+  int              i;
+
+  cx_path_dir_item (&file, git_dir, "info/exclude", 12);
+  text = read_file (file.str, &len);
+  if (text)
+    parse_ignore (&index->exclude, text);
+
+  alloc = 0;
+  for (i = 0; i < index->n_entries; ++i)
+  {
+    e    = &index->entries[i];
+    path = index->paths + e->path;
+    if (e->path_len < name_len ||
+        memcmp (path + e->path_len - name_len, GIT_IGNORE_NAME,
+                name_len) != 0 ||
+        (e->path_len > name_len && path[e->path_len - name_len - 1] != '/'))
+      continue;
+
+    cx_path_dir_item (&file, root, path, e->path_len);
+    text = read_file (file.str, &len);
+    if (!text)
+      continue;
+
+    if (index->n_ignores == alloc)
+    {
+      alloc          = alloc ? alloc * 2 : 16;
+      index->ignores = realloc (index->ignores, alloc * sizeof (GitIgnore));
+      if (!index->ignores)
+        cx_die (errno, "failed to allocate memory");
+    }
+    ig           = &index->ignores[index->n_ignores++];
+    ig->base_len = e->path_len - name_len;
+    ig->base     = malloc (ig->base_len + 1);
+    if (!ig->base)
+      cx_die (errno, "failed to allocate memory");
+    memcpy (ig->base, path, ig->base_len);
+    ig->base[ig->base_len] = '\0';
+    parse_ignore (ig, text);
+  }
+  qsort (index->ignores, index->n_ignores, sizeof (GitIgnore),
+         compare_ignores);
+}
+
+static void
+index_free (GitIndex *index)
+{
+  int i;
+
+  if (!index)
+    return;
+  for (i = 0; i < index->n_ignores; ++i)
+    ignore_free (&index->ignores[i]);
+  ignore_free (&index->exclude);
+  free (index->ignores);
+  free (index->entries);
+  free (index->paths);
+  free (index);
+}
+
+static void
+grow_paths (GitIndex *index, int *alloc, int need)
+{
+  while (*alloc < need)
+    *alloc = *alloc ? *alloc * 2 : 65536;
+  index->paths = realloc (index->paths, *alloc);
+  if (!index->paths)
+    cx_die (errno, "failed to allocate memory");
+}
+
+/* Reads the entries of index versions 2 to 4 from the mapped file; the
+   extensions after them are of no use here. Version 4 paths only hold
+   what differs from the previous one. */
+static bool
+parse_index (GitIndex *index, const unsigned char *map, size_t size,
+             int hash_size)
+{
+  const unsigned char *p   = map + INDEX_HEADER_SIZE;
+  const unsigned char *end = map + size - hash_size;
+  const unsigned char *name;
+  const unsigned char *nul;
+  GitEntry *           e;
+  uint32_t             version;
+  uint32_t             n;
+  uint16_t             flags;
+  uint64_t             strip;
+  int                  prev;
+  int                  alloc;
+  int                  fixed;
+  int                  len;
+
+  if (size < INDEX_HEADER_SIZE + (size_t) hash_size ||
+      memcmp (map, INDEX_SIGNATURE, 4) != 0)
+    return false;
+  version = be32 (map + 4);
+  n       = be32 (map + 8);
+  if (version < 2 || version > 4 || n > size / INDEX_STAT_SIZE)
+    return false;
+
+  index->entries = malloc ((n ? n : 1) * sizeof (GitEntry));
+  if (!index->entries)
+    cx_die (errno, "failed to allocate memory");
+
+  alloc = 0;
+  prev  = 0;
+  fixed = INDEX_STAT_SIZE + hash_size + 2;
+  for (index->n_entries = 0; index->n_entries < (int) n; ++index->n_entries)
+  {
+    if (end - p < fixed)
+      return false;
+    e = &index->entries[index->n_entries];
+
+    e->ctime         = be32 (p);
+    e->mtime         = be32 (p + 8);
+    e->ino           = be32 (p + 20);
+    e->mode          = be32 (p + 24);
+    e->size          = be32 (p + 36);
+    flags            = be16 (p + fixed - 2);
+    e->conflicted    = (flags & INDEX_FLAG_STAGE) != 0;
+    e->skip_worktree = false;
+    name             = p + fixed;
+    if ((flags & INDEX_FLAG_EXTENDED) && version >= 3)
+    {
+      if (end - name < 2)
+        return false;
+      e->skip_worktree = (be16 (name) & INDEX_XFLAG_SKIP_WORKTREE) != 0;
+      name += 2;
+    }
+
+    strip = 0;
+    if (version == 4)
+    {
+      if (name >= end)
+        return false;
+      strip = *name & 0x7f;
+      while (*name++ & 0x80)
+      {
+        if (name >= end || strip > (uint64_t) prev)
+          return false;
+        strip = ((strip + 1) << 7) | (*name & 0x7f);
+      }
+      if (strip > (uint64_t) prev)
+        return false;
+    }
+
+    nul = memchr (name, '\0', end - name);
+    if (!nul)
+      return false;
+    len = nul - name;
+
+    /* the entry's path goes after the previous one in the pool */
+    e->path     = index->n_entries ? e[-1].path + e[-1].path_len : 0;
+    e->path_len = (version == 4 ? prev - (int) strip : 0) + len;
+    grow_paths (index, &alloc, e->path + e->path_len + 1);
+    if (version == 4 && index->n_entries)
+      memmove (index->paths + e->path, index->paths + e[-1].path,
+               prev - strip);
+    memcpy (index->paths + e->path + e->path_len - len, name, len);
+    prev = e->path_len;
+
+    if (version == 4)
+      p = nul + 1;
+    else
+      p += ((nul - p) + 8) & ~7;
+  }
+  return true;
+}
+
+static bool
+uses_sha256 (const CxPath *git_dir)
+{
+  CxPath file;
+  char * text;
+  bool   sha256;
+  int    len;
+
+  cx_path_dir_item (&file, git_dir, "config", 6);
+  text = read_file (file.str, &len);
+  sha256 = text && strstr (text, "objectformat = sha256");
+  free (text);
+  return sha256;
+}
+
+/* runs on the reader thread; a missing or unreadable index leaves every
+   entry untracked */
+static GitIndex *
+index_read (const CxPath *root)
+{
+  GitIndex *index;
+  CxPath    git_dir;
+  uint64_t  start;
+  void *    map;
+  int       fd;
+
+  start = cx_monotonic_ns ();
+  index = calloc (1, sizeof (GitIndex));
+  if (!index)
+    cx_die (errno, "failed to allocate memory");
+  if (!find_git_dir (root, &git_dir))
+    return index;
+  cx_path_dir_item (&index->file, &git_dir, "index", 5);
+
+  fd = open (index->file.str, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return index;
+  if (fstat (fd, &index->st) != 0 || index->st.st_size == 0)
+  {
+    close (fd);
+    return index;
+  }
+  map = mmap (NULL, index->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return index;
+
+  if (!parse_index (index, map, index->st.st_size,
+                    uses_sha256 (&git_dir) ? SHA256_SIZE : SHA1_SIZE))
+  {
+    cx_log (CX_LOG_STATUS_WARN, "cannot read the git index `%s'",
+            index->file.str);
+    index->n_entries = 0;
+  }
+  munmap (map, index->st.st_size);
+
+  read_ignores (index, root, &git_dir);
+  cx_log (CX_LOG_STATUS_DEBUG,
+          "read %d entries and %d ignore files from `%s' in %" PRIu64 " us",
+          index->n_entries, index->n_ignores, index->file.str,
+          (cx_monotonic_ns () - start) / 1000);
+  return index;
+}
+
+static void *
+reader_main (void *arg)
+{
+  GitRepo * repo;
+  GitIndex *index;
+
+  pthread_mutex_lock (&git.lock);
+  for (;;)
+  {
+    while (!git.pending && !git.stopping)
+      pthread_cond_wait (&git.work, &git.lock);
+    if (git.stopping)
+      break;
+
+    repo        = git.pending;
+    git.pending = repo->next_pending;
+    pthread_mutex_unlock (&git.lock);
+
+    index = index_read (&repo->root);
+
+    pthread_mutex_lock (&git.lock);
+    repo->loaded = index;
+    cx_event_wakeup (git.wake_fd);
+  }
+  pthread_mutex_unlock (&git.lock);
+  return NULL;
+}
+
+static void
+on_indexes_read (int fd, void *data)
+{
+  GitRepo *repo;
+  bool     changed = false;
+
+  pthread_mutex_lock (&git.lock);
+  for (repo = git.repos; repo; repo = repo->next)
+  {
+    if (!repo->loaded)
+      continue;
+    index_free (repo->index);
+    repo->index      = repo->loaded;
+    repo->loaded     = NULL;
+    repo->loading    = false;
+    repo->generation = ++git.generation;
+    changed          = true;
+  }
+  pthread_mutex_unlock (&git.lock);
+
+  if (changed && git.callback)
+    git.callback (git.data);
+}
+
+static void
+request_read (GitRepo *repo)
+{
+  if (!git.running)
+  {
+    git.wake_fd = cx_event_wakeup_new (on_indexes_read, NULL);
+    if (pthread_create (&git.reader, NULL, reader_main, NULL) != 0)
+      cx_die (0, "failed to start git index reader");
+    git.running = true;
+  }
+
+  repo->loading    = true;
+  repo->checked_ns = cx_monotonic_ns ();
+  pthread_mutex_lock (&git.lock);
+  repo->next_pending = git.pending;
+  git.pending        = repo;
+  pthread_cond_signal (&git.work);
+  pthread_mutex_unlock (&git.lock);
+}
+
+/* the innermost checkout holding `path', whose repository itself is left
+   alone */
+static GitRepo *
+find_repo (const CxPath *path)
+{
+  struct stat st;
+  GitRepo *   repo;
+  CxPath      dir;
+  CxPath      dot_git;
+
+  if (strstr (path->str, "/" GIT_DIR_NAME "/") ||
+      (path->len >= 5 &&
+       cx_streq (path->str + path->len - 5, "/" GIT_DIR_NAME)))
+    return NULL;
+
+  cx_path_init_copy (&dir, path);
+  for (;;)
+  {
+    for (repo = git.repos; repo; repo = repo->next)
+      if (cx_strneq (repo->root.str, repo->root.len, dir.str, dir.len))
+        return repo;
+
+    cx_path_dir_item (&dot_git, &dir, GIT_DIR_NAME, strlen (GIT_DIR_NAME));
+    if (lstat (dot_git.str, &st) == 0)
+      break;
+    if (cx_path_is_root (&dir))
+      return NULL;
+    cx_path_init_parent_of (&dir);
+  }
+
+  repo = calloc (1, sizeof (GitRepo));
+  if (!repo)
+    cx_die (errno, "failed to allocate memory");
+  cx_path_init_copy (&repo->root, &dir);
+
+  pthread_mutex_lock (&git.lock);
+  repo->next = git.repos;
+  git.repos  = repo;
+  pthread_mutex_unlock (&git.lock);
+
+  cx_log (CX_LOG_STATUS_DEBUG, "`%s' is in the git checkout `%s'", path->str,
+          repo->root.str);
+  request_read (repo);
+  return repo;
+}
+
+/* reads the index again once it has been rewritten */
+static void
+check_index (GitRepo *repo)
+{
+  const GitIndex *index = repo->index;
+  struct stat     st;
+  uint64_t        now;
+
+  now = cx_monotonic_ns ();
+  if (repo->loading || now - repo->checked_ns < INDEX_CHECK_NS)
+    return;
+  repo->checked_ns = now;
+
+  if (stat (index->file.str, &st) != 0)
+    memset (&st, 0, sizeof (st));
+  if (st.st_ino != index->st.st_ino || st.st_size != index->st.st_size ||
+      st.st_mtime != index->st.st_mtime)
+    request_read (repo);
+}
+
+static const GitEntry *
+find_entry (const GitIndex *index, const char *path, int len, bool prefix)
+{
+  const GitEntry *e;
+  int             lo = 0;
+  int             hi = index->n_entries;
+  int             mid;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    e   = &index->entries[mid];
+    if (compare_paths (index->paths + e->path, e->path_len, path, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == index->n_entries)
+    return NULL;
+
+  e = &index->entries[lo];
+  if (prefix ? e->path_len > len && !memcmp (index->paths + e->path, path, len)
+             : cx_strneq (index->paths + e->path, e->path_len, path, len))
+    return e;
+  return NULL;
+}
+
+static const GitIgnore *
+find_ignore (const GitIndex *index, const char *base, int base_len)
+{
+  int lo = 0;
+  int hi = index->n_ignores;
+  int mid;
+  int cmp;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    cmp = compare_paths (index->ignores[mid].base, index->ignores[mid].base_len,
+                         base, base_len);
+    if (cmp == 0)
+      return &index->ignores[mid];
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+/* the last rule that matches wins; -1 when none does */
+static int
+match_rules (const GitIgnore *ig, const char *path, bool is_dir, int result)
+{
+  const char *rel  = path + ig->base_len;
+  const char *name = strrchr (rel, '/');
+  int         i;
+
+  name = name ? name + 1 : rel;
+  for (i = 0; i < ig->n_rules; ++i)
+  {
+    if (ig->rules[i].dir_only && !is_dir)
+      continue;
+    if (fnmatch (ig->rules[i].pattern, ig->rules[i].anchored ? rel : name,
+                 ig->rules[i].anchored ? FNM_PATHNAME : 0) == 0)
+      result = !ig->rules[i].negate;
+  }
+  return result;
+}
+
+/* ignore files deeper down take precedence, so they are tried last */
+static bool
+is_ignored (const GitIndex *index, const char *path, int len, bool is_dir)
+{
+  const GitIgnore *ig;
+  int              result;
+  int              i;
+
+  result = match_rules (&index->exclude, path, is_dir, -1);
+  for (i = 0; i <= len; ++i)
+  {
+    if (i > 0 && path[i - 1] != '/')
+      continue;
+    ig = find_ignore (index, path, i);
+    if (ig)
+      result = match_rules (ig, path, is_dir, result);
+  }
+  return result == 1;
+}
+
+static bool
+entry_changed (const GitEntry *e, const struct stat *st)
+{
+  if (e->conflicted)
+    return true;
+  if (e->skip_worktree)
+    return false;
+  if ((e->mode & S_IFMT) == GITLINK_MODE)
+    return !S_ISDIR (st->st_mode);
+  if ((e->mode & S_IFMT) != (st->st_mode & S_IFMT) ||
+      (S_ISREG (st->st_mode) && (e->mode & 0100) != (st->st_mode & 0100)))
+    return true;
+  return e->mtime != (uint32_t) st->st_mtime ||
+         e->ctime != (uint32_t) st->st_ctime ||
+         e->size != (uint32_t) st->st_size ||
+         e->ino != (uint32_t) st->st_ino;
+}
+
+/* Entries in the index compare their stat data, just as `git status'
+   does before it looks at contents; anything else is untracked unless an
+   ignore file, or that of a directory above it, says otherwise. */
+static void
+annotate (const GitIndex *index, CxDirListing *listing, int root_len)
+{
+  const GitEntry *e;
+  CxDirItem *     item;
+  char            path[CX_PATHMAX];
+  bool            dir_ignored;
+  bool            is_dir;
+  int             rel_len;
+  int             len;
+  int             i;
+
+  rel_len = listing->path->len - root_len;
+  memcpy (path, listing->path->str + root_len, rel_len);
+  if (rel_len > 0)
+    path[rel_len++] = '/';
+  path[rel_len] = '\0';
+
+  dir_ignored = false;
+  for (i = 1; i < rel_len && !dir_ignored; ++i)
+  {
+    if (path[i] != '/')
+      continue;
+    path[i]     = '\0';
+    dir_ignored = is_ignored (index, path, i, true);
+    path[i]     = '/';
+  }
+
+  i = cx_dir_listing_has_parent_item (listing) ? 1 : 0;
+  for (; i < listing->total; ++i)
+  {
+    item = cx_dir_listing_item (listing, i);
+    len  = rel_len + item->name_len;
+    if (item->info.error != 0 || len + 1 >= CX_PATHMAX ||
+        (rel_len == 0 && cx_streq (item->name, GIT_DIR_NAME)))
+    {
+      item->git_status = CX_GIT_STATUS_NONE;
+      continue;
+    }
+    memcpy (path + rel_len, item->name, item->name_len);
+    path[len] = '\0';
+    is_dir    = item->info.type == CX_FILE_TYPE_DIRECTORY;
+
+    e = find_entry (index, path, len, false);
+    if (e)
+    {
+      item->git_status = entry_changed (e, &item->info.st)
+                           ? CX_GIT_STATUS_MODIFIED
+                           : CX_GIT_STATUS_CLEAN;
+      continue;
+    }
+
+    path[len] = '/';
+    if (is_dir && find_entry (index, path, len + 1, true))
+      item->git_status = CX_GIT_STATUS_CLEAN;
+    else
+    {
+      path[len]        = '\0';
+      item->git_status = dir_ignored || is_ignored (index, path, len, is_dir)
+                           ? CX_GIT_STATUS_IGNORED
+                           : CX_GIT_STATUS_UNTRACKED;
+    }
+  }
+}
+
+void
+cx_git_init (CxGitCallback callback, void *data)
+{
+  git.callback = callback;
+  git.data     = data;
+}
+
+void
+cx_git_finish (void)
+{
+  GitRepo *repo;
+
+  if (git.running)
+  {
+    pthread_mutex_lock (&git.lock);
+    git.stopping = true;
+    pthread_cond_signal (&git.work);
+    pthread_mutex_unlock (&git.lock);
+    pthread_join (git.reader, NULL);
+    cx_event_wakeup_free (git.wake_fd);
+    git.running  = false;
+    git.stopping = false;
+    git.pending  = NULL;
+  }
+
+  while ((repo = git.repos))
+  {
+    git.repos = repo->next;
+    index_free (repo->index);
+    index_free (repo->loaded);
+    free (repo);
+  }
+  git.callback = NULL;
+}
+
+/* `git_generation' is -1 until the listing's checkout has been looked
+   for, 0 when it is in none, and otherwise which read of the index its
+   items' statuses came from */
+void
+cx_git_annotate (CxDirListing *listing)
+{
+  GitRepo *repo;
+  int      root_len;
+
+  if (listing->git_generation == 0)
+    return;
+  if (listing->git_generation < 0 && !listing->git_repo)
+  {
+    listing->git_repo =
+      cx_path_is_elided (listing->path) ? NULL : find_repo (listing->path);
+    if (!listing->git_repo)
+    {
+      listing->git_generation = 0;
+      return;
+    }
+  }
+
+  repo = listing->git_repo;
+  if (!repo->index)
+    return;
+  check_index (repo);
+  if (listing->git_generation == repo->generation)
+    return;
+
+  root_len = cx_path_is_root (&repo->root) ? 1 : repo->root.len + 1;
+  if (listing->path->len < root_len)
+    root_len = listing->path->len;
+  annotate (repo->index, listing, root_len);
+  listing->git_generation = repo->generation;
+}
@@ -0,0 +1,28 @@
+#ifndef __CX_GIT_H__
+#define __CX_GIT_H__
+
+#include "files.h"
+
+typedef enum
+{
+  CX_GIT_STATUS_NONE,
+  CX_GIT_STATUS_CLEAN,
+  CX_GIT_STATUS_MODIFIED,
+  CX_GIT_STATUS_UNTRACKED,
+  CX_GIT_STATUS_IGNORED
+} CxGitStatus;
+
+/* Called on the main thread whenever the index of a checkout has been
+   read, so that statuses worked out from the old one can be redrawn. */
+typedef void (*CxGitCallback) (void *data);
+
+void cx_git_init (CxGitCallback callback, void *data);
+void cx_git_finish (void);
+
+/* Sets the `git_status' of each item of a listing read from a directory
+   in a git checkout. The index is read in the background the first time
+   the checkout is seen and again whenever it changes; until it has been
+   read the items are left as they are. */
+void cx_git_annotate (CxDirListing *listing);
+
+#endif /* __CX_GIT_H__ */
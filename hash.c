@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define PRIME1 UINT64_C (0x9e3779b185ebca87)
+#define PRIME2 UINT64_C (0xc2b2ae3d27d4eb4f)
+#define PRIME3 UINT64_C (0x165667b19e3779f9)
+#define PRIME4 UINT64_C (0x85ebca77c2b2ae63)
+#define PRIME5 UINT64_C (0x27d4eb2f165667c5)
+
+#define ROTL(__x, __r) (((__x) << (__r)) | ((__x) >> (64 - (__r))))
+
+/* native byte order; the hashes are only ever compared with each other */
+static uint64_t
+read64 (const uint8_t *p)
+{
+  uint64_t v;
+
+  memcpy (&v, p, sizeof (v));
+  return v;
+}
+
+static uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy (&v, p, sizeof (v));
+  return v;
+}
+
+static uint64_t
+round64 (uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME2;
+  acc = ROTL (acc, 31);
+  return acc * PRIME1;
+}
+
+static uint64_t
+merge64 (uint64_t h, uint64_t acc)
+{
+  h ^= round64 (0, acc);
+  return h * PRIME1 + PRIME4;
+}
+
+static void
+consume_stripe (CxHash64 *h, const uint8_t *p)
+{
+  h->acc[0] = round64 (h->acc[0], read64 (p));
+  h->acc[1] = round64 (h->acc[1], read64 (p + 8));
+  h->acc[2] = round64 (h->acc[2], read64 (p + 16));
+  h->acc[3] = round64 (h->acc[3], read64 (p + 24));
+}
+
+void
+cx_hash64_init (CxHash64 *h)
+{
+  memset (h, 0, sizeof (*h));
+  h->acc[0] = PRIME1 + PRIME2;
+  h->acc[1] = PRIME2;
+  h->acc[2] = 0;
+  h->acc[3] = -PRIME1;
+}
+
+void
+cx_hash64_update (CxHash64 *h, const void *data, size_t len)
+{
+  const uint8_t *p   = data;
+  const uint8_t *end = p + len;
+  size_t         n;
+
+  h->total_len += len;
+
+  if (h->buf_len > 0)
+  {
+    n = sizeof (h->buf) - h->buf_len;
+    if (len < n)
+    {
+      memcpy (h->buf + h->buf_len, p, len);
+      h->buf_len += len;
+      return;
+    }
+    memcpy (h->buf + h->buf_len, p, n);
+    consume_stripe (h, h->buf);
+    h->buf_len = 0;
+    p += n;
+  }
+
+  for (; end - p >= 32; p += 32)
+    consume_stripe (h, p);
+
+  memcpy (h->buf, p, end - p);
+  h->buf_len = end - p;
+}
+
+uint64_t
+cx_hash64_digest (const CxHash64 *h)
+{
+  const uint8_t *p   = h->buf;
+  const uint8_t *end = p + h->buf_len;
+  uint64_t       v;
+
+  if (h->total_len >= 32)
+  {
+    v = ROTL (h->acc[0], 1) + ROTL (h->acc[1], 7) + ROTL (h->acc[2], 12) +
+        ROTL (h->acc[3], 18);
+    v = merge64 (v, h->acc[0]);
+    v = merge64 (v, h->acc[1]);
+    v = merge64 (v, h->acc[2]);
+    v = merge64 (v, h->acc[3]);
+  }
+  else
+    v = PRIME5;
+
+  v += h->total_len;
+
+  for (; end - p >= 8; p += 8)
+  {
+    v ^= round64 (0, read64 (p));
+    v = ROTL (v, 27) * PRIME1 + PRIME4;
+  }
+  if (end - p >= 4)
+  {
+    v ^= (uint64_t) read32 (p) * PRIME1;
+    v = ROTL (v, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+  {
+    v ^= *p * PRIME5;
+    v = ROTL (v, 11) * PRIME1;
+  }
+
+  v ^= v >> 33;
+  v *= PRIME2;
+  v ^= v >> 29;
+  v *= PRIME3;
+  v ^= v >> 32;
+  return v;
+}
+
+uint64_t
+cx_hash64 (const void *data, size_t len)
+{
+  CxHash64 h;
+
+  cx_hash64_init (&h);
+  cx_hash64_update (&h, data, len);
+  return cx_hash64_digest (&h);
+}
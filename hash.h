@@ -0,0 +1,23 @@
+#ifndef __CX_HASH_H__
+#define __CX_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A fast non-cryptographic 64-bit hash (the XXH64 construction) that can be
+   fed a file a buffer at a time. */
+typedef struct
+{
+  uint64_t acc[4];
+  uint64_t total_len;
+  uint8_t  buf[32];
+  int      buf_len;
+} CxHash64;
+
+void     cx_hash64_init (CxHash64 *h);
+void     cx_hash64_update (CxHash64 *h, const void *data, size_t len);
+uint64_t cx_hash64_digest (const CxHash64 *h);
+
+uint64_t cx_hash64 (const void *data, size_t len);
+
+#endif /* __CX_HASH_H__ */
@@ -0,0 +1,555 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cx.h"
+#include "jump.h"
+#include "log.h"
+#include "util.h"
+
+#define JUMP_FILENAME "." CX_PROGRAM_NAME ".jump"
+#define RECORD_MAGIC UINT32_C (0x314a5843) /* "CXJ1" */
+#define RECORD_ALIGN 8
+
+#define HOUR_SEC 3600
+#define DAY_SEC (24 * HOUR_SEC)
+#define WEEK_SEC (7 * DAY_SEC)
+
+/* the log is rewritten with one record per directory once it holds
+   COMPACT_RATIO times as many records as directories; visit counts are
+   scaled down whenever their sum passes AGING_MAX */
+#define COMPACT_RATIO 2
+#define COMPACT_MIN_RECORDS 64
+#define AGING_MAX 10000
+
+/* followed by the path, zero padded to RECORD_ALIGN */
+typedef struct
+{
+  uint32_t magic;
+  uint32_t path_len;
+  uint32_t count;
+  uint32_t reserved;
+  int64_t  time;
+} Record;
+
+typedef struct
+{
+  const char *path;
+  uint32_t    path_len;
+  uint32_t    count;
+  int64_t     time;
+} Entry;
+
+/* A rewrite of the file: `records' are those folded into the table, one
+   per directory, to be kept if the directory still exists; whatever was
+   appended past `folded' in the meantime is carried over as it is. */
+typedef struct
+{
+  char * records;
+  size_t size;
+  size_t folded;
+  dev_t  dev;
+  ino_t  ino;
+} Compaction;
+
+/* Visits are appended to the file one record at a time, so recording one
+   never reads the database. It is only mapped and folded into a table,
+   keyed by path and pointing into the mapping, while the prompt is open.
+   Appends hold a shared lock on the file, and the few steps of reading
+   it or replacing it that must not miss one hold an exclusive one. */
+static struct
+{
+  CxPath   file;
+  int      fd;
+  bool     recording;
+  bool     compacting;
+  char *   map;
+  size_t   map_size;
+  Entry *  table;
+  int      n_slots;
+  int      n_entries;
+  int      n_records;
+  uint64_t total_count;
+} jump = {
+  .fd = -1,
+};
+
+static size_t
+record_size (uint32_t path_len)
+{
+  return sizeof (Record) +
+         ((path_len + RECORD_ALIGN - 1) & ~(size_t) (RECORD_ALIGN - 1));
+}
+
+static size_t
+encode_record (char *buf, const char *path, uint32_t path_len,
+               uint32_t count, int64_t time)
+{
+  Record rec;
+  size_t size = record_size (path_len);
+
+  memset (&rec, 0, sizeof (rec));
+  rec.magic    = RECORD_MAGIC;
+  rec.path_len = path_len;
+  rec.count    = count;
+  rec.time     = time;
+
+  memcpy (buf, &rec, sizeof (rec));
+  memcpy (buf + sizeof (rec), path, path_len);
+  memset (buf + sizeof (rec) + path_len, 0,
+          size - sizeof (rec) - path_len);
+  return size;
+}
+
+static void
+init_file (void)
+{
+  if (jump.file.len == 0)
+    cx_path_set_as_user_file (&jump.file, JUMP_FILENAME);
+}
+
+/* only the interactive program records visits, never the benchmark or a
+   replayed session */
+void
+cx_jump_init (void)
+{
+  jump.recording = true;
+}
+
+static bool
+same_file (int fd, const char *path)
+{
+  struct stat a;
+  struct stat b;
+
+  return fstat (fd, &a) == 0 && lstat (path, &b) == 0 &&
+         a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+/* Locks the file that is there now for appending: another instance may
+   have compacted it, leaving `jump.fd' on the unlinked old one. Each retry
+   means yet another compaction got in first. */
+static bool
+lock_for_append (void)
+{
+  for (;;)
+  {
+    if (jump.fd == -1)
+    {
+      jump.fd = cx_path_open_user_file (jump.file.str,
+                                        O_WRONLY | O_APPEND | O_CREAT);
+      if (jump.fd == -1)
+        return false;
+    }
+    if (flock (jump.fd, LOCK_SH) != 0)
+      return false;
+    if (same_file (jump.fd, jump.file.str))
+      return true;
+    close (jump.fd);
+    jump.fd = -1;
+  }
+}
+
+void
+cx_jump_visit (const CxPath *path)
+{
+  char   buf[sizeof (Record) + CX_PATHMAX + RECORD_ALIGN];
+  size_t size;
+
+  /* one too deep to look up could not be jumped back to */
+  if (!jump.recording || cx_path_is_elided (path))
+    return;
+
+  init_file ();
+  if (!lock_for_append ())
+  {
+    cx_log (CX_LOG_STATUS_WARN, "failed to open `%s' - %s", jump.file.str,
+            strerror (errno));
+    jump.recording = false;
+    return;
+  }
+
+  /* one write, so concurrent instances never interleave a record */
+  size = encode_record (buf, path->str, path->len, 1, time (NULL));
+  if (write (jump.fd, buf, size) != (ssize_t) size)
+    cx_log (CX_LOG_STATUS_WARN, "failed to record visit to `%s' - %s",
+            path->str, strerror (errno));
+  flock (jump.fd, LOCK_UN);
+}
+
+static uint32_t
+hash_path (const char *path, uint32_t path_len)
+{
+  uint32_t h = UINT32_C (2166136261);
+  uint32_t i;
+
+  for (i = 0; i < path_len; ++i)
+    h = (h ^ (unsigned char) path[i]) * UINT32_C (16777619);
+  return h;
+}
+
+static void
+add_visits (const char *path, uint32_t path_len, uint32_t count, int64_t time)
+{
+  Entry *e;
+  int    i;
+
+  i = hash_path (path, path_len) & (jump.n_slots - 1);
+  for (;; i = (i + 1) & (jump.n_slots - 1))
+  {
+    e = &jump.table[i];
+    if (!e->path)
+    {
+      e->path     = path;
+      e->path_len = path_len;
+      ++jump.n_entries;
+      break;
+    }
+    if (cx_strneq (e->path, e->path_len, path, path_len))
+      break;
+  }
+
+  e->count += count;
+  if (time > e->time)
+    e->time = time;
+  jump.total_count += count;
+}
+
+static bool
+is_dir (const char *path, uint32_t path_len)
+{
+  struct stat st;
+  CxPath      p;
+
+  cx_path_init (&p, path, path_len);
+  return stat (p.str, &st) == 0 && S_ISDIR (st.st_mode);
+}
+
+static bool
+record_valid (const Record *rec, size_t off, size_t end)
+{
+  return rec->magic == RECORD_MAGIC && rec->path_len > 0 &&
+         rec->path_len < CX_PATHMAX && off + record_size (rec->path_len) <= end;
+}
+
+/* The records appended since the file was folded, up to a torn one. */
+static bool
+copy_tail (int fd, size_t from, size_t to, FILE *fp)
+{
+  const Record *rec;
+  char *        buf;
+  size_t        off;
+  bool          ok;
+
+  if (to <= from)
+    return true;
+  buf = malloc (to - from);
+  if (!buf)
+    cx_die (errno, "failed to allocate memory");
+
+  ok = pread (fd, buf, to - from, from) == (ssize_t) (to - from);
+  for (off = 0; ok && off + sizeof (Record) <= to - from;
+       off += record_size (rec->path_len))
+  {
+    rec = (const Record *) (buf + off);
+    if (!record_valid (rec, off, to - from))
+      break;
+    fwrite (rec, 1, record_size (rec->path_len), fp);
+  }
+  free (buf);
+  return ok;
+}
+
+/* Rewrites the file as one record per directory that still exists. The
+   directories are looked up first, unlocked; then, under the lock, what
+   was appended since is carried over and the new file takes the old one's
+   place, unless another instance has replaced it already. */
+static void *
+compact_main (void *arg)
+{
+  Compaction *  c = arg;
+  const Record *rec;
+  struct stat   st;
+  char          tmp[CX_PATHMAX + 32];
+  FILE *        fp;
+  size_t        off;
+  bool          ok;
+  int           fd;
+
+  snprintf (tmp, sizeof (tmp), "%s.%ld.tmp", jump.file.str, (long) getpid ());
+  unlink (tmp);
+  fd = cx_path_open_user_file (tmp, O_WRONLY | O_CREAT | O_EXCL);
+  fp = fd == -1 ? NULL : fdopen (fd, "w");
+  if (!fp)
+  {
+    if (fd != -1)
+      close (fd);
+    cx_log (CX_LOG_STATUS_WARN, "failed to compact `%s' - %s", jump.file.str,
+            strerror (errno));
+    goto out;
+  }
+
+  for (off = 0; off < c->size; off += record_size (rec->path_len))
+  {
+    rec = (const Record *) (c->records + off);
+    if (is_dir ((const char *) (rec + 1), rec->path_len))
+      fwrite (rec, 1, record_size (rec->path_len), fp);
+  }
+
+  fd = cx_path_open_user_file (jump.file.str, O_RDONLY);
+  ok = fd != -1 && flock (fd, LOCK_EX) == 0 && fstat (fd, &st) == 0;
+  if (ok && (st.st_dev != c->dev || st.st_ino != c->ino ||
+             !same_file (fd, jump.file.str)))
+  {
+    cx_log (CX_LOG_STATUS_DEBUG, "`%s' was compacted elsewhere",
+            jump.file.str);
+    fclose (fp);
+    unlink (tmp);
+    close (fd);
+    goto out;
+  }
+  ok = ok && copy_tail (fd, c->folded, st.st_size, fp);
+  if (fclose (fp) != 0 || !ok || rename (tmp, jump.file.str) != 0)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "failed to compact `%s' - %s", jump.file.str,
+            strerror (errno));
+    unlink (tmp);
+  }
+  if (fd != -1)
+    close (fd);
+
+out:
+  free (c->records);
+  free (c);
+  __atomic_store_n (&jump.compacting, false, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* hands the table's directories, aged if need be, to a thread to look
+   up, so opening the prompt never waits for them */
+static void
+start_compaction (const struct stat *st)
+{
+  Compaction *c;
+  pthread_t   thread;
+  Entry *     e;
+  bool        aging;
+  int         i;
+
+  if (__atomic_exchange_n (&jump.compacting, true, __ATOMIC_ACQUIRE))
+    return;
+
+  c = malloc (sizeof (Compaction));
+  if (c)
+    c->records = malloc (jump.map_size);
+  if (!c || !c->records)
+    cx_die (errno, "failed to allocate memory");
+  c->size   = 0;
+  c->folded = jump.map_size;
+  c->dev    = st->st_dev;
+  c->ino    = st->st_ino;
+
+  /* no more directories than records, so they fit in as much */
+  aging = jump.total_count > AGING_MAX;
+  for (i = 0; i < jump.n_slots; ++i)
+  {
+    e = &jump.table[i];
+    if (!e->path)
+      continue;
+    if (aging && e->count * 9 / 10 == 0)
+      continue;
+    c->size += encode_record (c->records + c->size, e->path, e->path_len,
+                              aging ? e->count * 9 / 10 : e->count, e->time);
+  }
+
+  if (pthread_create (&thread, NULL, compact_main, c) != 0)
+  {
+    free (c->records);
+    free (c);
+    __atomic_store_n (&jump.compacting, false, __ATOMIC_RELEASE);
+    return;
+  }
+  pthread_detach (thread);
+}
+
+void
+cx_jump_open (void)
+{
+  const Record *rec;
+  struct stat   st;
+  size_t        off;
+  bool          torn = false;
+  int           fd;
+
+  cx_jump_close ();
+  init_file ();
+
+  /* no record is half written while the size is taken */
+  fd = cx_path_open_user_file (jump.file.str, O_RDONLY);
+  if (fd == -1)
+    return;
+  flock (fd, LOCK_EX);
+  if (fstat (fd, &st) == 0 && st.st_size >= (off_t) sizeof (Record))
+  {
+    jump.map_size = st.st_size;
+    jump.map      =
+      mmap (NULL, jump.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (jump.map == MAP_FAILED)
+      jump.map = NULL;
+  }
+  close (fd);
+  if (!jump.map)
+    return;
+
+  jump.n_slots = 16;
+  while ((size_t) jump.n_slots < 2 * (jump.map_size / sizeof (Record)))
+    jump.n_slots *= 2;
+  jump.table = calloc (jump.n_slots, sizeof (Entry));
+  if (!jump.table)
+    cx_die (errno, "failed to allocate memory");
+
+  for (off = 0; off + sizeof (Record) <= jump.map_size;
+       off += record_size (rec->path_len))
+  {
+    rec = (const Record *) (jump.map + off);
+    if (!record_valid (rec, off, jump.map_size))
+    {
+      /* a torn write at the end; compaction drops it */
+      cx_log (CX_LOG_STATUS_WARN, "ignoring `%s' past offset %zu",
+              jump.file.str, off);
+      torn = true;
+      break;
+    }
+    add_visits ((const char *) (rec + 1), rec->path_len, rec->count,
+                rec->time);
+    ++jump.n_records;
+  }
+
+  if (torn || (jump.n_records >= COMPACT_MIN_RECORDS &&
+               (jump.n_records >= COMPACT_RATIO * jump.n_entries ||
+                jump.total_count > AGING_MAX)))
+    start_compaction (&st);
+}
+
+void
+cx_jump_close (void)
+{
+  free (jump.table);
+  if (jump.map)
+    munmap (jump.map, jump.map_size);
+
+  jump.table       = NULL;
+  jump.map         = NULL;
+  jump.map_size    = 0;
+  jump.n_slots     = 0;
+  jump.n_entries   = 0;
+  jump.n_records   = 0;
+  jump.total_count = 0;
+}
+
+static bool
+is_subsequence (const char *s, int s_len, const char *q, int q_len)
+{
+  int i;
+  int j;
+
+  for (i = 0, j = 0; i < s_len && j < q_len; ++i)
+    if (tolower ((unsigned char) s[i]) == tolower ((unsigned char) q[j]))
+      ++j;
+  return j == q_len;
+}
+
+static bool
+contains (const char *s, int s_len, const char *q, int q_len)
+{
+  int i;
+
+  for (i = 0; i + q_len <= s_len; ++i)
+    if (strncasecmp (s + i, q, q_len) == 0)
+      return true;
+  return false;
+}
+
+/* zero unless the query's characters appear in order in the path; better
+   when they all fall in the last component, or appear contiguously */
+static double
+match_quality (const Entry *e, const char *q, int q_len)
+{
+  const char *base = e->path + e->path_len;
+  double      quality;
+
+  if (!is_subsequence (e->path, e->path_len, q, q_len))
+    return 0.0;
+
+  while (base > e->path && base[-1] != '/')
+    --base;
+
+  quality = 1.0;
+  if (is_subsequence (base, e->path + e->path_len - base, q, q_len))
+    quality *= 4.0;
+  if (contains (e->path, e->path_len, q, q_len))
+    quality *= 2.0;
+  return quality;
+}
+
+static double
+frecency (const Entry *e, int64_t now)
+{
+  int64_t age = now - e->time;
+
+  if (age < HOUR_SEC)
+    return e->count * 4.0;
+  if (age < DAY_SEC)
+    return e->count * 2.0;
+  if (age < WEEK_SEC)
+    return e->count * 0.5;
+  return e->count * 0.25;
+}
+
+/* the best `max_matches' directories for `query', best first */
+int
+cx_jump_query (const char *query, int query_len, CxJumpMatch *matches,
+               int max_matches)
+{
+  const Entry *e;
+  int64_t      now = time (NULL);
+  double       score;
+  int          n   = 0;
+  int          i;
+  int          j;
+
+  for (i = 0; i < jump.n_slots; ++i)
+  {
+    e = &jump.table[i];
+    if (!e->path)
+      continue;
+
+    score = match_quality (e, query, query_len);
+    if (score == 0.0)
+      continue;
+    score *= frecency (e, now);
+
+    for (j = n; j > 0 && matches[j - 1].score < score; --j)
+      if (j < max_matches)
+        matches[j] = matches[j - 1];
+    if (j == max_matches)
+      continue;
+
+    cx_path_init (&matches[j].path, e->path, e->path_len);
+    matches[j].score = score;
+    if (n < max_matches)
+      ++n;
+  }
+  return n;
+}
@@ -0,0 +1,20 @@
+#ifndef __CX_JUMP_H__
+#define __CX_JUMP_H__
+
+#include "path.h"
+
+typedef struct
+{
+  CxPath path;
+  double score;
+} CxJumpMatch;
+
+void cx_jump_init (void);
+void cx_jump_visit (const CxPath *path);
+
+void cx_jump_open (void);
+int  cx_jump_query (const char *query, int query_len, CxJumpMatch *matches,
+                    int max_matches);
+void cx_jump_close (void);
+
+#endif /* __CX_JUMP_H__ */
@@ -0,0 +1,299 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cx.h"
+#include "log.h"
+#include "path.h"
+#include "ui.h"
+#include "util.h"
+
+#define LOG_FILENAME "." CX_PROGRAM_NAME ".log"
+#define LOG_LEVEL_ENV "CX_LOG_LEVEL"
+
+#define RING_SLOTS 1024 /* must be a power of two */
+#define SLOT_SIZE 256
+#define FLUSH_BUFSIZE 65536
+#define FLUSH_INTERVAL_SEC 1
+
+extern const char *g_program_name;
+
+typedef struct
+{
+  uint64_t seq;
+  int      len;
+  char     buf[SLOT_SIZE];
+} Slot;
+
+#ifdef CX_DEBUG_MODE
+CxLogStatus g_log_level = CX_LOG_STATUS_DEBUG;
+#else
+CxLogStatus g_log_level = CX_LOG_STATUS_WARN;
+#endif
+
+/* A bounded multi-producer ring: producers claim a slot by advancing `head'
+   and publish it by bumping the slot's sequence number, so formatting a
+   message never takes a lock. Only flushing, which is rare, is serialized. */
+static struct
+{
+  Slot            slots[RING_SLOTS];
+  uint64_t        head;
+  uint64_t        tail;
+  uint64_t        dropped;
+  pthread_once_t  once;
+  pthread_mutex_t flush_lock;
+  pthread_mutex_t wake_lock;
+  pthread_cond_t  wake;
+  pthread_t       flusher;
+  int             fd;
+} logger = {
+  .once       = PTHREAD_ONCE_INIT,
+  .flush_lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake_lock  = PTHREAD_MUTEX_INITIALIZER,
+  .wake       = PTHREAD_COND_INITIALIZER,
+  .fd         = -1,
+};
+
+static int
+write_all (const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = write (logger.fd, buf, len);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+void
+cx_log_flush (void)
+{
+  static char buf[FLUSH_BUFSIZE];
+  uint64_t    dropped;
+  Slot *      slot;
+  size_t      len;
+  uint64_t    pos;
+
+  pthread_mutex_lock (&logger.flush_lock);
+
+  len = 0;
+  pos = logger.tail;
+  for (;;)
+  {
+    slot = &logger.slots[pos & (RING_SLOTS - 1)];
+    if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+      break;
+
+    if (len + slot->len > sizeof (buf))
+    {
+      if (logger.fd != -1)
+        write_all (buf, len);
+      len = 0;
+    }
+    memcpy (buf + len, slot->buf, slot->len);
+    len += slot->len;
+
+    __atomic_store_n (&slot->seq, pos + RING_SLOTS, __ATOMIC_RELEASE);
+    ++pos;
+  }
+  __atomic_store_n (&logger.tail, pos, __ATOMIC_RELEASE);
+
+  dropped = __atomic_exchange_n (&logger.dropped, 0, __ATOMIC_RELAXED);
+  if (dropped > 0 && len + CX_SMALL_BUFMAX <= sizeof (buf))
+    len += snprintf (buf + len, CX_SMALL_BUFMAX,
+                     "WARNING: log ring full, dropped %llu messages\n",
+                     (unsigned long long) dropped);
+
+  if (len > 0 && logger.fd != -1)
+    write_all (buf, len);
+
+  pthread_mutex_unlock (&logger.flush_lock);
+}
+
+static bool
+ring_empty (void)
+{
+  return __atomic_load_n (&logger.head, __ATOMIC_RELAXED) ==
+         __atomic_load_n (&logger.tail, __ATOMIC_RELAXED);
+}
+
+/* sleeps for good while nothing is logged; otherwise batches whatever
+   arrives within an interval into one flush */
+static void *
+flusher_main (void *arg)
+{
+  struct timespec deadline;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&logger.wake_lock);
+    while (ring_empty ())
+      pthread_cond_wait (&logger.wake, &logger.wake_lock);
+    clock_gettime (CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += FLUSH_INTERVAL_SEC;
+    pthread_cond_timedwait (&logger.wake, &logger.wake_lock, &deadline);
+    pthread_mutex_unlock (&logger.wake_lock);
+    cx_log_flush ();
+  }
+  return NULL;
+}
+
+static void
+open_log_file (void)
+{
+  CxPath   path;
+  uint64_t i;
+
+  for (i = 0; i < RING_SLOTS; ++i)
+    logger.slots[i].seq = i;
+
+  cx_path_set_as_user_file (&path, LOG_FILENAME);
+  logger.fd =
+    cx_path_open_user_file (path.str, O_WRONLY | O_APPEND | O_CREAT);
+  if (logger.fd == -1)
+    return;
+
+  if (pthread_create (&logger.flusher, NULL, flusher_main, NULL) == 0)
+    pthread_detach (logger.flusher);
+  atexit (cx_log_flush);
+}
+
+void
+cx_log_init (void)
+{
+  static const char *names[] = { "debug", "info", "warn", "error", "none" };
+
+  const char *level = getenv (LOG_LEVEL_ENV);
+  int         i;
+
+  if (!level || !*level)
+    return;
+
+  for (i = 0; i <= CX_LOG_STATUS_NONE; ++i)
+  {
+    if (cx_streq (level, names[i]))
+    {
+      g_log_level = i;
+      return;
+    }
+  }
+}
+
+void
+cx_log_write (CxLogStatus status, const char *fmt, ...)
+{
+  static const char *prefixes[] = { "DEBUG: ", "INFO: ", "WARNING: ",
+                                    "ERROR: " };
+
+  va_list  ap;
+  Slot *   slot;
+  uint64_t pos;
+  uint64_t seq;
+  int      len;
+  int      n;
+
+  pthread_once (&logger.once, open_log_file);
+
+  pos = __atomic_load_n (&logger.head, __ATOMIC_RELAXED);
+  for (;;)
+  {
+    slot = &logger.slots[pos & (RING_SLOTS - 1)];
+    seq  = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == pos)
+    {
+      if (__atomic_compare_exchange_n (&logger.head, &pos, pos + 1, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if ((int64_t) (seq - pos) < 0)
+    {
+      /* never block the caller on a slow disk */
+      __atomic_add_fetch (&logger.dropped, 1, __ATOMIC_RELAXED);
+      pthread_cond_signal (&logger.wake);
+      return;
+    }
+    else
+      pos = __atomic_load_n (&logger.head, __ATOMIC_RELAXED);
+  }
+
+  len = snprintf (slot->buf, SLOT_SIZE, "%s", prefixes[status]);
+
+  va_start (ap, fmt);
+  n = vsnprintf (slot->buf + len, SLOT_SIZE - len, fmt, ap);
+  va_end (ap);
+
+  len = (n < 0 || len + n >= SLOT_SIZE - 1) ? SLOT_SIZE - 1 : len + n;
+  slot->buf[len++] = '\n';
+  slot->len        = len;
+
+  __atomic_store_n (&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  /* wake the flusher when the ring stops being empty, and again when it is
+     filling up or something went wrong */
+  if (status == CX_LOG_STATUS_ERROR ||
+      pos == __atomic_load_n (&logger.tail, __ATOMIC_RELAXED) ||
+      pos - __atomic_load_n (&logger.tail, __ATOMIC_RELAXED) >= RING_SLOTS / 2)
+  {
+    pthread_mutex_lock (&logger.wake_lock);
+    pthread_cond_signal (&logger.wake);
+    pthread_mutex_unlock (&logger.wake_lock);
+  }
+}
+
+void
+cx_log_debug (const char *fmt, ...)
+{
+  char    msg[SLOT_SIZE];
+  va_list ap;
+
+  if (CX_LOG_STATUS_DEBUG < CX_LOG_STATUS_MIN ||
+      CX_LOG_STATUS_DEBUG < g_log_level)
+    return;
+
+  va_start (ap, fmt);
+  vsnprintf (msg, sizeof (msg), fmt, ap);
+  va_end (ap);
+  cx_log_write (CX_LOG_STATUS_DEBUG, "%s", msg);
+}
+
+void
+cx_die (int errno_val, const char *fmt, ...)
+{
+  char    msg[CX_SMALL_BUFMAX * 8];
+  va_list ap;
+
+  va_start (ap, fmt);
+  vsnprintf (msg, sizeof (msg), fmt, ap);
+  va_end (ap);
+
+  if (errno_val != 0)
+    cx_log (CX_LOG_STATUS_ERROR, "%s - %s", msg, strerror (errno_val));
+  else
+    cx_log (CX_LOG_STATUS_ERROR, "%s", msg);
+  cx_log_flush ();
+
+  cx_ui_stop ();
+  fprintf (stderr, "%s: error: %s", g_program_name, msg);
+
+  if (errno_val != 0)
+    fprintf (stderr, " - %s", strerror (errno_val));
+
+  fputc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
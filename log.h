@@ -0,0 +1,40 @@
+#ifndef __CX_LOG_H__
+#define __CX_LOG_H__
+
+typedef enum
+{
+  CX_LOG_STATUS_DEBUG,
+  CX_LOG_STATUS_INFO,
+  CX_LOG_STATUS_WARN,
+  CX_LOG_STATUS_ERROR,
+  CX_LOG_STATUS_NONE
+} CxLogStatus;
+
+/* messages below this are compiled out entirely */
+#ifdef CX_DEBUG_MODE
+#define CX_LOG_STATUS_MIN CX_LOG_STATUS_DEBUG
+#else
+#define CX_LOG_STATUS_MIN CX_LOG_STATUS_INFO
+#endif
+
+/* messages below this are dropped before their arguments are evaluated */
+extern CxLogStatus g_log_level;
+
+#define cx_log(__status, ...)                                                 \
+  do                                                                          \
+  {                                                                           \
+    if ((__status) >= CX_LOG_STATUS_MIN && (__status) >= g_log_level)         \
+      cx_log_write ((__status), __VA_ARGS__);                                 \
+  } while (0)
+
+void cx_log_init (void);
+void cx_log_write (CxLogStatus status, const char *fmt, ...);
+void cx_log_flush (void);
+
+/* a debug message from code that cannot use cx_log(), such as libcx */
+void cx_log_debug (const char *fmt, ...);
+
+/* logs the error, restores the terminal and exits */
+void cx_die (int errno_val, const char *fmt, ...);
+
+#endif /* __CX_LOG_H__ */
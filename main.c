@@ -1,18 +1,50 @@
+#include <limits.h>
 #include <locale.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "cache.h"
 #include "cx.h"
+#include "event.h"
 #include "files.h"
+#include "jump.h"
+#include "log.h"
+#include "mount.h"
+#include "replay.h"
+#include "scan.h"
+#include "session.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "ui.h"
 #include "util.h"
 
+#define STATS_FILE_ENV "CX_STATS_FILE"
+
+#define FRAME_INTERVAL_NS (UINT64_C (1000000000) / 60)
+#define RESCAN_INTERVAL_NS UINT64_C (250000000)
+#define NS_PER_MS UINT64_C (1000000)
+
 const char *g_program_name;
-CxSizeUnits g_size_units           = CX_SIZE_UNITS_BINARY;
-bool        g_include_hidden_files = false;
-bool        g_state_changed        = true;
+bool        g_state_changed = true;
+
+/* what directories are listed with; the mount table is made in main() */
+CxScanOptions g_options = {
+  .size_units       = CX_SIZE_UNITS_BINARY,
+  .window_threshold = CX_DEFAULT_WINDOW_THRESHOLD,
+};
+
+static struct
+{
+  uint64_t last_frame;
+  uint64_t last_scan;
+  uint64_t frame_interval;
+} loop;
 
 static void
 set_program_name (const char *argv0)
@@ -32,76 +64,338 @@ set_program_name (const char *argv0)
 }
 
 static void
-handle_state_change (CxPath *location, CxDirListing *listing)
+set_home_dir (CxPath *path)
 {
-  cx_dir_listing_free (listing);
-  cx_dir_listing_init (listing, location);
+  if (!cx_path_set_as_home_dir (path))
+    cx_die (0, "could not determine home directory");
+}
 
-  if (cx_ui_hilighted_index () >= listing->total)
-    cx_ui_set_hilighted_index (listing->total - 1);
+/* every directory shown holds the ones above it open, however deep */
+static void
+raise_fd_limit (void)
+{
+  struct rlimit rl;
 
-  if (cx_ui_first_listing_item_index () >= listing->total)
-    cx_ui_set_first_listing_item_index (0);
+  if (getrlimit (RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &rl);
+  }
+}
+
+static void
+set_current_dir (CxPath *path)
+{
+  if (!cx_path_set_as_current_dir (path))
+    cx_die (errno, "could not determine the current working directory");
+}
+
+/* rescans whatever changed on disk or was invalidated, then lets each
+   pane pick up its directory from the shared cache */
+static void
+handle_state_change (void)
+{
+  CX_STATS_BEGIN (CX_STATS_PHASE_STATE_CHANGE);
+
+  cx_cache_rescan_stale ();
+  loop.last_scan = cx_monotonic_ns ();
+  cx_ui_sync ();
 
   g_state_changed = false;
+  CX_STATS_END (CX_STATS_PHASE_STATE_CHANGE);
+}
+
+/* how long the loop may sleep before something it has put off is due */
+static int
+next_timeout (uint64_t now)
+{
+  uint64_t due = UINT64_MAX;
+
+  if (cx_ui_redraw_pending ())
+    due = loop.last_frame + loop.frame_interval;
+  if (cx_cache_has_stale () && loop.last_scan + RESCAN_INTERVAL_NS < due)
+    due = loop.last_scan + RESCAN_INTERVAL_NS;
+
+  if (due == UINT64_MAX)
+    return -1;
+  if (due <= now)
+    return 0;
+  return (int) ((due - now + NS_PER_MS - 1) / NS_PER_MS);
+}
+
+static void
+run (void)
+{
+  uint64_t now;
+
+  loop.frame_interval = cx_replay_active () ? 0 : FRAME_INTERVAL_NS;
+  if (!cx_replay_active ())
+    cx_event_add_fd (STDIN_FILENO, NULL, NULL);
+
+  while (cx_ui_keep_running ())
+  {
+    now = cx_monotonic_ns ();
+
+    /* file system changes are folded into one rescan per interval */
+    if (cx_cache_has_stale () && now - loop.last_scan >= RESCAN_INTERVAL_NS)
+      g_state_changed = true;
+
+    if (g_state_changed)
+      handle_state_change ();
+
+    if (cx_ui_redraw_pending () &&
+        now - loop.last_frame >= loop.frame_interval)
+    {
+      cx_ui_draw ();
+      loop.last_frame = cx_monotonic_ns ();
+      if (cx_replay_active ())
+        cx_replay_frame_drawn ();
+      CX_STATS_COMMIT ();
+    }
+
+    if (!cx_ui_handle_input () && !g_state_changed)
+      cx_event_wait (next_timeout (cx_monotonic_ns ()));
+  }
 }
 
 int
 main (int argc, char **argv)
 {
-  CxDirListing listing;
-  CxPath       location;
+  CxPath      location;
+  const char *replay_script;
+  const char *snapshot_file;
+  const char *diff_file;
+  const char *diff_new_file;
+  const char *compare_dir;
+  long long   n_entries;
+  CxSession   session;
+  struct stat st;
+  CxPath      other;
+  bool        restore;
+  bool        verify;
+  char *      end;
+  long        n;
+  int         i;
 
   set_program_name (argv[0]);
   setlocale (LC_ALL, "");
+  cx_log_init ();
 
-  if (argc > 2)
+  replay_script = NULL;
+  snapshot_file = NULL;
+  diff_file     = NULL;
+  diff_new_file = NULL;
+  compare_dir   = NULL;
+  verify        = false;
+  for (i = 1; i < argc && *argv[i] == '-' && argv[i][1]; ++i)
   {
-    fprintf (stderr, "%s: error: too many arguments\n\n"
-                     "Usage: %s [--help|--version] [DIRECTORY]\n",
-             g_program_name, argv[0]);
-    return EXIT_FAILURE;
-  }
-  else if (argc == 2)
-  {
-    if (cx_streq (argv[1], "-h") || cx_streq (argv[1], "--help"))
+    if (cx_streq (argv[i], "-h") || cx_streq (argv[i], "--help"))
     {
-      printf ("Usage: %s [DIRECTORY]\n"
+      printf ("Usage: %s [OPTION...] [DIRECTORY]\n"
               "Options:\n"
-              "  -h, --help     Print this message and exit\n"
-              "  -v, --version  Print version information and exit\n",
-              argv[0]);
+              "  -h, --help           Print this message and exit\n"
+              "  -v, --version        Print version information and exit\n"
+              "  -r, --replay SCRIPT  Drive the UI from the keys in SCRIPT\n"
+              "                       on a pseudo-terminal and print\n"
+              "                       per-key latency histograms\n"
+              "  -s, --snapshot FILE  Save a snapshot of DIRECTORY to FILE\n"
+              "                       and exit\n"
+              "  -d, --diff SNAPSHOT  Show what changed in DIRECTORY since\n"
+              "                       SNAPSHOT, or in a second snapshot\n"
+              "                       given in place of DIRECTORY\n"
+              "  -c, --compare OTHER  Show how DIRECTORY differs from the\n"
+              "                       directory OTHER\n"
+              "  -V, --verify         With --compare, also compare the\n"
+              "                       contents of files that look the same\n"
+              "  -w, --window COUNT   Keep directories of more than COUNT\n"
+              "                       entries on disk and read them as\n"
+              "                       they are shown (default: %d)\n",
+              argv[0], CX_DEFAULT_WINDOW_THRESHOLD);
       return EXIT_SUCCESS;
     }
-    else if (cx_streq (argv[1], "-v") || cx_streq (argv[1], "--version"))
+    else if (cx_streq (argv[i], "-v") || cx_streq (argv[i], "--version"))
     {
       printf ("%s %d.%d\n"
               "Written by Nathan Forbes (2017)\n",
               CX_PROGRAM_NAME, CX_VERSION_MAJOR, CX_VERSION_MINOR);
       return EXIT_SUCCESS;
     }
-    else if (cx_streq (argv[1], "."))
-      cx_path_set_as_current_dir (&location);
-    else if (cx_streq (argv[1], "~"))
-      cx_path_set_as_home_dir (&location);
+    else if (cx_streq (argv[i], "-r") || cx_streq (argv[i], "--replay"))
+    {
+      if (++i == argc)
+      {
+        fprintf (stderr, "%s: error: `%s' requires an argument\n",
+                 g_program_name, argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+      replay_script = argv[i];
+    }
+    else if (cx_streq (argv[i], "-s") || cx_streq (argv[i], "--snapshot"))
+    {
+      if (++i == argc)
+      {
+        fprintf (stderr, "%s: error: `%s' requires an argument\n",
+                 g_program_name, argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+      snapshot_file = argv[i];
+    }
+    else if (cx_streq (argv[i], "-d") || cx_streq (argv[i], "--diff"))
+    {
+      if (++i == argc)
+      {
+        fprintf (stderr, "%s: error: `%s' requires an argument\n",
+                 g_program_name, argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+      diff_file = argv[i];
+    }
+    else if (cx_streq (argv[i], "-c") || cx_streq (argv[i], "--compare"))
+    {
+      if (++i == argc)
+      {
+        fprintf (stderr, "%s: error: `%s' requires an argument\n",
+                 g_program_name, argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+      compare_dir = argv[i];
+    }
+    else if (cx_streq (argv[i], "-V") || cx_streq (argv[i], "--verify"))
+      verify = true;
+    else if (cx_streq (argv[i], "-w") || cx_streq (argv[i], "--window"))
+    {
+      if (++i == argc)
+      {
+        fprintf (stderr, "%s: error: `%s' requires an argument\n",
+                 g_program_name, argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+      errno = 0;
+      n     = strtol (argv[i], &end, 10);
+      if (errno != 0 || end == argv[i] || *end || n < 1 || n > INT_MAX)
+      {
+        fprintf (stderr, "%s: error: invalid entry count `%s'\n",
+                 g_program_name, argv[i]);
+        return EXIT_FAILURE;
+      }
+      g_options.window_threshold = n;
+    }
     else
-      cx_path_init (&location, argv[1], strlen (argv[1]));
+    {
+      fprintf (stderr, "%s: error: unrecognized option `%s'\n\n"
+                       "Usage: %s [OPTION...] [DIRECTORY]\n",
+               g_program_name, argv[i], argv[0]);
+      return EXIT_FAILURE;
+    }
   }
-  else if (argc == 1)
-    cx_path_set_as_home_dir (&location);
 
-  cx_dir_listing_init (&listing, &location);
-  cx_ui_start ();
+  if (verify && !compare_dir)
+  {
+    fprintf (stderr, "%s: error: `--verify' requires `--compare'\n",
+             g_program_name);
+    return EXIT_FAILURE;
+  }
 
-  while (cx_ui_keep_running ())
+  if (argc - i > 1)
   {
-    if (g_state_changed)
-      handle_state_change (&location, &listing);
-    cx_ui_draw (&listing);
-    cx_ui_handle_next_event (&location, &listing);
+    fprintf (stderr, "%s: error: too many arguments\n\n"
+                     "Usage: %s [OPTION...] [DIRECTORY]\n",
+             g_program_name, argv[0]);
+    return EXIT_FAILURE;
+  }
+  else if (argc - i == 1 && diff_file &&
+           cx_snapshot_root (argv[i], &location))
+    diff_new_file = argv[i];
+  else if (argc - i == 1)
+  {
+    if (cx_streq (argv[i], "."))
+      set_current_dir (&location);
+    else if (cx_streq (argv[i], "~"))
+      set_home_dir (&location);
+    else
+      cx_path_init (&location, argv[i], strlen (argv[i]));
   }
+  else if (diff_file)
+  {
+    if (!cx_snapshot_root (diff_file, &location))
+    {
+      fprintf (stderr, "%s: error: cannot read snapshot `%s' - %s\n",
+               g_program_name, diff_file, strerror (errno));
+      return EXIT_FAILURE;
+    }
+  }
+  else
+    set_home_dir (&location);
+
+  if (snapshot_file)
+  {
+    if (!cx_snapshot_write (&location, snapshot_file, &n_entries))
+    {
+      fprintf (stderr, "%s: error: failed to save a snapshot of `%s' to "
+                       "`%s' - %s\n",
+               g_program_name, location.str, snapshot_file, strerror (errno));
+      return EXIT_FAILURE;
+    }
+    printf ("%s: saved %lld entries below `%s' to `%s'\n", g_program_name,
+            n_entries, location.str, snapshot_file);
+    return EXIT_SUCCESS;
+  }
+
+  /* a snapshot's root may be long gone */
+  if (diff_file && (stat (location.str, &st) != 0 || !S_ISDIR (st.st_mode)))
+    set_current_dir (&location);
+
+  /* Without a directory to open, cx goes back to where it was last left.
+     That directory, or the one asked for if it is the same, is drawn as
+     it was then, until it has been read again. */
+  restore = false;
+  if (!replay_script && !diff_file && cx_session_load (&session))
+  {
+    if (argc == i && stat (session.location.str, &st) == 0 &&
+        S_ISDIR (st.st_mode))
+      cx_path_init_copy (&location, &session.location);
+    restore = cx_strneq (location.str, location.len, session.location.str,
+                         session.location.len);
+    if (!restore)
+      cx_dir_listing_free (&session.listing);
+  }
+
+  raise_fd_limit ();
+  g_options.mounts = cx_mount_table_new (cx_log_debug);
+  cx_event_init ();
+  cx_scan_init ();
+
+  if (replay_script)
+    cx_replay_start (replay_script);
+  else
+  {
+    cx_jump_init ();
+    cx_session_init ();
+  }
+
+  cx_ui_start ();
+  if (restore)
+    cx_ui_open_session (&session);
+  else
+    cx_ui_open (&location);
+  if (diff_file)
+    cx_ui_open_diff (diff_file, diff_new_file);
+  else if (compare_dir)
+  {
+    cx_path_init (&other, compare_dir, strlen (compare_dir));
+    cx_ui_open_compare (&other, verify);
+  }
+
+  run ();
 
-  cx_dir_listing_free (&listing);
   cx_ui_stop ();
+  cx_replay_finish ();
+  cx_scan_finish ();
+  cx_event_finish ();
+  cx_mount_table_free (g_options.mounts);
+#ifdef CX_STATS
+  if (getenv (STATS_FILE_ENV))
+    cx_stats_dump (getenv (STATS_FILE_ENV));
+#endif
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,256 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#else
+#include <sys/param.h>
+#include <sys/mount.h>
+#endif
+
+#include "mount.h"
+#include "util.h"
+
+/* a stat call slower than this is worth another thread to overlap it */
+#define TARGET_CALL_NS 20000
+
+/* a stat thread claims about this much work at a time */
+#define BATCH_NS 1000000
+#define MAX_BATCH 256
+
+/* smaller directories say too little about the mount to act on */
+#define MIN_FEEDBACK_CALLS 16
+
+typedef struct
+{
+  uint32_t     magic;
+  const char * name;
+  CxMountClass mount_class;
+} FsType;
+
+static const FsType fs_types[] = {
+  { 0x01021994, "tmpfs", CX_MOUNT_CLASS_MEMORY },
+  { 0x858458f6, "ramfs", CX_MOUNT_CLASS_MEMORY },
+  { 0x00009fa0, "proc", CX_MOUNT_CLASS_MEMORY },
+  { 0x62656572, "sysfs", CX_MOUNT_CLASS_MEMORY },
+  { 0x00001cd1, "devpts", CX_MOUNT_CLASS_MEMORY },
+  { 0x0027e0eb, "cgroup", CX_MOUNT_CLASS_MEMORY },
+  { 0x63677270, "cgroup2", CX_MOUNT_CLASS_MEMORY },
+  { 0x64626720, "debugfs", CX_MOUNT_CLASS_MEMORY },
+  { 0x74726163, "tracefs", CX_MOUNT_CLASS_MEMORY },
+  { 0x0000ef53, "ext4", CX_MOUNT_CLASS_LOCAL },
+  { 0x58465342, "xfs", CX_MOUNT_CLASS_LOCAL },
+  { 0x9123683e, "btrfs", CX_MOUNT_CLASS_LOCAL },
+  { 0xf2f52010, "f2fs", CX_MOUNT_CLASS_LOCAL },
+  { 0x2fc12fc1, "zfs", CX_MOUNT_CLASS_LOCAL },
+  { 0x794c7630, "overlay", CX_MOUNT_CLASS_LOCAL },
+  { 0x73717368, "squashfs", CX_MOUNT_CLASS_LOCAL },
+  { 0x00004d44, "vfat", CX_MOUNT_CLASS_LOCAL },
+  { 0x2011bab0, "exfat", CX_MOUNT_CLASS_LOCAL },
+  { 0x00006969, "nfs", CX_MOUNT_CLASS_NETWORK },
+  { 0x0000517b, "smbfs", CX_MOUNT_CLASS_NETWORK },
+  { 0xff534d42, "cifs", CX_MOUNT_CLASS_NETWORK },
+  { 0xfe534d42, "smb2", CX_MOUNT_CLASS_NETWORK },
+  { 0x00c36400, "ceph", CX_MOUNT_CLASS_NETWORK },
+  { 0x5346414f, "afs", CX_MOUNT_CLASS_NETWORK },
+  { 0x01021997, "9p", CX_MOUNT_CLASS_NETWORK },
+  { 0x65735546, "fuse", CX_MOUNT_CLASS_NETWORK },
+  { 0x0bd00bd0, "lustre", CX_MOUNT_CLASS_NETWORK },
+  { 0x47504653, "gpfs", CX_MOUNT_CLASS_NETWORK },
+};
+
+/* what a mount starts with until its own calls have been timed; network
+   file systems assume a round trip per call and start wide */
+static const struct
+{
+  int      parallelism;
+  uint64_t latency_ns;
+} class_defaults[] = {
+  [CX_MOUNT_CLASS_MEMORY]  = { 1, 1000 },
+  [CX_MOUNT_CLASS_LOCAL]   = { 1, 5000 },
+  [CX_MOUNT_CLASS_NETWORK] = { 8, 500000 },
+};
+
+static const char *class_names[] = {
+  [CX_MOUNT_CLASS_MEMORY]  = "in-memory",
+  [CX_MOUNT_CLASS_LOCAL]   = "local",
+  [CX_MOUNT_CLASS_NETWORK] = "network",
+};
+
+struct CxMountTable
+{
+  pthread_mutex_t  lock;
+  CxMountProfile * list;
+  int              total;
+  int              alloc;
+  CxMountDebugFunc debug;
+};
+
+static const FsType *
+find_fs_type (int dir_fd)
+{
+  static const FsType unknown = { 0, "unknown", CX_MOUNT_CLASS_LOCAL };
+  struct statfs       sfs;
+  size_t              i;
+
+  if (fstatfs (dir_fd, &sfs) != 0)
+    return &unknown;
+
+  for (i = 0; i < sizeof (fs_types) / sizeof (fs_types[0]); ++i)
+  {
+#ifdef __linux__
+    if ((uint32_t) sfs.f_type == fs_types[i].magic)
+#else
+    if (cx_streq (sfs.f_fstypename, fs_types[i].name))
+#endif
+      return &fs_types[i];
+  }
+  return &unknown;
+}
+
+static void
+set_batch (CxMountProfile *m)
+{
+  uint64_t batch = BATCH_NS / (m->latency_ns ? m->latency_ns : 1);
+
+  m->batch      = batch < 1 ? 1 : (batch > MAX_BATCH ? MAX_BATCH : batch);
+  m->eager_stat = m->parallelism == 1;
+}
+
+static void
+set_defaults (CxMountProfile *m, dev_t dev, int dir_fd)
+{
+  const FsType *type = find_fs_type (dir_fd);
+
+  m->dev         = dev;
+  m->mount_class = type->mount_class;
+  m->fs_name     = type->name;
+  m->parallelism = class_defaults[m->mount_class].parallelism;
+  m->latency_ns  = class_defaults[m->mount_class].latency_ns;
+  set_batch (m);
+}
+
+CxMountTable *
+cx_mount_table_new (CxMountDebugFunc debug)
+{
+  CxMountTable *table;
+
+  table = calloc (1, sizeof (CxMountTable));
+  if (!table)
+    return NULL;
+  pthread_mutex_init (&table->lock, NULL);
+  table->debug = debug;
+  return table;
+}
+
+void
+cx_mount_table_free (CxMountTable *table)
+{
+  if (!table)
+    return;
+  pthread_mutex_destroy (&table->lock);
+  free (table->list);
+  free (table);
+}
+
+static CxMountProfile *
+find_mount (CxMountTable *table, dev_t dev)
+{
+  int i;
+
+  for (i = 0; i < table->total; ++i)
+    if (table->list[i].dev == dev)
+      return &table->list[i];
+  return NULL;
+}
+
+/* Statfs only runs the first time a mount is seen. Without a table, or
+   with no memory left to grow it, the profile is the defaults. */
+void
+cx_mount_profile (CxMountTable *table, int dir_fd, const char *path,
+                  CxMountProfile *profile)
+{
+  CxMountProfile *m;
+  CxMountProfile *list;
+  struct stat     st;
+  int             alloc;
+
+  if (fstat (dir_fd, &st) != 0)
+    st.st_dev = 0;
+
+  if (!table)
+  {
+    set_defaults (profile, st.st_dev, dir_fd);
+    return;
+  }
+
+  pthread_mutex_lock (&table->lock);
+  m = find_mount (table, st.st_dev);
+  if (!m)
+  {
+    if (table->total == table->alloc)
+    {
+      alloc = table->alloc ? table->alloc * 2 : 16;
+      list  = realloc (table->list, alloc * sizeof (*m));
+      if (!list)
+      {
+        pthread_mutex_unlock (&table->lock);
+        set_defaults (profile, st.st_dev, dir_fd);
+        return;
+      }
+      table->list  = list;
+      table->alloc = alloc;
+    }
+
+    m = &table->list[table->total++];
+    set_defaults (m, st.st_dev, dir_fd);
+
+    if (table->debug)
+      table->debug ("`%s' is on a %s file system (%s)", path, m->fs_name,
+                    class_names[m->mount_class]);
+  }
+  *profile = *m;
+  pthread_mutex_unlock (&table->lock);
+}
+
+/* Moves the mount's thread count halfway to what would overlap its
+   measured latency, so one odd directory never swings it far. Memory
+   file systems never block, so they always stay on one thread. */
+void
+cx_mount_feedback (CxMountTable *table, dev_t dev, int n_calls,
+                   uint64_t stat_ns)
+{
+  CxMountProfile *m;
+  uint64_t        want;
+  int             old;
+
+  if (!table || n_calls < MIN_FEEDBACK_CALLS)
+    return;
+
+  pthread_mutex_lock (&table->lock);
+  m = find_mount (table, dev);
+  if (m && m->mount_class != CX_MOUNT_CLASS_MEMORY)
+  {
+    m->latency_ns = (m->latency_ns + stat_ns / n_calls) / 2;
+
+    want = m->latency_ns / TARGET_CALL_NS;
+    if (want < 1)
+      want = 1;
+    else if (want > CX_MOUNT_MAX_PARALLELISM)
+      want = CX_MOUNT_MAX_PARALLELISM;
+
+    old = m->parallelism;
+    if ((int) want > m->parallelism)
+      m->parallelism += ((int) want - m->parallelism + 1) / 2;
+    else
+      m->parallelism -= (m->parallelism - (int) want + 1) / 2;
+    set_batch (m);
+
+    if (m->parallelism != old && table->debug)
+      table->debug ("%s stat calls take %" PRIu64 " us, now using %d threads",
+                    m->fs_name, m->latency_ns / 1000, m->parallelism);
+  }
+  pthread_mutex_unlock (&table->lock);
+}
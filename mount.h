@@ -0,0 +1,46 @@
+#ifndef __CX_MOUNT_H__
+#define __CX_MOUNT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CX_MOUNT_MAX_PARALLELISM 16
+
+typedef enum
+{
+  CX_MOUNT_CLASS_MEMORY,
+  CX_MOUNT_CLASS_LOCAL,
+  CX_MOUNT_CLASS_NETWORK
+} CxMountClass;
+
+/* How directories on one mount are scanned. Eager scans stat each entry
+   as soon as it is read; the others read every name first, then stat
+   them from `parallelism' threads that claim `batch' entries at a time. */
+typedef struct
+{
+  dev_t        dev;
+  CxMountClass mount_class;
+  const char * fs_name;
+  int          parallelism;
+  int          batch;
+  bool         eager_stat;
+  uint64_t     latency_ns; /* moving average of one stat call */
+} CxMountProfile;
+
+/* The profiles of every mount a directory has been listed on, shared by
+   whichever threads list them. What a profile starts as and how it moves
+   is reported through `debug', when given. */
+typedef struct CxMountTable CxMountTable;
+
+typedef void (*CxMountDebugFunc) (const char *fmt, ...);
+
+CxMountTable *cx_mount_table_new (CxMountDebugFunc debug);
+void          cx_mount_table_free (CxMountTable *table);
+
+void cx_mount_profile (CxMountTable *table, int dir_fd, const char *path,
+                       CxMountProfile *profile);
+void cx_mount_feedback (CxMountTable *table, dev_t dev, int n_calls,
+                        uint64_t stat_ns);
+
+#endif /* __CX_MOUNT_H__ */
@@ -1,6 +1,10 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "path.h"
@@ -44,38 +48,124 @@ cx_path_init_parent_of (CxPath *path)
   }
 }
 
-void
+/* false, leaving `path' as it was, when HOME is not set */
+bool
 cx_path_set_as_home_dir (CxPath *path)
 {
   const char *home_dir = getenv ("HOME");
 
-  if (home_dir && *home_dir)
-    cx_path_init (path, home_dir, strlen (home_dir));
-  else
-    cx_die (0, "could not determine home directory");
+  if (!home_dir || !*home_dir)
+    return false;
+  cx_path_init (path, home_dir, strlen (home_dir));
+  return true;
 }
 
-void
+/* false with errno set when the working directory cannot be told */
+bool
 cx_path_set_as_current_dir (CxPath *path)
 {
   char buf[CX_PATHMAX];
 
-  if (getcwd (buf, CX_PATHMAX))
-    cx_path_init (path, buf, strlen (buf));
+  if (!getcwd (buf, CX_PATHMAX))
+    return false;
+  cx_path_init (path, buf, strlen (buf));
+  return true;
+}
+
+/* Always the same file, wherever cx happens to be running from, in the
+   user's home directory or else their runtime one. Only without either
+   does it go in /tmp, under a name anyone could take first. */
+void
+cx_path_set_as_user_file (CxPath *path, const char *filename)
+{
+  const struct passwd *pw;
+  const char *         dir = getenv ("HOME");
+
+  if (!dir || !*dir)
+  {
+    pw  = getpwuid (getuid ());
+    dir = pw ? pw->pw_dir : NULL;
+  }
+  if (!dir || !*dir)
+    dir = getenv ("XDG_RUNTIME_DIR");
+
+  if (dir && *dir)
+    path->len = snprintf (path->str, CX_PATHMAX, "%s/%s", dir, filename);
   else
-    cx_die (errno, "could not determine the current working directory");
+    path->len = snprintf (path->str, CX_PATHMAX, "/tmp/%s-%lu", filename,
+                          (unsigned long) getuid ());
+  if (path->len >= CX_PATHMAX)
+    path->len = CX_PATHMAX - 1;
+}
+
+/* Opens one of the files above. A link put in its place is not followed,
+   and a file that is not the user's own is refused with EPERM. */
+int
+cx_path_open_user_file (const char *path, int flags)
+{
+  struct stat st;
+  int         fd;
+
+  fd = open (path, flags | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd != -1 && fstat (fd, &st) == 0 &&
+      (st.st_uid != getuid () || !S_ISREG (st.st_mode)))
+  {
+    close (fd);
+    errno = EPERM;
+    return -1;
+  }
+  return fd;
 }
 
+/* the end of a path that did not fit, as much of it as does */
 void
+cx_path_init_elided (CxPath *path, const char *tail, int tail_len)
+{
+  int n = CX_PATHMAX - 1 - CX_PATH_ELIDED_LEN;
+
+  if (tail_len > n)
+  {
+    tail += tail_len - n;
+    tail_len = n;
+  }
+  memcpy (path->str, CX_PATH_ELIDED, CX_PATH_ELIDED_LEN);
+  memmove (path->str + CX_PATH_ELIDED_LEN, tail, tail_len);
+  path->len            = CX_PATH_ELIDED_LEN + tail_len;
+  path->str[path->len] = '\0';
+}
+
+/* False with errno set when the item's path is, or is below, one too long
+   to hold; `path' is then left elided, to be shown but not looked up.
+   `parent' may be `path' itself. */
+bool
 cx_path_dir_item (CxPath *path, const CxPath *parent, const char *name_str,
                   int name_len)
 {
+  char tail[CX_PATHMAX];
+  int  from;
+  int  n;
+
+  if (cx_path_is_elided (parent) || parent->len + 1 + name_len >= CX_PATHMAX)
+  {
+    from = cx_path_is_elided (parent) ? CX_PATH_ELIDED_LEN : 0;
+    n    = CX_PATHMAX - 2 - CX_PATH_ELIDED_LEN - name_len;
+    if (n > parent->len - from)
+      n = parent->len - from;
+    memcpy (tail, parent->str + parent->len - n, n);
+    tail[n] = '/';
+    memcpy (tail + n + 1, name_str, name_len);
+    cx_path_init_elided (path, tail, n + 1 + name_len);
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
   if (!cx_path_is_root (parent))
   {
-    path->len = parent->len + 1 + name_len;
-    memcpy (path->str, parent->str, parent->len);
+    if (path != parent)
+      memcpy (path->str, parent->str, parent->len);
     path->str[parent->len] = '/';
     memcpy (path->str + (parent->len + 1), name_str, name_len);
+    path->len            = parent->len + 1 + name_len;
     path->str[path->len] = '\0';
   }
   else
@@ -85,6 +175,14 @@ cx_path_dir_item (CxPath *path, const CxPath *parent, const char *name_str,
     memcpy (&path->str[1], name_str, name_len);
     path->str[path->len] = '\0';
   }
+  return true;
+}
+
+bool
+cx_path_is_elided (const CxPath *path)
+{
+  return path->len >= CX_PATH_ELIDED_LEN &&
+         memcmp (path->str, CX_PATH_ELIDED, CX_PATH_ELIDED_LEN) == 0;
 }
 
 bool
@@ -98,9 +196,6 @@ cx_path_is_home_dir (const CxPath *path)
 {
   const char *home_dir = getenv ("HOME");
 
-  if (home_dir && *home_dir)
-    return cx_strneq (home_dir, strlen (home_dir), path->str, path->len);
-
-  cx_die (0, "could not determine home directory");
-  return false; /* suppress compiler warning */
+  return home_dir && *home_dir &&
+         cx_strneq (home_dir, strlen (home_dir), path->str, path->len);
 }
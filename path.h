@@ -8,6 +8,11 @@
 
 #define CX_PATHMAX MAXPATHLEN
 
+/* what a path too long to hold starts with in place of its beginning;
+   such a path is only shown, never looked up */
+#define CX_PATH_ELIDED "..."
+#define CX_PATH_ELIDED_LEN 3
+
 typedef struct
 {
   char str[CX_PATHMAX];
@@ -18,12 +23,16 @@ void cx_path_init (CxPath *path, const char *path_str, int path_len);
 void cx_path_init_copy (CxPath *dst, const CxPath *src);
 void cx_path_init_parent_of (CxPath *path);
 
-void cx_path_set_as_home_dir (CxPath *path);
-void cx_path_set_as_current_dir (CxPath *path);
+bool cx_path_set_as_home_dir (CxPath *path);
+bool cx_path_set_as_current_dir (CxPath *path);
+void cx_path_set_as_user_file (CxPath *path, const char *filename);
+int  cx_path_open_user_file (const char *path, int flags);
 
-void cx_path_dir_item (CxPath *path, const CxPath *parent,
+bool cx_path_dir_item (CxPath *path, const CxPath *parent,
                        const char *name_str, int name_len);
+void cx_path_init_elided (CxPath *path, const char *tail, int tail_len);
 
+bool cx_path_is_elided (const CxPath *path);
 bool cx_path_is_root (const CxPath *path);
 bool cx_path_is_home_dir (const CxPath *path);
 
@@ -0,0 +1,426 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ncurses.h>
+
+#include "event.h"
+#include "log.h"
+#include "replay.h"
+#include "scan.h"
+#include "ui.h"
+#include "util.h"
+
+#define ENTER_KEY 10
+#define ESC_KEY 27
+
+#define DEFAULT_TERM_LINES 24
+#define DEFAULT_TERM_COLUMNS 80
+
+#define N_BUCKETS 32
+#define DRAIN_BUFSIZE 65536
+#define TOKEN_MAX 64
+#define SENTINEL_TIMEOUT_S 5
+
+/* Written to the terminal after each frame; once the reader has seen it,
+   every byte of the frame has been counted. An APC string has a single
+   ESC, which cx never sends otherwise, and terminals ignore it. */
+#define SENTINEL "\033_cx-replay\a"
+#define SENTINEL_LEN (sizeof (SENTINEL) - 1)
+
+static const struct
+{
+  const char *name;
+  int         key;
+} key_names[] = {
+  { "UP", KEY_UP },       { "DOWN", KEY_DOWN },   { "LEFT", KEY_LEFT },
+  { "RIGHT", KEY_RIGHT }, { "HOME", KEY_HOME },   { "END", KEY_END },
+  { "PGUP", KEY_PPAGE },  { "PGDN", KEY_NPAGE },  { "ENTER", ENTER_KEY },
+  { "ESC", ESC_KEY },     { "SPACE", ' ' },       { "TAB", '\t' },
+  { NULL, 0 },
+};
+
+static struct
+{
+  pthread_t       reader;
+  pthread_mutex_t lock;
+  pthread_cond_t  seen;
+  FILE *          slave_fp;
+  uint64_t *      latencies;
+  uint64_t *      frame_bytes;
+  uint64_t        key_time;
+  uint64_t        key_bytes;
+  uint64_t        bytes;
+  uint64_t        sentinels_sent;
+  uint64_t        sentinels_seen;
+  size_t          matched;
+  int *           keys;
+  int             n_keys;
+  int             next;
+  int             n_events;
+  int             master;
+  int             wake_fd;
+  bool            active;
+  bool            armed;
+  bool            pending;
+  bool            hung_up;
+} replay;
+
+static void
+add_key (int key, int count)
+{
+  replay.keys = realloc (replay.keys, sizeof (int) * (replay.n_keys + count));
+  if (!replay.keys)
+    cx_die (errno, "failed to allocate memory");
+  while (count-- > 0)
+    replay.keys[replay.n_keys++] = key;
+}
+
+static int
+parse_key (const char *token, const char *script_path)
+{
+  int i;
+
+  for (i = 0; key_names[i].name; ++i)
+    if (cx_streq (token, key_names[i].name))
+      return key_names[i].key;
+
+  if (token[0] && !token[1])
+    return (unsigned char) token[0];
+
+  cx_die (0, "unknown key `%s' in replay script `%s'", token, script_path);
+  return 0; /* suppress compiler warning */
+}
+
+static void
+load_script (const char *script_path)
+{
+  FILE *fp;
+  char  token[TOKEN_MAX];
+  char *repeat;
+  int   count;
+  int   c;
+  int   n;
+
+  fp = fopen (script_path, "r");
+  if (!fp)
+    cx_die (errno, "failed to open replay script `%s'", script_path);
+
+  for (;;)
+  {
+    c = fgetc (fp);
+    if (c == EOF)
+      break;
+    if (c == '#')
+    {
+      while (c != EOF && c != '\n')
+        c = fgetc (fp);
+      continue;
+    }
+    if (isspace (c))
+      continue;
+
+    n = 0;
+    while (c != EOF && !isspace (c))
+    {
+      if (n == TOKEN_MAX - 1)
+        cx_die (0, "key name too long in replay script `%s'", script_path);
+      token[n++] = c;
+      c          = fgetc (fp);
+    }
+    token[n] = '\0';
+
+    /* `KEY*N' repeats KEY N times */
+    count  = 1;
+    repeat = strrchr (token, '*');
+    if (repeat && repeat != token && repeat[1])
+    {
+      *repeat = '\0';
+      count   = atoi (repeat + 1);
+      if (count < 1)
+        cx_die (0, "bad repeat count in replay script `%s'", script_path);
+    }
+    add_key (parse_key (token, script_path), count);
+  }
+  fclose (fp);
+
+  replay.latencies   = malloc (sizeof (uint64_t) * (replay.n_keys + 1));
+  replay.frame_bytes = malloc (sizeof (uint64_t) * (replay.n_keys + 1));
+  if (!replay.latencies || !replay.frame_bytes)
+    cx_die (errno, "failed to allocate memory");
+}
+
+static void *
+reader_main (void *arg)
+{
+  static char   buf[DRAIN_BUFSIZE];
+  struct pollfd pfd;
+  ssize_t       n;
+  ssize_t       i;
+
+  pfd.fd     = replay.master;
+  pfd.events = POLLIN;
+  for (;;)
+  {
+    if (poll (&pfd, 1, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (!(pfd.revents & POLLIN))
+      break;
+
+    n = read (replay.master, buf, sizeof (buf));
+    if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+      break;
+    if (n < 0)
+      continue;
+
+    pthread_mutex_lock (&replay.lock);
+    for (i = 0; i < n; ++i)
+    {
+      if (buf[i] != SENTINEL[replay.matched])
+        replay.matched = buf[i] == SENTINEL[0];
+      else if (++replay.matched == SENTINEL_LEN)
+      {
+        replay.matched = 0;
+        ++replay.sentinels_seen;
+        replay.bytes -= SENTINEL_LEN - 1;
+        pthread_cond_signal (&replay.seen);
+        continue;
+      }
+      ++replay.bytes;
+    }
+    pthread_mutex_unlock (&replay.lock);
+  }
+
+  pthread_mutex_lock (&replay.lock);
+  replay.hung_up = true;
+  pthread_cond_signal (&replay.seen);
+  pthread_mutex_unlock (&replay.lock);
+  return NULL;
+}
+
+/* the bytes written to the terminal up to now, once they have all been
+   read back from it */
+static uint64_t
+drained_bytes (void)
+{
+  struct timespec deadline;
+  uint64_t        bytes;
+  int             rc = 0;
+
+  fflush (replay.slave_fp);
+  if (write (fileno (replay.slave_fp), SENTINEL, SENTINEL_LEN) !=
+      (ssize_t) SENTINEL_LEN)
+    cx_die (errno, "failed to write to pseudo-terminal");
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += SENTINEL_TIMEOUT_S;
+
+  pthread_mutex_lock (&replay.lock);
+  ++replay.sentinels_sent;
+  while (replay.sentinels_seen < replay.sentinels_sent && !replay.hung_up &&
+         rc == 0)
+    rc = pthread_cond_timedwait (&replay.seen, &replay.lock, &deadline);
+  bytes = replay.bytes;
+  pthread_mutex_unlock (&replay.lock);
+
+  if (rc != 0)
+    cx_log (CX_LOG_STATUS_WARN, "pseudo-terminal output not drained after "
+                                "%d seconds; frame sizes may be off",
+            SENTINEL_TIMEOUT_S);
+  return bytes;
+}
+
+static void
+close_sample (void)
+{
+  uint64_t bytes;
+
+  bytes = drained_bytes ();
+  replay.latencies[replay.n_events]   = cx_monotonic_ns () - replay.key_time;
+  replay.frame_bytes[replay.n_events] = bytes - replay.key_bytes;
+  ++replay.n_events;
+  replay.pending = false;
+}
+
+/* keys are handed out one at a time, each only after the frame for the
+   previous one is on the terminal and the directories it had read are in */
+static int
+next_key (void)
+{
+  if (!replay.armed || cx_scan_busy ())
+    return ERR;
+  replay.armed = false;
+
+  /* its scans came to nothing that needed drawing */
+  if (replay.pending)
+    close_sample ();
+
+  if (replay.next >= replay.n_keys)
+  {
+    cx_ui_set_keep_running (false);
+    return ESC_KEY;
+  }
+
+  replay.key_bytes = drained_bytes ();
+  replay.key_time  = cx_monotonic_ns ();
+  replay.pending   = true;
+  return replay.keys[replay.next++];
+}
+
+static void
+open_pty (void)
+{
+  struct winsize ws;
+  const char *   slave_name;
+  int            slave;
+
+  replay.master = posix_openpt (O_RDWR | O_NOCTTY);
+  if (replay.master == -1 || grantpt (replay.master) != 0 ||
+      unlockpt (replay.master) != 0)
+    cx_die (errno, "failed to open pseudo-terminal");
+
+  slave_name = ptsname (replay.master);
+  if (!slave_name)
+    cx_die (errno, "failed to open pseudo-terminal");
+
+  slave = open (slave_name, O_RDWR | O_NOCTTY);
+  if (slave == -1)
+    cx_die (errno, "failed to open pseudo-terminal `%s'", slave_name);
+
+  if (ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0)
+  {
+    memset (&ws, 0, sizeof (ws));
+    ws.ws_row = DEFAULT_TERM_LINES;
+    ws.ws_col = DEFAULT_TERM_COLUMNS;
+  }
+  ioctl (slave, TIOCSWINSZ, &ws);
+
+  replay.slave_fp = fdopen (slave, "r+");
+  if (!replay.slave_fp)
+    cx_die (errno, "failed to open pseudo-terminal `%s'", slave_name);
+}
+
+void
+cx_replay_start (const char *script_path)
+{
+  load_script (script_path);
+  open_pty ();
+
+  pthread_mutex_init (&replay.lock, NULL);
+  pthread_cond_init (&replay.seen, NULL);
+  if (pthread_create (&replay.reader, NULL, reader_main, NULL) != 0)
+    cx_die (0, "failed to start pseudo-terminal reader");
+
+  cx_ui_set_terminal (replay.slave_fp, replay.slave_fp);
+  cx_ui_set_key_source (next_key);
+  replay.wake_fd = cx_event_wakeup_new (NULL, NULL);
+  replay.active  = true;
+}
+
+bool
+cx_replay_active (void)
+{
+  return replay.active;
+}
+
+/* a key's frame is the first one drawn once what it had read is shown */
+void
+cx_replay_frame_drawn (void)
+{
+  if (replay.pending && !cx_scan_busy ())
+    close_sample ();
+
+  replay.armed = true;
+  cx_event_wakeup (replay.wake_fd);
+}
+
+static int
+sample_cmp (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+print_histogram (const char *name, uint64_t *samples, int n, uint64_t scale)
+{
+  uint64_t counts[N_BUCKETS];
+  uint64_t v;
+  uint64_t sum;
+  int      bucket;
+  int      i;
+
+  memset (counts, 0, sizeof (counts));
+  sum = 0;
+  for (i = 0; i < n; ++i)
+  {
+    v = samples[i] / scale;
+    sum += v;
+    for (bucket = 0; v > 1 && bucket < N_BUCKETS - 1; v >>= 1)
+      ++bucket;
+    ++counts[bucket];
+  }
+
+  qsort (samples, n, sizeof (uint64_t), sample_cmp);
+  printf ("%s events=%d mean=%" PRIu64 " median=%" PRIu64 " p99=%" PRIu64
+          " max=%" PRIu64 "\n",
+          name, n, sum / n, samples[n / 2] / scale,
+          samples[(n * 99 + 99) / 100 - 1] / scale, samples[n - 1] / scale);
+
+  /* bucket i holds values in [2^i, 2^(i+1)), bucket 0 also holds 0 */
+  for (bucket = 0; bucket < N_BUCKETS; ++bucket)
+    if (counts[bucket] > 0)
+      printf ("%s bucket=%" PRIu64 "-%" PRIu64 " count=%" PRIu64 "\n", name,
+              bucket ? UINT64_C (1) << bucket : 0,
+              UINT64_C (1) << (bucket + 1), counts[bucket]);
+}
+
+void
+cx_replay_finish (void)
+{
+  uint64_t total = 0;
+  int      i;
+
+  if (!replay.active)
+    return;
+
+  cx_event_wakeup_free (replay.wake_fd);
+  /* hanging up the slave side lets the reader drain the rest and exit */
+  fclose (replay.slave_fp);
+  pthread_join (replay.reader, NULL);
+  close (replay.master);
+  pthread_mutex_destroy (&replay.lock);
+  pthread_cond_destroy (&replay.seen);
+
+  for (i = 0; i < replay.n_events; ++i)
+    total += replay.frame_bytes[i];
+
+  printf ("replay keys=%d events=%d total_bytes=%" PRIu64 "\n",
+          replay.n_keys, replay.n_events, total);
+  if (replay.n_events > 0)
+  {
+    print_histogram ("latency_us", replay.latencies, replay.n_events, 1000);
+    print_histogram ("frame_bytes", replay.frame_bytes, replay.n_events, 1);
+  }
+
+  free (replay.keys);
+  free (replay.latencies);
+  free (replay.frame_bytes);
+  replay.active = false;
+}
@@ -0,0 +1,11 @@
+#ifndef __CX_REPLAY_H__
+#define __CX_REPLAY_H__
+
+#include <stdbool.h>
+
+void cx_replay_start (const char *script_path);
+bool cx_replay_active (void);
+void cx_replay_frame_drawn (void);
+void cx_replay_finish (void);
+
+#endif /* __CX_REPLAY_H__ */
@@ -0,0 +1,347 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "event.h"
+#include "log.h"
+#include "scan.h"
+#include "stats.h"
+#include "util.h"
+
+extern CxScanOptions g_options;
+
+typedef struct ScanJob
+{
+  struct ScanJob * next;
+  CxScanCallback   callback;
+  CxDecodeCallback decode_callback;
+  void *           data;
+  CxPath           path;
+  CxDir *          at;
+  char             name[CX_DIR_ITEM_NAME_MAX];
+  CxScanOptions    options; /* as they were when the scan was asked for */
+  CxDirListing     listing;
+  CxDirBlock *     block; /* to decode rather than a directory to scan */
+} ScanJob;
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t  work;
+  pthread_t       worker;
+  ScanJob *       pending_head;
+  ScanJob *       pending_tail;
+  ScanJob *       current;
+  ScanJob *       done;
+  ScanJob *       delivering;
+  int             wake_fd;
+  bool            running;
+  bool            stopping;
+} scan = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+job_free (ScanJob *job)
+{
+  cx_dir_unref (job->at);
+  cx_dir_block_free (job->block);
+  free (job);
+}
+
+/* a directory that cannot be read shows only the way back up, and why */
+static void
+job_run (ScanJob *job)
+{
+  CxDirItem *list;
+  int        error;
+
+  if (job->block)
+  {
+    cx_dir_block_decode (job->block);
+    return;
+  }
+  if (cx_archive_listing_init (&job->listing, &job->path, &job->options))
+    cx_log (CX_LOG_STATUS_DEBUG, "listed `%s' from its archive",
+            job->path.str);
+  else if (!cx_dir_listing_init_at (&job->listing, &job->path, job->at,
+                                    job->at ? job->name : job->path.str,
+                                    &job->options))
+  {
+    error = errno;
+    cx_log (CX_LOG_STATUS_WARN, "cannot scan `%s' - %s", job->path.str,
+            strerror (error));
+
+    list = malloc (sizeof (CxDirItem));
+    if (!list)
+      cx_die (errno, "failed to allocate memory");
+    cx_dir_item_init_parent (list);
+    if (!cx_dir_listing_init_items (&job->listing, &job->path, list,
+                                    cx_path_is_root (&job->path) ? 0 : 1,
+                                    &job->options))
+      cx_die (ENOMEM, "failed to allocate memory");
+    job->listing.error = error;
+  }
+}
+
+static void
+job_forget (ScanJob *job)
+{
+  job->callback        = NULL;
+  job->decode_callback = NULL;
+}
+
+static void
+job_deliver (ScanJob *job)
+{
+  if (job->block)
+  {
+    if (job->decode_callback)
+    {
+      cx_dir_listing_put_block (job->data, job->block);
+      job->block = NULL;
+      job->decode_callback (job->data);
+    }
+    job_free (job);
+    return;
+  }
+
+  CX_STATS_TAKE (&job->listing.stats);
+  if (job->callback)
+    job->callback (&job->path, &job->listing, job->data);
+  else
+    cx_dir_listing_free (&job->listing);
+  job_free (job);
+}
+
+static void *
+worker_main (void *arg)
+{
+  ScanJob *job;
+
+  pthread_mutex_lock (&scan.lock);
+  for (;;)
+  {
+    while (!scan.pending_head && !scan.stopping)
+      pthread_cond_wait (&scan.work, &scan.lock);
+    if (scan.stopping)
+      break;
+
+    job               = scan.pending_head;
+    scan.pending_head = job->next;
+    scan.current      = job;
+    if (!scan.pending_head)
+      scan.pending_tail = NULL;
+    pthread_mutex_unlock (&scan.lock);
+
+    job_run (job);
+
+    pthread_mutex_lock (&scan.lock);
+    job->next    = scan.done;
+    scan.done    = job;
+    scan.current = NULL;
+    cx_event_wakeup (scan.wake_fd);
+  }
+  pthread_mutex_unlock (&scan.lock);
+  return NULL;
+}
+
+/* Runs on the main thread from the event loop. Jobs are delivered from
+   `scan.delivering', where a callback can still cancel those after it. */
+static void
+on_scans_done (int fd, void *data)
+{
+  ScanJob *done;
+  ScanJob *prev;
+  ScanJob *job;
+
+  pthread_mutex_lock (&scan.lock);
+  done      = scan.done;
+  scan.done = NULL;
+  pthread_mutex_unlock (&scan.lock);
+
+  /* the list was built newest first */
+  prev = NULL;
+  while (done)
+  {
+    job        = done->next;
+    done->next = prev;
+    prev       = done;
+    done       = job;
+  }
+
+  scan.delivering = prev;
+  while ((job = scan.delivering))
+  {
+    scan.delivering = job->next;
+    job_deliver (job);
+  }
+}
+
+void
+cx_scan_init (void)
+{
+  if (scan.running)
+    return;
+
+  scan.wake_fd = cx_event_wakeup_new (on_scans_done, NULL);
+  if (pthread_create (&scan.worker, NULL, worker_main, NULL) != 0)
+    cx_die (0, "failed to start directory scanner");
+  scan.running = true;
+}
+
+void
+cx_scan_finish (void)
+{
+  ScanJob *job;
+
+  if (!scan.running)
+    return;
+
+  pthread_mutex_lock (&scan.lock);
+  scan.stopping = true;
+  pthread_cond_signal (&scan.work);
+  pthread_mutex_unlock (&scan.lock);
+  pthread_join (scan.worker, NULL);
+
+  while ((job = scan.pending_head))
+  {
+    scan.pending_head = job->next;
+    job_free (job);
+  }
+  while ((job = scan.done))
+  {
+    scan.done = job->next;
+    cx_dir_listing_free (&job->listing);
+    job_free (job);
+  }
+
+  cx_event_wakeup_free (scan.wake_fd);
+  scan.running = false;
+}
+
+void
+cx_scan_request (const CxPath *path, CxDir *at, const char *name,
+                 CxScanCallback callback, void *data)
+{
+  ScanJob *job;
+
+  job = calloc (1, sizeof (ScanJob));
+  if (!job)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&job->path, path);
+  if (at)
+  {
+    job->at = cx_dir_ref (at);
+    snprintf (job->name, sizeof (job->name), "%s", name);
+  }
+  job->options  = g_options;
+  job->callback = callback;
+  job->data     = data;
+
+  if (!scan.running)
+  {
+    job_run (job);
+    job_deliver (job);
+    return;
+  }
+
+  pthread_mutex_lock (&scan.lock);
+  if (scan.pending_tail)
+    scan.pending_tail->next = job;
+  else
+    scan.pending_head = job;
+  scan.pending_tail = job;
+  pthread_cond_signal (&scan.work);
+  pthread_mutex_unlock (&scan.lock);
+}
+
+/* Decodes the blocks of `listing' that were drawn as placeholders, ahead
+   of any directory still to scan, and calls `callback' as each is put in;
+   cx_scan_cancel (listing) stops them. */
+void
+cx_scan_decode (CxDirListing *listing, CxDecodeCallback callback)
+{
+  CxDirBlock *block;
+  ScanJob *   job;
+
+  while ((block = cx_dir_listing_take_block (listing)))
+  {
+    job = calloc (1, sizeof (ScanJob));
+    if (!job)
+      cx_die (errno, "failed to allocate memory");
+    job->block           = block;
+    job->decode_callback = callback;
+    job->data            = listing;
+
+    if (!scan.running)
+    {
+      job_run (job);
+      job_deliver (job);
+      continue;
+    }
+
+    pthread_mutex_lock (&scan.lock);
+    job->next         = scan.pending_head;
+    scan.pending_head = job;
+    if (!scan.pending_tail)
+      scan.pending_tail = job;
+    pthread_cond_signal (&scan.work);
+    pthread_mutex_unlock (&scan.lock);
+  }
+}
+
+/* whether any scan has been asked for and not yet delivered */
+bool
+cx_scan_busy (void)
+{
+  bool busy;
+
+  pthread_mutex_lock (&scan.lock);
+  busy = scan.pending_head || scan.current || scan.done;
+  pthread_mutex_unlock (&scan.lock);
+  return busy;
+}
+
+/* Drops every request made with `data', so nothing is delivered to it once
+   the caller has gone away. Main thread only. */
+void
+cx_scan_cancel (void *data)
+{
+  ScanJob **p;
+  ScanJob * job;
+
+  pthread_mutex_lock (&scan.lock);
+
+  scan.pending_tail = NULL;
+  for (p = &scan.pending_head; (job = *p);)
+  {
+    if (job->data == data)
+    {
+      *p = job->next;
+      job_free (job);
+    }
+    else
+    {
+      scan.pending_tail = job;
+      p                 = &job->next;
+    }
+  }
+
+  /* already being scanned or waiting for the main loop */
+  if (scan.current && scan.current->data == data)
+    job_forget (scan.current);
+  for (job = scan.done; job; job = job->next)
+    if (job->data == data)
+      job_forget (job);
+  for (job = scan.delivering; job; job = job->next)
+    if (job->data == data)
+      job_forget (job);
+
+  pthread_mutex_unlock (&scan.lock);
+}
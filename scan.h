@@ -0,0 +1,28 @@
+#ifndef __CX_SCAN_H__
+#define __CX_SCAN_H__
+
+#include "files.h"
+#include "path.h"
+
+/* Called on the main thread once the scan of `path' has finished. The
+   callback takes ownership of `listing', whose `path' member points at
+   storage that is released when the callback returns. A scan given a
+   directory `at' reads `name' in it, as cx_dir_open() would, and only
+   otherwise looks `path' up. Without cx_scan_init(), as in the benchmark,
+   the scan is made and delivered before cx_scan_request() returns. */
+typedef void (*CxScanCallback) (const CxPath *path, CxDirListing *listing,
+                                void *data);
+
+/* called on the main thread once a block of `listing' has been put in */
+typedef void (*CxDecodeCallback) (CxDirListing *listing);
+
+void cx_scan_init (void);
+void cx_scan_finish (void);
+
+void cx_scan_request (const CxPath *path, CxDir *at, const char *name,
+                      CxScanCallback callback, void *data);
+void cx_scan_decode (CxDirListing *listing, CxDecodeCallback callback);
+void cx_scan_cancel (void *data);
+bool cx_scan_busy (void);
+
+#endif /* __CX_SCAN_H__ */
@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cx.h"
+#include "log.h"
+#include "session.h"
+#include "util.h"
+
+#define SESSION_FILENAME "." CX_PROGRAM_NAME ".session"
+#define SESSION_MAGIC UINT32_C (0x31535843) /* "CXS1" */
+#define SESSION_ALIGN 8
+
+/* a session is one listing small enough to hold in memory; anything much
+   bigger than that is not one */
+#define SESSION_MAX_SIZE (64 * 1024 * 1024)
+
+extern CxScanOptions g_options;
+
+/* followed by the path, then by an Item and its name for each entry but
+   the parent item, each zero padded to SESSION_ALIGN */
+typedef struct
+{
+  uint32_t magic;
+  uint32_t path_len;
+  uint32_t n_items;
+  int32_t  hilighted;
+  int32_t  first_item;
+  uint32_t hidden;
+} Header;
+
+/* what is drawn of an entry, and what a git status is worked out from */
+typedef struct
+{
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t  mtime;
+  int64_t  ctime;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t name_len;
+} Item;
+
+typedef struct
+{
+  const char *p;
+  const char *end;
+} Reader;
+
+static struct
+{
+  CxPath file;
+  bool   saving;
+} session;
+
+static size_t
+padded (size_t size)
+{
+  return (size + SESSION_ALIGN - 1) & ~(size_t) (SESSION_ALIGN - 1);
+}
+
+static void
+init_file (void)
+{
+  if (session.file.len == 0)
+    cx_path_set_as_user_file (&session.file, SESSION_FILENAME);
+}
+
+/* only the interactive program saves its session, never the benchmark or
+   a replayed one */
+void
+cx_session_init (void)
+{
+  session.saving = true;
+}
+
+static const void *
+take (Reader *r, size_t size)
+{
+  const char *p = r->p;
+
+  if ((size_t) (r->end - p) < padded (size))
+    return NULL;
+  r->p += padded (size);
+  return p;
+}
+
+/* the items of the saved listing; false when any of it does not add up */
+static bool
+read_items (Reader *r, CxSession *s, CxDirItem *list, int n)
+{
+  const Item *it;
+  const char *name;
+  struct stat st;
+  int         i;
+
+  for (i = 0; i < n; ++i)
+  {
+    it = take (r, sizeof (Item));
+    if (!it || it->name_len == 0 || it->name_len >= CX_DIR_ITEM_NAME_MAX)
+      return false;
+    name = take (r, it->name_len);
+    if (!name)
+      return false;
+
+    memset (&st, 0, sizeof (st));
+    st.st_dev   = it->dev;
+    st.st_ino   = it->ino;
+    st.st_size  = it->size;
+    st.st_mtime = it->mtime;
+    st.st_ctime = it->ctime;
+    st.st_mode  = it->mode;
+    st.st_uid   = it->uid;
+    st.st_gid   = it->gid;
+    st.st_nlink = 1;
+    cx_dir_item_init (&list[i], name, it->name_len, 0, &st,
+                      g_options.size_units);
+  }
+  return true;
+}
+
+/* The file is read in one go: it is small, and it may well be on the
+   slow mount whose directories it saves waiting for. */
+bool
+cx_session_load (CxSession *s)
+{
+  const Header *h;
+  const char *  path;
+  CxDirItem *   list;
+  struct stat   st;
+  Reader        r;
+  char *        buf;
+  bool          ok;
+  int           first;
+  int           total;
+  int           fd;
+
+  init_file ();
+  fd = cx_path_open_user_file (session.file.str, O_RDONLY);
+  if (fd == -1)
+    return false;
+  buf = NULL;
+  if (fstat (fd, &st) == 0 && st.st_size >= (off_t) sizeof (Header) &&
+      st.st_size <= SESSION_MAX_SIZE)
+  {
+    buf = malloc (st.st_size);
+    if (!buf)
+      cx_die (errno, "failed to allocate memory");
+    if (read (fd, buf, st.st_size) != st.st_size)
+    {
+      free (buf);
+      buf = NULL;
+    }
+  }
+  close (fd);
+  if (!buf)
+    return false;
+
+  r.p   = buf;
+  r.end = buf + st.st_size;
+  h     = take (&r, sizeof (Header));
+  path  = NULL;
+  if (h && h->magic == SESSION_MAGIC && h->path_len > 0 &&
+      h->path_len < CX_PATHMAX &&
+      h->hidden == g_options.include_hidden_files &&
+      h->n_items <= (uint32_t) g_options.window_threshold)
+    path = take (&r, h->path_len);
+  if (!path || *path != '/')
+  {
+    cx_log (CX_LOG_STATUS_WARN, "ignoring `%s'", session.file.str);
+    free (buf);
+    return false;
+  }
+
+  cx_path_init (&s->location, path, h->path_len);
+  first = cx_path_is_root (&s->location) ? 0 : 1;
+  total = first + h->n_items;
+  list  = malloc ((total > 0 ? total : 1) * sizeof (CxDirItem));
+  if (!list)
+    cx_die (errno, "failed to allocate memory");
+  if (first)
+    cx_dir_item_init_parent (list);
+
+  ok = read_items (&r, s, list + first, h->n_items) && total > 0 &&
+       h->hilighted >= 0 && h->hilighted < total && h->first_item >= 0 &&
+       h->first_item <= h->hilighted;
+  if (!ok)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "ignoring `%s'", session.file.str);
+    free (list);
+    free (buf);
+    return false;
+  }
+
+  s->hilighted  = h->hilighted;
+  s->first_item = h->first_item;
+  free (buf);
+  if (!cx_dir_listing_init_items (&s->listing, &s->location, list, total,
+                                  &g_options))
+  {
+    cx_dir_listing_free (&s->listing);
+    return false;
+  }
+  return true;
+}
+
+static bool
+write_padded (FILE *fp, const void *data, size_t size)
+{
+  static const char zeros[SESSION_ALIGN];
+
+  return fwrite (data, 1, size, fp) == size &&
+         fwrite (zeros, 1, padded (size) - size, fp) == padded (size) - size;
+}
+
+/* Replaces the saved session, going through a temporary file so that a
+   crash half way through leaves the last one. Listings too large to hold
+   in memory are not saved. */
+void
+cx_session_save (const CxPath *location, const CxDirListing *listing,
+                 int hilighted, int first_item)
+{
+  const CxDirItem *item;
+  Header           h;
+  Item             it;
+  char             tmp[CX_PATHMAX + 8];
+  FILE *           fp;
+  bool             ok;
+  int              first;
+  int              fd;
+  int              i;
+
+  if (!session.saving || listing->window || listing->error ||
+      cx_path_is_elided (location))
+    return;
+  init_file ();
+
+  snprintf (tmp, sizeof (tmp), "%s.tmp", session.file.str);
+  unlink (tmp);
+  fd = cx_path_open_user_file (tmp, O_WRONLY | O_CREAT | O_EXCL);
+  fp = fd == -1 ? NULL : fdopen (fd, "w");
+  if (!fp)
+  {
+    if (fd != -1)
+      close (fd);
+    cx_log (CX_LOG_STATUS_WARN, "failed to save `%s' - %s",
+            session.file.str, strerror (errno));
+    return;
+  }
+
+  first = cx_dir_listing_has_parent_item (listing) ? 1 : 0;
+  memset (&h, 0, sizeof (h));
+  h.magic      = SESSION_MAGIC;
+  h.path_len   = location->len;
+  h.n_items    = listing->total - first;
+  h.hilighted  = hilighted;
+  h.first_item = first_item;
+  h.hidden     = g_options.include_hidden_files;
+
+  ok = write_padded (fp, &h, sizeof (h)) &&
+       write_padded (fp, location->str, location->len);
+
+  for (i = first; ok && i < listing->total; ++i)
+  {
+    item = &listing->list[i];
+    memset (&it, 0, sizeof (it));
+    it.dev      = item->info.st.st_dev;
+    it.ino      = item->info.st.st_ino;
+    it.size     = item->info.st.st_size;
+    it.mtime    = item->info.st.st_mtime;
+    it.ctime    = item->info.st.st_ctime;
+    it.mode     = item->info.st.st_mode;
+    it.uid      = item->info.st.st_uid;
+    it.gid      = item->info.st.st_gid;
+    it.name_len = item->name_len;
+
+    ok = write_padded (fp, &it, sizeof (it)) &&
+         write_padded (fp, item->name, item->name_len);
+  }
+
+  if (fclose (fp) != 0 || !ok || rename (tmp, session.file.str) != 0)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "failed to save `%s' - %s",
+            session.file.str, strerror (errno));
+    unlink (tmp);
+  }
+}
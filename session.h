@@ -0,0 +1,25 @@
+#ifndef __CX_SESSION_H__
+#define __CX_SESSION_H__
+
+#include <stdbool.h>
+
+#include "files.h"
+#include "path.h"
+
+/* The directory shown when cx last exited, with the cursor and viewport
+   of its pane, kept so that it can be drawn again before it is read. */
+typedef struct
+{
+  CxPath       location;
+  CxDirListing listing;
+  int          hilighted;
+  int          first_item;
+} CxSession;
+
+void cx_session_init (void);
+
+bool cx_session_load (CxSession *session);
+void cx_session_save (const CxPath *location, const CxDirListing *listing,
+                      int hilighted, int first_item);
+
+#endif /* __CX_SESSION_H__ */
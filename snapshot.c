@@ -0,0 +1,632 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "log.h"
+#include "snapshot.h"
+#include "util.h"
+#include "walk.h"
+
+/* A snapshot file is the magic, the root's path and then one record per
+   entry: the length of the path it shares with the previous record's, the
+   rest of the path, then its size, mtime, mode and inode, every number a
+   varint. A record with an empty path ends the file, followed by the
+   number of records before it. */
+#define SNAPSHOT_MAGIC "CXSNAP1\n"
+#define SNAPSHOT_MAGIC_LEN 8
+
+/* snapshots are read and written through stdio buffers this large */
+#define IO_BUFFER_BYTES (1024 * 1024)
+
+/* past this many changes the rest are only counted */
+#define MAX_CHANGES 10000
+
+/* how many entries a comparison gets through between checks for being
+   cancelled */
+#define CANCEL_INTERVAL 4096
+
+#define ADDED_TYPE_STR "added"
+#define REMOVED_TYPE_STR "removed"
+#define MODIFIED_TYPE_STR "modified"
+
+extern CxScanOptions g_options;
+
+typedef struct
+{
+  FILE *      fp;
+  CxWalkEntry entry;
+  long long   n;
+  bool        failed;
+} Reader;
+
+/* one side of a comparison */
+typedef struct
+{
+  bool     live;
+  CxWalker walker;
+  Reader   reader;
+} Source;
+
+typedef enum
+{
+  CHANGE_ADDED,
+  CHANGE_REMOVED,
+  CHANGE_MODIFIED
+} ChangeKind;
+
+typedef struct
+{
+  char *     path;
+  int        path_len;
+  ChangeKind kind;
+  uint64_t   size;
+  int64_t    mtime;
+  uint32_t   mode;
+  uint64_t   ino;
+} Change;
+
+/* The comparison merges the two sides on its own thread, both already in
+   path order, so it only ever holds one entry of each. */
+typedef struct DiffSearch
+{
+  pthread_mutex_t lock;
+  pthread_t       thread;
+  CxPath          old_file;
+  Source          old;
+  Source          new;
+  Change *        changes;
+  int             n_changes;
+  int             alloc;
+  int             wake_fd;
+  bool            cancel;
+} DiffSearch;
+
+static void
+put_varint (FILE *fp, uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    putc_unlocked ((int) (v & 0x7f) | 0x80, fp);
+    v >>= 7;
+  }
+  putc_unlocked ((int) v, fp);
+}
+
+static bool
+get_varint (FILE *fp, uint64_t *v)
+{
+  int shift;
+  int c;
+
+  *v = 0;
+  for (shift = 0; shift < 64; shift += 7)
+  {
+    c = getc_unlocked (fp);
+    if (c == EOF)
+      return false;
+    *v |= (uint64_t) (c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static bool
+reader_open (Reader *r, const char *file, CxPath *root)
+{
+  char     magic[SNAPSHOT_MAGIC_LEN];
+  uint64_t len;
+  bool     ok;
+
+  memset (r, 0, sizeof (*r));
+  r->fp = fopen (file, "rb");
+  if (!r->fp)
+    return false;
+  setvbuf (r->fp, NULL, _IOFBF, IO_BUFFER_BYTES);
+
+  errno = 0;
+  ok    = fread (magic, 1, SNAPSHOT_MAGIC_LEN, r->fp) == SNAPSHOT_MAGIC_LEN &&
+       memcmp (magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) == 0 &&
+       get_varint (r->fp, &len) && len > 0 && len < CX_PATHMAX &&
+       fread (root->str, 1, len, r->fp) == len;
+  if (!ok)
+  {
+    if (errno == 0)
+      errno = EINVAL;
+    fclose (r->fp);
+    r->fp = NULL;
+    return false;
+  }
+
+  root->len            = len;
+  root->str[root->len] = '\0';
+  return true;
+}
+
+static void
+reader_close (Reader *r)
+{
+  if (r->fp)
+    fclose (r->fp);
+  r->fp = NULL;
+}
+
+/* false at the end of the file or at anything that does not parse, which
+   also marks the reader failed */
+static bool
+read_record (Reader *r)
+{
+  CxWalkEntry *e = &r->entry;
+  uint64_t     shared;
+  uint64_t     suffix;
+  uint64_t     v;
+
+  if (!get_varint (r->fp, &shared) || !get_varint (r->fp, &suffix))
+  {
+    r->failed = true;
+    return false;
+  }
+
+  if (shared == 0 && suffix == 0)
+  {
+    r->failed = !get_varint (r->fp, &v) || v != (uint64_t) r->n;
+    return false;
+  }
+
+  if (shared > (uint64_t) e->path_len || shared + suffix >= CX_PATHMAX ||
+      fread (e->path + shared, 1, suffix, r->fp) != suffix)
+  {
+    r->failed = true;
+    return false;
+  }
+  e->path_len          = shared + suffix;
+  e->path[e->path_len] = '\0';
+
+  if (!get_varint (r->fp, &e->size) || !get_varint (r->fp, &v))
+  {
+    r->failed = true;
+    return false;
+  }
+  e->mtime = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+
+  if (!get_varint (r->fp, &v) || !get_varint (r->fp, &e->ino))
+  {
+    r->failed = true;
+    return false;
+  }
+  e->mode = v;
+
+  ++r->n;
+  return true;
+}
+
+static const CxWalkEntry *
+reader_next (Reader *r)
+{
+  if (!r->fp)
+    return NULL;
+  if (read_record (r))
+    return &r->entry;
+  reader_close (r);
+  return NULL;
+}
+
+static const CxWalkEntry *
+source_next (Source *s)
+{
+  return s->live ? cx_walker_next (&s->walker) : reader_next (&s->reader);
+}
+
+static void
+source_free (Source *s)
+{
+  if (s->live)
+    cx_walker_free (&s->walker);
+  else
+    reader_close (&s->reader);
+}
+
+static void
+put_record (FILE *fp, const CxWalkEntry *e, const CxWalkEntry *prev)
+{
+  int shared;
+
+  for (shared = 0; shared < prev->path_len && shared < e->path_len &&
+                   prev->path[shared] == e->path[shared];
+       ++shared)
+    ;
+
+  put_varint (fp, shared);
+  put_varint (fp, e->path_len - shared);
+  fwrite (e->path + shared, 1, e->path_len - shared, fp);
+  put_varint (fp, e->size);
+  put_varint (fp, ((uint64_t) e->mtime << 1) ^ (uint64_t) (e->mtime >> 63));
+  put_varint (fp, e->mode);
+  put_varint (fp, e->ino);
+}
+
+bool
+cx_snapshot_write (const CxPath *root, const char *file,
+                   long long *n_entries)
+{
+  const CxWalkEntry *e;
+  CxWalker *         w;
+  CxWalkEntry *      prev;
+  FILE *             fp;
+  long long          n;
+  bool               ok;
+  int                err;
+
+  w    = calloc (1, sizeof (CxWalker));
+  prev = calloc (1, sizeof (CxWalkEntry));
+  if (!w || !prev)
+    cx_die (errno, "failed to allocate memory");
+
+  fp = NULL;
+  ok = cx_walker_init (w, root) && (fp = fopen (file, "wb"));
+  if (ok)
+  {
+    setvbuf (fp, NULL, _IOFBF, IO_BUFFER_BYTES);
+    fwrite (SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LEN, fp);
+    put_varint (fp, w->root_len);
+    fwrite (w->path, 1, w->root_len, fp);
+
+    for (n = 0; (e = cx_walker_next (w)); ++n)
+    {
+      put_record (fp, e, prev);
+      memcpy (prev, e, sizeof (CxWalkEntry));
+    }
+    put_varint (fp, 0);
+    put_varint (fp, 0);
+    put_varint (fp, n);
+
+    ok = !ferror (fp);
+    if (fclose (fp) != 0)
+      ok = false;
+    if (n_entries)
+      *n_entries = n;
+  }
+
+  err = errno;
+  cx_walker_free (w);
+  free (w);
+  free (prev);
+  errno = err;
+  return ok;
+}
+
+bool
+cx_snapshot_root (const char *file, CxPath *root)
+{
+  Reader r;
+
+  if (!reader_open (&r, file, root))
+    return false;
+  reader_close (&r);
+  return true;
+}
+
+static bool
+cancelled (DiffSearch *s)
+{
+  bool cancel;
+
+  pthread_mutex_lock (&s->lock);
+  cancel = s->cancel;
+  pthread_mutex_unlock (&s->lock);
+  return cancel;
+}
+
+/* A directory's size and mtime move with every entry added to or removed
+   from it, which is reported on its own, so only its mode and inode count
+   as a change. */
+static bool
+entry_changed (const CxWalkEntry *a, const CxWalkEntry *b)
+{
+  if (a->mode != b->mode || a->ino != b->ino)
+    return true;
+  if (S_ISDIR (a->mode))
+    return false;
+  return a->size != b->size || a->mtime != b->mtime;
+}
+
+static void
+add_change (CxSnapshotDiff *d, ChangeKind kind, const CxWalkEntry *e)
+{
+  DiffSearch *s = d->search;
+  Change *    c;
+
+  switch (kind)
+  {
+    case CHANGE_ADDED:
+      ++d->n_added;
+      break;
+    case CHANGE_REMOVED:
+      ++d->n_removed;
+      break;
+    case CHANGE_MODIFIED:
+      ++d->n_modified;
+      break;
+  }
+
+  if (s->n_changes == MAX_CHANGES)
+    return;
+  if (s->n_changes == s->alloc)
+  {
+    s->alloc   = s->alloc ? s->alloc * 2 : 64;
+    s->changes = realloc (s->changes, s->alloc * sizeof (Change));
+    if (!s->changes)
+      cx_die (errno, "failed to allocate memory");
+  }
+
+  c       = &s->changes[s->n_changes++];
+  c->path = malloc (e->path_len + 1);
+  if (!c->path)
+    cx_die (errno, "failed to allocate memory");
+  memcpy (c->path, e->path, e->path_len + 1);
+  c->path_len = e->path_len;
+  c->kind     = kind;
+  c->size     = e->size;
+  c->mtime    = e->mtime;
+  c->mode     = e->mode;
+  c->ino      = e->ino;
+}
+
+static void *
+diff_main (void *arg)
+{
+  CxSnapshotDiff *   d = arg;
+  DiffSearch *       s = d->search;
+  const CxWalkEntry *a;
+  const CxWalkEntry *b;
+  long long          n;
+  int                cmp;
+
+  a = source_next (&s->old);
+  b = source_next (&s->new);
+  for (n = 1; a || b; ++n)
+  {
+    if (n % CANCEL_INTERVAL == 0 && cancelled (s))
+      break;
+
+    cmp = !a ? 1
+             : (!b ? -1
+                   : cx_walk_compare (a->path, a->path_len, b->path,
+                                      b->path_len));
+    if (cmp < 0)
+    {
+      add_change (d, CHANGE_REMOVED, a);
+      a = source_next (&s->old);
+    }
+    else if (cmp > 0)
+    {
+      add_change (d, CHANGE_ADDED, b);
+      b = source_next (&s->new);
+    }
+    else
+    {
+      if (entry_changed (a, b))
+        add_change (d, CHANGE_MODIFIED, b);
+      a = source_next (&s->old);
+      b = source_next (&s->new);
+    }
+  }
+
+  d->failed = (!s->old.live && s->old.reader.failed) ||
+              (!s->new.live && s->new.reader.failed);
+  cx_event_wakeup (s->wake_fd);
+  return NULL;
+}
+
+static void
+set_title (CxSnapshotDiff *d)
+{
+  const char *old_file = d->search->old_file.str;
+  int         len;
+
+  if (d->failed)
+    len = snprintf (d->title.str, CX_PATHMAX,
+                    "%s: cannot compare with snapshot `%s'", d->base.str,
+                    old_file);
+  else if (!d->done)
+    len = snprintf (d->title.str, CX_PATHMAX, "%s: comparing with `%s'",
+                    d->base.str, old_file);
+  else
+  {
+    len = snprintf (d->title.str, CX_PATHMAX,
+                    "%s: %lld added, %lld removed, %lld modified since `%s'",
+                    d->base.str, d->n_added, d->n_removed, d->n_modified,
+                    old_file);
+    if (d->search->n_changes == MAX_CHANGES && len < CX_PATHMAX)
+      len += snprintf (d->title.str + len, CX_PATHMAX - len,
+                       " (first %d shown)", MAX_CHANGES);
+  }
+  d->title.len = len < CX_PATHMAX ? len : CX_PATHMAX - 1;
+}
+
+static void
+build_listing (CxSnapshotDiff *d)
+{
+  static const char *kind_strs[] = {
+    [CHANGE_ADDED]    = ADDED_TYPE_STR,
+    [CHANGE_REMOVED]  = REMOVED_TYPE_STR,
+    [CHANGE_MODIFIED] = MODIFIED_TYPE_STR,
+  };
+
+  const DiffSearch *s = d->search;
+  const Change *    c;
+  CxDirItem *       item;
+  struct stat       st;
+  char              type_str[CX_SMALL_BUFMAX];
+  int               i;
+
+  cx_dir_listing_free (&d->listing);
+  d->listing.path  = &d->title;
+  d->listing.total = 1 + s->n_changes;
+  d->listing.list  = malloc (d->listing.total * sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+
+  item = d->listing.list;
+  cx_dir_item_init_parent (item++);
+
+  /* entries are named by their path below the base */
+  memset (&st, 0, sizeof (st));
+  for (i = 0; i < s->n_changes; ++i, ++item)
+  {
+    c           = &s->changes[i];
+    st.st_mode  = c->mode;
+    st.st_size  = c->size;
+    st.st_mtime = c->mtime;
+    st.st_ino   = c->ino;
+    cx_dir_item_init (item, c->path, c->path_len, 0, &st,
+                      g_options.size_units);
+
+    item->info.type_str_len =
+      snprintf (type_str, sizeof (type_str), "%s %s", kind_strs[c->kind],
+                item->info.type_str);
+    memcpy (item->info.type_str, type_str, item->info.type_str_len + 1);
+  }
+}
+
+static void
+free_changes (DiffSearch *s)
+{
+  int i;
+
+  for (i = 0; i < s->n_changes; ++i)
+    free (s->changes[i].path);
+  free (s->changes);
+  s->changes   = NULL;
+  s->n_changes = 0;
+  s->alloc     = 0;
+}
+
+static void
+on_diff_done (int fd, void *data)
+{
+  CxSnapshotDiff *d = data;
+  DiffSearch *    s = d->search;
+
+  pthread_join (s->thread, NULL);
+  d->done = true;
+
+  source_free (&s->old);
+  source_free (&s->new);
+  if (d->failed)
+    cx_log (CX_LOG_STATUS_WARN, "snapshot `%s' is truncated or corrupt",
+            s->old_file.str);
+  else
+  {
+    build_listing (d);
+    cx_log (CX_LOG_STATUS_INFO,
+            "%lld added, %lld removed, %lld modified below `%s'", d->n_added,
+            d->n_removed, d->n_modified, d->base.str);
+  }
+  free_changes (s);
+  set_title (d);
+
+  if (d->callback)
+    d->callback (d, d->data);
+}
+
+/* With two snapshots the entries are listed below the newer one's root,
+   which need not exist any more; with one they are below `root'. */
+CxSnapshotDiff *
+cx_snapshot_diff_start (const char *old_file, const char *new_file,
+                        const CxPath *root, CxSnapshotDiffCallback callback,
+                        void *data)
+{
+  CxSnapshotDiff *d;
+  DiffSearch *    s;
+  CxPath          old_root;
+  bool            ok;
+
+  d = calloc (1, sizeof (CxSnapshotDiff));
+  s = calloc (1, sizeof (DiffSearch));
+  if (!d || !s)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&d->root, root);
+  cx_path_init_copy (&d->base, root);
+  cx_path_init (&s->old_file, old_file, strlen (old_file));
+  d->callback = callback;
+  d->data     = data;
+  d->search   = s;
+  s->wake_fd  = -1;
+
+  ok = reader_open (&s->old.reader, old_file, &old_root);
+  if (ok && new_file)
+    ok = reader_open (&s->new.reader, new_file, &d->base);
+  else if (ok)
+  {
+    s->new.live = true;
+    ok          = cx_walker_init (&s->new.walker, root);
+    if (ok)
+      cx_path_init (&d->base, s->new.walker.path, s->new.walker.root_len);
+  }
+
+  /* just a way back until the results are in */
+  d->listing.path     = &d->title;
+  d->listing.roots[0] = &d->base;
+  d->listing.total    = 1;
+  d->listing.list  = malloc (sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+  cx_dir_item_init_parent (d->listing.list);
+
+  if (!ok)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "failed to compare `%s' with `%s' - %s",
+            new_file ? new_file : root->str, old_file, strerror (errno));
+    source_free (&s->old);
+    source_free (&s->new);
+    d->done   = true;
+    d->failed = true;
+    set_title (d);
+    return d;
+  }
+
+  set_title (d);
+  pthread_mutex_init (&s->lock, NULL);
+  s->wake_fd = cx_event_wakeup_new (on_diff_done, d);
+  if (pthread_create (&s->thread, NULL, diff_main, d) != 0)
+    cx_die (0, "failed to start snapshot comparison");
+  return d;
+}
+
+void
+cx_snapshot_diff_free (CxSnapshotDiff *d)
+{
+  DiffSearch *s;
+
+  if (!d)
+    return;
+  s = d->search;
+
+  if (!d->done)
+  {
+    pthread_mutex_lock (&s->lock);
+    s->cancel = true;
+    pthread_mutex_unlock (&s->lock);
+    pthread_join (s->thread, NULL);
+    source_free (&s->old);
+    source_free (&s->new);
+    free_changes (s);
+  }
+
+  if (s->wake_fd != -1)
+  {
+    cx_event_wakeup_free (s->wake_fd);
+    pthread_mutex_destroy (&s->lock);
+  }
+  cx_dir_listing_free (&d->listing);
+  free (s);
+  free (d);
+}
@@ -0,0 +1,47 @@
+#ifndef __CX_SNAPSHOT_H__
+#define __CX_SNAPSHOT_H__
+
+#include <stdbool.h>
+
+#include "files.h"
+#include "path.h"
+
+typedef struct CxSnapshotDiff CxSnapshotDiff;
+
+/* Called on the main thread once `listing' holds the results. */
+typedef void (*CxSnapshotDiffCallback) (CxSnapshotDiff *diff, void *data);
+
+/* A snapshot records every entry below a directory, in the order of a
+   depth-first walk with each directory sorted by name. */
+bool cx_snapshot_write (const CxPath *root, const char *file,
+                        long long *n_entries);
+bool cx_snapshot_root (const char *file, CxPath *root);
+
+/* What changed between the snapshot `old_file' and either the snapshot
+   `new_file' or, when that is NULL, the tree as it is now. Its listing
+   starts with a `..' item, then one item per entry added, removed or
+   modified, in path order. */
+struct CxSnapshotDiff
+{
+  CxPath                 root; /* where the pane shows the results */
+  CxPath                 base; /* what the entries' paths are below */
+  CxPath                 title;
+  CxDirListing           listing;
+  long long              n_added;
+  long long              n_removed;
+  long long              n_modified;
+  bool                   done;
+  bool                   failed;
+  CxSnapshotDiffCallback callback;
+  void *                 data;
+  struct DiffSearch *    search;
+};
+
+CxSnapshotDiff *cx_snapshot_diff_start (const char *old_file,
+                                        const char *new_file,
+                                        const CxPath *root,
+                                        CxSnapshotDiffCallback callback,
+                                        void *data);
+void            cx_snapshot_diff_free (CxSnapshotDiff *diff);
+
+#endif /* __CX_SNAPSHOT_H__ */
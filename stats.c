@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stats.h"
+
+#define HISTORY_LEN 16
+
+#define THREAD_IO_PATH "/proc/thread-self/io"
+#define THREAD_IO_BUFSIZE 512
+#define WRITTEN_FIELD "wchar:"
+
+typedef struct
+{
+  uint64_t current;
+  uint64_t history[HISTORY_LEN];
+  uint64_t total;
+  int      n_samples;
+} Metric;
+
+static struct
+{
+  Metric   phases[CX_STATS_PHASE_COUNT];
+  Metric   counters[CX_STATS_COUNTER_COUNT];
+  int      io_fd;
+  int      cycles;
+} stats = { .io_fd = -1 };
+
+static const char *phase_names[CX_STATS_PHASE_COUNT] = {
+  "scan", "readdir", "stat", "alloc", "state_change", "draw",
+};
+
+static const char *counter_names[CX_STATS_COUNTER_COUNT] = {
+  "syscalls",
+  "alloc_bytes",
+  "term_bytes",
+};
+
+/* any thread may add, the main loop commits */
+void
+cx_stats_add_time (CxStatsPhase phase, uint64_t ns)
+{
+  __atomic_fetch_add (&stats.phases[phase].current, ns, __ATOMIC_RELAXED);
+}
+
+void
+cx_stats_add (CxStatsCounter counter, uint64_t n)
+{
+  __atomic_fetch_add (&stats.counters[counter].current, n, __ATOMIC_RELAXED);
+}
+
+/* What the main thread has written so far, as the kernel accounts it.
+   While a frame is drawn, its only writes are curses sending that frame
+   to the terminal, which cannot be hooked: curses writes to the
+   terminal's descriptor itself rather than through its FILE. Always 0
+   where the kernel does not keep the count. */
+uint64_t
+cx_stats_written_bytes (void)
+{
+  char        buf[THREAD_IO_BUFSIZE];
+  const char *field;
+  ssize_t     n;
+
+  if (stats.io_fd == -1)
+    stats.io_fd = open (THREAD_IO_PATH, O_RDONLY | O_CLOEXEC);
+  if (stats.io_fd == -1)
+    return 0;
+
+  n = pread (stats.io_fd, buf, sizeof (buf) - 1, 0);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+  field  = strstr (buf, WRITTEN_FIELD);
+  return field ? strtoull (field + strlen (WRITTEN_FIELD), NULL, 10) : 0;
+}
+
+/* adds what a listing cost since it was last taken to this cycle */
+void
+cx_stats_take (CxStatsTally *tally)
+{
+  int i;
+
+  for (i = 0; i < CX_STATS_PHASE_COUNT; ++i)
+    cx_stats_add_time (i, tally->phases[i]);
+  for (i = 0; i < CX_STATS_COUNTER_COUNT; ++i)
+    cx_stats_add (i, tally->counters[i]);
+  memset (tally, 0, sizeof (*tally));
+}
+
+/* cycles in which a metric did not move (e.g. no scan because only the
+   cursor moved) are not samples of it and would only drag the average down */
+static void
+metric_commit (Metric *m)
+{
+  uint64_t current = __atomic_exchange_n (&m->current, 0, __ATOMIC_RELAXED);
+
+  if (current == 0)
+    return;
+
+  m->history[m->n_samples++ % HISTORY_LEN] = current;
+  m->total += current;
+}
+
+static uint64_t
+metric_last (const Metric *m)
+{
+  if (m->n_samples == 0)
+    return 0;
+  return m->history[(m->n_samples - 1) % HISTORY_LEN];
+}
+
+static uint64_t
+metric_avg (const Metric *m)
+{
+  uint64_t sum = 0;
+  int      n;
+  int      i;
+
+  n = m->n_samples < HISTORY_LEN ? m->n_samples : HISTORY_LEN;
+  for (i = 0; i < n; ++i)
+    sum += m->history[i];
+  return n ? sum / n : 0;
+}
+
+void
+cx_stats_commit (void)
+{
+  int i;
+
+  for (i = 0; i < CX_STATS_PHASE_COUNT; ++i)
+    metric_commit (&stats.phases[i]);
+  for (i = 0; i < CX_STATS_COUNTER_COUNT; ++i)
+    metric_commit (&stats.counters[i]);
+  ++stats.cycles;
+}
+
+const char *
+cx_stats_phase_name (CxStatsPhase phase)
+{
+  return phase_names[phase];
+}
+
+const char *
+cx_stats_counter_name (CxStatsCounter counter)
+{
+  return counter_names[counter];
+}
+
+uint64_t
+cx_stats_phase_last (CxStatsPhase phase)
+{
+  return metric_last (&stats.phases[phase]);
+}
+
+uint64_t
+cx_stats_phase_avg (CxStatsPhase phase)
+{
+  return metric_avg (&stats.phases[phase]);
+}
+
+uint64_t
+cx_stats_counter_last (CxStatsCounter counter)
+{
+  return metric_last (&stats.counters[counter]);
+}
+
+uint64_t
+cx_stats_counter_avg (CxStatsCounter counter)
+{
+  return metric_avg (&stats.counters[counter]);
+}
+
+void
+cx_stats_dump (const char *path)
+{
+  FILE *fp;
+  int   i;
+
+  fp = fopen (path, "w");
+  if (!fp)
+  {
+    cx_log (CX_LOG_STATUS_ERROR, "failed to open stats file `%s' - %s", path,
+            strerror (errno));
+    return;
+  }
+
+  fprintf (fp, "cycles=%d\n", stats.cycles);
+  for (i = 0; i < CX_STATS_PHASE_COUNT; ++i)
+    fprintf (fp,
+             "phase=%s samples=%d last_ns=%" PRIu64 " avg_ns=%" PRIu64
+             " total_ns=%" PRIu64 "\n",
+             phase_names[i], stats.phases[i].n_samples,
+             cx_stats_phase_last (i), cx_stats_phase_avg (i),
+             stats.phases[i].total);
+  for (i = 0; i < CX_STATS_COUNTER_COUNT; ++i)
+    fprintf (fp,
+             "counter=%s samples=%d last=%" PRIu64 " avg=%" PRIu64
+             " total=%" PRIu64 "\n",
+             counter_names[i], stats.counters[i].n_samples,
+             cx_stats_counter_last (i), cx_stats_counter_avg (i),
+             stats.counters[i].total);
+  fclose (fp);
+}
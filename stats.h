@@ -0,0 +1,81 @@
+#ifndef __CX_STATS_H__
+#define __CX_STATS_H__
+
+#include <stdint.h>
+
+#include "util.h"
+
+typedef enum
+{
+  CX_STATS_PHASE_SCAN,
+  CX_STATS_PHASE_READDIR,
+  CX_STATS_PHASE_STAT,
+  CX_STATS_PHASE_ALLOC,
+  CX_STATS_PHASE_STATE_CHANGE,
+  CX_STATS_PHASE_DRAW,
+  CX_STATS_PHASE_COUNT
+} CxStatsPhase;
+
+typedef enum
+{
+  CX_STATS_COUNTER_SYSCALLS,
+  CX_STATS_COUNTER_ALLOC_BYTES,
+  CX_STATS_COUNTER_TERM_BYTES,
+  CX_STATS_COUNTER_COUNT
+} CxStatsCounter;
+
+/* What one listing cost to read and decode. The listing code only adds to
+   its listing's own tally, and calls nothing of the program's; whoever
+   holds the listing hands the tally over with CX_STATS_TAKE(). */
+typedef struct
+{
+  uint64_t phases[CX_STATS_PHASE_COUNT];
+  uint64_t counters[CX_STATS_COUNTER_COUNT];
+} CxStatsTally;
+
+#ifdef CX_STATS
+
+void cx_stats_add_time (CxStatsPhase phase, uint64_t ns);
+void cx_stats_add (CxStatsCounter counter, uint64_t n);
+
+uint64_t cx_stats_written_bytes (void);
+
+void cx_stats_take (CxStatsTally *tally);
+void cx_stats_commit (void);
+
+const char *cx_stats_phase_name (CxStatsPhase phase);
+const char *cx_stats_counter_name (CxStatsCounter counter);
+
+uint64_t cx_stats_phase_last (CxStatsPhase phase);
+uint64_t cx_stats_phase_avg (CxStatsPhase phase);
+uint64_t cx_stats_counter_last (CxStatsCounter counter);
+uint64_t cx_stats_counter_avg (CxStatsCounter counter);
+
+void cx_stats_dump (const char *path);
+
+#define CX_STATS_BEGIN(__phase)                                               \
+  uint64_t __cx_stats_start_##__phase = cx_monotonic_ns ()
+#define CX_STATS_END(__phase)                                                 \
+  cx_stats_add_time (__phase, cx_monotonic_ns () - __cx_stats_start_##__phase)
+#define CX_STATS_COUNT(__counter, __n) cx_stats_add (__counter, __n)
+#define CX_STATS_TALLY_END(__tally, __phase)                                  \
+  ((__tally)->phases[__phase] +=                                              \
+   cx_monotonic_ns () - __cx_stats_start_##__phase)
+#define CX_STATS_TALLY_COUNT(__tally, __counter, __n)                         \
+  ((__tally)->counters[__counter] += (__n))
+#define CX_STATS_TAKE(__tally) cx_stats_take (__tally)
+#define CX_STATS_COMMIT() cx_stats_commit ()
+
+#else /* !CX_STATS */
+
+#define CX_STATS_BEGIN(__phase)
+#define CX_STATS_END(__phase)
+#define CX_STATS_COUNT(__counter, __n)
+#define CX_STATS_TALLY_END(__tally, __phase)
+#define CX_STATS_TALLY_COUNT(__tally, __counter, __n)
+#define CX_STATS_TAKE(__tally)
+#define CX_STATS_COMMIT()
+
+#endif /* CX_STATS */
+
+#endif /* __CX_STATS_H__ */
@@ -0,0 +1,630 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "log.h"
+#include "top.h"
+#include "util.h"
+
+#define MAX_WORKERS 8
+
+/* how often the results so far are gathered while the walk goes on */
+#define REFRESH_MS 250
+
+#define DATE_FORMAT "%Y-%m-%d %H:%M"
+
+extern CxScanOptions g_options;
+
+typedef struct
+{
+  char *   path;
+  int      path_len;
+  uint64_t size;
+  int64_t  mtime;
+  uint32_t mode;
+  uint64_t ino;
+} TopFile;
+
+/* at most `count' files, the one ranking lowest on top */
+typedef struct
+{
+  TopFile *list;
+  int      n;
+  int      alloc;
+} Heap;
+
+typedef struct DirJob
+{
+  struct DirJob *next;
+  char           path[];
+} DirJob;
+
+/* Each worker keeps the best of the files it has found in a heap of its
+   own, so that nothing is shared while walking but the directory queue. */
+typedef struct
+{
+  struct TopSearch *search;
+  pthread_t         thread;
+  pthread_mutex_t   lock; /* against the heap being gathered */
+  Heap              heap;
+  long long         n_files;
+} Worker;
+
+/* The walk is fanned out over the workers, and the search's own thread
+   merges their heaps every REFRESH_MS into the results handed to the main
+   thread, so memory goes with the number of files asked for, however
+   many there are. */
+typedef struct TopSearch
+{
+  pthread_mutex_t lock;
+  pthread_cond_t  work;
+  pthread_t       thread;
+  Worker          workers[MAX_WORKERS];
+  int             n_workers;
+  DirJob *        dirs;
+  int             n_walking;
+  bool            walked;
+  CxTopOrder      order;
+  int             count;
+  dev_t           dev;
+  bool            hidden;
+  Heap            results;
+  long long       n_files;
+  bool            fresh; /* the results are yet to be taken */
+  bool            finished;
+  int             wake_fd;
+  bool            cancel;
+} TopSearch;
+
+static DirJob *
+dir_job_new (const char *path, int path_len, DirJob *next)
+{
+  DirJob *job;
+
+  job = malloc (sizeof (DirJob) + path_len + 1);
+  if (!job)
+    cx_die (errno, "failed to allocate memory");
+  memcpy (job->path, path, path_len + 1);
+  job->next = next;
+  return job;
+}
+
+static bool
+ranks_above (CxTopOrder order, const TopFile *a, const TopFile *b)
+{
+  if (order == CX_TOP_LARGEST && a->size != b->size)
+    return a->size > b->size;
+  if (a->mtime != b->mtime)
+    return a->mtime > b->mtime;
+  return a->size > b->size;
+}
+
+static void
+swap_files (TopFile *a, TopFile *b)
+{
+  TopFile t = *a;
+
+  *a = *b;
+  *b = t;
+}
+
+static void
+sift_up (Heap *h, CxTopOrder order, int i)
+{
+  int parent;
+
+  for (; i > 0; i = parent)
+  {
+    parent = (i - 1) / 2;
+    if (!ranks_above (order, &h->list[parent], &h->list[i]))
+      break;
+    swap_files (&h->list[parent], &h->list[i]);
+  }
+}
+
+static void
+sift_down (Heap *h, CxTopOrder order, int i)
+{
+  int lowest;
+  int child;
+
+  for (;;)
+  {
+    lowest = i;
+    for (child = 2 * i + 1; child <= 2 * i + 2 && child < h->n; ++child)
+      if (ranks_above (order, &h->list[lowest], &h->list[child]))
+        lowest = child;
+    if (lowest == i)
+      break;
+    swap_files (&h->list[i], &h->list[lowest]);
+    i = lowest;
+  }
+}
+
+/* whether `f' would make it into a heap of at most `count' */
+static bool
+heap_takes (const Heap *h, CxTopOrder order, int count, const TopFile *f)
+{
+  return h->n < count || ranks_above (order, f, &h->list[0]);
+}
+
+/* adds a copy of `f', in place of the lowest ranking file once full */
+static void
+heap_offer (Heap *h, CxTopOrder order, int count, const TopFile *f)
+{
+  TopFile *slot;
+  char *   path;
+
+  if (!heap_takes (h, order, count, f))
+    return;
+
+  path = malloc (f->path_len + 1);
+  if (!path)
+    cx_die (errno, "failed to allocate memory");
+  memcpy (path, f->path, f->path_len + 1);
+
+  if (h->n == count)
+  {
+    free (h->list[0].path);
+    h->list[0]      = *f;
+    h->list[0].path = path;
+    sift_down (h, order, 0);
+    return;
+  }
+
+  if (h->n == h->alloc)
+  {
+    h->alloc = h->alloc ? h->alloc * 2 : 64;
+    if (h->alloc > count)
+      h->alloc = count;
+    h->list = realloc (h->list, h->alloc * sizeof (TopFile));
+    if (!h->list)
+      cx_die (errno, "failed to allocate memory");
+  }
+  slot       = &h->list[h->n++];
+  *slot      = *f;
+  slot->path = path;
+  sift_up (h, order, h->n - 1);
+}
+
+static void
+heap_free (Heap *h)
+{
+  int i;
+
+  for (i = 0; i < h->n; ++i)
+    free (h->list[i].path);
+  free (h->list);
+  memset (h, 0, sizeof (*h));
+}
+
+/* Symlinks are never followed, and directories on another file system
+   are not entered, so a mount below the root cannot crowd it out. */
+static void
+walk_dir (Worker *w, const char *dir)
+{
+  TopSearch *    s     = w->search;
+  DirJob *       found = NULL;
+  DirJob *       last;
+  DIR *          dp;
+  struct dirent *de;
+  struct stat    st;
+  TopFile        f;
+  char           path[CX_PATHMAX];
+  long long      n = 0;
+  int            len;
+
+  dp = opendir (dir);
+  if (!dp)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "cannot search `%s' - %s", dir,
+            strerror (errno));
+    return;
+  }
+  if (fstat (dirfd (dp), &st) != 0 || st.st_dev != s->dev)
+  {
+    closedir (dp);
+    return;
+  }
+
+  while ((de = readdir (dp)))
+  {
+    if (cx_streq (de->d_name, ".") || cx_streq (de->d_name, "..") ||
+        (!s->hidden && *de->d_name == '.'))
+      continue;
+
+    len = snprintf (path, sizeof (path), "%s/%s",
+                    cx_streq (dir, "/") ? "" : dir, de->d_name);
+    if (len >= (int) sizeof (path))
+      continue;
+
+    /* the entry type saves a stat for every directory */
+    if (de->d_type == DT_DIR)
+      found = dir_job_new (path, len, found);
+    else if (de->d_type == DT_REG || de->d_type == DT_UNKNOWN)
+    {
+      if (fstatat (dirfd (dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      if (S_ISDIR (st.st_mode))
+        found = dir_job_new (path, len, found);
+      if (!S_ISREG (st.st_mode))
+        continue;
+
+      ++n;
+      f.path     = path;
+      f.path_len = len;
+      f.size     = st.st_size;
+      f.mtime    = st.st_mtime;
+      f.mode     = st.st_mode;
+      f.ino      = st.st_ino;
+
+      /* only this thread changes the heap, so it looks without locking */
+      if (heap_takes (&w->heap, s->order, s->count, &f))
+      {
+        pthread_mutex_lock (&w->lock);
+        heap_offer (&w->heap, s->order, s->count, &f);
+        pthread_mutex_unlock (&w->lock);
+      }
+    }
+  }
+  closedir (dp);
+
+  pthread_mutex_lock (&w->lock);
+  w->n_files += n;
+  pthread_mutex_unlock (&w->lock);
+
+  if (!found)
+    return;
+
+  for (last = found; last->next; last = last->next)
+    ;
+  pthread_mutex_lock (&s->lock);
+  last->next = s->dirs;
+  s->dirs    = found;
+  pthread_cond_broadcast (&s->work);
+  pthread_mutex_unlock (&s->lock);
+}
+
+/* the walk is over once no directory is queued and none is being read */
+static void *
+walk_main (void *arg)
+{
+  Worker *   w = arg;
+  TopSearch *s = w->search;
+  DirJob *   job;
+
+  pthread_mutex_lock (&s->lock);
+  for (;;)
+  {
+    while (!s->dirs && s->n_walking > 0 && !s->cancel)
+      pthread_cond_wait (&s->work, &s->lock);
+    if (!s->dirs || s->cancel)
+      break;
+
+    job     = s->dirs;
+    s->dirs = job->next;
+    ++s->n_walking;
+    pthread_mutex_unlock (&s->lock);
+
+    walk_dir (w, job->path);
+    free (job);
+
+    pthread_mutex_lock (&s->lock);
+    --s->n_walking;
+  }
+  s->walked = true;
+  pthread_cond_broadcast (&s->work);
+  pthread_mutex_unlock (&s->lock);
+  return NULL;
+}
+
+static int
+compare_largest (const void *a, const void *b)
+{
+  if (ranks_above (CX_TOP_LARGEST, a, b))
+    return -1;
+  return ranks_above (CX_TOP_LARGEST, b, a) ? 1 : 0;
+}
+
+static int
+compare_newest (const void *a, const void *b)
+{
+  if (ranks_above (CX_TOP_NEWEST, a, b))
+    return -1;
+  return ranks_above (CX_TOP_NEWEST, b, a) ? 1 : 0;
+}
+
+/* merges the workers' heaps into new results, best first, for the main
+   thread to pick up */
+static void
+gather (TopSearch *s, bool finished)
+{
+  Worker *  w;
+  Heap      merged;
+  long long n_files = 0;
+  int       i;
+  int       j;
+
+  memset (&merged, 0, sizeof (merged));
+  for (i = 0; i < s->n_workers; ++i)
+  {
+    w = &s->workers[i];
+    pthread_mutex_lock (&w->lock);
+    for (j = 0; j < w->heap.n; ++j)
+      heap_offer (&merged, s->order, s->count, &w->heap.list[j]);
+    n_files += w->n_files;
+    pthread_mutex_unlock (&w->lock);
+  }
+  qsort (merged.list, merged.n, sizeof (TopFile),
+         s->order == CX_TOP_LARGEST ? compare_largest : compare_newest);
+
+  pthread_mutex_lock (&s->lock);
+  heap_free (&s->results);
+  s->results  = merged;
+  s->n_files  = n_files;
+  s->fresh    = true;
+  s->finished = finished;
+  pthread_mutex_unlock (&s->lock);
+  cx_event_wakeup (s->wake_fd);
+}
+
+static void *
+search_main (void *arg)
+{
+  TopSearch *     s = arg;
+  struct timespec deadline;
+  int             i;
+
+  for (i = 0; i < s->n_workers; ++i)
+    if (pthread_create (&s->workers[i].thread, NULL, walk_main,
+                        &s->workers[i]) != 0)
+      cx_die (0, "failed to start file search");
+
+  pthread_mutex_lock (&s->lock);
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  while (!s->walked)
+  {
+    deadline.tv_nsec += REFRESH_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    while (!s->walked &&
+           pthread_cond_timedwait (&s->work, &s->lock, &deadline) == 0)
+      ;
+    if (s->walked)
+      break;
+
+    pthread_mutex_unlock (&s->lock);
+    gather (s, false);
+    pthread_mutex_lock (&s->lock);
+  }
+  pthread_mutex_unlock (&s->lock);
+
+  for (i = 0; i < s->n_workers; ++i)
+    pthread_join (s->workers[i].thread, NULL);
+  gather (s, true);
+  return NULL;
+}
+
+static void
+set_title (CxTop *d)
+{
+  const char *order_str = d->order == CX_TOP_LARGEST ? "largest" : "newest";
+  int         len;
+
+  if (d->failed)
+    len = snprintf (d->title.str, CX_PATHMAX, "%s: cannot search for files",
+                    d->root.str);
+  else
+    len = snprintf (d->title.str, CX_PATHMAX, "%s: %d %s of %lld files%s",
+                    d->root.str, d->listing.total - 1, order_str, d->n_files,
+                    d->done ? "" : " found so far");
+  d->title.len = len < CX_PATHMAX ? len : CX_PATHMAX - 1;
+}
+
+static void
+build_listing (CxTop *d, const Heap *results)
+{
+  const TopFile *f;
+  const char *   rel;
+  CxDirItem *    item;
+  struct stat    st;
+  struct tm      tm;
+  char           date[CX_SMALL_BUFMAX];
+  char           type_str[CX_SMALL_BUFMAX];
+  int            i;
+
+  cx_dir_listing_free (&d->listing);
+  d->listing.path  = &d->title;
+  d->listing.total = 1 + results->n;
+  d->listing.list  = malloc (d->listing.total * sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+
+  item = d->listing.list;
+  cx_dir_item_init_parent (item++);
+
+  /* files are named by their path below the root */
+  memset (&st, 0, sizeof (st));
+  for (i = 0; i < results->n; ++i, ++item)
+  {
+    f           = &results->list[i];
+    st.st_mode  = f->mode;
+    st.st_size  = f->size;
+    st.st_mtime = f->mtime;
+    st.st_ino   = f->ino;
+    rel         = f->path + d->root.len + (cx_path_is_root (&d->root) ? 0 : 1);
+    cx_dir_item_init (item, rel, f->path_len - (rel - f->path), 0, &st,
+                      g_options.size_units);
+
+    /* the order is not otherwise on screen */
+    if (d->order == CX_TOP_NEWEST)
+    {
+      *date = '\0';
+      if (localtime_r (&st.st_mtime, &tm))
+        strftime (date, sizeof (date), DATE_FORMAT, &tm);
+      item->info.type_str_len = snprintf (type_str, sizeof (type_str),
+                                          "%s %s", date, item->info.type_str);
+      memcpy (item->info.type_str, type_str, item->info.type_str_len + 1);
+    }
+  }
+}
+
+static void
+on_results (int fd, void *data)
+{
+  CxTop *    d = data;
+  TopSearch *s = d->search;
+  Heap       results;
+  bool       fresh;
+  bool       finished;
+
+  /* one wakeup may stand for several gathers, the last one's results
+     replacing the others' */
+  pthread_mutex_lock (&s->lock);
+  fresh   = s->fresh;
+  results = s->results;
+  memset (&s->results, 0, sizeof (s->results));
+  d->n_files = s->n_files;
+  finished   = s->finished;
+  s->fresh   = false;
+  pthread_mutex_unlock (&s->lock);
+
+  if (!fresh)
+    return;
+  if (finished)
+  {
+    pthread_join (s->thread, NULL);
+    d->done = true;
+  }
+
+  build_listing (d, &results);
+  heap_free (&results);
+  set_title (d);
+
+  if (d->done)
+    cx_log (CX_LOG_STATUS_INFO, "walked %lld files below `%s'", d->n_files,
+            d->root.str);
+  if (d->callback)
+    d->callback (d, d->data);
+}
+
+CxTop *
+cx_top_start (const CxPath *root, CxTopOrder order, int count,
+              CxTopCallback callback, void *data)
+{
+  CxTop *     d;
+  TopSearch * s;
+  struct stat st;
+  long        n_cpus;
+  int         i;
+
+  d = calloc (1, sizeof (CxTop));
+  s = calloc (1, sizeof (TopSearch));
+  if (!d || !s)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&d->root, root);
+  d->order    = order;
+  d->count    = count;
+  d->callback = callback;
+  d->data     = data;
+  d->search   = s;
+  s->wake_fd  = -1;
+
+  /* just a way back until the first results are in */
+  d->listing.path     = &d->title;
+  d->listing.roots[0] = &d->root;
+  d->listing.total    = 1;
+  d->listing.list  = malloc (sizeof (CxDirItem));
+  if (!d->listing.list)
+    cx_die (errno, "failed to allocate memory");
+  cx_dir_item_init_parent (d->listing.list);
+
+  if (stat (root->str, &st) != 0)
+  {
+    cx_log (CX_LOG_STATUS_WARN, "cannot search `%s' - %s", root->str,
+            strerror (errno));
+    d->done   = true;
+    d->failed = true;
+    set_title (d);
+    return d;
+  }
+
+  pthread_mutex_init (&s->lock, NULL);
+  pthread_cond_init (&s->work, NULL);
+
+  n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  s->n_workers =
+    n_cpus < 2 ? 2 : (n_cpus > MAX_WORKERS ? MAX_WORKERS : n_cpus);
+  for (i = 0; i < s->n_workers; ++i)
+  {
+    s->workers[i].search = s;
+    pthread_mutex_init (&s->workers[i].lock, NULL);
+  }
+
+  s->order   = order;
+  s->count   = count;
+  s->dev     = st.st_dev;
+  s->hidden  = g_options.include_hidden_files;
+  s->dirs    = dir_job_new (root->str, root->len, NULL);
+  s->wake_fd = cx_event_wakeup_new (on_results, d);
+  set_title (d);
+
+  if (pthread_create (&s->thread, NULL, search_main, s) != 0)
+    cx_die (0, "failed to start file search");
+  return d;
+}
+
+void
+cx_top_free (CxTop *d)
+{
+  TopSearch *s;
+  DirJob *   job;
+  int        i;
+
+  if (!d)
+    return;
+  s = d->search;
+
+  if (!d->done)
+  {
+    pthread_mutex_lock (&s->lock);
+    s->cancel = true;
+    pthread_cond_broadcast (&s->work);
+    pthread_mutex_unlock (&s->lock);
+    pthread_join (s->thread, NULL);
+  }
+
+  if (s->wake_fd != -1)
+  {
+    while ((job = s->dirs))
+    {
+      s->dirs = job->next;
+      free (job);
+    }
+    for (i = 0; i < s->n_workers; ++i)
+    {
+      heap_free (&s->workers[i].heap);
+      pthread_mutex_destroy (&s->workers[i].lock);
+    }
+    heap_free (&s->results);
+
+    cx_event_wakeup_free (s->wake_fd);
+    pthread_cond_destroy (&s->work);
+    pthread_mutex_destroy (&s->lock);
+  }
+  cx_dir_listing_free (&d->listing);
+  free (s);
+  free (d);
+}
@@ -0,0 +1,44 @@
+#ifndef __CX_TOP_H__
+#define __CX_TOP_H__
+
+#include <stdbool.h>
+
+#include "files.h"
+#include "path.h"
+
+typedef enum
+{
+  CX_TOP_LARGEST,
+  CX_TOP_NEWEST
+} CxTopOrder;
+
+typedef struct CxTop CxTop;
+
+/* Called on the main thread each time `listing' is refined, the last time
+   with `done' set. */
+typedef void (*CxTopCallback) (CxTop *top, void *data);
+
+/* The `count' largest or most recently modified files below `root', on
+   its file system. Its listing starts with a `..' item, then one item per
+   file, first to last in that order, and holds those of the files walked
+   so far until the walk is over. */
+struct CxTop
+{
+  CxPath            root;
+  CxPath            title;
+  CxDirListing      listing;
+  CxTopOrder        order;
+  int               count;
+  long long         n_files;
+  bool              done;
+  bool              failed;
+  CxTopCallback     callback;
+  void *            data;
+  struct TopSearch *search;
+};
+
+CxTop *cx_top_start (const CxPath *root, CxTopOrder order, int count,
+                     CxTopCallback callback, void *data);
+void   cx_top_free (CxTop *top);
+
+#endif /* __CX_TOP_H__ */
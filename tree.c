@@ -0,0 +1,483 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "scan.h"
+#include "tree.h"
+#include "util.h"
+
+static void request_scan (CxTree *tree, CxTreeNode *node);
+
+static bool
+is_parent_item (const CxTreeNode *node, int index)
+{
+  return index == 0 && node->listing->total > 0 &&
+         cx_dir_listing_has_parent_item (node->listing);
+}
+
+static int
+item_rows (const CxTreeNode *node, int index)
+{
+  const CxTreeNode *child = node->children[index];
+  int               rows;
+
+  /* nested listings leave out their `..' item */
+  rows = (node->parent && is_parent_item (node, index)) ? 0 : 1;
+  if (child && child->expanded)
+    rows += child->rows;
+  return rows;
+}
+
+static void
+fenwick_build (CxTreeNode *node)
+{
+  int n = node->listing->total;
+  int i;
+  int j;
+
+  free (node->fenwick);
+  node->fenwick = calloc (n + 1, sizeof (int));
+  if (!node->fenwick)
+    cx_die (errno, "failed to allocate memory");
+  node->n_items = n;
+
+  /* linear-time construction: each slot is complete by the time it is
+     folded into the next one that covers it */
+  for (i = 1; i <= n; ++i)
+  {
+    node->fenwick[i] += item_rows (node, i - 1);
+    j = i + (i & -i);
+    if (j <= n)
+      node->fenwick[j] += node->fenwick[i];
+  }
+}
+
+static void
+fenwick_add (CxTreeNode *node, int index, int delta)
+{
+  int i;
+
+  for (i = index + 1; i <= node->n_items; i += i & -i)
+    node->fenwick[i] += delta;
+}
+
+/* rows occupied by the first `count' items */
+static int
+fenwick_prefix (const CxTreeNode *node, int count)
+{
+  int sum = 0;
+  int i;
+
+  for (i = count; i > 0; i -= i & -i)
+    sum += node->fenwick[i];
+  return sum;
+}
+
+/* the item covering `*row', leaving the offset into that item in `*row' */
+static int
+fenwick_find (const CxTreeNode *node, int *row)
+{
+  int pos  = 0;
+  int r    = *row;
+  int step = 1;
+
+  while (step * 2 <= node->n_items)
+    step *= 2;
+
+  for (; step > 0; step /= 2)
+  {
+    if (pos + step <= node->n_items && node->fenwick[pos + step] <= r)
+    {
+      pos += step;
+      r -= node->fenwick[pos];
+    }
+  }
+
+  *row = r;
+  return pos;
+}
+
+/* carries a change in the size of `node' up through every expanded
+   ancestor, one O(log n) update per level */
+static void
+propagate (CxTreeNode *node, int delta)
+{
+  while (node->parent && node->expanded && delta != 0)
+  {
+    fenwick_add (node->parent, node->index, delta);
+    node->parent->rows += delta;
+    node = node->parent;
+  }
+}
+
+static bool
+is_visible (const CxTreeNode *node)
+{
+  for (; node->parent; node = node->parent)
+    if (!node->expanded)
+      return false;
+  return true;
+}
+
+static int
+start_row (const CxTreeNode *node)
+{
+  if (!node->parent)
+    return 0;
+  return cx_tree_row_of (node->parent, node->index) + 1;
+}
+
+static void
+notify (CxTree *tree, const CxTreeNode *node, int old_rows, int new_rows)
+{
+  if (tree->on_change && is_visible (node))
+    tree->on_change (start_row (node), old_rows, new_rows, tree->data);
+}
+
+/* scans are asked for by node, and the root is part of the tree */
+static CxTree *
+tree_of (CxTreeNode *node)
+{
+  while (node->parent)
+    node = node->parent;
+  return (CxTree *) ((char *) node - offsetof (CxTree, root));
+}
+
+static void
+node_free (CxTreeNode *node)
+{
+  CxTreeNode *child;
+  CxTreeNode *next;
+
+  cx_scan_cancel (node);
+  for (child = node->first_child; child; child = next)
+  {
+    next = child->next_sibling;
+    node_free (child);
+  }
+
+  if (node->scanned)
+  {
+    cx_scan_cancel (&node->own);
+    cx_dir_listing_free (&node->own);
+  }
+  free (node->children);
+  free (node->fenwick);
+  free (node);
+}
+
+static bool
+is_dir_named (const CxDirItem *item, const char *name, int name_len)
+{
+  /* a rescanned link has not been followed yet */
+  return (item->info.target_type == CX_FILE_TYPE_DIRECTORY ||
+          item->info.type == CX_FILE_TYPE_SYMLINK) &&
+         cx_strneq (item->name, item->name_len, name, name_len);
+}
+
+/* the item `child' now belongs to, trying its old position first since
+   most rescans change little */
+static int
+find_item (const CxTreeNode *node, const CxTreeNode *child)
+{
+  CxDirListing *listing = node->listing;
+  int           i;
+
+  if (child->index < listing->total &&
+      is_dir_named (cx_dir_listing_item (listing, child->index), child->name,
+                    child->name_len))
+    return child->index;
+
+  i = cx_dir_listing_find_name (listing, child->name, child->name_len);
+  if (i >= 0 && is_dir_named (cx_dir_listing_item (listing, i), child->name,
+                              child->name_len))
+    return i;
+  return -1;
+}
+
+/* keeps the cached subtrees whose directories survived a rescan of `node';
+   the ones on screen are rescanned too, the rest when next expanded */
+static void
+reattach_children (CxTree *tree, CxTreeNode *node)
+{
+  CxTreeNode *child;
+  CxTreeNode *next;
+  int         index;
+
+  free (node->children);
+  node->children = calloc (node->listing->total + 1, sizeof (CxTreeNode *));
+  if (!node->children)
+    cx_die (errno, "failed to allocate memory");
+
+  child             = node->first_child;
+  node->first_child = NULL;
+  for (; child; child = next)
+  {
+    next  = child->next_sibling;
+    index = find_item (node, child);
+    if (index == -1)
+    {
+      node_free (child);
+      continue;
+    }
+
+    child->index          = index;
+    child->next_sibling   = node->first_child;
+    node->first_child     = child;
+    node->children[index] = child;
+
+    if (child->expanded)
+      request_scan (tree, child);
+    else if (child->scanned)
+      child->stale = true;
+  }
+}
+
+static void
+node_set_listing (CxTree *tree, CxTreeNode *node, CxDirListing *listing)
+{
+  int old_rows = node->rows;
+
+  if (node->scanned)
+  {
+    cx_scan_cancel (&node->own);
+    cx_dir_listing_free (&node->own);
+  }
+  node->own      = *listing;
+  node->own.path = &node->path;
+  node->listing  = &node->own;
+  node->scanned  = true;
+
+  reattach_children (tree, node);
+  fenwick_build (node);
+  node->rows = fenwick_prefix (node, node->n_items);
+
+  propagate (node, node->rows - old_rows);
+  if (node->expanded)
+    notify (tree, node, old_rows, node->rows);
+}
+
+/* a node that went away since took its scans with it */
+static void
+on_scan_done (const CxPath *path, CxDirListing *listing, void *data)
+{
+  CxTreeNode *node = data;
+  CxTree *    tree = tree_of (node);
+  bool        stale;
+
+  stale          = node->stale;
+  node->scanning = false;
+  node->stale    = false;
+  node_set_listing (tree, node, listing);
+
+  if (stale)
+  {
+    if (node->expanded)
+      request_scan (tree, node);
+    else
+      node->stale = true;
+  }
+}
+
+/* a directory below one that was read is read from it by name */
+static void
+request_scan (CxTree *tree, CxTreeNode *node)
+{
+  CxDir *at = node->parent ? node->parent->listing->dir : NULL;
+
+  if (node->scanning)
+  {
+    node->stale = true;
+    return;
+  }
+
+  node->scanning = true;
+  node->stale    = false;
+  cx_scan_request (&node->path, at, node->name, on_scan_done, node);
+}
+
+void
+cx_tree_init (CxTree *tree, CxTreeChanged on_change, void *data)
+{
+  memset (tree, 0, sizeof (*tree));
+  tree->root.expanded = true;
+  tree->root.scanned  = true;
+  tree->on_change     = on_change;
+  tree->data          = data;
+}
+
+void
+cx_tree_free (CxTree *tree)
+{
+  CxTreeNode *child;
+  CxTreeNode *next;
+
+  for (child = tree->root.first_child; child; child = next)
+  {
+    next = child->next_sibling;
+    node_free (child);
+  }
+  free (tree->root.children);
+  free (tree->root.fenwick);
+  cx_tree_init (tree, tree->on_change, tree->data);
+}
+
+/* The root listing belongs to the caller. When it is a rescan of the same
+   directory, `keep' holds on to the subtrees already expanded below it. */
+void
+cx_tree_set_root (CxTree *tree, CxDirListing *listing, bool keep)
+{
+  CxTreeNode *root = &tree->root;
+
+  if (!keep)
+  {
+    cx_tree_free (tree);
+    root = &tree->root;
+  }
+
+  root->listing = listing;
+  cx_path_init_copy (&root->path, listing->path);
+
+  reattach_children (tree, root);
+  fenwick_build (root);
+  root->rows = fenwick_prefix (root, root->n_items);
+}
+
+int
+cx_tree_rows (const CxTree *tree)
+{
+  return tree->root.listing ? tree->root.rows : 0;
+}
+
+static bool
+tree_row (const CxTree *tree, int row, CxTreeRow *out, bool wait)
+{
+  const CxTreeNode *node = &tree->root;
+  int               index;
+
+  if (!node->listing || row < 0 || row >= node->rows)
+    return false;
+
+  for (;;)
+  {
+    index = fenwick_find (node, &row);
+    if (row == 0)
+      break;
+    node = node->children[index];
+    --row;
+  }
+
+  out->node  = (CxTreeNode *) node;
+  out->index = index;
+  out->item  = wait ? cx_dir_listing_item (node->listing, index)
+                    : cx_dir_listing_item_nowait (node->listing, index);
+  out->depth = node->depth;
+  return true;
+}
+
+bool
+cx_tree_row (const CxTree *tree, int row, CxTreeRow *out)
+{
+  return tree_row (tree, row, out, true);
+}
+
+/* for drawing: the item may be a placeholder, as from
+   cx_dir_listing_item_nowait() */
+bool
+cx_tree_row_nowait (const CxTree *tree, int row, CxTreeRow *out)
+{
+  return tree_row (tree, row, out, false);
+}
+
+int
+cx_tree_row_of (const CxTreeNode *node, int index)
+{
+  return start_row (node) + fenwick_prefix (node, index);
+}
+
+CxTreeNode *
+cx_tree_child (const CxTreeRow *row)
+{
+  return row->node->children[row->index];
+}
+
+bool
+cx_tree_is_last (const CxTreeNode *node, int index)
+{
+  return index == node->listing->total - 1;
+}
+
+void
+cx_tree_expand (CxTree *tree, const CxTreeRow *row)
+{
+  CxTreeNode *node = row->node;
+  CxTreeNode *child;
+
+  if (row->item->info.target_type != CX_FILE_TYPE_DIRECTORY ||
+      is_parent_item (node, row->index))
+    return;
+
+  child = node->children[row->index];
+  if (!child)
+  {
+    child = calloc (1, sizeof (CxTreeNode));
+    if (!child)
+      cx_die (errno, "failed to allocate memory");
+
+    cx_path_dir_item (&child->path, &node->path, row->item->name,
+                      row->item->name_len);
+    memcpy (child->name, row->item->name, row->item->name_len + 1);
+    child->name_len     = row->item->name_len;
+    child->own.path     = &child->path;
+    child->listing      = &child->own;
+    child->parent       = node;
+    child->index        = row->index;
+    child->depth        = node->depth + 1;
+    child->next_sibling = node->first_child;
+
+    node->first_child          = child;
+    node->children[row->index] = child;
+  }
+
+  if (child->expanded)
+    return;
+
+  /* whatever was cached shows up at once; a fresh listing follows */
+  child->expanded = true;
+  propagate (child, child->rows);
+  notify (tree, child, 0, child->rows);
+
+  if (!child->scanned || child->stale)
+    request_scan (tree, child);
+}
+
+static void
+collapse_node (CxTree *tree, CxTreeNode *node)
+{
+  if (!node->expanded)
+    return;
+
+  propagate (node, -node->rows);
+  notify (tree, node, node->rows, 0);
+  node->expanded = false;
+}
+
+void
+cx_tree_collapse (CxTree *tree, const CxTreeRow *row)
+{
+  CxTreeNode *child = cx_tree_child (row);
+
+  if (child)
+    collapse_node (tree, child);
+}
+
+void
+cx_tree_collapse_all (CxTree *tree)
+{
+  CxTreeNode *child;
+
+  for (child = tree->root.first_child; child; child = child->next_sibling)
+    collapse_node (tree, child);
+}
@@ -0,0 +1,74 @@
+#ifndef __CX_TREE_H__
+#define __CX_TREE_H__
+
+#include <stdbool.h>
+
+#include "files.h"
+#include "path.h"
+
+typedef struct CxTreeNode CxTreeNode;
+
+/* A directory whose listing is (or is being) shown inline below its item.
+   Every node keeps a Fenwick tree over the number of visible rows each of
+   its items occupies, so a row can be found, and an expansion accounted
+   for, without flattening the whole tree. A node is read by its `name' in
+   the directory its parent was read from; `path' is only for showing. */
+struct CxTreeNode
+{
+  CxPath        path;
+  char          name[CX_DIR_ITEM_NAME_MAX];
+  int           name_len;
+  CxDirListing  own;
+  CxDirListing *listing;
+  CxTreeNode *  parent;
+  CxTreeNode *  first_child;
+  CxTreeNode *  next_sibling;
+  CxTreeNode ** children;
+  int *         fenwick;
+  int           n_items;
+  int           rows;
+  int           index;
+  int           depth;
+  bool          scanned;
+  bool          scanning;
+  bool          expanded;
+  bool          stale;
+};
+
+/* rows [row, row + old_rows) of the visible tree became `new_rows' rows */
+typedef void (*CxTreeChanged) (int row, int old_rows, int new_rows,
+                               void *data);
+
+typedef struct
+{
+  CxTreeNode    root;
+  CxTreeChanged on_change;
+  void *        data;
+} CxTree;
+
+typedef struct
+{
+  CxTreeNode *node;
+  CxDirItem * item;
+  int         index;
+  int         depth;
+} CxTreeRow;
+
+void cx_tree_init (CxTree *tree, CxTreeChanged on_change, void *data);
+void cx_tree_free (CxTree *tree);
+
+void cx_tree_set_root (CxTree *tree, CxDirListing *listing, bool keep);
+
+int  cx_tree_rows (const CxTree *tree);
+bool cx_tree_row (const CxTree *tree, int row, CxTreeRow *out);
+bool cx_tree_row_nowait (const CxTree *tree, int row, CxTreeRow *out);
+int  cx_tree_row_of (const CxTreeNode *node, int index);
+
+CxTreeNode *cx_tree_child (const CxTreeRow *row);
+bool        cx_tree_is_last (const CxTreeNode *node, int index);
+
+void cx_tree_expand (CxTree *tree, const CxTreeRow *row);
+void cx_tree_collapse (CxTree *tree, const CxTreeRow *row);
+void cx_tree_collapse_all (CxTree *tree);
+
+#endif /* __CX_TREE_H__ */
@@ -1,14 +1,51 @@
-#include <signal.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wchar.h>
 
 #include <ncurses.h>
 
+#include "archive.h"
+#include "cache.h"
+#include "compare.h"
+#include "compressed.h"
+#include "dupes.h"
+#include "follow.h"
+#include "git.h"
+#include "jump.h"
+#include "log.h"
+#include "scan.h"
+#include "session.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "top.h"
+#include "tree.h"
 #include "ui.h"
 #include "util.h"
 
 #define ENTER_KEY 10
+#define TAB_KEY 9
 #define ESC_KEY 27
 
+#define MAX_COUNT 100000
+#define MAX_PANES 9
+
+#define PREVIEW_BYTES 65536
+#define PREVIEW_TAB_WIDTH 8
+#define PREVIEW_HEX_BYTES 16
+
+#define JUMP_QUERY_MAX 256
+#define JUMP_MAX_MATCHES 8
+
+/* how many files `L' and `N' list without a count */
+#define TOP_COUNT 100
+
 #define HELP_ITEM_PADDING 4
 #define HELP_WINDOW_LINE_PADDING 2
 #define HELP_WINDOW_COLUMN_PADDING 4
@@ -25,6 +62,36 @@
 #define RIGHT_ARROW_HELP_KEY "\u2192"
 #define RIGHT_ARROW_HELP_DESC "Change to hilighted directory"
 
+#define PAGE_HELP_KEY "PgUp/PgDn"
+#define PAGE_HELP_DESC "Move up/down one page"
+
+#define TOP_HELP_KEY "Home/End"
+#define TOP_HELP_DESC "Move to the first/last item"
+
+#define PERCENT_HELP_KEY "N%"
+#define PERCENT_HELP_DESC "Move to N percent of the way down the listing"
+
+#define LETTER_HELP_KEY "f<c>"
+#define LETTER_HELP_DESC "Move to the next item starting with <c>"
+
+#define JUMP_HELP_KEY "j"
+#define JUMP_HELP_DESC "Jump to a frequently visited directory"
+
+#define DUPES_HELP_KEY "D"
+#define DUPES_HELP_DESC "Find duplicate files below the current directory"
+
+#define LARGEST_HELP_KEY "L"
+#define LARGEST_HELP_DESC "List the N largest files below this directory"
+
+#define NEWEST_HELP_KEY "N"
+#define NEWEST_HELP_DESC "List the N newest files below this directory"
+
+#define COMPARE_HELP_KEY "C"
+#define COMPARE_HELP_DESC "Compare the current directory with the other pane's"
+
+#define VERIFY_HELP_KEY "V"
+#define VERIFY_HELP_DESC "Compare as with C, including file contents"
+
 #define HOME_HELP_KEY "H"
 #define HOME_HELP_DESC "Change to home directory"
 
@@ -41,52 +108,396 @@
 #define EXIT_HELP_DESC "Exit program"
 
 #define ENTER_HELP_KEY "Enter"
-#define ENTER_HELP_DESC "Change to hilighted directory"
+#define ENTER_HELP_DESC "Open hilighted directory or archive, or preview file"
+
+#define TREE_HELP_KEY "t"
+#define TREE_HELP_DESC "Toggle tree view"
+
+#define SPACE_HELP_KEY "Space"
+#define SPACE_HELP_DESC "Expand/collapse hilighted directory in tree view"
+
+#define NEW_TAB_HELP_KEY "T"
+#define NEW_TAB_HELP_DESC "Open a new tab at the current directory"
+
+#define CLOSE_TAB_HELP_KEY "X"
+#define CLOSE_TAB_HELP_DESC "Close the current tab"
+
+#define NEXT_TAB_HELP_KEY "[/]"
+#define NEXT_TAB_HELP_DESC "Switch to the previous/next tab"
+
+#define SPLIT_HELP_KEY "|"
+#define SPLIT_HELP_DESC "Toggle the dual-pane view"
+
+#define SWITCH_PANE_HELP_KEY "Tab"
+#define SWITCH_PANE_HELP_DESC "Switch to the other pane (or the next tab)"
+
+#define FOLLOW_HELP_KEY "F"
+#define FOLLOW_HELP_DESC "Follow the end of hilighted file as it grows"
+
+#define GIT_HELP_KEY "v"
+#define GIT_HELP_DESC "Toggle the git status column"
+
+#define STATS_HELP_KEY "s"
+#define STATS_HELP_DESC "Toggle the performance statistics overlay"
 
 #define HELP_HELP_KEY "h"
-#define HELP_HELP_DESC "Toggle this help window"
+#define HELP_HELP_DESC "Toggle this help window, arrows scroll it"
 
 #define CURDIR_COLOR 1
 #define HILIGHT_COLOR 2
 #define PARENT_ITEM_COLOR 3
 
-extern CxSizeUnits g_size_units;
-extern bool        g_include_hidden_files;
-extern bool        g_state_changed;
+extern CxScanOptions g_options;
+extern bool          g_state_changed;
+
+/* where the preview reads from as it scrolls; an archive member and a
+   message are read once */
+typedef enum
+{
+  PREVIEW_FILE,
+  PREVIEW_COMPRESSED,
+  PREVIEW_MEMBER,
+  PREVIEW_MESSAGE
+} PreviewSource;
+
+/* A tab. Panes showing the same directory share its cache entry, so it is
+   scanned and held in memory once however many are open on it. */
+typedef struct
+{
+  CxPath        location;
+  CxCacheEntry *entry;
+  uint64_t      generation;
+  /* every row goes through the tree; outside tree mode nothing is
+     expanded and row i is simply item i of the listing */
+  CxTree tree;
+  int    first_listing_item;
+  int    hilighted;
+  bool   tree_mode;
+  /* shown in place of the directory while set */
+  CxDupes *       dupes;
+  CxSnapshotDiff *diff;
+  CxCompare *     compare;
+  CxTop *         top;
+} Pane;
 
 static struct
 {
-  int  first_listing_item;
-  int  hilighted;
-  int  height;
-  int  width;
-  int  listing_area_h;
-  int  listing_area_w;
-  bool running;
-  bool keep_running;
+  SCREEN *screen;
+  FILE *  term_out;
+  FILE *  term_in;
+  int (*next_key) (void);
+  Pane *panes[MAX_PANES];
+  int   n_panes;
+  int   active;
+  int   other; /* shown beside the active pane in the dual-pane view */
+  bool  split;
+  int   area_x;
+  int   area_w;
+  int   height;
+  int   width;
+  int   listing_area_h;
+  int   listing_area_w;
+  bool  running;
+  bool  keep_running;
+  int   count;
+  bool  find_letter;
+  bool  redraw;
+  bool  show_help;
+  int   help_top; /* the first help entry shown when they do not all fit */
+  bool  jumping;
+  char  jump_query[JUMP_QUERY_MAX];
+  int   jump_query_len;
+  int   jump_selected;
+  int   n_jump_matches;
+  CxJumpMatch   jump_matches[JUMP_MAX_MATCHES];
+  bool          show_preview;
+  char *        preview;
+  int           preview_len;
+  int           preview_top; /* where the first row shown starts */
+  uint64_t      preview_offset;
+  bool          preview_end; /* nothing follows what `preview' holds */
+  bool          preview_hex;
+  PreviewSource preview_source;
+  CxCompressed *preview_compressed;
+  CxPath        preview_path;
+  CxFollow *    follow;
+  /* a file too deep to be named from `/' is opened through the held
+     descriptor of its directory, and titled by where it is */
+  CxDir * file_dir;
+  CxPath  file_path;
+  CxPath  file_title;
+  bool          show_git;
+#ifdef CX_STATS
+  bool show_stats;
+#endif
 } ui;
 
+static int
+read_key (void)
+{
+  if (!ui.next_key)
+    return getch ();
+  return ui.next_key ();
+}
+
+void
+cx_ui_set_terminal (FILE *out, FILE *in)
+{
+  ui.term_out = out;
+  ui.term_in  = in;
+}
+
+void
+cx_ui_set_key_source (int (*next_key) (void))
+{
+  ui.next_key = next_key;
+}
+
+static Pane *
+active_pane (void)
+{
+  return ui.n_panes > 0 ? ui.panes[ui.active] : NULL;
+}
+
+/* the pane beside the active one, or the next tab */
+static Pane *
+other_pane (void)
+{
+  return ui.panes[ui.split ? ui.other : (ui.active + 1) % ui.n_panes];
+}
+
+static CxDirListing *
+pane_listing (const Pane *p)
+{
+  if (p->dupes)
+    return &p->dupes->listing;
+  if (p->diff)
+    return &p->diff->listing;
+  if (p->compare)
+    return &p->compare->listing;
+  if (p->top)
+    return &p->top->listing;
+  return &p->entry->listing;
+}
+
+static bool
+has_results (const Pane *p)
+{
+  return p->dupes || p->diff || p->compare || p->top;
+}
+
+static int
+n_rows (const Pane *p)
+{
+  return cx_tree_rows (&p->tree);
+}
+
+static bool
+is_parent_row (const CxTreeRow *row)
+{
+  return !row->node->parent && row->index == 0 &&
+         cx_dir_listing_has_parent_item (row->node->listing);
+}
+
+/* the index in the top-level listing of the item `row' is, or is under */
+static int
+top_level_index (const CxTreeRow *row)
+{
+  const CxTreeNode *node  = row->node;
+  int               index = row->index;
+
+  for (; node->parent; node = node->parent)
+    index = node->index;
+  return index;
+}
+
 static void
-resize_callback (int sig)
+clamp_viewport (Pane *p)
 {
-  endwin ();
-  refresh ();
-  clear ();
-  getmaxyx (stdscr, ui.height, ui.width);
+  if (p->hilighted >= n_rows (p))
+    p->hilighted = n_rows (p) - 1;
+  if (p->first_listing_item >= n_rows (p))
+    p->first_listing_item = 0;
+  if (p->hilighted >= p->first_listing_item + ui.listing_area_h)
+    p->first_listing_item = p->hilighted - ui.listing_area_h + 1;
+  if (p->first_listing_item < 0)
+    p->first_listing_item = 0;
+}
 
-  ui.listing_area_h = ui.height - 1;
-  ui.listing_area_w = ui.width;
+/* keeps the cursor on the same item while rows appear or disappear above
+   it, and on the nearest remaining row when its own row goes away */
+static void
+on_tree_change (int row, int old_rows, int new_rows, void *data)
+{
+  Pane *p = data;
+
+  if (p->hilighted >= row + old_rows)
+    p->hilighted += new_rows - old_rows;
+  else if (p->hilighted >= row + new_rows)
+    p->hilighted = row + new_rows - 1;
+
+  if (p->first_listing_item >= row + old_rows)
+    p->first_listing_item += new_rows - old_rows;
+  else if (p->first_listing_item > p->hilighted)
+    p->first_listing_item = p->hilighted;
+  if (p->first_listing_item < 0)
+    p->first_listing_item = 0;
+
+  ui.redraw = true;
+}
+
+static Pane *
+pane_new (const CxPath *location)
+{
+  Pane *p;
+
+  if (ui.n_panes == MAX_PANES)
+    return NULL;
+
+  p = calloc (1, sizeof (Pane));
+  if (!p)
+    cx_die (errno, "failed to allocate memory");
+
+  cx_path_init_copy (&p->location, location);
+  cx_tree_init (&p->tree, on_tree_change, p);
+  p->hilighted = -1;
+
+  ui.panes[ui.n_panes++] = p;
+  g_state_changed        = true;
+  return p;
+}
+
+static void
+pane_free (Pane *p)
+{
+  cx_dupes_free (p->dupes);
+  cx_snapshot_diff_free (p->diff);
+  cx_compare_free (p->compare);
+  cx_top_free (p->top);
+  cx_tree_free (&p->tree);
+  cx_cache_release (p->entry);
+  free (p);
+}
+
+static void
+close_results (Pane *p)
+{
+  cx_dupes_free (p->dupes);
+  cx_snapshot_diff_free (p->diff);
+  cx_compare_free (p->compare);
+  cx_top_free (p->top);
+  p->dupes   = NULL;
+  p->diff    = NULL;
+  p->compare = NULL;
+  p->top     = NULL;
+  cx_tree_set_root (&p->tree, &p->entry->listing, false);
+  p->hilighted    = 0;
+  g_state_changed = true;
+}
+
+/* shows `entry', whose reference the pane takes over */
+static void
+pane_show (Pane *p, CxCacheEntry *entry)
+{
+  CxCacheEntry *old = p->entry;
+
+  p->entry = entry;
+  cx_tree_set_root (&p->tree, &entry->listing, false);
+  cx_cache_release (old);
+  cx_path_init_copy (&p->location, &entry->path);
+  cx_jump_visit (&p->location);
+
+  p->generation = entry->generation;
+  clamp_viewport (p);
+  ui.redraw = true;
+}
+
+/* brings the pane's listing in line with its location, or with a rescan
+   of the directory it already shows */
+static void
+pane_sync (Pane *p)
+{
+  CxCacheEntry *entry = p->entry;
+  const CxPath *root;
+
+  /* search results stay up until the pane moves elsewhere */
+  if (has_results (p))
+  {
+    if (p->dupes)
+      root = &p->dupes->root;
+    else if (p->diff)
+      root = &p->diff->root;
+    else if (p->compare)
+      root = &p->compare->root;
+    else
+      root = &p->top->root;
+    if (cx_strneq (root->str, root->len, p->location.str, p->location.len))
+      return;
+    close_results (p);
+  }
+
+  if (!entry || !cx_strneq (entry->path.str, entry->path.len,
+                            p->location.str, p->location.len))
+    pane_show (p, cx_cache_acquire (&p->location));
+  else if (p->generation != entry->generation)
+  {
+    /* a rescan in place keeps whatever is expanded in tree view */
+    cx_tree_set_root (&p->tree, &p->entry->listing, true);
+    p->generation = p->entry->generation;
+    clamp_viewport (p);
+    ui.redraw = true;
+  }
+}
+
+/* Moves between directories through the cache, which reaches those too
+   deep to be named from `/' by their parent's descriptor. The location
+   then only says where the pane is. */
+static void
+go_to (Pane *p, CxCacheEntry *entry)
+{
+  p->hilighted    = 0;
+  g_state_changed = true;
+  pane_show (p, entry);
+}
+
+/* A new pane on the directory `p' shows, sharing its entry, which
+   reaches it even where the location is too deep to look up. */
+static Pane *
+pane_copy (Pane *p)
+{
+  Pane *copy = pane_new (&p->location);
+
+  if (copy && p->entry)
+    pane_show (copy, cx_cache_ref (p->entry));
+  return copy;
+}
+
+static void
+on_git_read (void *data)
+{
+  ui.redraw = true;
+}
+
+static void
+on_block_decoded (CxDirListing *listing)
+{
+  ui.redraw = true;
 }
 
 void
 cx_ui_start (void)
 {
-  struct sigaction sa;
-
   if (ui.running)
     return;
 
-  if (!initscr ())
+  if (ui.term_out)
+  {
+    ui.screen = newterm (NULL, ui.term_out, ui.term_in);
+    if (!ui.screen)
+      cx_die (0, "failed to initialize Ncurses");
+    set_term (ui.screen);
+  }
+  else if (!initscr ())
     cx_die (0, "failed to initialize Ncurses");
 
   raw ();
@@ -94,6 +505,7 @@ cx_ui_start (void)
   cbreak ();
   curs_set (0);
   keypad (stdscr, true);
+  nodelay (stdscr, true);
   set_escdelay (25);
 
   if (has_colors ())
@@ -105,155 +517,138 @@ cx_ui_start (void)
     init_pair (PARENT_ITEM_COLOR, COLOR_BLUE, -1);
   }
 
-  memset (&sa, 0, sizeof (struct sigaction));
-  sa.sa_handler = resize_callback;
-  sigaction (SIGWINCH, &sa, NULL);
-
   getmaxyx (stdscr, ui.height, ui.width);
 
-  ui.listing_area_h     = ui.height - 1;
-  ui.listing_area_w     = ui.width;
-  ui.first_listing_item = 0;
-  ui.hilighted          = -1;
-  ui.running            = true;
-  ui.keep_running       = true;
+  ui.listing_area_h = ui.height - 1;
+  ui.listing_area_w = ui.width;
+  ui.n_panes        = 0;
+  ui.active         = 0;
+  ui.other          = 0;
+  ui.split          = false;
+  ui.running        = true;
+  ui.keep_running   = true;
+  ui.count          = -1;
+  ui.find_letter    = false;
+  ui.redraw         = true;
+  ui.show_help      = false;
+
+  cx_git_init (on_git_read, NULL);
 }
 
 void
-cx_ui_stop (void)
+cx_ui_resize (void)
 {
+  struct winsize ws;
+  FILE *         out = ui.term_out ? ui.term_out : stdout;
+  int            i;
+
   if (!ui.running)
     return;
 
-  endwin ();
-
-  ui.running      = false;
-  ui.keep_running = false;
-}
-
-void
-cx_ui_draw (const CxDirListing *listing)
-{
-  CxDirItem *item;
-  char       item_count_str[CX_SMALL_BUFMAX];
-  int        item_count_str_len;
-  int        i;
-  int        y;
-  int        x;
-  int        info_len;
-  int        info_start;
-  bool       is_hilighted;
-
-  clear ();
-
-  snprintf (item_count_str, CX_SMALL_BUFMAX, "%d items", listing->total);
-  item_count_str_len = strlen (item_count_str);
-
-  attron (COLOR_PAIR (CURDIR_COLOR) | A_BOLD | A_UNDERLINE);
-  mvaddnstr (0, 0, listing->path->str, listing->path->len);
-
-  info_start = ui.width - item_count_str_len;
-  for (x = listing->path->len; x < info_start; ++x)
-    mvaddch (0, x, ' ');
-
-  mvaddnstr (0, x, item_count_str, item_count_str_len);
-  attroff (COLOR_PAIR (CURDIR_COLOR) | A_BOLD | A_UNDERLINE);
-
-  if (ui.first_listing_item == 0 && cx_dir_listing_has_parent_item (listing))
-  {
-    x = 0;
-
-    mvaddch (1, x++, ' ');
+  if (ioctl (fileno (out), TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0)
+    resizeterm (ws.ws_row, ws.ws_col);
+  getmaxyx (stdscr, ui.height, ui.width);
 
-    attron (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
-    if (listing->total > 1)
-      mvaddch (1, x++, ACS_LTEE);
-    else
-      mvaddch (1, x++, ACS_LLCORNER);
+  ui.listing_area_h = ui.height - 1;
+  ui.listing_area_w = ui.width;
 
-    mvaddch (1, x++, ACS_HLINE);
+  for (i = 0; i < ui.n_panes; ++i)
+    clamp_viewport (ui.panes[i]);
 
-    if (ui.hilighted == 0)
-      mvaddch (1, x++, ACS_RARROW);
-    attroff (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
+  ui.redraw = true;
+}
 
-    mvaddch (1, x++, ' ');
+/* rows are saved as the items they belong to, since nothing is expanded
+   when the session is restored */
+static void
+save_session (void)
+{
+  Pane *    p = active_pane ();
+  CxTreeRow hilighted;
+  CxTreeRow first;
 
-    if (ui.hilighted == 0)
-      attron (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
-    else
-      attron (COLOR_PAIR (PARENT_ITEM_COLOR) | A_BOLD);
+  if (!p || has_results (p) ||
+      !cx_tree_row (&p->tree, p->hilighted, &hilighted) ||
+      !cx_tree_row (&p->tree, p->first_listing_item, &first))
+    return;
+  cx_session_save (&p->location, &p->entry->listing,
+                   top_level_index (&hilighted), top_level_index (&first));
+}
 
-    mvaddnstr (1, x, listing->list[0].name, listing->list[0].name_len);
-    x += listing->list[0].name_len;
+void
+cx_ui_stop (void)
+{
+  int i;
 
-    if (ui.hilighted == 0)
-    {
-      while (x < ui.width)
-        mvaddch (1, x++, ' ');
-      attroff (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
-    }
-    else
-      attroff (COLOR_PAIR (PARENT_ITEM_COLOR) | A_BOLD);
+  if (!ui.running)
+    return;
 
-    i = 1;
-    y = 2;
-  }
-  else
+  endwin ();
+  if (ui.screen)
   {
-    i = ui.first_listing_item;
-    y = 1;
+    delscreen (ui.screen);
+    ui.screen = NULL;
   }
 
-  for (; i < listing->total && y < ui.height; ++i, ++y)
-  {
-    item         = &listing->list[i];
-    is_hilighted = (ui.hilighted == i);
-    x            = 0;
-
-    mvaddch (y, x++, ' ');
-
-    attron (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
-    if (i < (listing->total - 1))
-      mvaddch (y, x++, ACS_LTEE);
-    else
-      mvaddch (y, x++, ACS_LLCORNER);
+  save_session ();
+  for (i = 0; i < ui.n_panes; ++i)
+    pane_free (ui.panes[i]);
+  ui.n_panes = 0;
 
-    mvaddch (y, x++, ACS_HLINE);
+  free (ui.preview);
+  ui.preview            = NULL;
+  ui.preview_compressed = NULL;
+  ui.show_preview       = false;
 
-    if (is_hilighted)
-      mvaddch (y, x++, ACS_RARROW);
-    attroff (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
+  cx_follow_free (ui.follow);
+  ui.follow = NULL;
+  cx_dir_unref (ui.file_dir);
+  ui.file_dir = NULL;
 
-    mvaddch (y, x++, ' ');
+  cx_git_finish ();
 
-    if (is_hilighted)
-      attron (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
-
-    mvaddnstr (y, x, item->name, item->name_len);
-    x += item->name_len;
+  ui.running      = false;
+  ui.keep_running = false;
+}
 
-    info_len   = item->info.type_str_len + item->info.size_str_len + 5;
-    info_start = ui.width - info_len;
-    for (; x < info_start; ++x)
-      mvaddch (y, x, ' ');
+/* shows `location' in the current tab, or in a first one */
+void
+cx_ui_open (const CxPath *location)
+{
+  if (ui.n_panes == 0)
+    pane_new (location);
+  else
+    cx_path_init_copy (&active_pane ()->location, location);
+  cx_ui_sync ();
+}
 
-    mvaddch (y, x++, '(');
-    mvaddnstr (y, x, item->info.type_str, item->info.type_str_len);
-    x += item->info.type_str_len;
-    mvaddch (y, x++, ')');
+/* shows the directory kept from the last run in a first tab, as it was
+   left, while the directory is read again */
+void
+cx_ui_open_session (CxSession *session)
+{
+  Pane *p;
 
-    mvaddch (y, x++, ' ');
-    mvaddch (y, x++, '[');
-    mvaddnstr (y, x, item->info.size_str, item->info.size_str_len);
-    x += item->info.size_str_len;
-    mvaddch (y, x, ']');
+  p = pane_new (&session->location);
+  if (!p)
+    return;
+  p->entry      = cx_cache_restore (&session->location, &session->listing);
+  p->generation = p->entry->generation;
+  cx_tree_set_root (&p->tree, &p->entry->listing, false);
+  p->hilighted          = session->hilighted;
+  p->first_listing_item = session->first_item;
+  clamp_viewport (p);
+  cx_jump_visit (&p->location);
+  ui.redraw = true;
+}
 
-    if (is_hilighted)
-      attroff (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
-  }
+void
+cx_ui_sync (void)
+{
+  int i;
 
-  refresh ();
+  for (i = 0; i < ui.n_panes; ++i)
+    pane_sync (ui.panes[i]);
 }
 
 static void
@@ -279,6 +674,36 @@ show_help_window (void)
     { RIGHT_ARROW_HELP_KEY, RIGHT_ARROW_HELP_DESC, 1,
       strlen (RIGHT_ARROW_HELP_DESC), true },
 
+    { PAGE_HELP_KEY, PAGE_HELP_DESC, strlen (PAGE_HELP_KEY),
+      strlen (PAGE_HELP_DESC), false },
+
+    { TOP_HELP_KEY, TOP_HELP_DESC, strlen (TOP_HELP_KEY),
+      strlen (TOP_HELP_DESC), false },
+
+    { PERCENT_HELP_KEY, PERCENT_HELP_DESC, strlen (PERCENT_HELP_KEY),
+      strlen (PERCENT_HELP_DESC), false },
+
+    { LETTER_HELP_KEY, LETTER_HELP_DESC, strlen (LETTER_HELP_KEY),
+      strlen (LETTER_HELP_DESC), false },
+
+    { JUMP_HELP_KEY, JUMP_HELP_DESC, strlen (JUMP_HELP_KEY),
+      strlen (JUMP_HELP_DESC), false },
+
+    { DUPES_HELP_KEY, DUPES_HELP_DESC, strlen (DUPES_HELP_KEY),
+      strlen (DUPES_HELP_DESC), false },
+
+    { LARGEST_HELP_KEY, LARGEST_HELP_DESC, strlen (LARGEST_HELP_KEY),
+      strlen (LARGEST_HELP_DESC), false },
+
+    { NEWEST_HELP_KEY, NEWEST_HELP_DESC, strlen (NEWEST_HELP_KEY),
+      strlen (NEWEST_HELP_DESC), false },
+
+    { COMPARE_HELP_KEY, COMPARE_HELP_DESC, strlen (COMPARE_HELP_KEY),
+      strlen (COMPARE_HELP_DESC), false },
+
+    { VERIFY_HELP_KEY, VERIFY_HELP_DESC, strlen (VERIFY_HELP_KEY),
+      strlen (VERIFY_HELP_DESC), false },
+
     { HOME_HELP_KEY, HOME_HELP_DESC, strlen (HOME_HELP_KEY),
       strlen (HOME_HELP_DESC), false },
 
@@ -297,6 +722,38 @@ show_help_window (void)
     { ENTER_HELP_KEY, ENTER_HELP_DESC, strlen (ENTER_HELP_KEY),
       strlen (ENTER_HELP_DESC), false },
 
+    { TREE_HELP_KEY, TREE_HELP_DESC, strlen (TREE_HELP_KEY),
+      strlen (TREE_HELP_DESC), false },
+
+    { SPACE_HELP_KEY, SPACE_HELP_DESC, strlen (SPACE_HELP_KEY),
+      strlen (SPACE_HELP_DESC), false },
+
+    { NEW_TAB_HELP_KEY, NEW_TAB_HELP_DESC, strlen (NEW_TAB_HELP_KEY),
+      strlen (NEW_TAB_HELP_DESC), false },
+
+    { CLOSE_TAB_HELP_KEY, CLOSE_TAB_HELP_DESC, strlen (CLOSE_TAB_HELP_KEY),
+      strlen (CLOSE_TAB_HELP_DESC), false },
+
+    { NEXT_TAB_HELP_KEY, NEXT_TAB_HELP_DESC, strlen (NEXT_TAB_HELP_KEY),
+      strlen (NEXT_TAB_HELP_DESC), false },
+
+    { SPLIT_HELP_KEY, SPLIT_HELP_DESC, strlen (SPLIT_HELP_KEY),
+      strlen (SPLIT_HELP_DESC), false },
+
+    { SWITCH_PANE_HELP_KEY, SWITCH_PANE_HELP_DESC,
+      strlen (SWITCH_PANE_HELP_KEY), strlen (SWITCH_PANE_HELP_DESC), false },
+
+    { FOLLOW_HELP_KEY, FOLLOW_HELP_DESC, strlen (FOLLOW_HELP_KEY),
+      strlen (FOLLOW_HELP_DESC), false },
+
+    { GIT_HELP_KEY, GIT_HELP_DESC, strlen (GIT_HELP_KEY),
+      strlen (GIT_HELP_DESC), false },
+
+#ifdef CX_STATS
+    { STATS_HELP_KEY, STATS_HELP_DESC, strlen (STATS_HELP_KEY),
+      strlen (STATS_HELP_DESC), false },
+#endif
+
     { HELP_HELP_KEY, HELP_HELP_DESC, strlen (HELP_HELP_KEY),
       strlen (HELP_HELP_DESC), false },
 
@@ -309,10 +766,12 @@ show_help_window (void)
   int     i;
   int     n_longest_key  = 0;
   int     n_longest_desc = 0;
-  int     n_lines        = 0;
-  int     n_columns      = 0;
+  int     n_items        = 0;
+  int     n_shown;
+  int     n_lines;
+  int     n_columns;
 
-  for (i = 0; help[i].key && help[i].desc; ++i, ++n_lines)
+  for (i = 0; help[i].key && help[i].desc; ++i, ++n_items)
   {
     if (help[i].key_len > n_longest_key)
       n_longest_key = help[i].key_len;
@@ -321,19 +780,37 @@ show_help_window (void)
       n_longest_desc = help[i].desc_len;
   }
 
-  n_lines += HELP_WINDOW_LINE_PADDING * 2;
+  /* on a terminal too short for all of them, the entries scroll */
+  n_lines   = n_items + HELP_WINDOW_LINE_PADDING * 2;
   n_columns = (n_longest_key + n_longest_desc + HELP_ITEM_PADDING +
                (HELP_WINDOW_COLUMN_PADDING * 2));
+  if (n_lines > ui.height)
+    n_lines = ui.height;
+  if (n_columns > ui.width)
+    n_columns = ui.width;
+  n_shown = n_lines - HELP_WINDOW_LINE_PADDING * 2;
+  if (n_shown < 1)
+    return;
 
-  win = newwin (n_lines, n_columns, (ui.height / 2) - (n_lines / 2),
-                (ui.width / 2) - (n_columns / 2));
+  if (ui.help_top > n_items - n_shown)
+    ui.help_top = n_items - n_shown;
+  if (ui.help_top < 0)
+    ui.help_top = 0;
+
+  win = newwin (n_lines, n_columns, (ui.height - n_lines) / 2,
+                (ui.width - n_columns) / 2);
   if (!win)
-    cx_die (0, "failed to create help window");
+    return;
 
   wbkgd (win, A_BOLD | A_REVERSE);
   wborder (win, 0, 0, 0, 0, 0, 0, 0, 0);
+  if (ui.help_top > 0)
+    mvwaddstr (win, 0, HELP_WINDOW_COLUMN_PADDING, " more ");
+  if (ui.help_top + n_shown < n_items)
+    mvwaddstr (win, n_lines - 1, HELP_WINDOW_COLUMN_PADDING, " more ");
 
-  for (i = 0, y = HELP_WINDOW_LINE_PADDING; help[i].key; ++i, ++y)
+  for (i = ui.help_top, y = HELP_WINDOW_LINE_PADDING;
+       i < ui.help_top + n_shown; ++i, ++y)
   {
     x = HELP_WINDOW_COLUMN_PADDING;
 
@@ -349,119 +826,1478 @@ show_help_window (void)
   }
 
   wrefresh (win);
+  delwin (win);
+}
 
-  for (;;)
-    if (wgetch (win) == 'h')
-      break;
+#ifdef CX_STATS
+static void
+draw_stats_overlay (void)
+{
+  char buf[CX_SMALL_BUFMAX];
+  int  n_lines;
+  int  w;
+  int  y;
+  int  x;
+  int  i;
+  int  n;
+
+  n_lines = CX_STATS_PHASE_COUNT + CX_STATS_COUNTER_COUNT + 1;
+  w       = 44;
+  y       = ui.height - n_lines;
+  x       = ui.width - w;
+  if (y < 1 || x < 0)
+    return;
 
-  delwin (win);
+  attron (A_REVERSE);
+  n = snprintf (buf, sizeof (buf), " %-14s %12s %12s ", "stat", "last",
+                "avg");
+  mvaddnstr (y++, x, buf, n);
+
+  for (i = 0; i < CX_STATS_PHASE_COUNT; ++i)
+  {
+    n = snprintf (buf, sizeof (buf), " %-14s %10.3fms %10.3fms ",
+                  cx_stats_phase_name (i),
+                  (double) cx_stats_phase_last (i) / 1e6,
+                  (double) cx_stats_phase_avg (i) / 1e6);
+    mvaddnstr (y++, x, buf, n);
+  }
+
+  for (i = 0; i < CX_STATS_COUNTER_COUNT; ++i)
+  {
+    n = snprintf (buf, sizeof (buf), " %-14s %12" PRIu64 " %12" PRIu64 " ",
+                  cx_stats_counter_name (i), cx_stats_counter_last (i),
+                  cx_stats_counter_avg (i));
+    mvaddnstr (y++, x, buf, n);
+  }
+  attroff (A_REVERSE);
 }
+#endif
 
+/* drawing is clipped to the pane being drawn, columns [0, ui.area_w) */
 static void
-show_info_window (const CxFileInfo *info)
+put_ch (int y, int x, chtype ch)
 {
+  if (x >= 0 && x < ui.area_w)
+    mvaddch (y, ui.area_x + x, ch);
 }
 
-void
-cx_ui_handle_next_event (CxPath *location, const CxDirListing *listing)
+static void
+put_str (int y, int x, const char *str, int len)
 {
-  switch (getch ())
+  if (x + len > ui.area_w)
+    len = ui.area_w - x;
+  if (len > 0)
+    mvaddnstr (y, ui.area_x + x, str, len);
+}
+
+/* Draws no more than `max' columns of text that is not plain ASCII, a
+   character at a time so a wide one is never cut in half, and returns
+   the columns used. */
+static int
+put_text (int y, int x, const char *str, int len, int max)
+{
+  mbstate_t state;
+  wchar_t   wc;
+  size_t    n;
+  int       used;
+  int       w;
+
+  if (x + max > ui.area_w)
+    max = ui.area_w - x;
+  if (max <= 0)
+    return 0;
+
+  move (y, ui.area_x + x);
+  memset (&state, 0, sizeof (state));
+  for (used = 0; len > 0; str += n, len -= n)
   {
-    case KEY_LEFT:
-      if (cx_dir_listing_has_parent_item (listing))
-      {
-        cx_path_init_parent_of (location);
-        g_state_changed = true;
-        ui.hilighted    = 0;
-      }
-      break;
+    n = mbrtowc (&wc, str, len, &state);
+    if (n == (size_t) -1 || n == (size_t) -2)
+    {
+      memset (&state, 0, sizeof (state));
+      n = 1;
+      w = -1;
+    }
+    else
+    {
+      if (n == 0)
+        n = 1;
+      w = wcwidth (wc);
+    }
 
-    case KEY_RIGHT:
-    case ENTER_KEY:
-      if (listing->list[ui.hilighted].info.type == CX_FILE_TYPE_DIRECTORY)
-      {
-        cx_path_init_copy (location, &listing->list[ui.hilighted].info.path);
-        g_state_changed = true;
-        ui.hilighted    = 0;
-      }
-      else if (ui.hilighted == 0 && cx_dir_listing_has_parent_item (listing))
-      {
-        cx_path_init_parent_of (location);
-        g_state_changed = true;
-        ui.hilighted    = 0;
-      }
+    if (used + (w < 0 ? 1 : w) > max)
       break;
-
-    case KEY_UP:
-      if (listing->total > 0)
+    if (w < 0)
+      addch ('?');
+    else
+      addnstr (str, n);
+    used += w < 0 ? 1 : w;
+  }
+  return used;
+}
+
+/* names worked out to be plain ASCII when they were read skip decoding */
+static int
+put_name (int y, int x, const CxDirItem *item, int max)
+{
+  int len = item->name_len < max ? item->name_len : max;
+
+  if (!item->name_ascii)
+    return put_text (y, x, item->name, item->name_len, max);
+  put_str (y, x, item->name, len);
+  return len;
+}
+
+/* `├─' for files, `├+' and `├-' for collapsed and expanded directories
+   in tree view, `├*' while one is being scanned */
+static chtype
+row_glyph (const Pane *p, const CxTreeRow *row)
+{
+  const CxTreeNode *child;
+
+  if (!p->tree_mode || is_parent_row (row) ||
+      row->item->info.target_type != CX_FILE_TYPE_DIRECTORY)
+    return ACS_HLINE;
+
+  child = cx_tree_child (row);
+  if (!child)
+    return '+';
+  if (child->scanning)
+    return '*';
+  return child->expanded ? '-' : '+';
+}
+
+static void
+draw_row (const Pane *p, int y, const CxTreeRow *row, bool is_hilighted,
+          bool is_active)
+{
+  static const char git_marks[] = {
+    [CX_GIT_STATUS_NONE]      = ' ',
+    [CX_GIT_STATUS_CLEAN]     = ' ',
+    [CX_GIT_STATUS_MODIFIED]  = 'M',
+    [CX_GIT_STATUS_UNTRACKED] = '?',
+    [CX_GIT_STATUS_IGNORED]   = '!',
+  };
+  const CxDirItem * item = row->item;
+  const CxTreeNode *node;
+  bool              more[CX_PATHMAX / 2];
+  int               info_len;
+  int               info_start;
+  int               name_width;
+  int               depth;
+  int               x;
+
+  /* which ancestors still have items further down, for their lines; every
+     level adds at least two bytes to the path, which bounds the depth */
+  for (node = row->node; node->parent; node = node->parent)
+    more[node->depth - 1] = !cx_tree_is_last (node->parent, node->index);
+
+  x = 0;
+  put_ch (y, x++, ' ');
+
+  attron (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
+  for (depth = 0; depth < row->depth && x + 3 < ui.area_w; ++depth)
+  {
+    put_ch (y, x++, more[depth] ? ACS_VLINE : ' ');
+    put_ch (y, x++, ' ');
+    put_ch (y, x++, ' ');
+  }
+
+  if (!cx_tree_is_last (row->node, row->index))
+    put_ch (y, x++, ACS_LTEE);
+  else
+    put_ch (y, x++, ACS_LLCORNER);
+
+  put_ch (y, x++, row_glyph (p, row));
+
+  if (is_hilighted)
+    put_ch (y, x++, ACS_RARROW);
+  attroff (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
+
+  put_ch (y, x++, ' ');
+
+  if (is_parent_row (row))
+  {
+    if (is_hilighted && is_active)
+      attron (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
+    else
+      attron (COLOR_PAIR (PARENT_ITEM_COLOR) | A_BOLD);
+
+    put_str (y, x, item->name, item->name_len);
+    x += item->name_len;
+
+    if (is_hilighted && is_active)
+    {
+      while (x < ui.area_w)
+        put_ch (y, x++, ' ');
+      attroff (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
+    }
+    else
+      attroff (COLOR_PAIR (PARENT_ITEM_COLOR) | A_BOLD);
+    return;
+  }
+
+  if (is_hilighted && is_active)
+    attron (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
+
+  info_len = item->info.type_str_len + item->info.size_str_len + 5;
+  if (ui.show_git)
+    info_len += 2;
+  info_start = ui.area_w - info_len;
+
+  /* deep rows give up the end of the name, never the columns */
+  name_width = item->name_width;
+  if (x + name_width > info_start - 1)
+    name_width = info_start - 1 - x;
+  if (name_width > 0)
+    x += put_name (y, x, item, name_width);
+
+  for (; x < info_start; ++x)
+    put_ch (y, x, ' ');
+
+  if (x + info_len <= ui.area_w)
+  {
+    if (ui.show_git)
+    {
+      put_ch (y, x++, git_marks[item->git_status]);
+      put_ch (y, x++, ' ');
+    }
+    put_ch (y, x++, '(');
+    put_str (y, x, item->info.type_str, item->info.type_str_len);
+    x += item->info.type_str_len;
+    put_ch (y, x++, ')');
+
+    put_ch (y, x++, ' ');
+    put_ch (y, x++, '[');
+    put_str (y, x, item->info.size_str, item->info.size_str_len);
+    x += item->info.size_str_len;
+    put_ch (y, x, ']');
+  }
+
+  if (is_hilighted && is_active)
+    attroff (COLOR_PAIR (HILIGHT_COLOR) | A_UNDERLINE);
+}
+
+static void
+draw_pane (int index, int x0, int w)
+{
+  const Pane *        p         = ui.panes[index];
+  const CxDirListing *listing   = pane_listing (p);
+  bool                is_active = (index == ui.active);
+  const char *        stale;
+  CxTreeRow           row;
+  char                info[CX_SMALL_BUFMAX];
+  int                 info_len;
+  int                 y;
+  int                 x;
+  attr_t              attrs;
+
+  ui.area_x = x0;
+  ui.area_w = w;
+
+  /* a listing from the last run, or none, until the directory is read;
+     one that cannot be read says why */
+  if (has_results (p))
+    stale = "";
+  else if (p->entry->reading)
+    stale = " (reading)";
+  else
+    stale = p->entry->restored ? " (stale)" : "";
+  if (listing->error)
+    info_len = snprintf (info, sizeof (info), "cannot read - %s",
+                         strerror (listing->error));
+  else
+    info_len = snprintf (info, sizeof (info), "%d items%s", listing->total,
+                         stale);
+  if (ui.n_panes > 1)
+    info_len += snprintf (info + info_len, sizeof (info) - info_len,
+                          " [%d/%d]", index + 1, ui.n_panes);
+
+  attrs = COLOR_PAIR (CURDIR_COLOR) | A_BOLD;
+  if (is_active)
+    attrs |= A_UNDERLINE;
+
+  attron (attrs);
+  if (cx_str_is_ascii (listing->path->str, listing->path->len))
+  {
+    put_str (0, 0, listing->path->str, listing->path->len);
+    x = listing->path->len;
+  }
+  else
+    x = put_text (0, 0, listing->path->str, listing->path->len, w);
+  for (; x < w - info_len; ++x)
+    put_ch (0, x, ' ');
+  put_str (0, x, info, info_len);
+  attroff (attrs);
+
+  for (y = 1; y < ui.height; ++y)
+  {
+    if (!cx_tree_row_nowait (&p->tree, p->first_listing_item + y - 1, &row))
+      break;
+    cx_dir_listing_follow_link (row.node->listing, row.item);
+    if (ui.show_git)
+      cx_git_annotate (row.node->listing);
+    draw_row (p, y, &row, p->hilighted == p->first_listing_item + y - 1,
+              is_active);
+    cx_scan_decode (row.node->listing, on_block_decoded);
+    CX_STATS_TAKE (&row.node->listing->stats);
+  }
+}
+
+static void
+draw_text (const char *text, int len)
+{
+  int y = 1;
+  int x = 0;
+  int i;
+  int c;
+
+  for (i = 0; i < len && y < ui.height; ++i)
+  {
+    c = (unsigned char) text[i];
+    if (c == '\n')
+    {
+      ++y;
+      x = 0;
+    }
+    else if (c == '\t')
+      x += PREVIEW_TAB_WIDTH - x % PREVIEW_TAB_WIDTH;
+    else
+    {
+      if (x < ui.width)
+        mvaddch (y, x, isprint (c) ? c : '.');
+      ++x;
+    }
+  }
+}
+
+/* offset, bytes and their printable characters, for binary files */
+static void
+draw_preview_hex (void)
+{
+  char buf[CX_SMALL_BUFMAX];
+  int  off;
+  int  len;
+  int  y;
+  int  i;
+  int  c;
+
+  for (y = 1, off = ui.preview_top; y < ui.height && off < ui.preview_len;
+       ++y, off += PREVIEW_HEX_BYTES)
+  {
+    len = snprintf (buf, sizeof (buf), "%08" PRIx64 " ",
+                    ui.preview_offset + off);
+    for (i = 0; i < PREVIEW_HEX_BYTES; ++i)
+    {
+      if (off + i < ui.preview_len)
+        len += snprintf (buf + len, sizeof (buf) - len, " %02x",
+                         (unsigned char) ui.preview[off + i]);
+      else
+        len += snprintf (buf + len, sizeof (buf) - len, "   ");
+    }
+    len += snprintf (buf + len, sizeof (buf) - len, "  ");
+    for (i = 0; i < PREVIEW_HEX_BYTES && off + i < ui.preview_len; ++i)
+    {
+      c          = (unsigned char) ui.preview[off + i];
+      buf[len++] = isprint (c) ? c : '.';
+    }
+    mvaddnstr (y, 0, buf, len < ui.width ? len : ui.width);
+  }
+}
+
+static void
+draw_file_title (const CxPath *path, const char *info, int info_len)
+{
+  if (ui.file_dir && cx_streq (path->str, ui.file_path.str))
+    path = &ui.file_title;
+
+  attron (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
+  mvhline (0, 0, ' ', ui.width);
+  mvaddnstr (0, 0, path->str, path->len < ui.width ? path->len : ui.width);
+  if (info_len > 0 && path->len + 1 + info_len <= ui.width)
+    mvaddnstr (0, ui.width - info_len, info, info_len);
+  attroff (COLOR_PAIR (CURDIR_COLOR) | A_BOLD);
+}
+
+/* the hilighted file over the whole screen, from where it was scrolled
+   to; a compressed one has how far into it that is in the title */
+static void
+draw_preview (void)
+{
+  const CxCompressed *c = ui.preview_compressed;
+  char                info[CX_SMALL_BUFMAX];
+  char                size_str[CX_SMALL_BUFMAX];
+  int                 size_len;
+  int                 info_len = 0;
+
+  erase ();
+  if (c)
+  {
+    cx_size_str (size_str, &size_len,
+                 (cx_byte_t) (ui.preview_offset + ui.preview_top),
+                 g_options.size_units);
+    info_len = snprintf (info, sizeof (info), "%s, at %s, %d seek point%s",
+                         c->format, size_str, c->n_points,
+                         c->n_points == 1 ? "" : "s");
+  }
+  draw_file_title (&ui.preview_path, info, info_len);
+
+  if (ui.preview_hex)
+    draw_preview_hex ();
+  else
+    draw_text (ui.preview + ui.preview_top,
+               ui.preview_len - ui.preview_top);
+}
+
+/* The end of the followed file, its last line at the bottom. This is
+   where whatever was appended since the last frame gets read. */
+static void
+draw_follow (void)
+{
+  const CxFollow *f = ui.follow;
+  const char *    start;
+  char            info[CX_SMALL_BUFMAX];
+  char            size_str[CX_SMALL_BUFMAX];
+  int             size_len;
+  int             info_len;
+  int             n_lines;
+  int             len;
+
+  cx_follow_update (ui.follow);
+
+  erase ();
+  cx_size_str (size_str, &size_len, (cx_byte_t) f->offset,
+               g_options.size_units);
+  if (f->n_restarts > 0)
+    info_len = snprintf (info, sizeof (info), "following %s, restarted %d",
+                         size_str, f->n_restarts);
+  else
+    info_len = snprintf (info, sizeof (info), "following %s", size_str);
+  draw_file_title (&f->path, info, info_len);
+
+  len = f->tail_len;
+  if (len > 0 && f->tail[len - 1] == '\n')
+    --len;
+  for (start = f->tail + len, n_lines = 0; start > f->tail; --start)
+    if (start[-1] == '\n' && ++n_lines == ui.height - 1)
+      break;
+  draw_text (start, f->tail + len - start);
+}
+
+/* the best matches so far, above a prompt on the bottom line */
+static void
+draw_jump_prompt (void)
+{
+  const CxPath *path;
+  int           y;
+  int           i;
+
+  attron (A_REVERSE);
+  for (i = 0; i < ui.n_jump_matches; ++i)
+  {
+    y = ui.height - 1 - ui.n_jump_matches + i;
+    if (y < 1)
+      continue;
+
+    path = &ui.jump_matches[i].path;
+    if (i == ui.jump_selected)
+      attron (A_BOLD);
+    mvhline (y, 0, ' ', ui.width);
+    mvaddnstr (y, 2, path->str, path->len < ui.width - 2 ? path->len
+                                                          : ui.width - 2);
+    if (i == ui.jump_selected)
+      attroff (A_BOLD);
+  }
+  attroff (A_REVERSE);
+
+  attron (A_BOLD);
+  mvhline (ui.height - 1, 0, ' ', ui.width);
+  mvaddstr (ui.height - 1, 0, "Jump to: ");
+  addnstr (ui.jump_query, ui.jump_query_len);
+  attroff (A_BOLD);
+}
+
+void
+cx_ui_draw (void)
+{
+  int w;
+
+  CX_STATS_BEGIN (CX_STATS_PHASE_DRAW);
+#ifdef CX_STATS
+  uint64_t term_bytes = cx_stats_written_bytes ();
+#endif
+
+  /* erase () rather than clear () lets curses send only what changed */
+  erase ();
+
+  if (ui.n_panes > 0)
+  {
+    if (ui.split)
+    {
+      /* the two panes keep their sides whichever has the focus */
+      w = (ui.width - 1) / 2;
+      draw_pane (ui.active < ui.other ? ui.active : ui.other, 0, w);
+      mvvline (0, w, ACS_VLINE, ui.height);
+      draw_pane (ui.active < ui.other ? ui.other : ui.active, w + 1,
+                 ui.width - w - 1);
+    }
+    else
+      draw_pane (ui.active, 0, ui.width);
+  }
+
+#ifdef CX_STATS
+  if (ui.show_stats)
+    draw_stats_overlay ();
+#endif
+
+  if (ui.jumping)
+    draw_jump_prompt ();
+
+  if (ui.show_preview)
+    draw_preview ();
+  else if (ui.follow)
+    draw_follow ();
+
+  refresh ();
+
+  if (ui.show_help)
+    show_help_window ();
+  ui.redraw = false;
+
+#ifdef CX_STATS
+  CX_STATS_COUNT (CX_STATS_COUNTER_TERM_BYTES,
+                  cx_stats_written_bytes () - term_bytes);
+#endif
+  CX_STATS_END (CX_STATS_PHASE_DRAW);
+}
+
+static void
+show_info_window (const CxFileInfo *info)
+{
+}
+
+/* Only the rows between first_listing_item and the bottom of the screen are
+   ever drawn, so any cursor position costs the same to reach and paint. */
+static void
+set_hilighted (Pane *p, int index)
+{
+  if (n_rows (p) == 0)
+  {
+    p->hilighted = -1;
+    return;
+  }
+
+  if (index < 0)
+    index = 0;
+  else if (index >= n_rows (p))
+    index = n_rows (p) - 1;
+
+  p->hilighted = index;
+  if (p->hilighted < p->first_listing_item)
+    p->first_listing_item = p->hilighted;
+  else if (p->hilighted >= p->first_listing_item + ui.listing_area_h)
+    p->first_listing_item = p->hilighted - ui.listing_area_h + 1;
+}
+
+/* same result as `delta' single steps, wrapping at either end */
+static void
+move_hilighted (Pane *p, int delta)
+{
+  int index;
+
+  if (n_rows (p) == 0 || delta == 0)
+    return;
+
+  if (p->hilighted == -1)
+  {
+    p->hilighted = 0;
+    delta += (delta > 0) ? -1 : 1;
+  }
+
+  index = (p->hilighted + delta) % n_rows (p);
+  if (index < 0)
+    index += n_rows (p);
+  set_hilighted (p, index);
+}
+
+static void
+toggle_expanded (Pane *p, const CxTreeRow *row)
+{
+  const CxTreeNode *child = cx_tree_child (row);
+
+  if (child && child->expanded)
+    cx_tree_collapse (&p->tree, row);
+  else
+    cx_tree_expand (&p->tree, row);
+}
+
+static void
+switch_to (int index)
+{
+  /* the dual-pane view never shows the same tab twice */
+  if (ui.split && index == ui.other)
+    ui.other = ui.active;
+  ui.active = index;
+}
+
+static void
+close_active_pane (void)
+{
+  int i;
+
+  if (ui.n_panes == 1)
+    return;
+
+  pane_free (ui.panes[ui.active]);
+  for (i = ui.active; i < ui.n_panes - 1; ++i)
+    ui.panes[i] = ui.panes[i + 1];
+  --ui.n_panes;
+
+  if (ui.other > ui.active)
+    --ui.other;
+  if (ui.split)
+    ui.active = ui.other;
+  else if (ui.active == ui.n_panes)
+    --ui.active;
+
+  ui.split = ui.split && ui.n_panes > 1;
+  if (ui.split)
+    ui.other = (ui.active + 1) % ui.n_panes;
+}
+
+static void
+toggle_split (Pane *p)
+{
+  if (ui.split)
+  {
+    ui.split = false;
+    return;
+  }
+
+  /* a second pane starts out on the same directory, which costs nothing
+     since the two share its listing */
+  if (ui.n_panes == 1 && !pane_copy (p))
+    return;
+  ui.other = (ui.active + 1) % ui.n_panes;
+  ui.split = true;
+}
+
+/* Reads as much of the file as the preview can show. A path that is not
+   on disk belongs to an archive, and the member is streamed out of it. */
+static void
+alloc_preview (void)
+{
+  if (!ui.preview)
+  {
+    ui.preview = malloc (PREVIEW_BYTES);
+    if (!ui.preview)
+      cx_die (errno, "failed to allocate memory");
+  }
+}
+
+/* what went wrong is shown in place of the file */
+static void
+show_failure (const char *action, const CxPath *path, int error)
+{
+  alloc_preview ();
+  ui.preview_len = snprintf (ui.preview, PREVIEW_BYTES, "cannot %s `%s' - %s",
+                             action, path->str, strerror (error));
+  if (ui.preview_len >= PREVIEW_BYTES)
+    ui.preview_len = PREVIEW_BYTES - 1;
+  if (path != &ui.preview_path)
+    cx_path_init_copy (&ui.preview_path, path);
+  ui.preview_top        = 0;
+  ui.preview_offset     = 0;
+  ui.preview_end        = true;
+  ui.preview_hex        = false;
+  ui.preview_source     = PREVIEW_MESSAGE;
+  ui.preview_compressed = NULL;
+  ui.show_preview       = true;
+}
+
+static ssize_t
+read_preview (uint64_t offset, char *buf, size_t len)
+{
+  ssize_t n;
+  int     fd;
+
+  if (ui.preview_source == PREVIEW_COMPRESSED)
+    return cx_compressed_read (ui.preview_compressed, offset, buf, len);
+
+  fd = open (ui.preview_path.str, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  n = pread (fd, buf, len, offset);
+  close (fd);
+  return n;
+}
+
+static bool
+preview_read_at (uint64_t offset)
+{
+  ssize_t n;
+
+  n = read_preview (offset, ui.preview, PREVIEW_BYTES);
+  if (n < 0)
+  {
+    show_failure ("preview", &ui.preview_path, errno);
+    return false;
+  }
+  ui.preview_offset = offset;
+  ui.preview_len    = n;
+  ui.preview_top    = 0;
+  ui.preview_end    = n < PREVIEW_BYTES;
+  return true;
+}
+
+/* Keeps what is below the first row shown and reads on after it, which
+   a compressed file decodes from where it stopped. */
+static bool
+preview_read_on (void)
+{
+  int     keep = ui.preview_len - ui.preview_top;
+  ssize_t n;
+
+  memmove (ui.preview, ui.preview + ui.preview_top, keep);
+  n = read_preview (ui.preview_offset + ui.preview_len, ui.preview + keep,
+                    PREVIEW_BYTES - keep);
+  if (n < 0)
+  {
+    show_failure ("preview", &ui.preview_path, errno);
+    return false;
+  }
+  ui.preview_offset += ui.preview_top;
+  ui.preview_len = keep + n;
+  ui.preview_top = 0;
+  ui.preview_end = n < PREVIEW_BYTES - keep;
+  return true;
+}
+
+/* whether what is left from the first row shown on is all on screen */
+static bool
+preview_at_bottom (void)
+{
+  const char *p   = ui.preview + ui.preview_top;
+  const char *end = ui.preview + ui.preview_len;
+  int         rows;
+
+  if (!ui.preview_end)
+    return false;
+  if (ui.preview_hex)
+    return (end - p + PREVIEW_HEX_BYTES - 1) / PREVIEW_HEX_BYTES < ui.height;
+  for (rows = 0; p < end && rows < ui.height; ++rows)
+  {
+    p = memchr (p, '\n', end - p);
+    p = p ? p + 1 : end;
+  }
+  return rows < ui.height;
+}
+
+/* Moves the view a row down, reading on once less than half of the
+   buffer is left below it. */
+static bool
+preview_row_down (void)
+{
+  const char *nl;
+  int         next;
+
+  if (preview_at_bottom ())
+    return false;
+
+  if (ui.preview_hex)
+    next = ui.preview_top + PREVIEW_HEX_BYTES;
+  else
+  {
+    nl   = memchr (ui.preview + ui.preview_top, '\n',
+                   ui.preview_len - ui.preview_top);
+    next = nl ? nl - ui.preview + 1 : ui.preview_len;
+  }
+
+  ui.preview_top = next;
+  if (!ui.preview_end && ui.preview_len - next < PREVIEW_BYTES / 2)
+    return preview_read_on ();
+  return true;
+}
+
+/* Moves the view a row up. Once little of the buffer is left above it,
+   the buffer is read again from half of it before the view, which the
+   start of the row above almost always is in. */
+static bool
+preview_row_up (void)
+{
+  uint64_t view = ui.preview_offset + ui.preview_top;
+  uint64_t start;
+  int      top  = ui.preview_top;
+
+  if (top < PREVIEW_BYTES / 4 && ui.preview_offset > 0)
+  {
+    start = view > PREVIEW_BYTES / 2 ? view - PREVIEW_BYTES / 2 : 0;
+    if (!preview_read_at (start))
+      return false;
+    top = view - start < (uint64_t) ui.preview_len ? view - start
+                                                   : ui.preview_len;
+  }
+  if (top == 0)
+    return false;
+
+  if (ui.preview_hex)
+    top = top > PREVIEW_HEX_BYTES ? top - PREVIEW_HEX_BYTES : 0;
+  else
+    for (--top; top > 0 && ui.preview[top - 1] != '\n'; --top)
+      ;
+  ui.preview_top = top;
+  return true;
+}
+
+static void
+scroll_preview (int rows)
+{
+  for (; rows > 0 && preview_row_down (); --rows)
+    ;
+  for (; rows < 0 && preview_row_up (); ++rows)
+    ;
+}
+
+/* The path `item' is opened by. One in a directory too deep to be named
+   from `/' is named through the directory's descriptor, held until the
+   next file is opened. False, with what is known of the path left in
+   `path', when there is neither. */
+static bool
+file_path (const CxDirListing *listing, const CxDirItem *item, CxPath *path)
+{
+  cx_dir_unref (ui.file_dir);
+  ui.file_dir = NULL;
+  if (cx_dir_listing_item_path (listing, item, path))
+    return true;
+  if (path->len == 0)
+    cx_path_init (path, item->name, item->name_len);
+  if (!listing->dir || item->name_cut)
+    return false;
+
+  cx_path_init_copy (&ui.file_title, path);
+  ui.file_dir = cx_dir_ref (listing->dir);
+  path->len   = snprintf (path->str, CX_PATHMAX, "/proc/self/fd/%d/%s",
+                          cx_dir_fd (ui.file_dir), item->name);
+  cx_path_init_copy (&ui.file_path, path);
+  return true;
+}
+
+/* A compressed file is opened again where it was left, which it decodes
+   from the nearest seek point found the last time. */
+static void
+open_preview (const CxDirListing *listing, const CxDirItem *item)
+{
+  struct stat st;
+  CxPath      path;
+  ssize_t     n;
+
+  if (!file_path (listing, item, &path))
+  {
+    show_failure ("preview", &path, errno);
+    return;
+  }
+  alloc_preview ();
+  cx_path_init_copy (&ui.preview_path, &path);
+
+  if (stat (path.str, &st) == 0)
+  {
+    ui.preview_compressed = cx_compressed_open (&path);
+    ui.preview_source =
+      ui.preview_compressed ? PREVIEW_COMPRESSED : PREVIEW_FILE;
+    if (!preview_read_at (ui.preview_compressed ? ui.preview_compressed->view
+                                                : 0))
+      return;
+  }
+  else
+  {
+    n = cx_archive_read (&path, ui.preview, PREVIEW_BYTES);
+    if (n < 0)
+    {
+      show_failure ("preview", &path, errno);
+      return;
+    }
+    ui.preview_compressed = NULL;
+    ui.preview_source     = PREVIEW_MEMBER;
+    ui.preview_offset     = 0;
+    ui.preview_len        = n;
+    ui.preview_top        = 0;
+    ui.preview_end        = true;
+  }
+
+  ui.preview_hex  = memchr (ui.preview, '\0', ui.preview_len) != NULL;
+  ui.show_preview = true;
+}
+
+static void
+close_preview (void)
+{
+  if (ui.preview_compressed)
+    ui.preview_compressed->view = ui.preview_offset + ui.preview_top;
+  ui.preview_compressed = NULL;
+  ui.show_preview       = false;
+}
+
+/* the arrows and page keys scroll, Home goes back to the start and any
+   other key closes the preview */
+static void
+handle_preview_key (int key)
+{
+  switch (key)
+  {
+    case KEY_DOWN:
+      scroll_preview (1);
+      break;
+
+    case KEY_UP:
+      scroll_preview (-1);
+      break;
+
+    case KEY_NPAGE:
+      scroll_preview (ui.height - 1);
+      break;
+
+    case KEY_PPAGE:
+      scroll_preview (-(ui.height - 1));
+      break;
+
+    case KEY_HOME:
+      if (ui.preview_offset > 0)
+        preview_read_at (0);
+      ui.preview_top = 0;
+      break;
+
+    default:
+      close_preview ();
+  }
+}
+
+static void
+on_follow_change (CxFollow *follow, void *data)
+{
+  ui.redraw = true;
+}
+
+static void
+start_follow (const CxDirListing *listing, const CxDirItem *item)
+{
+  CxPath path;
+
+  if (!file_path (listing, item, &path))
+  {
+    show_failure ("follow", &path, errno);
+    return;
+  }
+  ui.follow = cx_follow_start (&path, on_follow_change, NULL);
+  if (!ui.follow)
+    show_failure ("follow", &path, errno);
+}
+
+static void
+on_dupes_done (CxDupes *dupes, void *data)
+{
+  Pane *p = data;
+
+  cx_tree_set_root (&p->tree, &dupes->listing, false);
+  clamp_viewport (p);
+  ui.redraw = true;
+}
+
+static void
+open_dupes (Pane *p)
+{
+  p->dupes = cx_dupes_start (&p->location, on_dupes_done, p);
+  cx_tree_set_root (&p->tree, &p->dupes->listing, false);
+  p->hilighted          = 0;
+  p->first_listing_item = 0;
+}
+
+/* the listing refines as the walk goes on */
+static void
+on_top_update (CxTop *top, void *data)
+{
+  Pane *p = data;
+
+  cx_tree_set_root (&p->tree, &top->listing, false);
+  clamp_viewport (p);
+  ui.redraw = true;
+}
+
+static void
+open_top (Pane *p, CxTopOrder order, int count)
+{
+  p->top = cx_top_start (&p->location, order, count > 0 ? count : TOP_COUNT,
+                         on_top_update, p);
+  cx_tree_set_root (&p->tree, &p->top->listing, false);
+  p->hilighted          = 0;
+  p->first_listing_item = 0;
+}
+
+static void
+on_diff_done (CxSnapshotDiff *diff, void *data)
+{
+  Pane *p = data;
+
+  cx_tree_set_root (&p->tree, &diff->listing, false);
+  clamp_viewport (p);
+  ui.redraw = true;
+}
+
+/* shows what changed since the snapshot `old_file' in place of the active
+   pane's directory, or since then until the snapshot `new_file' */
+void
+cx_ui_open_diff (const char *old_file, const char *new_file)
+{
+  Pane *p = active_pane ();
+
+  close_results (p);
+  p->diff = cx_snapshot_diff_start (old_file, new_file, &p->location,
+                                    on_diff_done, p);
+  cx_tree_set_root (&p->tree, &p->diff->listing, false);
+  p->hilighted          = 0;
+  p->first_listing_item = 0;
+  ui.redraw             = true;
+}
+
+static void
+on_compare_done (CxCompare *compare, void *data)
+{
+  Pane *p = data;
+
+  cx_tree_set_root (&p->tree, &compare->listing, false);
+  clamp_viewport (p);
+  ui.redraw = true;
+}
+
+/* shows how the active pane's directory differs from `other' in its
+   place, down to the contents of files when `verify' is set */
+void
+cx_ui_open_compare (const CxPath *other, bool verify)
+{
+  Pane *p = active_pane ();
+
+  close_results (p);
+  p->compare =
+    cx_compare_start (&p->location, other, verify, on_compare_done, p);
+  cx_tree_set_root (&p->tree, &p->compare->listing, false);
+  p->hilighted          = 0;
+  p->first_listing_item = 0;
+  ui.redraw             = true;
+}
+
+/* leaving goes back to the directory searched, or to the one holding the
+   hilighted entry while it is still there */
+static void
+handle_results_key (Pane *p, const CxTreeRow *row)
+{
+  struct stat st;
+  CxPath      dir;
+
+  if (row && !is_parent_row (row))
+  {
+    if (row->item->info.type == CX_FILE_TYPE_UNKNOWN)
+      return;
+    if (!cx_dir_listing_item_path (row->node->listing, row->item, &dir))
+      return;
+    cx_path_init_parent_of (&dir);
+    if (stat (dir.str, &st) != 0 || !S_ISDIR (st.st_mode))
+      return;
+    cx_path_init_copy (&p->location, &dir);
+  }
+  close_results (p);
+}
+
+/* A directory of the pane's own listing is stepped into through its
+   descriptor, so any depth can be reached; the rest go by their path. */
+static void
+open_row (Pane *p, const CxTreeRow *row)
+{
+  const CxDirListing *listing = row->node->listing;
+  const CxDirItem *   item    = row->item;
+  CxPath              path;
+
+  if (item->info.target_type == CX_FILE_TYPE_DIRECTORY && listing->dir)
+    go_to (p, cx_cache_acquire_at (listing->dir, item->name, item->name_len));
+  else if (cx_dir_listing_item_path (listing, item, &path) &&
+           (item->info.target_type == CX_FILE_TYPE_DIRECTORY ||
+            cx_archive_is_archive (&path)))
+  {
+    cx_path_init_copy (&p->location, &path);
+    g_state_changed = true;
+    p->hilighted    = 0;
+  }
+  else if (item->info.target_type == CX_FILE_TYPE_FILE)
+    open_preview (listing, item);
+  else if (item->info.target_type == CX_FILE_TYPE_DIRECTORY)
+  {
+    if (path.len == 0)
+      cx_path_init (&path, item->name, item->name_len);
+    show_failure ("open", &path, errno);
+  }
+}
+
+static void
+update_jump_matches (void)
+{
+  ui.n_jump_matches = cx_jump_query (ui.jump_query, ui.jump_query_len,
+                                     ui.jump_matches, JUMP_MAX_MATCHES);
+  ui.jump_selected  = 0;
+}
+
+static void
+start_jump (void)
+{
+  cx_jump_open ();
+  ui.jumping        = true;
+  ui.jump_query_len = 0;
+  update_jump_matches ();
+}
+
+static void
+handle_jump_key (Pane *p, int key)
+{
+  const CxPath *target;
+  struct stat   st;
+
+  switch (key)
+  {
+    case ENTER_KEY:
+      /* straight there: none of the levels in between are read */
+      target = &ui.jump_matches[ui.jump_selected].path;
+      if (ui.n_jump_matches > 0 && stat (target->str, &st) == 0 &&
+          S_ISDIR (st.st_mode))
       {
-        if (ui.hilighted == -1)
-          ui.hilighted = 0;
-        else if (ui.hilighted == 0)
-        {
-          ui.hilighted = listing->total - 1;
-          if (ui.listing_area_h < listing->total)
-            ui.first_listing_item = listing->total - ui.listing_area_h;
-        }
-        else
-        {
-          if (ui.listing_area_h < listing->total &&
-              ui.hilighted == ui.first_listing_item)
-            --ui.first_listing_item;
-          --ui.hilighted;
-        }
+        cx_path_init_copy (&p->location, target);
+        g_state_changed = true;
+        p->hilighted    = 0;
       }
+      /* fall through */
+    case ESC_KEY:
+      cx_jump_close ();
+      ui.jumping = false;
+      break;
+
+    case KEY_UP:
+      if (ui.jump_selected > 0)
+        --ui.jump_selected;
       break;
 
     case KEY_DOWN:
-      if (listing->total > 0)
+      if (ui.jump_selected < ui.n_jump_matches - 1)
+        ++ui.jump_selected;
+      break;
+
+    case KEY_BACKSPACE:
+    case 127:
+    case '\b':
+      if (ui.jump_query_len > 0)
+      {
+        --ui.jump_query_len;
+        update_jump_matches ();
+      }
+      break;
+
+    default:
+      if (key >= ' ' && key < 127 && ui.jump_query_len < JUMP_QUERY_MAX)
       {
-        if (ui.hilighted == -1)
-          ui.hilighted = 0;
-        else if (ui.hilighted == (listing->total - 1))
+        ui.jump_query[ui.jump_query_len++] = key;
+        update_jump_matches ();
+      }
+  }
+}
+
+/* Keys that only move the cursor need the row under it but not its item,
+   so a block not decoded yet is left to the scan thread. */
+static bool
+moves_cursor (int key)
+{
+  switch (key)
+  {
+    case KEY_UP:
+    case KEY_DOWN:
+    case KEY_PPAGE:
+    case KEY_NPAGE:
+    case KEY_HOME:
+    case 'g':
+    case KEY_END:
+    case 'G':
+    case '%':
+      return true;
+    default:
+      return key >= '0' && key <= '9';
+  }
+}
+
+static void
+handle_key (int key)
+{
+  Pane *            p        = active_pane ();
+  CxPath *          location = &p->location;
+  CxDirListing *    listing  = pane_listing (p);
+  const CxTreeNode *child;
+  CxTreeRow         row;
+  bool              have_row;
+  int               count;
+  int               index;
+
+  if (ui.show_help)
+  {
+    if (key == 'h')
+      ui.show_help = false;
+    else if (key == KEY_UP || key == KEY_DOWN)
+      ui.help_top += key == KEY_UP ? -1 : 1;
+    else if (key == KEY_PPAGE || key == KEY_NPAGE)
+      ui.help_top += (key == KEY_PPAGE ? -1 : 1) * (ui.height / 2);
+    return;
+  }
+
+  if (ui.jumping)
+  {
+    handle_jump_key (p, key);
+    return;
+  }
+
+  if (ui.show_preview)
+  {
+    handle_preview_key (key);
+    return;
+  }
+
+  if (ui.follow)
+  {
+    cx_follow_free (ui.follow);
+    ui.follow = NULL;
+    return;
+  }
+
+  if (ui.find_letter || moves_cursor (key))
+    have_row = cx_tree_row_nowait (&p->tree, p->hilighted, &row);
+  else
+    have_row = cx_tree_row (&p->tree, p->hilighted, &row);
+  if (have_row)
+    cx_dir_listing_follow_link (row.node->listing, row.item);
+
+  if (has_results (p) &&
+      (key == KEY_LEFT || key == KEY_RIGHT || key == ENTER_KEY))
+  {
+    handle_results_key (p, key != KEY_LEFT && have_row ? &row : NULL);
+    return;
+  }
+
+  if (ui.find_letter)
+  {
+    ui.find_letter = false;
+    if (key != ESC_KEY && key < KEY_MIN)
+    {
+      index = cx_dir_listing_find_letter (
+        listing, key, have_row ? top_level_index (&row) : -1);
+      if (index != -1)
+        set_hilighted (p, cx_tree_row_of (&p->tree.root, index));
+    }
+    return;
+  }
+
+  if (key >= '0' && key <= '9')
+  {
+    if (ui.count == -1)
+      ui.count = 0;
+    if (ui.count < MAX_COUNT)
+      ui.count = ui.count * 10 + (key - '0');
+    return;
+  }
+
+  count    = ui.count;
+  ui.count = -1;
+
+  switch (key)
+  {
+    case KEY_LEFT:
+      if (p->tree_mode && have_row)
+      {
+        child = cx_tree_child (&row);
+        if (child && child->expanded)
         {
-          ui.hilighted = 0;
-          if (ui.listing_area_h < listing->total)
-            ui.first_listing_item = 0;
+          cx_tree_collapse (&p->tree, &row);
+          break;
         }
-        else
+        if (row.node->parent)
         {
-          if (ui.listing_area_h < listing->total &&
-              ui.hilighted == (ui.first_listing_item + ui.listing_area_h - 1))
-            ++ui.first_listing_item;
-          ++ui.hilighted;
+          set_hilighted (
+            p, cx_tree_row_of (row.node->parent, row.node->index));
+          break;
         }
       }
+      if (cx_dir_listing_has_parent_item (listing))
+        go_to (p, cx_cache_acquire_parent (p->entry));
+      break;
+
+    case KEY_RIGHT:
+      /* in tree view a directory opens in place, then steps inside */
+      if (p->tree_mode && have_row && !is_parent_row (&row) &&
+          row.item->info.target_type == CX_FILE_TYPE_DIRECTORY)
+      {
+        child = cx_tree_child (&row);
+        if (!child || !child->expanded)
+          cx_tree_expand (&p->tree, &row);
+        else if (child->rows > 0)
+          set_hilighted (p, p->hilighted + 1);
+        break;
+      }
+      /* fall through */
+    case ENTER_KEY:
+      if (!have_row)
+        break;
+      if (is_parent_row (&row))
+        go_to (p, cx_cache_acquire_parent (p->entry));
+      else
+        open_row (p, &row);
+      break;
+
+    case ' ':
+      if (p->tree_mode && have_row && !is_parent_row (&row))
+        toggle_expanded (p, &row);
+      break;
+
+    case 't':
+      p->tree_mode = !p->tree_mode;
+      if (!p->tree_mode)
+        cx_tree_collapse_all (&p->tree);
+      break;
+
+    case KEY_UP:
+      move_hilighted (p, count > 0 ? -count : -1);
+      break;
+
+    case KEY_DOWN:
+      move_hilighted (p, count > 0 ? count : 1);
+      break;
+
+    case KEY_PPAGE:
+      set_hilighted (p, p->hilighted - ui.listing_area_h);
+      break;
+
+    case KEY_NPAGE:
+      set_hilighted (p, p->hilighted + ui.listing_area_h);
+      break;
+
+    case KEY_HOME:
+    case 'g':
+      set_hilighted (p, 0);
+      break;
+
+    case KEY_END:
+    case 'G':
+      set_hilighted (p, n_rows (p) - 1);
+      break;
+
+    case '%':
+      if (count >= 0 && n_rows (p) > 0)
+        set_hilighted (p, (int) ((long long) (n_rows (p) - 1) *
+                                 (count > 100 ? 100 : count) / 100));
+      break;
+
+    case 'f':
+      ui.find_letter = true;
+      break;
+
+    case 'j':
+      start_jump ();
+      break;
+
+    case 'D':
+      if (has_results (p))
+        close_results (p);
+      else if (!cx_path_is_elided (location))
+        open_dupes (p);
+      break;
+
+    case 'L':
+    case 'N':
+      if (has_results (p))
+        close_results (p);
+      else if (!cx_path_is_elided (location))
+        open_top (p, key == 'L' ? CX_TOP_LARGEST : CX_TOP_NEWEST, count);
+      break;
+
+    case 'C':
+    case 'V':
+      if (has_results (p))
+        close_results (p);
+      else if (ui.n_panes > 1 && !cx_path_is_elided (location) &&
+               !cx_path_is_elided (&other_pane ()->location))
+        cx_ui_open_compare (&other_pane ()->location, key == 'V');
       break;
 
     case 'h':
-      show_help_window ();
+      ui.show_help = true;
+      ui.help_top  = 0;
       break;
 
     case 'H':
-      if (!cx_path_is_home_dir (location))
-      {
-        cx_path_set_as_home_dir (location);
+      if (!cx_path_is_home_dir (location) &&
+          cx_path_set_as_home_dir (location))
         g_state_changed = true;
-      }
       break;
 
     case 'i':
-      show_info_window (&listing->list[ui.hilighted].info);
+      if (have_row && !is_parent_row (&row))
+        show_info_window (&row.item->info);
       break;
 
     case 'u':
-      g_size_units = (g_size_units == CX_SIZE_UNITS_BINARY)
-                       ? CX_SIZE_UNITS_METRIC
-                       : CX_SIZE_UNITS_BINARY;
+      g_options.size_units = (g_options.size_units == CX_SIZE_UNITS_BINARY)
+                               ? CX_SIZE_UNITS_METRIC
+                               : CX_SIZE_UNITS_BINARY;
+      cx_cache_invalidate_all ();
       g_state_changed = true;
       break;
 
     case '.':
-      g_include_hidden_files = !g_include_hidden_files;
-      g_state_changed        = true;
+      g_options.include_hidden_files = !g_options.include_hidden_files;
+      cx_cache_invalidate_all ();
+      g_state_changed = true;
+      break;
+
+    case 'T':
+      if (pane_copy (p))
+        switch_to (ui.n_panes - 1);
+      break;
+
+    case 'X':
+      close_active_pane ();
       break;
 
+    case ']':
+      switch_to ((ui.active + 1) % ui.n_panes);
+      break;
+
+    case '[':
+      switch_to ((ui.active + ui.n_panes - 1) % ui.n_panes);
+      break;
+
+    case TAB_KEY:
+      switch_to (ui.split ? ui.other : (ui.active + 1) % ui.n_panes);
+      break;
+
+    case '|':
+      toggle_split (p);
+      break;
+
+    case 'v':
+      ui.show_git = !ui.show_git;
+      break;
+
+    case 'F':
+      if (have_row && !is_parent_row (&row) &&
+          row.item->info.target_type == CX_FILE_TYPE_FILE)
+        start_follow (row.node->listing, row.item);
+      break;
+
+#ifdef CX_STATS
+    case 's':
+      ui.show_stats = !ui.show_stats;
+      break;
+#endif
+
     case ESC_KEY:
       ui.keep_running = false;
       break;
@@ -470,28 +2306,85 @@ cx_ui_handle_next_event (CxPath *location, const CxDirListing *listing)
   }
 }
 
+static bool
+is_plain_step (int key)
+{
+  return (key == KEY_UP || key == KEY_DOWN) && !ui.show_help &&
+         !ui.find_letter && !ui.jumping && !ui.show_preview && !ui.follow &&
+         ui.count == -1;
+}
+
+bool
+cx_ui_handle_input (void)
+{
+  bool handled = false;
+  int  delta   = 0;
+  int  key;
+
+  /* take everything already queued, but stop as soon as a key invalidates
+     the listing the remaining keys would be applied to; runs of arrow keys
+     (auto-repeat) collapse into a single cursor move */
+  while (ui.keep_running && !g_state_changed && ui.n_panes > 0)
+  {
+    key = read_key ();
+    if (key == ERR)
+      break;
+
+    handled = true;
+    if (is_plain_step (key))
+    {
+      delta += (key == KEY_UP) ? -1 : 1;
+      continue;
+    }
+
+    move_hilighted (active_pane (), delta);
+    delta = 0;
+    handle_key (key);
+  }
+  if (delta != 0)
+    move_hilighted (active_pane (), delta);
+
+  if (handled)
+    ui.redraw = true;
+  return handled;
+}
+
+bool
+cx_ui_redraw_pending (void)
+{
+  return ui.redraw;
+}
+
+void
+cx_ui_request_redraw (void)
+{
+  ui.redraw = true;
+}
+
 int
 cx_ui_hilighted_index (void)
 {
-  return ui.hilighted;
+  return ui.n_panes > 0 ? active_pane ()->hilighted : -1;
 }
 
 void
 cx_ui_set_hilighted_index (int index)
 {
-  ui.hilighted = index;
+  if (ui.n_panes > 0)
+    active_pane ()->hilighted = index;
 }
 
 int
 cx_ui_first_listing_item_index (void)
 {
-  return ui.first_listing_item;
+  return ui.n_panes > 0 ? active_pane ()->first_listing_item : 0;
 }
 
 void
 cx_ui_set_first_listing_item_index (int index)
 {
-  ui.first_listing_item = index;
+  if (ui.n_panes > 0)
+    active_pane ()->first_listing_item = index;
 }
 
 bool
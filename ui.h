@@ -2,18 +2,29 @@
 #define __CX_UI_H__
 
 #include <stdbool.h>
+#include <stdio.h>
 
-#include "files.h"
 #include "path.h"
+#include "session.h"
+
+void cx_ui_set_terminal (FILE *out, FILE *in);
+void cx_ui_set_key_source (int (*next_key) (void));
 
 void cx_ui_start (void);
 void cx_ui_stop (void);
+void cx_ui_resize (void);
 
-void cx_ui_draw (const CxDirListing *listing);
+void cx_ui_open (const CxPath *location);
+void cx_ui_open_diff (const char *old_file, const char *new_file);
+void cx_ui_open_compare (const CxPath *other, bool verify);
+void cx_ui_open_session (CxSession *session);
+void cx_ui_sync (void);
 
-void cx_ui_handle_next_event (CxPath *location, const CxDirListing *listing);
+void cx_ui_draw (void);
+bool cx_ui_redraw_pending (void);
+void cx_ui_request_redraw (void);
 
-void cx_ui_help_window (void);
+bool cx_ui_handle_input (void);
 
 int  cx_ui_hilighted_index (void);
 void cx_ui_set_hilighted_index (int index);
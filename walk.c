@@ -0,0 +1,217 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "util.h"
+#include "walk.h"
+
+/* a directory on the walk's path, its names sorted */
+typedef struct WalkFrame
+{
+  char * names;
+  char **sorted;
+  int    n;
+  int    next;
+  int    path_len;
+} WalkFrame;
+
+/* `/' sorts before any other byte, so a directory's entries come right
+   after it and before any sibling named with it as a prefix */
+int
+cx_walk_compare (const char *a, int a_len, const char *b, int b_len)
+{
+  const unsigned char *p = (const unsigned char *) a;
+  const unsigned char *q = (const unsigned char *) b;
+  int                  n = a_len < b_len ? a_len : b_len;
+  int                  i;
+
+  for (i = 0; i < n; ++i)
+    if (p[i] != q[i])
+      return (p[i] == '/' ? 0 : p[i]) - (q[i] == '/' ? 0 : q[i]);
+  return a_len - b_len;
+}
+
+static int
+compare_names (const void *a, const void *b)
+{
+  return strcmp (*(char *const *) a, *(char *const *) b);
+}
+
+/* reads and sorts the names in the directory at `w->path' */
+static bool
+walker_push (CxWalker *w)
+{
+  struct dirent *de;
+  WalkFrame *    f;
+  DIR *          dp;
+  char *         names;
+  size_t         used;
+  size_t         alloc;
+  size_t         len;
+  int            err;
+  int            n;
+  int            i;
+
+  dp = opendir (w->path);
+  if (!dp)
+  {
+    err = errno;
+    cx_log (CX_LOG_STATUS_WARN, "failed to open directory `%s' - %s",
+            w->path, strerror (err));
+    errno = err;
+    return false;
+  }
+
+  used  = 0;
+  alloc = 4096;
+  names = malloc (alloc);
+  if (!names)
+    cx_die (errno, "failed to allocate memory");
+
+  for (n = 0; (de = readdir (dp)); ++n)
+  {
+    if (cx_streq (de->d_name, ".") || cx_streq (de->d_name, ".."))
+    {
+      --n;
+      continue;
+    }
+    len = strlen (de->d_name) + 1;
+    if (used + len > alloc)
+    {
+      alloc *= 2;
+      names = realloc (names, alloc);
+      if (!names)
+        cx_die (errno, "failed to allocate memory");
+    }
+    memcpy (names + used, de->d_name, len);
+    used += len;
+  }
+  closedir (dp);
+
+  if (w->depth == w->alloc)
+  {
+    w->alloc  = w->alloc ? w->alloc * 2 : 16;
+    w->frames = realloc (w->frames, w->alloc * sizeof (WalkFrame));
+    if (!w->frames)
+      cx_die (errno, "failed to allocate memory");
+  }
+
+  f           = &w->frames[w->depth++];
+  f->names    = names;
+  f->n        = n;
+  f->next     = 0;
+  f->path_len = w->path_len;
+  f->sorted   = malloc ((n + 1) * sizeof (char *));
+  if (!f->sorted)
+    cx_die (errno, "failed to allocate memory");
+
+  for (i = 0, used = 0; i < n; ++i)
+  {
+    f->sorted[i] = names + used;
+    used += strlen (names + used) + 1;
+  }
+  qsort (f->sorted, n, sizeof (char *), compare_names);
+  return true;
+}
+
+static void
+walker_pop (CxWalker *w)
+{
+  --w->depth;
+  free (w->frames[w->depth].names);
+  free (w->frames[w->depth].sorted);
+}
+
+void
+cx_walker_free (CxWalker *w)
+{
+  while (w->depth > 0)
+    walker_pop (w);
+  free (w->frames);
+  w->frames = NULL;
+  w->alloc  = 0;
+}
+
+bool
+cx_walker_init (CxWalker *w, const CxPath *root)
+{
+  struct stat st;
+
+  if (!realpath (root->str, w->path) || stat (w->path, &st) != 0)
+    return false;
+  if (!S_ISDIR (st.st_mode))
+  {
+    errno = ENOTDIR;
+    return false;
+  }
+
+  w->path_len = strlen (w->path);
+  w->root_len = w->path_len;
+  w->base_len = w->path_len + (w->path_len == 1 ? 0 : 1);
+  w->dev      = st.st_dev;
+  return walker_push (w);
+}
+
+const CxWalkEntry *
+cx_walker_next (CxWalker *w)
+{
+  struct stat  st;
+  const char * name;
+  CxWalkEntry *e = &w->entry;
+  WalkFrame *  f;
+  int          len;
+
+  w->entered = false;
+  while (w->depth > 0)
+  {
+    f = &w->frames[w->depth - 1];
+    if (f->next == f->n)
+    {
+      walker_pop (w);
+      continue;
+    }
+
+    name        = f->sorted[f->next++];
+    len         = strlen (name);
+    w->path_len = f->path_len;
+    if (w->path[w->path_len - 1] != '/')
+      w->path[w->path_len++] = '/';
+    if (w->path_len + len >= CX_PATHMAX)
+    {
+      cx_log (CX_LOG_STATUS_WARN, "skipped `%s' in `%.*s' - path too long",
+              name, f->path_len, w->path);
+      continue;
+    }
+    memcpy (w->path + w->path_len, name, len + 1);
+    w->path_len += len;
+
+    /* gone since its directory was read */
+    if (lstat (w->path, &st) != 0)
+      continue;
+
+    e->path_len = w->path_len - w->base_len;
+    memcpy (e->path, w->path + w->base_len, e->path_len + 1);
+    e->size  = st.st_size;
+    e->mtime = st.st_mtime;
+    e->mode  = st.st_mode;
+    e->ino   = st.st_ino;
+
+    if (S_ISDIR (st.st_mode) && st.st_dev == w->dev)
+      w->entered = walker_push (w);
+    return e;
+  }
+  return NULL;
+}
+
+/* leaves out what is below the directory just returned */
+void
+cx_walker_skip (CxWalker *w)
+{
+  if (w->entered)
+    walker_pop (w);
+  w->entered = false;
+}
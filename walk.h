@@ -0,0 +1,46 @@
+#ifndef __CX_WALK_H__
+#define __CX_WALK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "path.h"
+
+typedef struct
+{
+  char     path[CX_PATHMAX]; /* below the root, with no leading `/' */
+  int      path_len;
+  uint64_t size;
+  int64_t  mtime;
+  uint32_t mode;
+  uint64_t ino;
+} CxWalkEntry;
+
+/* Walks a live tree depth-first with each directory sorted by name,
+   holding the names of the directories on the current path and nothing
+   else, so its memory does not grow with the size of the tree. Other file
+   systems are not entered. */
+typedef struct
+{
+  char              path[CX_PATHMAX]; /* the root, then the current entry */
+  int               path_len;
+  int               root_len;
+  int               base_len; /* where paths below the root start */
+  dev_t             dev;
+  struct WalkFrame *frames;
+  int               depth;
+  int               alloc;
+  bool              entered; /* the last entry is a directory being walked */
+  CxWalkEntry       entry;
+} CxWalker;
+
+bool               cx_walker_init (CxWalker *w, const CxPath *root);
+const CxWalkEntry *cx_walker_next (CxWalker *w);
+void               cx_walker_skip (CxWalker *w);
+void               cx_walker_free (CxWalker *w);
+
+/* the order of a walk, between paths below its root */
+int cx_walk_compare (const char *a, int a_len, const char *b, int b_len);
+
+#endif /* __CX_WALK_H__ */